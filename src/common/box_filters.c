@@ -0,0 +1,278 @@
+/*
+    This file is part of darktable,
+    copyright (c) 2013 the darktable project.
+
+    darktable is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    darktable is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with darktable.  If not, see <http://www.gnu.org/licenses/>.
+*/
+#include "common/darktable.h"
+#include "common/box_filters.h"
+
+#include <assert.h>
+#include <string.h>
+#include <xmmintrin.h>
+#ifdef DT_HAVE_TARGET_AVX
+#include <immintrin.h>
+#endif
+
+// number of floats processed side by side in the vertical pass. one block
+// row is a single cache line, the running sums stay in registers.
+#define BOX_BLOCK_SSE 16
+#define BOX_BLOCK_AVX 32
+
+static void
+_box_mean_horizontal_1ch(float *const buf, const int width, const int radius, float *const scanline)
+{
+  float L = 0;
+  int hits = 0;
+  for(int x=-radius; x<width; x++)
+  {
+    const int op = x-radius-1;
+    const int np = x+radius;
+    if(op >= 0)
+    {
+      L -= buf[op];
+      hits--;
+    }
+    if(np < width)
+    {
+      L += buf[np];
+      hits++;
+    }
+    if(x >= 0)
+      scanline[x] = L/hits;
+  }
+  memcpy(buf, scanline, sizeof(float)*width);
+}
+
+static void
+_box_mean_horizontal_4ch(float *const buf, const int width, const int radius, float *const scanline)
+{
+  __m128 L = _mm_setzero_ps();
+  int hits = 0;
+  for(int x=-radius; x<width; x++)
+  {
+    const int op = x-radius-1;
+    const int np = x+radius;
+    if(op >= 0)
+    {
+      L = _mm_sub_ps(L, _mm_load_ps(buf+4*op));
+      hits--;
+    }
+    if(np < width)
+    {
+      L = _mm_add_ps(L, _mm_load_ps(buf+4*np));
+      hits++;
+    }
+    if(x >= 0)
+      _mm_store_ps(scanline+4*x, _mm_div_ps(L, _mm_set_ps1(hits)));
+  }
+  memcpy(buf, scanline, sizeof(float)*4*width);
+}
+
+// vertical pass on n < BOX_BLOCK_SSE floats starting at buf, rows are stride floats apart.
+static void
+_box_mean_vertical_scalar(float *const buf, const size_t stride, const int n, const int height,
+                          const int radius, float *const scratch)
+{
+  float L[BOX_BLOCK_SSE] = { 0.0f };
+  int hits = 0;
+  for(int y=-radius; y<height; y++)
+  {
+    const int op = y-radius-1;
+    const int np = y+radius;
+    if(op >= 0)
+    {
+      const float *p = buf + op*stride;
+      for(int k=0; k<n; k++) L[k] -= p[k];
+      hits--;
+    }
+    if(np < height)
+    {
+      const float *p = buf + np*stride;
+      for(int k=0; k<n; k++) L[k] += p[k];
+      hits++;
+    }
+    if(y >= 0)
+      for(int k=0; k<n; k++) scratch[(size_t)y*n+k] = L[k]/hits;
+  }
+  for(int y=0; y<height; y++)
+    memcpy(buf + y*stride, scratch + (size_t)y*n, sizeof(float)*n);
+}
+
+static void
+_box_mean_vertical_sse(float *const buf, const size_t stride, const int height, const int radius,
+                       float *const scratch)
+{
+  __m128 L0 = _mm_setzero_ps(), L1 = _mm_setzero_ps(), L2 = _mm_setzero_ps(), L3 = _mm_setzero_ps();
+  int hits = 0;
+  for(int y=-radius; y<height; y++)
+  {
+    const int op = y-radius-1;
+    const int np = y+radius;
+    if(op >= 0)
+    {
+      const float *p = buf + op*stride;
+      L0 = _mm_sub_ps(L0, _mm_loadu_ps(p));
+      L1 = _mm_sub_ps(L1, _mm_loadu_ps(p+4));
+      L2 = _mm_sub_ps(L2, _mm_loadu_ps(p+8));
+      L3 = _mm_sub_ps(L3, _mm_loadu_ps(p+12));
+      hits--;
+    }
+    if(np < height)
+    {
+      const float *p = buf + np*stride;
+      L0 = _mm_add_ps(L0, _mm_loadu_ps(p));
+      L1 = _mm_add_ps(L1, _mm_loadu_ps(p+4));
+      L2 = _mm_add_ps(L2, _mm_loadu_ps(p+8));
+      L3 = _mm_add_ps(L3, _mm_loadu_ps(p+12));
+      hits++;
+    }
+    if(y >= 0)
+    {
+      const __m128 h = _mm_set_ps1(hits);
+      float *s = scratch + (size_t)y*BOX_BLOCK_SSE;
+      _mm_store_ps(s,    _mm_div_ps(L0, h));
+      _mm_store_ps(s+4,  _mm_div_ps(L1, h));
+      _mm_store_ps(s+8,  _mm_div_ps(L2, h));
+      _mm_store_ps(s+12, _mm_div_ps(L3, h));
+    }
+  }
+  for(int y=0; y<height; y++)
+  {
+    const float *s = scratch + (size_t)y*BOX_BLOCK_SSE;
+    float *p = buf + y*stride;
+    _mm_storeu_ps(p,    _mm_load_ps(s));
+    _mm_storeu_ps(p+4,  _mm_load_ps(s+4));
+    _mm_storeu_ps(p+8,  _mm_load_ps(s+8));
+    _mm_storeu_ps(p+12, _mm_load_ps(s+12));
+  }
+}
+
+#ifdef DT_HAVE_TARGET_AVX
+__attribute__((target("avx")))
+static void
+_box_mean_vertical_avx(float *const buf, const size_t stride, const int height, const int radius,
+                       float *const scratch)
+{
+  __m256 L0 = _mm256_setzero_ps(), L1 = _mm256_setzero_ps(), L2 = _mm256_setzero_ps(), L3 = _mm256_setzero_ps();
+  int hits = 0;
+  for(int y=-radius; y<height; y++)
+  {
+    const int op = y-radius-1;
+    const int np = y+radius;
+    if(op >= 0)
+    {
+      const float *p = buf + op*stride;
+      L0 = _mm256_sub_ps(L0, _mm256_loadu_ps(p));
+      L1 = _mm256_sub_ps(L1, _mm256_loadu_ps(p+8));
+      L2 = _mm256_sub_ps(L2, _mm256_loadu_ps(p+16));
+      L3 = _mm256_sub_ps(L3, _mm256_loadu_ps(p+24));
+      hits--;
+    }
+    if(np < height)
+    {
+      const float *p = buf + np*stride;
+      L0 = _mm256_add_ps(L0, _mm256_loadu_ps(p));
+      L1 = _mm256_add_ps(L1, _mm256_loadu_ps(p+8));
+      L2 = _mm256_add_ps(L2, _mm256_loadu_ps(p+16));
+      L3 = _mm256_add_ps(L3, _mm256_loadu_ps(p+24));
+      hits++;
+    }
+    if(y >= 0)
+    {
+      const __m256 h = _mm256_set1_ps(hits);
+      float *s = scratch + (size_t)y*BOX_BLOCK_AVX;
+      _mm256_store_ps(s,    _mm256_div_ps(L0, h));
+      _mm256_store_ps(s+8,  _mm256_div_ps(L1, h));
+      _mm256_store_ps(s+16, _mm256_div_ps(L2, h));
+      _mm256_store_ps(s+24, _mm256_div_ps(L3, h));
+    }
+  }
+  for(int y=0; y<height; y++)
+  {
+    const float *s = scratch + (size_t)y*BOX_BLOCK_AVX;
+    float *p = buf + y*stride;
+    _mm256_storeu_ps(p,    _mm256_load_ps(s));
+    _mm256_storeu_ps(p+8,  _mm256_load_ps(s+8));
+    _mm256_storeu_ps(p+16, _mm256_load_ps(s+16));
+    _mm256_storeu_ps(p+24, _mm256_load_ps(s+24));
+  }
+  _mm256_zeroupper();
+}
+#endif
+
+void
+dt_box_mean(float *const buf, const int width, const int height, const int ch, const int radius, const int iterations)
+{
+  assert(ch == 1 || ch == 4);
+  if(radius <= 0 || width <= 0 || height <= 0) return;
+
+  // the vertical pass does not care about pixels, it filters the columns
+  // of a height x (width*ch) float matrix in blocks of adjacent columns.
+  const int floats = width*ch;
+  int block = BOX_BLOCK_SSE;
+#ifdef DT_HAVE_TARGET_AVX
+  if(darktable.cpu_flags & DT_CPU_FLAG_AVX) block = BOX_BLOCK_AVX;
+#endif
+  const int blocks = floats / block;
+
+  // one scratch line per thread, large enough for both passes and padded to full cache lines
+  const size_t scratch_size = (MAX((size_t)floats, (size_t)height*block) + 15) & ~(size_t)15;
+  const int nthreads = omp_get_max_threads();
+  float *const scratch_all = dt_alloc_align(64, sizeof(float)*scratch_size*nthreads);
+  if(!scratch_all) return;
+
+  for(int iteration=0; iteration<iterations; iteration++)
+  {
+    /* horizontal pass, row by row */
+#ifdef _OPENMP
+    #pragma omp parallel for schedule(static)
+#endif
+    for(int y=0; y<height; y++)
+    {
+      float *scratch = scratch_all + scratch_size*dt_get_thread_num();
+      if(ch == 4) _box_mean_horizontal_4ch(buf + (size_t)y*floats, width, radius, scratch);
+      else _box_mean_horizontal_1ch(buf + (size_t)y*floats, width, radius, scratch);
+    }
+
+    /* vertical pass, a cache line worth of columns at a time */
+#ifdef _OPENMP
+    #pragma omp parallel for schedule(static)
+#endif
+    for(int b=0; b<blocks; b++)
+    {
+      float *scratch = scratch_all + scratch_size*dt_get_thread_num();
+#ifdef DT_HAVE_TARGET_AVX
+      if(block == BOX_BLOCK_AVX)
+        _box_mean_vertical_avx(buf + (size_t)b*block, floats, height, radius, scratch);
+      else
+#endif
+        _box_mean_vertical_sse(buf + (size_t)b*block, floats, height, radius, scratch);
+    }
+
+    // left over columns on the right border
+    for(int c=blocks*block; c<floats; c+=BOX_BLOCK_SSE)
+    {
+      const int n = MIN(BOX_BLOCK_SSE, floats-c);
+      if(n == BOX_BLOCK_SSE) _box_mean_vertical_sse(buf + c, floats, height, radius, scratch_all);
+      else _box_mean_vertical_scalar(buf + c, floats, n, height, radius, scratch_all);
+    }
+  }
+
+  dt_free_align(scratch_all);
+}
+
+// modelines: These editor modelines have been set for all relevant files by tools/update_modelines.sh
+// vim: shiftwidth=2 expandtab tabstop=2 cindent
+// kate: tab-indents: off; indent-width 2; replace-tabs on; indent-mode cstyle; remove-trailing-spaces modified;
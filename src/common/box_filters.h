@@ -0,0 +1,30 @@
+/*
+    This file is part of darktable,
+    copyright (c) 2013 the darktable project.
+
+    darktable is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    darktable is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with darktable.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef DT_COMMON_BOX_FILTERS_H
+#define DT_COMMON_BOX_FILTERS_H
+
+/** iterated box mean filter of the given radius, in place on buf.
+ *  ch is the number of floats per pixel, 1 or 4 (4 channel buffers need to be 16 byte aligned).
+ *  a few iterations approximate a gaussian blur of sigma = sqrt(iterations*radius*(radius+1)/3). */
+void dt_box_mean(float *const buf, const int width, const int height, const int ch, const int radius, const int iterations);
+
+#endif
+// modelines: These editor modelines have been set for all relevant files by tools/update_modelines.sh
+// vim: shiftwidth=2 expandtab tabstop=2 cindent
+// kate: tab-indents: off; indent-width 2; replace-tabs on; indent-mode cstyle; remove-trailing-spaces modified;
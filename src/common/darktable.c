@@ -33,6 +33,9 @@
 #include "common/selection.h"
 #include "common/exif.h"
 #include "common/fswatch.h"
+#include "common/readahead.h"
+#include "common/sidecar.h"
+#include "common/tag_index.h"
 #include "common/pwstorage/pwstorage.h"
 #ifdef HAVE_GPHOTO2
 #include "common/camera_control.h"
@@ -41,6 +44,7 @@
 #include "common/grealpath.h"
 #include "common/image.h"
 #include "common/image_cache.h"
+#include "common/interpolation.h"
 #include "common/imageio_module.h"
 #include "common/mipmap_cache.h"
 #include "common/opencl.h"
@@ -456,6 +460,17 @@ int dt_init(int argc, char *argv[], const int init_gui,lua_State *L)
   // init all pointers to 0:
   memset(&darktable, 0, sizeof(darktable_t));
 
+  // remember which instruction sets we may use for runtime dispatching.
+  // sse2 and sse3 are required at compile time anyways.
+  darktable.cpu_flags = DT_CPU_FLAG_SSE2 | DT_CPU_FLAG_SSE3;
+#if (__GNUC_PREREQ(4,8) || __has_builtin(__builtin_cpu_supports))
+  if(__builtin_cpu_supports("avx")) darktable.cpu_flags |= DT_CPU_FLAG_AVX;
+  if(__builtin_cpu_supports("avx2")) darktable.cpu_flags |= DT_CPU_FLAG_AVX2;
+#if __GNUC_PREREQ(5,0)
+  if(__builtin_cpu_supports("avx512f")) darktable.cpu_flags |= DT_CPU_FLAG_AVX512F;
+#endif
+#endif
+
   darktable.progname = argv[0];
 
   // database
@@ -707,6 +722,15 @@ int dt_init(int argc, char *argv[], const int init_gui,lua_State *L)
   // Initialize the filesystem watcher
   darktable.fswatch=dt_fswatch_new();
 
+  // io thread reading upcoming raws ahead of the decoder
+  darktable.readahead = dt_readahead_new();
+
+  // threads writing the xmp files
+  darktable.sidecar = dt_sidecar_new();
+
+  // tag names and co-occurrence counts for the tag suggestions
+  darktable.tag_index = dt_tag_index_new();
+
 #ifdef HAVE_GPHOTO2
   // Initialize the camera control
   darktable.camctl=dt_camctl_new();
@@ -768,6 +792,8 @@ int dt_init(int argc, char *argv[], const int init_gui,lua_State *L)
   darktable.points = (dt_points_t *)calloc(1, sizeof(dt_points_t));
   dt_points_init(darktable.points, dt_get_num_threads());
 
+  dt_interpolation_init();
+
   // must come before mipmap_cache, because that one will need to access
   // image dimensions stored in here:
   darktable.image_cache = (dt_image_cache_t *)calloc(1, sizeof(dt_image_cache_t));
@@ -905,6 +931,9 @@ void dt_cleanup()
     dt_gui_gtk_cleanup(darktable.gui);
     free(darktable.gui);
   }
+  // write the xmp files still pending, they need the image cache and the database
+  dt_sidecar_destroy(darktable.sidecar);
+  darktable.sidecar = NULL;
   dt_image_cache_cleanup(darktable.image_cache);
   free(darktable.image_cache);
   dt_mipmap_cache_cleanup(darktable.mipmap_cache);
@@ -919,6 +948,7 @@ void dt_cleanup()
   free(darktable.conf);
   dt_points_cleanup(darktable.points);
   free(darktable.points);
+  dt_interpolation_cleanup();
   dt_iop_unload_modules_so();
   dt_opencl_cleanup(darktable.opencl);
   free(darktable.opencl);
@@ -927,6 +957,9 @@ void dt_cleanup()
 #endif
   dt_pwstorage_destroy(darktable.pwstorage);
   dt_fswatch_destroy(darktable.fswatch);
+  dt_readahead_destroy(darktable.readahead);
+  dt_tag_index_destroy(darktable.tag_index);
+  darktable.tag_index = NULL;
 
 #ifdef HAVE_GRAPHICSMAGICK
   DestroyMagick();
@@ -168,6 +168,25 @@ typedef enum dt_debug_thread_t
 }
 dt_debug_thread_t;
 
+/** instruction set extensions found at runtime, see darktable_t::cpu_flags */
+typedef enum dt_cpu_flags_t
+{
+  DT_CPU_FLAG_SSE2    = 1<<0,
+  DT_CPU_FLAG_SSE3    = 1<<1,
+  DT_CPU_FLAG_AVX     = 1<<2,
+  DT_CPU_FLAG_AVX2    = 1<<3,
+  DT_CPU_FLAG_AVX512F = 1<<4
+}
+dt_cpu_flags_t;
+
+/* code paths for wider instruction sets than the build target are compiled
+ * with __attribute__((target(...))) and selected at runtime depending on
+ * darktable.cpu_flags, so one binary makes use of whatever cpu it runs on. */
+#if (defined(__x86_64__) || defined(__i386__)) && \
+    (defined(__clang__) || (defined(__GNUC__) && ((__GNUC__ > 4) || (__GNUC__ == 4 && __GNUC_MINOR__ >= 9))))
+#define DT_HAVE_TARGET_AVX 1
+#endif
+
 typedef struct darktable_t
 {
   uint32_t cpu_flags;
@@ -190,6 +209,9 @@ typedef struct darktable_t
   struct dt_bauhaus_t            *bauhaus;
   const struct dt_database_t     *db;
   const struct dt_fswatch_t      *fswatch;
+  struct dt_readahead_t          *readahead;
+  struct dt_sidecar_t            *sidecar;
+  struct dt_tag_index_t          *tag_index;
   const struct dt_pwstorage_t    *pwstorage;
   const struct dt_camctl_t       *camctl;
   const struct dt_collection_t   *collection;
@@ -35,7 +35,7 @@
 #include <errno.h>
 
 // whenever _create_schema() gets changed you HAVE to bump this version and add an update path to _upgrade_schema_step()!
-#define CURRENT_DATABASE_VERSION 7
+#define CURRENT_DATABASE_VERSION 8
 
 typedef struct dt_database_t
 {
@@ -543,6 +543,38 @@ static int _upgrade_schema_step(dt_database_t *db, int version)
 
     sqlite3_exec(db->handle, "COMMIT", NULL, NULL, NULL);
     new_version = 7;
+  }
+  else if(version == 7)
+  {
+    // the tag co-occurrence counts are kept in memory now (common/tag_index.c) and only written back
+    // to tagxtag from time to time. drop the triggers updating them row by row, and the one filling
+    // the table with a row for every pair of tags. what is left are the pairs that occur, id1 <= id2.
+    sqlite3_exec(db->handle, "BEGIN TRANSACTION", NULL, NULL, NULL);
+    if(sqlite3_exec(db->handle, "DROP TRIGGER IF EXISTS insert_tag", NULL, NULL, NULL) != SQLITE_OK
+       || sqlite3_exec(db->handle, "DROP TRIGGER IF EXISTS attach_tag", NULL, NULL, NULL) != SQLITE_OK
+       || sqlite3_exec(db->handle, "DROP TRIGGER IF EXISTS detach_tag", NULL, NULL, NULL) != SQLITE_OK)
+    {
+      fprintf(stderr, "[init] can't drop tagxtag triggers\n");
+      fprintf(stderr, "[init]   %s\n", sqlite3_errmsg(db->handle));
+      sqlite3_exec(db->handle, "ROLLBACK TRANSACTION", NULL, NULL, NULL);
+      return version;
+    }
+    // the counts were off whenever a tag was attached twice, so count again
+    if(sqlite3_exec(db->handle, "DELETE FROM tagxtag", NULL, NULL, NULL) != SQLITE_OK
+       || sqlite3_exec(db->handle,
+                       "INSERT INTO tagxtag (id1, id2, count) "
+                       "SELECT a.tagid, b.tagid, COUNT(*) FROM tagged_images a "
+                       "JOIN tagged_images b ON a.imgid = b.imgid AND a.tagid <= b.tagid "
+                       "GROUP BY a.tagid, b.tagid",
+                       NULL, NULL, NULL) != SQLITE_OK)
+    {
+      fprintf(stderr, "[init] can't recount tagxtag\n");
+      fprintf(stderr, "[init]   %s\n", sqlite3_errmsg(db->handle));
+      sqlite3_exec(db->handle, "ROLLBACK TRANSACTION", NULL, NULL, NULL);
+      return version;
+    }
+    sqlite3_exec(db->handle, "COMMIT", NULL, NULL, NULL);
+    new_version = 8;
   }// maybe in the future, see commented out code elsewhere
 //   else if(version == XXX)
 //   {
@@ -640,13 +672,6 @@ static void _create_schema(dt_database_t *db)
   DT_DEBUG_SQLITE3_EXEC(db->handle,
                         "CREATE TABLE tagxtag (id1 INTEGER, id2 INTEGER, count INTEGER, "
                         "PRIMARY KEY (id1, id2))", NULL, NULL, NULL);
-  DT_DEBUG_SQLITE3_EXEC(db->handle,
-                        "CREATE TRIGGER insert_tag AFTER INSERT ON tags"
-                        " BEGIN"
-                        "   INSERT INTO tagxtag SELECT id, new.id, 0 FROM TAGS;"
-                        "   UPDATE tagxtag SET count = 1000000 WHERE id1=new.id AND id2=new.id;"
-                        " END",
-                        NULL, NULL, NULL);
   DT_DEBUG_SQLITE3_EXEC(db->handle,
                         "CREATE TRIGGER delete_tag BEFORE DELETE on tags"
                         " BEGIN"
@@ -654,24 +679,6 @@ static void _create_schema(dt_database_t *db)
                         "   DELETE FROM tagged_images WHERE tagid=old.id;"
                         " END",
                         NULL, NULL, NULL);
-  DT_DEBUG_SQLITE3_EXEC(db->handle,
-                        "CREATE TRIGGER attach_tag AFTER INSERT ON tagged_images"
-                        " BEGIN"
-                        "   UPDATE tagxtag"
-                        "     SET count = count + 1"
-                        "     WHERE (id1=new.tagid AND id2 IN (SELECT tagid FROM tagged_images WHERE imgid=new.imgid))"
-                        "        OR (id2=new.tagid AND id1 IN (SELECT tagid FROM tagged_images WHERE imgid=new.imgid));"
-                        " END",
-                        NULL, NULL, NULL);
-  DT_DEBUG_SQLITE3_EXEC(db->handle,
-                        "CREATE TRIGGER detach_tag BEFORE DELETE ON tagged_images"
-                        " BEGIN"
-                        "   UPDATE tagxtag"
-                        "     SET count = count - 1"
-                        "     WHERE (id1=old.tagid AND id2 IN (SELECT tagid FROM tagged_images WHERE imgid=old.imgid))"
-                        "        OR (id2=old.tagid AND id1 IN (SELECT tagid FROM tagged_images WHERE imgid=old.imgid));"
-                        " END",
-                        NULL, NULL, NULL);
   ////////////////////////////// styles
   DT_DEBUG_SQLITE3_EXEC(db->handle,
                         "CREATE TABLE styles (id INTEGER, name VARCHAR, description VARCHAR)", NULL, NULL, NULL);
@@ -920,17 +927,44 @@ lock_again:
   DT_DEBUG_SQLITE3_EXEC(db->handle,
                         "CREATE TABLE memory.tmp_selection (imgid INTEGER)", NULL, NULL, NULL);
   DT_DEBUG_SQLITE3_EXEC(db->handle,
-                        "CREATE TABLE memory.tagq (tmpid INTEGER PRIMARY KEY, id INTEGER)",
+                        "CREATE TABLE memory.history (imgid INTEGER, num INTEGER, module INTEGER, "
+                        "operation VARCHAR(256) UNIQUE ON CONFLICT REPLACE, op_params BLOB, enabled INTEGER, "
+                        "blendop_params BLOB, blendop_version INTEGER, multi_priority INTEGER, multi_name VARCHAR(256))",
                         NULL, NULL, NULL);
   DT_DEBUG_SQLITE3_EXEC(db->handle,
-                        "CREATE TABLE memory.taglist "
-                        "(tmpid INTEGER PRIMARY KEY, id INTEGER UNIQUE ON CONFLICT REPLACE, "
-                        "count INTEGER)",
+                        "CREATE TABLE memory.bulk_images (imgid INTEGER PRIMARY KEY, offs INTEGER)",
                         NULL, NULL, NULL);
+  // changes to tags and tagged_images, picked up by the in-memory tag index. temp triggers so they
+  // catch every statement touching these tables, without slowing down other processes on the db.
   DT_DEBUG_SQLITE3_EXEC(db->handle,
-                        "CREATE TABLE memory.history (imgid INTEGER, num INTEGER, module INTEGER, "
-                        "operation VARCHAR(256) UNIQUE ON CONFLICT REPLACE, op_params BLOB, enabled INTEGER, "
-                        "blendop_params BLOB, blendop_version INTEGER, multi_priority INTEGER, multi_name VARCHAR(256))",
+                        "CREATE TEMP TABLE tagxtag_delta (id1 INTEGER, id2 INTEGER, delta INTEGER)", NULL, NULL, NULL);
+  DT_DEBUG_SQLITE3_EXEC(db->handle,
+                        "CREATE TEMP TABLE tags_changed (id INTEGER)", NULL, NULL, NULL);
+  DT_DEBUG_SQLITE3_EXEC(db->handle,
+                        "CREATE TEMP TRIGGER tagxtag_attach AFTER INSERT ON main.tagged_images"
+                        " BEGIN"
+                        "   INSERT INTO tagxtag_delta SELECT MIN(new.tagid, tagid), MAX(new.tagid, tagid), 1"
+                        "     FROM tagged_images WHERE imgid = new.imgid;"
+                        " END",
+                        NULL, NULL, NULL);
+  DT_DEBUG_SQLITE3_EXEC(db->handle,
+                        "CREATE TEMP TRIGGER tagxtag_detach BEFORE DELETE ON main.tagged_images"
+                        " BEGIN"
+                        "   INSERT INTO tagxtag_delta SELECT MIN(old.tagid, tagid), MAX(old.tagid, tagid), -1"
+                        "     FROM tagged_images WHERE imgid = old.imgid;"
+                        " END",
+                        NULL, NULL, NULL);
+  DT_DEBUG_SQLITE3_EXEC(db->handle,
+                        "CREATE TEMP TRIGGER tags_insert AFTER INSERT ON main.tags"
+                        " BEGIN INSERT INTO tags_changed VALUES (new.id); END",
+                        NULL, NULL, NULL);
+  DT_DEBUG_SQLITE3_EXEC(db->handle,
+                        "CREATE TEMP TRIGGER tags_update AFTER UPDATE OF name ON main.tags"
+                        " BEGIN INSERT INTO tags_changed VALUES (new.id); END",
+                        NULL, NULL, NULL);
+  DT_DEBUG_SQLITE3_EXEC(db->handle,
+                        "CREATE TEMP TRIGGER tags_delete AFTER DELETE ON main.tags"
+                        " BEGIN INSERT INTO tags_changed VALUES (old.id); END",
                         NULL, NULL, NULL);
   DT_DEBUG_SQLITE3_EXEC(db->handle,
                         "CREATE TABLE MEMORY.style_items (styleid INTEGER, num INTEGER, module INTEGER, "
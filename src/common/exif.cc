@@ -47,6 +47,7 @@ extern "C"
 #include <exiv2/error.hpp>
 #include <exiv2/image.hpp>
 #include <exiv2/exif.hpp>
+#include <exiv2/convert.hpp>
 
 using namespace std;
 
@@ -2087,6 +2088,41 @@ int dt_exif_xmp_attach (const int imgid, const char* filename)
   }
 }
 
+char *dt_exif_xmp_read_string(const int imgid)
+{
+  try
+  {
+    char input_filename[PATH_MAX];
+    gboolean from_cache = FALSE;
+    dt_image_full_path(imgid, input_filename, sizeof(input_filename), &from_cache);
+
+    // same contents dt_exif_xmp_attach() would write: the xmp of the original
+    // file, its iptc folded into xmp (there is no separate iptc block here) and
+    // our own data on top.
+    Exiv2::XmpData xmpData;
+    Exiv2::Image::AutoPtr input_image = Exiv2::ImageFactory::open(input_filename);
+    if(input_image.get() != 0)
+    {
+      input_image->readMetadata();
+      xmpData = input_image->xmpData();
+      Exiv2::copyIptcToXmp(input_image->iptcData(), xmpData);
+    }
+    dt_exif_xmp_read_data(xmpData, imgid);
+
+    std::string xmpPacket;
+    if(Exiv2::XmpParser::encode(xmpPacket, xmpData, Exiv2::XmpParser::useCompactFormat) != 0)
+    {
+      throw Exiv2::Error(1, "[xmp_read_string] failed to serialize xmp data");
+    }
+    return g_strdup(xmpPacket.c_str());
+  }
+  catch (Exiv2::AnyError& e)
+  {
+    std::cerr << "[xmp_read_string] caught exiv2 exception '" << e << "'\n";
+    return NULL;
+  }
+}
+
 // write xmp sidecar file:
 int dt_exif_xmp_write (const int imgid, const char* filename)
 {
@@ -45,6 +45,9 @@ extern "C"
   /** write xmp packet inside an image. */
   int dt_exif_xmp_attach (const int imgid, const char* filename);
 
+  /** serialize the xmp packet dt_exif_xmp_attach() would write, for formats which embed it while writing. free with g_free(). */
+  char *dt_exif_xmp_read_string (const int imgid);
+
   /** read xmp sidecar file. */
   int dt_exif_xmp_read (dt_image_t * img, const char* filename, const int history_only);
 
@@ -343,6 +343,34 @@ int _film_filename_cmp(gchar *a, gchar *b)
   return ret;
 }
 
+/* auto apply the gpx files found in the directory of the film roll to its images,
+   all of them merged into one track */
+static void _film_apply_gpx(dt_film_t *cfr)
+{
+  if(!cfr || !cfr->dir)
+    return;
+
+  GList *gpx_files = NULL;
+  g_dir_rewind(cfr->dir);
+  const gchar *dfn = NULL;
+  while ((dfn = g_dir_read_name(cfr->dir)) != NULL)
+  {
+    /* check if we have a gpx to be auto applied to filmroll */
+    size_t len = strlen(dfn);
+    if(len >= 4 && (strcmp(dfn+len-4,".gpx") == 0 ||
+                    strcmp(dfn+len-4,".GPX") == 0))
+      gpx_files = g_list_prepend(gpx_files, g_build_path (G_DIR_SEPARATOR_S, cfr->dirname, dfn, NULL));
+  }
+
+  if(gpx_files)
+  {
+    gchar *tz = dt_conf_get_string("plugins/lighttable/geotagging/tz");
+    dt_control_gpx_apply_files(gpx_files, cfr->id, tz);
+    g_free(tz);
+    g_list_free_full(gpx_files, g_free);
+  }
+}
+
 void dt_film_import1(dt_film_t *film)
 {
   gboolean recursive = dt_conf_get_bool("ui_last/import_recursive");
@@ -378,28 +406,7 @@ void dt_film_import1(dt_film_t *film)
     /* check if we need to initialize a new filmroll */
     if(!cfr || g_strcmp0(cfr->dirname, cdn) != 0)
     {
-      //FIXME: maybe refactor into function and call it?
-      if(cfr && cfr->dir)
-      {
-        /* check if we can find a gpx data file to be auto applied
-           to images in the jsut imported filmroll */
-        g_dir_rewind(cfr->dir);
-        const gchar *dfn = NULL;
-        while ((dfn = g_dir_read_name(cfr->dir)) != NULL)
-        {
-          /* check if we have a gpx to be auto applied to filmroll */
-          size_t len = strlen(dfn);
-          if(strcmp(dfn+len-4,".gpx") == 0 ||
-              strcmp(dfn+len-4,".GPX") == 0)
-          {
-            gchar *gpx_file = g_build_path (G_DIR_SEPARATOR_S, cfr->dirname, dfn, NULL);
-            gchar *tz = dt_conf_get_string("plugins/lighttable/geotagging/tz");
-            dt_control_gpx_apply(gpx_file, cfr->id, tz);
-            g_free(gpx_file);
-            g_free(tz);
-          }
-        }
-      }
+      _film_apply_gpx(cfr);
 
       /* cleanup previously imported filmroll*/
       if(cfr && cfr!=film)
@@ -438,28 +445,7 @@ void dt_film_import1(dt_film_t *film)
   dt_control_progress_destroy(darktable.control, progress);
   dt_control_signal_raise(darktable.signals , DT_SIGNAL_FILMROLLS_IMPORTED,film->id);
 
-  //FIXME: maybe refactor into function and call it?
-  if(cfr && cfr->dir)
-  {
-    /* check if we can find a gpx data file to be auto applied
-       to images in the just imported filmroll */
-    g_dir_rewind(cfr->dir);
-    const gchar *dfn = NULL;
-    while ((dfn = g_dir_read_name(cfr->dir)) != NULL)
-    {
-      /* check if we have a gpx to be auto applied to filmroll */
-      size_t len = strlen(dfn);
-      if(strcmp(dfn+len-4,".gpx") == 0 ||
-          strcmp(dfn+len-4,".GPX") == 0)
-      {
-        gchar *gpx_file = g_build_path (G_DIR_SEPARATOR_S, cfr->dirname, dfn, NULL);
-        gchar *tz = dt_conf_get_string("plugins/lighttable/geotagging/tz");
-        dt_control_gpx_apply(gpx_file, cfr->id, tz);
-        g_free(gpx_file);
-        g_free(tz);
-      }
-    }
-  }
+  _film_apply_gpx(cfr);
 }
 
 
@@ -571,6 +557,7 @@ void dt_film_remove(const int id)
     const uint32_t imgid = sqlite3_column_int(stmt, 0);
     dt_image_local_copy_reset(imgid);
     dt_mipmap_cache_remove(darktable.mipmap_cache, imgid);
+    dt_mipmap_cache_remove_stored(imgid);
     dt_image_cache_remove (darktable.image_cache, imgid);
   }
   sqlite3_finalize(stmt);
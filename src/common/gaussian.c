@@ -20,11 +20,19 @@
 #include <math.h>
 #include <assert.h>
 #include <xmmintrin.h>
+#include "common/darktable.h"
+#ifdef DT_HAVE_TARGET_AVX
+#include <immintrin.h>
+#endif
 #include "common/opencl.h"
 #include "common/gaussian.h"
 
 #define CLAMPF(a, mn, mx) ((a) < (mn) ? (mn) : ((a) > (mx) ? (mx) : (a)))
 #define MMCLAMPPS(a, mn, mx) (_mm_min_ps((mx), _mm_max_ps((a), (mn))))
+
+// number of 4 channel pixels filtered side by side in the vertical passes
+#define GAUSS_VBLOCK 4
+
 #define BLOCKSIZE 32
 
 static
@@ -172,26 +180,39 @@ dt_gaussian_blur(
   float *Labmax = g->max;
   float *Labmin = g->min;
 
-  // vertical blur column by column
+  // vertical blur, a cache line worth of adjacent columns at a time so that
+  // every row access touches whole cache lines instead of a single pixel.
+  const int bw = MAX(1, GAUSS_VBLOCK*4/ch);
+  const int vblocks = (width + bw - 1) / bw;
 #ifdef _OPENMP
   #pragma omp parallel for default(none) shared(in,out,temp,Labmin,Labmax,a0,a1,a2,a3,b1,b2,coefp,coefn) schedule(static)
 #endif
-  for(int i=0; i<width; i++)
+  for(int b=0; b<vblocks; b++)
   {
-    float xp[ch];
-    float yb[ch];
-    float yp[ch];
-    float xc[ch];
-    float yc[ch];
-    float xn[ch];
-    float xa[ch];
-    float yn[ch];
-    float ya[ch];
+    const int i0 = b*bw;
+    const int n = MIN(bw, width - i0) * ch;
+    float xp[bw*ch];
+    float yb[bw*ch];
+    float yp[bw*ch];
+    float xc[bw*ch];
+    float yc[bw*ch];
+    float xn[bw*ch];
+    float xa[bw*ch];
+    float yn[bw*ch];
+    float ya[bw*ch];
+    float mn[bw*ch];
+    float mx[bw*ch];
+
+    for(int k=0; k<n; k++)
+    {
+      mn[k] = Labmin[k % ch];
+      mx[k] = Labmax[k % ch];
+    }
 
     // forward filter
-    for(int k=0; k<ch; k++)
+    for(int k=0; k<n; k++)
     {
-      xp[k] = CLAMPF(in[(size_t)i*ch+k], Labmin[k], Labmax[k]);
+      xp[k] = CLAMPF(in[(size_t)i0*ch+k], mn[k], mx[k]);
       yb[k] = xp[k] * coefp;
       yp[k] = yb[k];
       xc[k] = yc[k] = xn[k] = xa[k] = yn[k] = ya[k] = 0.0f;
@@ -199,11 +220,11 @@ dt_gaussian_blur(
 
     for(int j=0; j<height; j++)
     {
-      size_t offset = ((size_t)j * width + i)*ch;
+      size_t offset = ((size_t)j * width + i0)*ch;
 
-      for(int k=0; k<ch; k++)
+      for(int k=0; k<n; k++)
       {
-        xc[k] = CLAMPF(in[offset+k], Labmin[k], Labmax[k]);
+        xc[k] = CLAMPF(in[offset+k], mn[k], mx[k]);
         yc[k] = (a0 * xc[k]) + (a1 * xp[k]) - (b1 * yp[k]) - (b2 * yb[k]);
 
         temp[offset+k] = yc[k];
@@ -215,9 +236,9 @@ dt_gaussian_blur(
     }
 
     // backward filter
-    for(int k=0; k<ch; k++)
+    for(int k=0; k<n; k++)
     {
-      xn[k] = CLAMPF(in[((size_t)(height - 1) * width + i)*ch+k], Labmin[k], Labmax[k]);
+      xn[k] = CLAMPF(in[((size_t)(height - 1) * width + i0)*ch+k], mn[k], mx[k]);
       xa[k] = xn[k];
       yn[k] = xn[k] * coefn;
       ya[k] = yn[k];
@@ -225,11 +246,11 @@ dt_gaussian_blur(
 
     for(int j=height - 1; j > -1; j--)
     {
-      size_t offset = ((size_t)j * width + i)*ch;
+      size_t offset = ((size_t)j * width + i0)*ch;
 
-      for(int k=0; k<ch; k++)
+      for(int k=0; k<n; k++)
       {
-        xc[k] = CLAMPF(in[offset+k], Labmin[k], Labmax[k]);
+        xc[k] = CLAMPF(in[offset+k], mn[k], mx[k]);
 
         yc[k] = (a2 * xn[k]) + (a3 * xa[k]) - (b1 * yn[k]) - (b2 * ya[k]);
 
@@ -317,93 +338,276 @@ dt_gaussian_blur(
 
 
 
-void
-dt_gaussian_blur_4c(
-  dt_gaussian_t *g,
-  float    *in,
-  float    *out)
+// recursive filter along a single column of a 4 channel buffer, forward pass into temp, backward pass added.
+static inline void
+_gaussian_blur_4c_column(const float *const in, float *const temp, const int width, const int height, const int i,
+                         const __m128 Labmin, const __m128 Labmax,
+                         const float a0, const float a1, const float a2, const float a3,
+                         const float b1, const float b2, const float coefp, const float coefn)
 {
-
-  const int width = g->width;
-  const int height = g->height;
   const int ch = 4;
+  __m128 xp = _mm_setzero_ps();
+  __m128 yb = _mm_setzero_ps();
+  __m128 yp = _mm_setzero_ps();
+  __m128 xc = _mm_setzero_ps();
+  __m128 yc = _mm_setzero_ps();
+  __m128 xn = _mm_setzero_ps();
+  __m128 xa = _mm_setzero_ps();
+  __m128 yn = _mm_setzero_ps();
+  __m128 ya = _mm_setzero_ps();
+
+  // forward filter
+  xp = MMCLAMPPS(_mm_load_ps(in+(size_t)i*ch), Labmin, Labmax);
+  yb = _mm_mul_ps(_mm_set_ps1(coefp), xp);
+  yp = yb;
 
-  assert(g->channels == 4);
+  for(int j=0; j<height; j++)
+  {
+    size_t offset = ((size_t)j * width + i)*ch;
 
-  float a0, a1, a2, a3, b1, b2, coefp, coefn;
+    xc = MMCLAMPPS(_mm_load_ps(in+offset), Labmin, Labmax);
 
-  compute_gauss_params(g->sigma, g->order, &a0, &a1, &a2, &a3, &b1, &b2, &coefp, &coefn);
+    yc = _mm_add_ps(_mm_mul_ps(xc, _mm_set_ps1(a0)),
+                    _mm_sub_ps(_mm_mul_ps(xp, _mm_set_ps1(a1)),
+                               _mm_add_ps(_mm_mul_ps(yp, _mm_set_ps1(b1)), _mm_mul_ps(yb, _mm_set_ps1(b2)))));
 
-  const __m128 Labmax = _mm_set_ps(g->max[3], g->max[2], g->max[1], g->max[0]);
-  const __m128 Labmin = _mm_set_ps(g->min[3], g->min[2], g->min[1], g->min[0]);
+    _mm_store_ps(temp+offset, yc);
 
-  float *temp = g->buf;
+    xp = xc;
+    yb = yp;
+    yp = yc;
+  }
 
+  // backward filter
+  xn = MMCLAMPPS(_mm_load_ps(in+((size_t)(height - 1) * width + i)*ch), Labmin, Labmax);
+  xa = xn;
+  yn = _mm_mul_ps(_mm_set_ps1(coefn), xn);
+  ya = yn;
 
-  // vertical blur column by column
-#ifdef _OPENMP
-  #pragma omp parallel for default(none) shared(in,out,temp,a0,a1,a2,a3,b1,b2,coefp,coefn) schedule(static)
-#endif
-  for(int i=0; i<width; i++)
+  for(int j=height - 1; j > -1; j--)
   {
-    __m128 xp = _mm_setzero_ps();
-    __m128 yb = _mm_setzero_ps();
-    __m128 yp = _mm_setzero_ps();
-    __m128 xc = _mm_setzero_ps();
-    __m128 yc = _mm_setzero_ps();
-    __m128 xn = _mm_setzero_ps();
-    __m128 xa = _mm_setzero_ps();
-    __m128 yn = _mm_setzero_ps();
-    __m128 ya = _mm_setzero_ps();
+    size_t offset = ((size_t)j * width + i)*ch;
 
-    // forward filter
-    xp = MMCLAMPPS(_mm_load_ps(in+i*ch), Labmin, Labmax);
-    yb = _mm_mul_ps(_mm_set_ps1(coefp), xp);
-    yp = yb;
+    xc = MMCLAMPPS(_mm_load_ps(in+offset), Labmin, Labmax);
 
+    yc = _mm_add_ps(_mm_mul_ps(xn, _mm_set_ps1(a2)),
+                    _mm_sub_ps(_mm_mul_ps(xa, _mm_set_ps1(a3)),
+                               _mm_add_ps(_mm_mul_ps(yn, _mm_set_ps1(b1)), _mm_mul_ps(ya, _mm_set_ps1(b2)))));
 
-    for(int j=0; j<height; j++)
+    xa = xn;
+    xn = xc;
+    ya = yn;
+    yn = yc;
+
+    _mm_store_ps(temp+offset, _mm_add_ps(_mm_load_ps(temp+offset), yc));
+  }
+}
+
+// same as above for GAUSS_VBLOCK adjacent columns starting at i0, the filter states live in registers.
+static void
+_gaussian_blur_4c_column_block_sse(const float *const in, float *const temp, const int width, const int height, const int i0,
+                                   const __m128 Labmin, const __m128 Labmax,
+                                   const float a0, const float a1, const float a2, const float a3,
+                                   const float b1, const float b2, const float coefp, const float coefn)
+{
+  const int ch = 4;
+  __m128 xp[GAUSS_VBLOCK], yb[GAUSS_VBLOCK], yp[GAUSS_VBLOCK], xn[GAUSS_VBLOCK], xa[GAUSS_VBLOCK], yn[GAUSS_VBLOCK], ya[GAUSS_VBLOCK];
+
+  // forward filter
+  for(int c=0; c<GAUSS_VBLOCK; c++)
+  {
+    xp[c] = MMCLAMPPS(_mm_load_ps(in+(size_t)(i0+c)*ch), Labmin, Labmax);
+    yb[c] = _mm_mul_ps(_mm_set_ps1(coefp), xp[c]);
+    yp[c] = yb[c];
+  }
+
+  for(int j=0; j<height; j++)
+  {
+    const size_t offset = ((size_t)j * width + i0)*ch;
+
+    for(int c=0; c<GAUSS_VBLOCK; c++)
     {
-      size_t offset = ((size_t)j * width + i)*ch;
+      const __m128 xc = MMCLAMPPS(_mm_load_ps(in+offset+c*ch), Labmin, Labmax);
 
-      xc = MMCLAMPPS(_mm_load_ps(in+offset), Labmin, Labmax);
+      const __m128 yc = _mm_add_ps(_mm_mul_ps(xc, _mm_set_ps1(a0)),
+                                   _mm_sub_ps(_mm_mul_ps(xp[c], _mm_set_ps1(a1)),
+                                              _mm_add_ps(_mm_mul_ps(yp[c], _mm_set_ps1(b1)), _mm_mul_ps(yb[c], _mm_set_ps1(b2)))));
 
+      _mm_store_ps(temp+offset+c*ch, yc);
 
-      yc = _mm_add_ps(_mm_mul_ps(xc, _mm_set_ps1(a0)),
-                      _mm_sub_ps(_mm_mul_ps(xp, _mm_set_ps1(a1)),
-                                 _mm_add_ps(_mm_mul_ps(yp, _mm_set_ps1(b1)), _mm_mul_ps(yb, _mm_set_ps1(b2)))));
+      xp[c] = xc;
+      yb[c] = yp[c];
+      yp[c] = yc;
+    }
+  }
 
-      _mm_store_ps(temp+offset, yc);
+  // backward filter
+  for(int c=0; c<GAUSS_VBLOCK; c++)
+  {
+    xn[c] = MMCLAMPPS(_mm_load_ps(in+((size_t)(height - 1) * width + i0 + c)*ch), Labmin, Labmax);
+    xa[c] = xn[c];
+    yn[c] = _mm_mul_ps(_mm_set_ps1(coefn), xn[c]);
+    ya[c] = yn[c];
+  }
 
-      xp = xc;
-      yb = yp;
-      yp = yc;
+  for(int j=height - 1; j > -1; j--)
+  {
+    const size_t offset = ((size_t)j * width + i0)*ch;
 
+    for(int c=0; c<GAUSS_VBLOCK; c++)
+    {
+      const __m128 xc = MMCLAMPPS(_mm_load_ps(in+offset+c*ch), Labmin, Labmax);
+
+      const __m128 yc = _mm_add_ps(_mm_mul_ps(xn[c], _mm_set_ps1(a2)),
+                                   _mm_sub_ps(_mm_mul_ps(xa[c], _mm_set_ps1(a3)),
+                                              _mm_add_ps(_mm_mul_ps(yn[c], _mm_set_ps1(b1)), _mm_mul_ps(ya[c], _mm_set_ps1(b2)))));
+
+      xa[c] = xn[c];
+      xn[c] = xc;
+      ya[c] = yn[c];
+      yn[c] = yc;
+
+      _mm_store_ps(temp+offset+c*ch, _mm_add_ps(_mm_load_ps(temp+offset+c*ch), yc));
     }
+  }
+}
 
-    // backward filter
-    xn = MMCLAMPPS(_mm_load_ps(in+((size_t)(height - 1) * width + i)*ch), Labmin, Labmax);
-    xa = xn;
-    yn = _mm_mul_ps(_mm_set_ps1(coefn), xn);
-    ya = yn;
+#ifdef DT_HAVE_TARGET_AVX
+// avx flavour of the column block, two pixels per register. c[] holds a0, a1, a2, a3, b1, b2, coefp, coefn.
+__attribute__((target("avx")))
+static void
+_gaussian_blur_4c_column_block_avx(const float *const in, float *const temp, const int width, const int height, const int i0,
+                                   const float *const min, const float *const max, const float *const c)
+{
+  const int ch = 4;
+  const int nv = GAUSS_VBLOCK/2;
+  const __m256 Labmin = _mm256_setr_ps(min[0], min[1], min[2], min[3], min[0], min[1], min[2], min[3]);
+  const __m256 Labmax = _mm256_setr_ps(max[0], max[1], max[2], max[3], max[0], max[1], max[2], max[3]);
+  const __m256 a0 = _mm256_set1_ps(c[0]), a1 = _mm256_set1_ps(c[1]), a2 = _mm256_set1_ps(c[2]), a3 = _mm256_set1_ps(c[3]);
+  const __m256 b1 = _mm256_set1_ps(c[4]), b2 = _mm256_set1_ps(c[5]);
+  __m256 xp[GAUSS_VBLOCK/2], yb[GAUSS_VBLOCK/2], yp[GAUSS_VBLOCK/2], xn[GAUSS_VBLOCK/2], xa[GAUSS_VBLOCK/2], yn[GAUSS_VBLOCK/2], ya[GAUSS_VBLOCK/2];
+
+  // forward filter
+  for(int v=0; v<nv; v++)
+  {
+    xp[v] = _mm256_min_ps(Labmax, _mm256_max_ps(_mm256_loadu_ps(in+(size_t)(i0+2*v)*ch), Labmin));
+    yb[v] = _mm256_mul_ps(_mm256_set1_ps(c[6]), xp[v]);
+    yp[v] = yb[v];
+  }
 
-    for(int j=height - 1; j > -1; j--)
+  for(int j=0; j<height; j++)
+  {
+    const size_t offset = ((size_t)j * width + i0)*ch;
+
+    for(int v=0; v<nv; v++)
     {
-      size_t offset = ((size_t)j * width + i)*ch;
+      const __m256 xc = _mm256_min_ps(Labmax, _mm256_max_ps(_mm256_loadu_ps(in+offset+8*v), Labmin));
 
-      xc = MMCLAMPPS(_mm_load_ps(in+offset), Labmin, Labmax);
+      const __m256 yc = _mm256_add_ps(_mm256_mul_ps(xc, a0),
+                                      _mm256_sub_ps(_mm256_mul_ps(xp[v], a1),
+                                                    _mm256_add_ps(_mm256_mul_ps(yp[v], b1), _mm256_mul_ps(yb[v], b2))));
 
-      yc = _mm_add_ps(_mm_mul_ps(xn, _mm_set_ps1(a2)),
-                      _mm_sub_ps(_mm_mul_ps(xa, _mm_set_ps1(a3)),
-                                 _mm_add_ps(_mm_mul_ps(yn, _mm_set_ps1(b1)), _mm_mul_ps(ya, _mm_set_ps1(b2)))));
+      _mm256_storeu_ps(temp+offset+8*v, yc);
 
+      xp[v] = xc;
+      yb[v] = yp[v];
+      yp[v] = yc;
+    }
+  }
 
-      xa = xn;
-      xn = xc;
-      ya = yn;
-      yn = yc;
+  // backward filter
+  for(int v=0; v<nv; v++)
+  {
+    xn[v] = _mm256_min_ps(Labmax, _mm256_max_ps(_mm256_loadu_ps(in+((size_t)(height - 1) * width + i0 + 2*v)*ch), Labmin));
+    xa[v] = xn[v];
+    yn[v] = _mm256_mul_ps(_mm256_set1_ps(c[7]), xn[v]);
+    ya[v] = yn[v];
+  }
+
+  for(int j=height - 1; j > -1; j--)
+  {
+    const size_t offset = ((size_t)j * width + i0)*ch;
+
+    for(int v=0; v<nv; v++)
+    {
+      const __m256 xc = _mm256_min_ps(Labmax, _mm256_max_ps(_mm256_loadu_ps(in+offset+8*v), Labmin));
+
+      const __m256 yc = _mm256_add_ps(_mm256_mul_ps(xn[v], a2),
+                                      _mm256_sub_ps(_mm256_mul_ps(xa[v], a3),
+                                                    _mm256_add_ps(_mm256_mul_ps(yn[v], b1), _mm256_mul_ps(ya[v], b2))));
+
+      xa[v] = xn[v];
+      xn[v] = xc;
+      ya[v] = yn[v];
+      yn[v] = yc;
+
+      _mm256_storeu_ps(temp+offset+8*v, _mm256_add_ps(_mm256_loadu_ps(temp+offset+8*v), yc));
+    }
+  }
+  _mm256_zeroupper();
+}
+#endif
 
-      _mm_store_ps(temp+offset, _mm_add_ps(_mm_load_ps(temp+offset), yc));
+void
+dt_gaussian_blur_4c(
+  dt_gaussian_t *g,
+  float    *in,
+  float    *out)
+{
+
+  const int width = g->width;
+  const int height = g->height;
+  const int ch = 4;
+
+  assert(g->channels == 4);
+
+  float a0, a1, a2, a3, b1, b2, coefp, coefn;
+
+  compute_gauss_params(g->sigma, g->order, &a0, &a1, &a2, &a3, &b1, &b2, &coefp, &coefn);
+
+  const __m128 Labmax = _mm_set_ps(g->max[3], g->max[2], g->max[1], g->max[0]);
+  const __m128 Labmin = _mm_set_ps(g->min[3], g->min[2], g->min[1], g->min[0]);
+
+  float *temp = g->buf;
+
+
+  // vertical blur, GAUSS_VBLOCK adjacent columns at a time
+  const int vblocks = (width + GAUSS_VBLOCK - 1) / GAUSS_VBLOCK;
+#ifdef DT_HAVE_TARGET_AVX
+  if(darktable.cpu_flags & DT_CPU_FLAG_AVX)
+  {
+#ifdef _OPENMP
+    #pragma omp parallel for default(none) shared(g,in,temp,a0,a1,a2,a3,b1,b2,coefp,coefn) schedule(static)
+#endif
+    for(int b=0; b<vblocks; b++)
+    {
+      const int i0 = b*GAUSS_VBLOCK;
+      if(i0 + GAUSS_VBLOCK <= width)
+      {
+        const float c[8] = { a0, a1, a2, a3, b1, b2, coefp, coefn };
+        _gaussian_blur_4c_column_block_avx(in, temp, width, height, i0, g->min, g->max, c);
+        continue;
+      }
+      for(int i=i0; i<width; i++)
+        _gaussian_blur_4c_column(in, temp, width, height, i, Labmin, Labmax, a0, a1, a2, a3, b1, b2, coefp, coefn);
+    }
+  }
+  else
+#endif
+  {
+#ifdef _OPENMP
+    #pragma omp parallel for default(none) shared(in,temp,a0,a1,a2,a3,b1,b2,coefp,coefn) schedule(static)
+#endif
+    for(int b=0; b<vblocks; b++)
+    {
+      const int i0 = b*GAUSS_VBLOCK;
+      if(i0 + GAUSS_VBLOCK <= width)
+      {
+        _gaussian_blur_4c_column_block_sse(in, temp, width, height, i0, Labmin, Labmax, a0, a1, a2, a3, b1, b2, coefp, coefn);
+        continue;
+      }
+      for(int i=i0; i<width; i++)
+        _gaussian_blur_4c_column(in, temp, width, height, i, Labmin, Labmax, a0, a1, a2, a3, b1, b2, coefp, coefn);
     }
   }
 
@@ -19,6 +19,9 @@
 #include <inttypes.h>
 #include "common/gpx.h"
 #include "common/darktable.h"
+#include "common/database.h"
+#include "common/image.h"
+#include "common/image_cache.h"
 
 typedef struct _gpx_track_point_t
 {
@@ -37,8 +40,8 @@ typedef enum _gpx_parser_element_t
 
 typedef struct dt_gpx_t
 {
-  /* the list of track records parsed */
-  GList *track;
+  /* the track records parsed, sorted by time once a file is done */
+  GArray *track;
 
   /* currently parsed track point */
   _gpx_track_point_t *current_track_point;
@@ -67,14 +70,38 @@ static GMarkupParser _gpx_parser =
 };
 
 
+static gint _gpx_sort_by_time(gconstpointer a, gconstpointer b)
+{
+  const GTimeVal *ta = &((const _gpx_track_point_t *)a)->time, *tb = &((const _gpx_track_point_t *)b)->time;
+  if(ta->tv_sec != tb->tv_sec) return ta->tv_sec < tb->tv_sec ? -1 : 1;
+  return (ta->tv_usec > tb->tv_usec) - (ta->tv_usec < tb->tv_usec);
+}
+
+static inline gdouble _gpx_seconds(const GTimeVal *t)
+{
+  return t->tv_sec + 1e-6*t->tv_usec;
+}
+
 dt_gpx_t *dt_gpx_new(const gchar *filename)
 {
-  dt_gpx_t *gpx = NULL;
+  dt_gpx_t *gpx = g_malloc0(sizeof(dt_gpx_t));
+  gpx->track = g_array_new(FALSE, FALSE, sizeof(_gpx_track_point_t));
+  if(!dt_gpx_add(gpx, filename))
+  {
+    dt_gpx_destroy(gpx);
+    return NULL;
+  }
+  return gpx;
+}
+
+gboolean dt_gpx_add(struct dt_gpx_t *gpx, const gchar *filename)
+{
   GMarkupParseContext *ctx = NULL;
   GError *err = NULL;
   GMappedFile *gpxmf = NULL;
   gchar *gpxmf_content = NULL;
   gint gpxmf_size = 0;
+  const guint track_len = gpx->track->len;
 
 
   /* map gpx file to parse into memory */
@@ -87,9 +114,6 @@ dt_gpx_t *dt_gpx_new(const gchar *filename)
   if (!gpxmf_content || gpxmf_size < 10)
     goto error;
 
-  /* allocate new dt_gpx_t context */
-  gpx = g_malloc0(sizeof(dt_gpx_t));
-
   /* initialize the parser and start parse gpx xml data */
   ctx = g_markup_parse_context_new(&_gpx_parser, 0, gpx, NULL);
   g_markup_parse_context_parse(ctx, gpxmf_content, gpxmf_size, &err);
@@ -97,37 +121,43 @@ dt_gpx_t *dt_gpx_new(const gchar *filename)
     goto error;
 
 
-  /* cleanup and return gpx context */
+  /* cleanup. the points of all files are kept in one array sorted by time,
+     so the location of an image is found by binary search */
   g_markup_parse_context_free(ctx);
   g_mapped_file_unref(gpxmf);
+  g_array_sort(gpx->track, _gpx_sort_by_time);
 
-  return gpx;
+  return TRUE;
 
 error:
   if (err)
   {
-    fprintf(stderr, "dt_gpx_new: %s\n", err->message);
+    fprintf(stderr, "dt_gpx_add: %s\n", err->message);
     g_error_free(err);
   }
 
   if (ctx)
     g_markup_parse_context_free(ctx);
 
-  g_free(gpx);
+  /* drop what we got from a broken file, keep the tracks added before */
+  g_free(gpx->current_track_point);
+  gpx->current_track_point = NULL;
+  gpx->current_parser_element = GPX_PARSER_ELEMENT_NONE;
+  if(gpx->track->len > track_len)
+    g_array_set_size(gpx->track, track_len);
 
   if(gpxmf)
     g_mapped_file_unref(gpxmf);
 
-  return NULL;
+  return FALSE;
 }
 
 void dt_gpx_destroy(struct dt_gpx_t *gpx)
 {
   g_assert(gpx != NULL);
 
-  if (gpx->track)
-    g_list_free_full(gpx->track, g_free);
-
+  g_array_free(gpx->track, TRUE);
+  g_free(gpx->current_track_point);
   g_free(gpx);
 }
 
@@ -135,41 +165,128 @@ gboolean dt_gpx_get_location(struct dt_gpx_t *gpx, GTimeVal *timestamp, gdouble
 {
   g_assert(gpx != NULL);
 
-  GList *item = g_list_first(gpx->track);
+  const _gpx_track_point_t *track = (const _gpx_track_point_t *)gpx->track->data;
+  const guint n = gpx->track->len;
 
   /* verify that we got at least 2 trackpoints */
-  if (!item || !item->next)
+  if (n < 2)
     return FALSE;
 
-  do
+  /* if timestamp is out of time range return false but fill
+     closest location value start or end point */
+  const gdouble t = _gpx_seconds(timestamp);
+  if (t < _gpx_seconds(&track[0].time) || t > _gpx_seconds(&track[n-1].time))
   {
+    const _gpx_track_point_t *tp = (t < _gpx_seconds(&track[0].time)) ? track : track + n - 1;
+    *lon = tp->longitude;
+    *lat = tp->latitude;
+    return FALSE;
+  }
 
-    _gpx_track_point_t *tp = (_gpx_track_point_t *)item->data;
+  /* find the first trackpoint after the timestamp */
+  guint lo = 1, hi = n - 1;
+  while (lo < hi)
+  {
+    const guint mid = (lo + hi) / 2;
+    if (_gpx_seconds(&track[mid].time) <= t)
+      lo = mid + 1;
+    else
+      hi = mid;
+  }
 
-    /* if timestamp is out of time range return false but fill
-       closest location value start or end point */
-    if ((!item->next && timestamp->tv_sec >= tp->time.tv_sec)
-        || (timestamp->tv_sec <= tp->time.tv_sec))
-    {
-      *lon = tp->longitude;
-      *lat = tp->latitude;
-      return FALSE;
-    }
+  /* and interpolate between it and the one before */
+  const _gpx_track_point_t *tp0 = track + lo - 1, *tp1 = track + lo;
+  const gdouble t0 = _gpx_seconds(&tp0->time), t1 = _gpx_seconds(&tp1->time);
+  const gdouble f = (t1 > t0) ? CLAMP((t - t0) / (t1 - t0), 0.0, 1.0) : 0.0;
+  *lon = tp0->longitude + f * (tp1->longitude - tp0->longitude);
+  *lat = tp0->latitude + f * (tp1->latitude - tp0->latitude);
+  return TRUE;
+}
+
+int dt_gpx_apply(struct dt_gpx_t *gpx, GList *imgs, const gchar *tz)
+{
+  g_assert(gpx != NULL);
+
+  GTimeZone *tz_camera = (tz == NULL)?g_time_zone_new_utc():g_time_zone_new(tz);
+  if(!tz_camera)
+    return 0;
+  GTimeZone *tz_utc = g_time_zone_new_utc();
 
-    /* check if timestamp is within current and next trackpoint */
-    if (timestamp->tv_sec >= tp->time.tv_sec &&
-        timestamp->tv_sec <= ((_gpx_track_point_t*)item->next->data)->time.tv_sec)
+  /* look up all locations first, so the database is only locked for the updates */
+  const guint num = g_list_length(imgs);
+  int *imgid = (int *)g_malloc(sizeof(int) * num);
+  gdouble *lon = (gdouble *)g_malloc(sizeof(gdouble) * num), *lat = (gdouble *)g_malloc(sizeof(gdouble) * num);
+  int cntr = 0;
+
+  for(GList *t = imgs; t; t = g_list_next(t))
+  {
+    GTimeVal timestamp;
+    GDateTime *exif_time, *utc_time;
+    const int id = GPOINTER_TO_INT(t->data);
+
+    /* get image */
+    const dt_image_t *cimg = dt_image_cache_read_get(darktable.image_cache, id);
+    if (!cimg)
+      continue;
+
+    /* convert exif datetime
+       TODO: exiv2 dates should be iso8601 and we are probably doing some ugly
+       conversion before inserting into database.
+     */
+    gint year, month, day, hour, minute, seconds;
+    if (sscanf(cimg->exif_datetime_taken, "%d:%d:%d %d:%d:%d",
+               (int*)&year, (int*)&month, (int*)&day,
+               (int*)&hour,(int*)&minute,(int*)&seconds) != 6)
     {
-      *lon = tp->longitude;
-      *lat = tp->latitude;
-      return TRUE;
+      fprintf(stderr,"broken exif time in db, '%s'\n", cimg->exif_datetime_taken);
+      dt_image_cache_read_release(darktable.image_cache, cimg);
+      continue;
     }
 
+    /* release the lock */
+    dt_image_cache_read_release(darktable.image_cache, cimg);
+
+    exif_time = g_date_time_new(tz_camera, year, month, day, hour, minute, seconds);
+    if(!exif_time)
+      continue;
+    utc_time = g_date_time_to_timezone(exif_time, tz_utc);
+    g_date_time_unref(exif_time);
+    if(!utc_time)
+      continue;
+    gboolean res = g_date_time_to_timeval(utc_time, &timestamp);
+    g_date_time_unref(utc_time);
+    if(!res)
+      continue;
+
+    /* only update image location if time is within gpx tack range */
+    if(dt_gpx_get_location(gpx, &timestamp, lon + cntr, lat + cntr))
+      imgid[cntr++] = id;
   }
-  while ((item = g_list_next(item)) != NULL);
 
-  /* should not reach this point */
-  return FALSE;
+  /* store all locations in one transaction, the sidecars are written after that */
+  sqlite3_exec(dt_database_get(darktable.db), "BEGIN TRANSACTION", NULL, NULL, NULL);
+  for(int k = 0; k < cntr; k++)
+  {
+    const dt_image_t *cimg = dt_image_cache_read_get(darktable.image_cache, imgid[k]);
+    if (!cimg)
+      continue;
+    dt_image_t *image = dt_image_cache_write_get(darktable.image_cache, cimg);
+    image->longitude = lon[k];
+    image->latitude = lat[k];
+    dt_image_cache_write_release(darktable.image_cache, image, DT_IMAGE_CACHE_RELAXED);
+    dt_image_cache_read_release(darktable.image_cache, image);
+  }
+  sqlite3_exec(dt_database_get(darktable.db), "COMMIT", NULL, NULL, NULL);
+
+  for(int k = 0; k < cntr; k++)
+    dt_image_write_sidecar_file(imgid[k]);
+
+  g_free(imgid);
+  g_free(lon);
+  g_free(lat);
+  g_time_zone_unref(tz_camera);
+  g_time_zone_unref(tz_utc);
+  return cntr;
 }
 
 /*
@@ -260,10 +377,9 @@ void _gpx_parser_end_element (GMarkupParseContext *context, const gchar *element
   /* closing trackpoint lets take care of data parsed */
   if (strcmp(element_name, "trkpt") == 0)
   {
-    if (!gpx->invalid_track_point)
-      gpx->track = g_list_append(gpx->track, gpx->current_track_point);
-    else
-      g_free(gpx->current_track_point);
+    if (gpx->current_track_point && !gpx->invalid_track_point)
+      g_array_append_val(gpx->track, *gpx->current_track_point);
+    g_free(gpx->current_track_point);
 
     gpx->current_track_point = NULL;
   }
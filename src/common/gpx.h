@@ -23,11 +23,19 @@ struct dt_gpx_t;
 
 /* loads and parses a gpx track file */
 struct dt_gpx_t *dt_gpx_new(const gchar *filename);
+/* merges the track points of another gpx file, FALSE if it couldn't be parsed */
+gboolean dt_gpx_add(struct dt_gpx_t *, const gchar *filename);
 void dt_gpx_destroy(struct dt_gpx_t *);
 
-/* fetch the lon,lat coords for time t, if within time range
-  of gpx record return TRUE, FALSE is returned if out of time frame
-  and closest record of lon,lat is filled */
+/* fetch the lon,lat coords for time t, interpolated between the
+  surrounding track points. if within time range of gpx record
+  return TRUE, FALSE is returned if out of time frame and closest
+  record of lon,lat is filled */
 gboolean dt_gpx_get_location(struct dt_gpx_t *, GTimeVal *timestamp, gdouble *lon, gdouble *lat);
 
+/* sets the location of the images taken within the time range of the
+  track, their exif time being in time zone tz (utc if NULL). the database
+  is updated in one transaction. returns the number of images geotagged */
+int dt_gpx_apply(struct dt_gpx_t *, GList *imgs, const gchar *tz);
+
 #endif
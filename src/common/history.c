@@ -250,6 +250,140 @@ dt_history_copy_and_paste_on_image (int32_t imgid, int32_t dest_imgid, gboolean
   return 0;
 }
 
+int
+dt_history_fill_bulk_images(GList *imgs, int32_t skip_imgid)
+{
+  sqlite3_stmt *stmt;
+  int count = 0;
+  DT_DEBUG_SQLITE3_EXEC(dt_database_get(darktable.db), "delete from memory.bulk_images", NULL, NULL, NULL);
+  DT_DEBUG_SQLITE3_PREPARE_V2(dt_database_get(darktable.db), "insert or ignore into memory.bulk_images (imgid, offs) values (?1, 0)", -1, &stmt, NULL);
+  for(GList *l = imgs; l; l = g_list_next(l))
+  {
+    const int32_t imgid = GPOINTER_TO_INT(l->data);
+    if(imgid <= 0 || imgid == skip_imgid) continue;
+    DT_DEBUG_SQLITE3_BIND_INT(stmt, 1, imgid);
+    sqlite3_step(stmt);
+    sqlite3_reset(stmt);
+    sqlite3_clear_bindings(stmt);
+    count++;
+  }
+  sqlite3_finalize(stmt);
+
+  /* where the new history items go on each stack */
+  DT_DEBUG_SQLITE3_EXEC(dt_database_get(darktable.db),
+                        "update memory.bulk_images set offs = ifnull((select MAX(num)+1 from history where history.imgid = memory.bulk_images.imgid), 0)",
+                        NULL, NULL, NULL);
+  return count;
+}
+
+void
+dt_history_update_images(GList *imgs)
+{
+  for(GList *l = imgs; l; l = g_list_next(l))
+  {
+    const int32_t imgid = GPOINTER_TO_INT(l->data);
+
+    /* if current image in develop reload history */
+    if (dt_dev_is_current_image(darktable.develop, imgid))
+    {
+      dt_dev_reload_history_items (darktable.develop);
+      dt_dev_modulegroups_set(darktable.develop, dt_dev_modulegroups_get(darktable.develop));
+    }
+
+    /* remove old obsolete thumbnails */
+    dt_mipmap_cache_remove(darktable.mipmap_cache, imgid);
+
+    /* update xmp file, this is queued and written in the background */
+    dt_image_write_sidecar_file(imgid);
+  }
+}
+
+int
+dt_history_copy_and_paste_on_images (int32_t imgid, GList *dest_imgids, gboolean merge, GList *ops)
+{
+  sqlite3_stmt *stmt;
+
+  if(imgid==-1)
+  {
+    dt_control_log(_("you need to copy history from an image before you paste it onto another"));
+    return 1;
+  }
+
+  // be sure the current history is written before pasting some other history data
+  const dt_view_t *cv = dt_view_manager_get_current_view(darktable.view_manager);
+  if(cv->view((dt_view_t*)cv) == DT_VIEW_DARKROOM)
+    dt_dev_write_history(darktable.develop);
+
+  /* all images are done with the same statements in one transaction */
+  sqlite3_exec(dt_database_get(darktable.db), "BEGIN TRANSACTION", NULL, NULL, NULL);
+  if(!dt_history_fill_bulk_images(dest_imgids, imgid))
+  {
+    sqlite3_exec(dt_database_get(darktable.db), "COMMIT", NULL, NULL, NULL);
+    return 1;
+  }
+
+  if (!merge)
+  {
+    /* replace history stack */
+    DT_DEBUG_SQLITE3_EXEC(dt_database_get(darktable.db),
+                          "delete from history where imgid in (select imgid from memory.bulk_images)", NULL, NULL, NULL);
+    DT_DEBUG_SQLITE3_EXEC(dt_database_get(darktable.db), "update memory.bulk_images set offs = 0", NULL, NULL, NULL);
+  }
+
+  //  prepare SQL request
+  char req[2048];
+  g_strlcpy (req, "insert into history (imgid, num, module, operation, op_params, enabled, blendop_params, blendop_version, multi_name, multi_priority) select b.imgid, h.num+b.offs, h.module, h.operation, h.op_params, h.enabled, h.blendop_params, h.blendop_version, h.multi_name, h.multi_priority from memory.bulk_images b, history h where h.imgid = ?1", sizeof(req));
+
+  //  Add ops selection if any format: ... and num in (val1, val2)
+  if (ops)
+  {
+    GList *l = ops;
+    int first = 1;
+    g_strlcat(req, " and h.num in (", sizeof(req));
+
+    while (l)
+    {
+      unsigned int value = GPOINTER_TO_UINT(l->data);
+      char v[30];
+
+      if (!first) g_strlcat(req, ",", sizeof(req));
+      snprintf (v, sizeof(v), "%u", value);
+      g_strlcat(req, v, sizeof(req));
+      first=0;
+      l = g_list_next(l);
+    }
+    g_strlcat(req, ")", sizeof(req));
+  }
+
+  /* add the history items to stack offest */
+  DT_DEBUG_SQLITE3_PREPARE_V2(dt_database_get(darktable.db), req, -1, &stmt, NULL);
+  DT_DEBUG_SQLITE3_BIND_INT(stmt, 1, imgid);
+  sqlite3_step (stmt);
+  sqlite3_finalize (stmt);
+
+  /* same as _dt_history_cleanup_multi_instance(), for all images */
+  if (merge && ops)
+    DT_DEBUG_SQLITE3_EXEC(dt_database_get(darktable.db),
+                          "update history set multi_priority=(select COUNT(0)-1 from history hst2 where hst2.num<=history.num and hst2.num>=(select offs from memory.bulk_images b where b.imgid=history.imgid) and hst2.operation=history.operation and hst2.imgid=history.imgid) "
+                          "where imgid in (select imgid from memory.bulk_images) and num>=(select offs from memory.bulk_images b where b.imgid=history.imgid)", NULL, NULL, NULL);
+
+  //we have to copy masks too, see dt_history_copy_and_paste_on_image()
+  if (!merge)
+    DT_DEBUG_SQLITE3_EXEC(dt_database_get(darktable.db),
+                          "delete from mask where imgid in (select imgid from memory.bulk_images)", NULL, NULL, NULL);
+
+  DT_DEBUG_SQLITE3_PREPARE_V2(dt_database_get(darktable.db), "insert into mask (imgid, formid, form, name, version, points, points_count, source) select b.imgid, m.formid, m.form, m.name, m.version, m.points, m.points_count, m.source from memory.bulk_images b, mask m where m.imgid = ?1", -1, &stmt, NULL);
+  DT_DEBUG_SQLITE3_BIND_INT(stmt, 1, imgid);
+  sqlite3_step (stmt);
+  sqlite3_finalize (stmt);
+
+  sqlite3_exec(dt_database_get(darktable.db), "COMMIT", NULL, NULL, NULL);
+
+  dt_history_update_images(dest_imgids);
+
+  return 0;
+}
+
 GList *
 dt_history_get_items(int32_t imgid, gboolean enabled)
 {
@@ -324,26 +458,17 @@ dt_history_copy_and_paste_on_selection (int32_t imgid, gboolean merge, GList *op
 {
   if (imgid < 0) return 1;
 
-  int res=0;
+  GList *imgs = NULL;
   sqlite3_stmt *stmt;
-  DT_DEBUG_SQLITE3_PREPARE_V2(dt_database_get(darktable.db), "select * from selected_images where imgid != ?1", -1, &stmt, NULL);
+  DT_DEBUG_SQLITE3_PREPARE_V2(dt_database_get(darktable.db), "select imgid from selected_images where imgid != ?1", -1, &stmt, NULL);
   DT_DEBUG_SQLITE3_BIND_INT(stmt, 1, imgid);
-  if (sqlite3_step(stmt) == SQLITE_ROW)
-  {
-    do
-    {
-      /* get imgid of selected image */
-      int32_t dest_imgid = sqlite3_column_int (stmt, 0);
-
-      /* paste history stack onto image id */
-      dt_history_copy_and_paste_on_image(imgid,dest_imgid,merge,ops);
-
-    }
-    while (sqlite3_step (stmt) == SQLITE_ROW);
-  }
-  else res = 1;
-
+  while (sqlite3_step(stmt) == SQLITE_ROW)
+    imgs = g_list_prepend(imgs, GINT_TO_POINTER(sqlite3_column_int(stmt, 0)));
   sqlite3_finalize(stmt);
+
+  /* paste history stack onto all of them at once */
+  const int res = imgs ? dt_history_copy_and_paste_on_images(imgid, imgs, merge, ops) : 1;
+  g_list_free(imgs);
   return res;
 }
 
@@ -27,6 +27,9 @@ int dt_history_copy_and_paste_on_image(int32_t imgid, int32_t dest_imgid, gboole
 
 void dt_history_delete_on_image(int32_t imgid);
 
+/** copy history from imgid and pasts on the given images in one transaction, merge or overwrite... */
+int dt_history_copy_and_paste_on_images(int32_t imgid, GList *dest_imgids, gboolean merge, GList *ops);
+
 /** copy history from imgid and pasts on selected images, merge or overwrite... */
 int dt_history_copy_and_paste_on_selection(int32_t imgid, gboolean merge,GList *ops);
 
@@ -39,6 +42,14 @@ int dt_history_load_and_apply(int imgid, gchar *filename, int history_only);
 /** delete historystack of selected images */
 void dt_history_delete_on_selection();
 
+/** fills memory.bulk_images with the images (but skip_imgid) and the offset of new items on
+    their history stacks, for set-based updates of several images. returns the number of images. */
+int dt_history_fill_bulk_images(GList *imgs, int32_t skip_imgid);
+
+/** reloads the darkroom, drops the thumbnails and writes the sidecar files in the background after
+    the history of the images was changed in the database */
+void dt_history_update_images(GList *imgs);
+
 typedef struct dt_history_item_t
 {
   guint num;
@@ -27,6 +27,7 @@
 #include "common/mipmap_cache.h"
 #include "common/tags.h"
 #include "common/history.h"
+#include "common/sidecar.h"
 #include "control/control.h"
 #include "control/conf.h"
 #include "control/jobs.h"
@@ -153,6 +154,9 @@ gboolean dt_image_safe_remove(const int32_t imgid)
   // always safe to remove if we do not have .xmp
   if(!dt_conf_get_bool("write_sidecar_files")) return TRUE;
 
+  // the .xmp of the local copy may still be on its way
+  dt_sidecar_flush(darktable.sidecar);
+
   // check whether the original file is accessible
   char pathname[PATH_MAX];
   gboolean from_cache = TRUE;
@@ -482,6 +486,9 @@ void dt_image_remove(const int32_t imgid)
   if (dt_image_local_copy_reset(imgid))
     return;
 
+  // don't write the xmp of an image that is gone
+  dt_sidecar_cancel(darktable.sidecar, imgid);
+
   sqlite3_stmt *stmt;
   const dt_image_t *img = dt_image_cache_read_get(darktable.image_cache, imgid);
   int old_group_id = img->group_id;
@@ -526,6 +533,7 @@ void dt_image_remove(const int32_t imgid)
   sqlite3_finalize(stmt);
   // also clear all thumbnails in mipmap_cache.
   dt_mipmap_cache_remove(darktable.mipmap_cache, imgid);
+  dt_mipmap_cache_remove_stored(imgid);
 }
 
 int dt_image_altered(const uint32_t imgid)
@@ -966,6 +974,9 @@ int32_t dt_image_move(const int32_t imgid, const int32_t filmid)
                                 "where id = ?1) and film_id in (select film_id from images where id = ?1)",
                                 -1, &duplicates_stmt, NULL);
 
+    // pending xmp writes would go to the old place
+    dt_sidecar_flush(darktable.sidecar);
+
     // move image
     GFile *old, *new;
     old = g_file_new_for_path(oldimg);
@@ -1339,14 +1350,23 @@ int dt_image_local_copy_reset(const int32_t imgid)
 // *******************************************************
 
 void dt_image_write_sidecar_file(int imgid)
+{
+  // queued, so a burst of changes to an image ends up as one write off the gui thread
+  if(imgid > 0 && dt_conf_get_bool("write_sidecar_files"))
+    dt_sidecar_write(darktable.sidecar, imgid);
+}
+
+void dt_image_write_sidecar_file_sync(int imgid)
 {
   // TODO: compute hash and don't write if not needed!
   // write .xmp file
   if(imgid > 0 && dt_conf_get_bool("write_sidecar_files"))
   {
     gboolean from_cache = TRUE;
-    char filename[PATH_MAX];
+    char filename[PATH_MAX] = { 0 };
     dt_image_full_path(imgid, filename, sizeof(filename), &from_cache);
+    // the image may have been removed meanwhile
+    if(!filename[0]) return;
     dt_image_path_append_version(imgid, filename, sizeof(filename));
     g_strlcat(filename, ".xmp", sizeof(filename));
     if(!dt_exif_xmp_write(imgid, filename))
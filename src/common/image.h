@@ -65,7 +65,9 @@ typedef enum
   // image has an associated .txt file for overlay
   DT_IMAGE_HAS_TXT = 4096,
   // image has an associated wav file
-  DT_IMAGE_HAS_WAV = 8192
+  DT_IMAGE_HAS_WAV = 8192,
+  // raw which can't be binned while decoding (x-trans, sraw, ...), so mip_f comes from the full image
+  DT_IMAGE_NO_BINNING = 16384
 }
 dt_image_flags_t;
 
@@ -270,7 +272,10 @@ gboolean dt_image_safe_remove(const int32_t imgid);
 /* try to sync .xmp for all local copies */
 void dt_image_local_copy_synch(void);
 // xmp functions:
+/** writes the xmp file of the image in the background, see common/sidecar.h */
 void dt_image_write_sidecar_file(int imgid);
+/** writes the xmp file of the image right away */
+void dt_image_write_sidecar_file_sync(int imgid);
 void dt_image_synch_xmp(const int selected);
 void dt_image_synch_all_xmp(const gchar *pathname);
 
@@ -21,6 +21,7 @@
 #include <stdlib.h>
 #include <math.h>
 #include <string.h>
+#include <emmintrin.h>
 
 typedef union
 {
@@ -29,122 +30,262 @@ typedef union
 }
 dt_image_float_int_t;
 
-void dt_image_uncompress(const uint8_t *in, float *out, const int32_t width, const int32_t height)
+// round to nearest even, overflows go to inf, nan stays nan.
+static inline uint16_t
+_float_to_half(const float f)
+{
+  dt_image_float_int_t v = { .f = f };
+  const uint32_t sign = v.i & 0x80000000u;
+  v.i ^= sign;
+  uint16_t h;
+  if(v.i >= (127u + 16u) << 23)
+  {
+    h = v.i > 0x7f800000u ? 0x7e00 : 0x7c00;
+  }
+  else if(v.i < 113u << 23)
+  {
+    // denormals: let the fpu do the rounding
+    const dt_image_float_int_t magic = { .i = ((127u - 15u) + (23u - 10u) + 1u) << 23 };
+    v.f += magic.f;
+    h = v.i - magic.i;
+  }
+  else
+  {
+    const uint32_t mant_odd = (v.i >> 13) & 1;
+    v.i += ((uint32_t)(15 - 127) << 23) + 0xfff + mant_odd;
+    h = v.i >> 13;
+  }
+  return h | (sign >> 16);
+}
+
+static inline float
+_half_to_float(const uint16_t h)
+{
+  const dt_image_float_int_t magic = { .i = 113u << 23 };
+  const uint32_t shifted_exp = 0x7c00u << 13;
+  dt_image_float_int_t v = { .i = (uint32_t)(h & 0x7fff) << 13 };
+  const uint32_t exp = shifted_exp & v.i;
+  v.i += (127u - 15u) << 23;
+  if(exp == shifted_exp)
+  {
+    // inf and nan
+    v.i += (128u - 16u) << 23;
+  }
+  else if(exp == 0)
+  {
+    // denormals
+    v.i += 1u << 23;
+    v.f -= magic.f;
+  }
+  v.i |= (uint32_t)(h & 0x8000) << 16;
+  return v.f;
+}
+
+void dt_image_pack_half(const float *in, uint16_t *out, const size_t num)
+{
+#ifdef _OPENMP
+  #pragma omp parallel for schedule(static)
+#endif
+  for(size_t k=0; k<num; k++)
+    for(int c=0; c<3; c++) out[3*k+c] = _float_to_half(in[4*k+c]);
+}
+
+void dt_image_unpack_half(const uint16_t *in, float *out, const size_t num)
+{
+#ifdef _OPENMP
+  #pragma omp parallel for schedule(static)
+#endif
+  for(size_t k=0; k<num; k++)
+  {
+    for(int c=0; c<3; c++) out[4*k+c] = _half_to_float(in[3*k+c]);
+    out[4*k+3] = 0.0f;
+  }
+}
+
+// expand the 4-bit luma codes of a block to the 16 half float bit patterns and from there to
+// float. the half exponent is rebiased by adding (127-15)<<23 after moving it into place.
+static inline void
+_uncompress_luma(const uint8_t *block, __m128 L[4])
+{
+  const int Lbias = (block[0] >> 3) << 10;
+  const int n_zeroes = block[0] & 0x7;
+  const __m128i shift = _mm_cvtsi32_si128(14-n_zeroes-4+1);
+  const __m128i bias = _mm_set1_epi32(Lbias);
+  const __m128i rebias = _mm_set1_epi32((127-15) << 23);
+  for(int r=0; r<4; r++)
+  {
+    const uint8_t b0 = block[1+2*r], b1 = block[2+2*r];
+    __m128i l = _mm_set_epi32(b1 & 0xf, b1 >> 4, b0 & 0xf, b0 >> 4);
+    l = _mm_add_epi32(_mm_sll_epi32(l, shift), bias);
+    L[r] = _mm_castsi128_ps(_mm_add_epi32(_mm_slli_epi32(l, 13), rebias));
+  }
+}
+
+static inline void
+_uncompress_chroma(const uint8_t *block, float chrom[4][3])
 {
-  dt_image_float_int_t L[16];
-  float chrom[4][3];
-  const float fac[3] = {4., 2., 4.};
-  uint16_t L16[16];
-  int32_t n_zeroes, Lbias;
   uint8_t r[4], b[4];
-  const uint8_t *block = in;
+  r[0] =                              block[ 9] >> 1;
+  b[0] = ((block[ 9] & 0x01) << 6) | (block[10] >> 2);
+  r[1] = ((block[10] & 0x03) << 5) | (block[11] >> 3);
+  b[1] = ((block[11] & 0x07) << 4) | (block[12] >> 4);
+  r[2] = ((block[12] & 0x0f) << 3) | (block[13] >> 5);
+  b[2] = ((block[13] & 0x1f) << 2) | (block[14] >> 6);
+  r[3] = ((block[14] & 0x3f) << 1) | (block[15] >> 7);
+  b[3] =   block[15] & 0x7f;
+
+  // the luma weights are powers of two, folding them into the chroma is exact.
+  for(int q=0; q<4; q++)
+  {
+    chrom[q][0] = r[q]*(1./127.);
+    chrom[q][2] = b[q]*(1./127.);
+    chrom[q][1] = 1. - chrom[q][0] - chrom[q][2];
+    chrom[q][0] *= 4.0f;
+    chrom[q][1] *= 2.0f;
+    chrom[q][2] *= 4.0f;
+  }
+}
+
+// one block into 4 rows of 4 rgb pixels. a row is twelve floats, which are three vectors
+// pairing up the luma of pixels 0..3 with the chroma of the left (a) and right (b) quad.
+static inline void
+_uncompress_block(const uint8_t *block, float *out, const int32_t width)
+{
+  __m128 L[4];
+  float chrom[4][3];
+  _uncompress_luma(block, L);
+  _uncompress_chroma(block, chrom);
+  for(int r=0; r<4; r++)
+  {
+    const float *a = chrom[(r>>1)<<1], *b = chrom[((r>>1)<<1)|1];
+    const __m128 C0 = _mm_set_ps(a[0], a[2], a[1], a[0]);
+    const __m128 C1 = _mm_set_ps(b[1], b[0], a[2], a[1]);
+    const __m128 C2 = _mm_set_ps(b[2], b[1], b[0], b[2]);
+    const __m128 L0 = _mm_shuffle_ps(L[r], L[r], _MM_SHUFFLE(1, 0, 0, 0));
+    const __m128 L1 = _mm_shuffle_ps(L[r], L[r], _MM_SHUFFLE(2, 2, 1, 1));
+    const __m128 L2 = _mm_shuffle_ps(L[r], L[r], _MM_SHUFFLE(3, 3, 3, 2));
+    float *o = out + (size_t)3*width*r;
+    _mm_storeu_ps(o,   _mm_mul_ps(L0, C0));
+    _mm_storeu_ps(o+4, _mm_mul_ps(L1, C1));
+    _mm_storeu_ps(o+8, _mm_mul_ps(L2, C2));
+  }
+}
+
+void dt_image_uncompress(const uint8_t *in, float *out, const int32_t width, const int32_t height)
+{
+  const int32_t bw = (width+3)/4;
+#ifdef _OPENMP
+  #pragma omp parallel for schedule(static)
+#endif
   for(int j=0; j<height; j+=4)
   {
+    const uint8_t *block = in + (size_t)16*bw*(j/4);
     for(int i=0; i<width; i+=4)
     {
-      // luma
-      Lbias = (block[0] >> 3) << 10;
-      n_zeroes = block[0] & 0x7;
-      const int shift = 14-n_zeroes-4+1;
+      _uncompress_block(block, out + (size_t)3*(i + (size_t)width*j), width);
+      block += 16*sizeof(uint8_t);
+    }
+  }
+}
 
-      for(int k=0; k<8; k++)
-      {
-        L16[2*k  ] = ((int)(block[1+k]>> 4) << shift) + Lbias;
-        L16[2*k+1] = ((int)(block[1+k]&0xf) << shift) + Lbias;
-      }
-      for(int k=0; k<16; k++)
-      {
-        L[k].i  = (((int)(L16[k]) >> 10)-(15-127)) << (23);
-        L[k].i |= (L16[k] & 0x3ff)<<13;
-      }
-      // chroma
-      r[0] =                              block[ 9] >> 1;
-      b[0] = ((block[ 9] & 0x01) << 6) | (block[10] >> 2);
-      r[1] = ((block[10] & 0x03) << 5) | (block[11] >> 3);
-      b[1] = ((block[11] & 0x07) << 4) | (block[12] >> 4);
-      r[2] = ((block[12] & 0x0f) << 3) | (block[13] >> 5);
-      b[2] = ((block[13] & 0x1f) << 2) | (block[14] >> 6);
-      r[3] = ((block[14] & 0x3f) << 1) | (block[15] >> 7);
-      b[3] =   block[15] & 0x7f;
-
-      for(int q=0; q<4; q++)
+static inline void
+_compress_block(const float *in, uint8_t *block, const int32_t width)
+{
+  float L[16];
+  uint8_t r[4], b[4];
+  for(int q=0; q<4; q++)
+  {
+    float chrom[3] = {0,0,0};
+    for(int pj=0; pj<2; pj++)
+    {
+      for(int pi=0; pi<2; pi++)
       {
-        chrom[q][0] = r[q]*(1./127.);
-        chrom[q][2] = b[q]*(1./127.);
-        chrom[q][1] = 1. - chrom[q][0] - chrom[q][2];
+        const int io = (pi+((q&1)<<1)), jo = (pj+(q&2));
+        const float *p = in + (size_t)3*(io + (size_t)width*jo);
+        L[io+4*jo] = (p[0] + 2*p[1] + p[2])*.25f;
+        for(int k=0; k<3; k++) chrom[k] += L[io+4*jo]*p[k];
       }
-      for(int k=0; k<16; k++)
-        for(int c=0; c<3; c++)
-          out[3*(i + (k & 3) + width*(j + (k>>2))) + c] = L[k].f*fac[c]*chrom[((k>>3)<<1)|((k&3)>>1)][c];
-      block += 16*sizeof(uint8_t);
     }
+    const float norm = 1./(chrom[0] + 2*chrom[1] + chrom[2]);
+    r[q] = (int)(127.*(chrom[0]*norm));
+    b[q] = (int)(127.*(chrom[2]*norm));
   }
+
+  // luma to half floats without sign, the exponent clamped to [0,30]. 16 of those fit
+  // into two vectors of signed 16-bit integers.
+  const __m128i rebias = _mm_set1_epi32(127-15);
+  const __m128i emax = _mm_set1_epi32(30);
+  const __m128i mmask = _mm_set1_epi32(0x3ff);
+  __m128i L16[2];
+  for(int h=0; h<2; h++)
+  {
+    __m128i l32[2];
+    for(int k=0; k<2; k++)
+    {
+      const __m128i Li = _mm_castps_si128(_mm_loadu_ps(L + 8*h + 4*k));
+      __m128i e = _mm_sub_epi32(_mm_srli_epi32(Li, 23), rebias);
+      e = _mm_andnot_si128(_mm_cmplt_epi32(e, _mm_setzero_si128()), e);
+      const __m128i over = _mm_cmpgt_epi32(e, emax);
+      e = _mm_or_si128(_mm_and_si128(over, emax), _mm_andnot_si128(over, e));
+      l32[k] = _mm_or_si128(_mm_and_si128(_mm_srli_epi32(Li, 13), mmask), _mm_slli_epi32(e, 10));
+    }
+    L16[h] = _mm_packs_epi32(l32[0], l32[1]);
+  }
+
+  // horizontal minimum, rounded down to the exponent
+  __m128i m = _mm_min_epi16(L16[0], L16[1]);
+  m = _mm_min_epi16(m, _mm_shuffle_epi32(m, _MM_SHUFFLE(1, 0, 3, 2)));
+  m = _mm_min_epi16(m, _mm_shuffle_epi32(m, _MM_SHUFFLE(2, 3, 0, 1)));
+  m = _mm_min_epi16(m, _mm_shufflelo_epi16(m, _MM_SHUFFLE(2, 3, 0, 1)));
+  const int16_t Lmin = _mm_cvtsi128_si32(m) & ~0x3ff;
+  const __m128i vmin = _mm_set1_epi16(Lmin);
+  L16[0] = _mm_sub_epi16(L16[0], vmin);
+  L16[1] = _mm_sub_epi16(L16[1], vmin);
+  m = _mm_max_epi16(L16[0], L16[1]);
+  m = _mm_max_epi16(m, _mm_shuffle_epi32(m, _MM_SHUFFLE(1, 0, 3, 2)));
+  m = _mm_max_epi16(m, _mm_shuffle_epi32(m, _MM_SHUFFLE(2, 3, 0, 1)));
+  m = _mm_max_epi16(m, _mm_shufflelo_epi16(m, _MM_SHUFFLE(2, 3, 0, 1)));
+  const int16_t Lmax = _mm_cvtsi128_si32(m);
+
+  int n_zeroes = 0;
+  for(int k=1<<14; (k&Lmax)==0&&n_zeroes<7; k>>=1) n_zeroes++;
+  const int shift = 14-n_zeroes-4+1;
+  const int off = (1<<shift)>>1;
+
+  // quantise to 4 bits. the offset sum stays below 2^15 so the signed lanes cannot overflow.
+  const __m128i vshift = _mm_cvtsi32_si128(shift);
+  const __m128i voff = _mm_set1_epi16(off);
+  const __m128i vmax = _mm_set1_epi16(0xf);
+  int16_t q16[16];
+  for(int h=0; h<2; h++)
+    _mm_storeu_si128((__m128i *)(q16 + 8*h),
+                     _mm_min_epi16(_mm_srl_epi16(_mm_add_epi16(L16[h], voff), vshift), vmax));
+
+  // store luma
+  block[0] = ((Lmin>>10)<<3) | n_zeroes; // Lbias
+  for(int k=0; k<8; k++) block[k+1] = q16[2*k+1] | (q16[2*k]<<4);
+  // store chroma
+  block[ 9] = (r[0] << 1) | (b[0] >> 6);
+  block[10] = (b[0] << 2) | (r[1] >> 5);
+  block[11] = (r[1] << 3) | (b[1] >> 4);
+  block[12] = (b[1] << 4) | (r[2] >> 3);
+  block[13] = (r[2] << 5) | (b[2] >> 2);
+  block[14] = (b[2] << 6) | (r[3] >> 1);
+  block[15] = (r[3] << 7) | (b[3] >> 0);
 }
 
 void dt_image_compress(const float *in, uint8_t *out, const int32_t width, const int32_t height)
 {
-  dt_image_float_int_t L[16];
-  int16_t Lmin, Lmax, n_zeroes, L16[16];
-  uint8_t *block = out, r[4], b[4];
+  const int32_t bw = (width+3)/4;
+#ifdef _OPENMP
+  #pragma omp parallel for schedule(static)
+#endif
   for(int j=0; j<height; j+=4)
   {
+    uint8_t *block = out + (size_t)16*bw*(j/4);
     for(int i=0; i<width; i+=4)
     {
-      Lmin = 0x7fff;
-      for(int q=0; q<4; q++)
-      {
-        float chrom[3] = {0,0,0};
-        for(int pj=0; pj<2; pj++)
-        {
-          for(int pi=0; pi<2; pi++)
-          {
-            const int io = (pi+((q&1)<<1)), jo = (pj+(q&2));
-            const int ii = i + io, jj = j + jo;
-
-            L[io+4*jo].f = (in[3*(ii+width*jj) + 0] + 2*in[3*(ii+width*jj) +1] + in[3*(ii+width*jj) +2])*.25;
-            for(int k=0; k<3; k++) chrom[k] += L[io+4*jo].f*in[3*(ii+width*jj) + k];
-            L16[io+4*jo]  =  (L[io+4*jo].i>>13)&0x3ff;
-            int e = ((L[io+4*jo].i >> (23))-(127-15));
-            e = e > 0 ? e : 0;
-            e = e > 30 ? 30 : e;
-            L16[io+4*jo] |= e<<10;
-            Lmin = Lmin < L16[io+4*jo] ? Lmin : L16[io+4*jo];
-          }
-        }
-        const float norm = 1./(chrom[0] + 2*chrom[1] + chrom[2]);
-        r[q] = (int)(127.*(chrom[0]*norm));
-        b[q] = (int)(127.*(chrom[2]*norm));
-      }
-      // store luma
-      Lmin &= ~0x3ff;
-      block[0] = (Lmin>>10)<<3; // Lbias
-      Lmax = 0;
-      for(int k=0; k<16; k++)
-      {
-        L16[k] -= Lmin;
-        Lmax = Lmax > L16[k] ? Lmax : L16[k];
-      }
-      n_zeroes = 0;
-      for(int k=1<<14; (k&Lmax)==0&&n_zeroes<7; k>>=1) n_zeroes++;
-      block[0] |= n_zeroes;
-      const int shift = 14-n_zeroes-4+1;
-      const int off = (1<<shift)>>1;
-      for(int k=0; k<8; k++)
-      {
-        L16[2*k] = ((int)L16[2*k] + off)>>shift;
-        L16[2*k] = L16[2*k] > 0xf ? 0xf : L16[2*k];
-        L16[2*k+1] = ((int)L16[2*k+1] + off)>>shift;
-        L16[2*k+1] = L16[2*k+1] > 0xf ? 0xf : L16[2*k+1];
-        block[k+1] = L16[2*k+1] | (L16[2*k]<<4);
-      }
-      // store chroma
-      block[ 9] = (r[0] << 1) | (b[0] >> 6);
-      block[10] = (b[0] << 2) | (r[1] >> 5);
-      block[11] = (r[1] << 3) | (b[1] >> 4);
-      block[12] = (b[1] << 4) | (r[2] >> 3);
-      block[13] = (r[2] << 5) | (b[2] >> 2);
-      block[14] = (b[2] << 6) | (r[3] >> 1);
-      block[15] = (r[3] << 7) | (b[3] >> 0);
+      _compress_block(in + (size_t)3*(i + (size_t)width*j), block, width);
       block += 16*sizeof(uint8_t);
     }
   }
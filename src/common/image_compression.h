@@ -17,11 +17,19 @@
 */
 #ifndef DT_IMAGE_COMPRESSION
 #include <inttypes.h>
+#include <stddef.h>
 
-/** K. Roimela, T. Aarnio and J. Itäranta. High Dynamic Range Texture Compression. Proceedings of SIGGRAPH 2006. */
+/** K. Roimela, T. Aarnio and J. Itäranta. High Dynamic Range Texture Compression. Proceedings of SIGGRAPH 2006.
+ *  3-channel float buffers to 16 byte 4x4 blocks and back, width and height need to be multiples of 4.
+ *  tools/compression/compression-bench measures speed and round trip quality against dxt1. */
 void dt_image_compress(const float *in, uint8_t *out, const int32_t width, const int32_t height);
 void dt_image_uncompress(const uint8_t *in, float *out, const int32_t width, const int32_t height);
 
+/** store num float4 pixels as three half floats each, the fourth channel is dropped. */
+void dt_image_pack_half(const float *in, uint16_t *out, const size_t num);
+/** inverse of dt_image_pack_half, the fourth channel is set to zero. */
+void dt_image_unpack_half(const uint16_t *in, float *out, const size_t num);
+
 #endif
 // modelines: These editor modelines have been set for all relevant files by tools/update_modelines.sh
 // vim: shiftwidth=2 expandtab tabstop=2 cindent
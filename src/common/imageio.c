@@ -47,6 +47,7 @@
 #include "develop/develop.h"
 #include "develop/imageop.h"
 #include "develop/blend.h"
+#include "develop/tiling.h"
 #include "libraw/libraw.h"
 
 #include <inttypes.h>
@@ -592,12 +593,102 @@ int dt_imageio_export(
 {
   if (strcmp(format->mime(format_params),"x-copy")==0)
     /* This is a just a copy, skip process and just export */
-    return format->write_image(format_params, filename, NULL, NULL, 0, imgid);
+    return format->write_image(format_params, filename, NULL, NULL, 0, NULL, imgid);
   else
     return dt_imageio_export_with_flags(imgid, filename, format, format_params,
                                         0, 0, high_quality, 0, NULL,copy_metadata,storage,storage_params);
 }
 
+/* state of a streaming export: the pipe is run over horizontal strips of the
+ * output, which are converted to the format's precision and handed out as rows.
+ * every strip is processed with the modules' overlap above and below it, which
+ * is cropped again, so neighbourhood filters don't leave seams. */
+typedef struct dt_imageio_export_stream_t
+{
+  dt_dev_pixelpipe_t *pipe;
+  dt_develop_t *dev;
+  int width, height, bpp;
+  double scale;
+  int strip_rows, overlap;
+  // currently processed strip, starting at buf inside pipe.backbuf
+  int y0, rows;
+  const uint8_t *buf;
+}
+dt_imageio_export_stream_t;
+
+static void
+_export_stream_process(dt_imageio_export_stream_t *s, const int y0)
+{
+  const int rows = MIN(s->strip_rows, s->height - y0);
+  const size_t npix = (size_t)s->width*rows;
+  const int py0 = MAX(0, y0 - s->overlap);
+  const int prows = MIN(s->height, y0 + rows + s->overlap) - py0;
+  // first pixel of the strip inside the padded one
+  const size_t off = (size_t)s->width*(y0 - py0);
+  s->buf = NULL;
+  if(s->bpp == 8)
+  {
+    dt_dev_pixelpipe_process(s->pipe, s->dev, 0, py0, s->width, prows, s->scale);
+    if(!s->pipe->backbuf) return;
+    uint8_t *const buf8 = (uint8_t *)s->pipe->backbuf + 4*off;
+#ifdef _OPENMP
+    #pragma omp parallel for schedule(static)
+#endif
+    // flip byte order
+    for(size_t k=0; k<npix; k++)
+    {
+      uint8_t tmp = buf8[4*k+0];
+      buf8[4*k+0] = buf8[4*k+2];
+      buf8[4*k+2] = tmp;
+    }
+    s->buf = buf8;
+  }
+  else
+  {
+    dt_dev_pixelpipe_process_no_gamma(s->pipe, s->dev, 0, py0, s->width, prows, s->scale);
+    if(!s->pipe->backbuf) return;
+    const float *const buff = (const float *)s->pipe->backbuf + 4*off;
+    if(s->bpp == 16)
+    {
+      // convert in place to the start of the buffer, has to run in order
+      uint16_t *const buf16 = (uint16_t *)s->pipe->backbuf;
+      for(size_t k=0; k<npix; k++)
+        for(int i=0; i<3; i++) buf16[4*k+i] = CLAMP(buff[4*k+i]*0x10000, 0, 0xffff);
+      s->buf = (const uint8_t *)buf16;
+    }
+    else
+      s->buf = (const uint8_t *)buff;
+  }
+  s->y0 = y0;
+  s->rows = rows;
+}
+
+static const void *
+_export_stream_rows(dt_imageio_module_row_source_t *source, const int y, const int num, void *scratch)
+{
+  dt_imageio_export_stream_t *s = (dt_imageio_export_stream_t *)source->data;
+  if(y < 0 || y + num > s->height) return NULL;
+
+  // rows come in order, so a new strip always starts at the first requested row
+  if(!s->buf || y < s->y0 || y >= s->y0 + s->rows) _export_stream_process(s, y);
+  if(!s->buf) return NULL;
+  if(y + num <= s->y0 + s->rows)
+    return s->buf + source->stride*(y - s->y0);
+
+  // the range spans strips, collect it in the caller's buffer
+  uint8_t *out = (uint8_t *)scratch;
+  for(int row = y; row < y + num;)
+  {
+    if(row >= s->y0 + s->rows) _export_stream_process(s, row);
+    if(!s->buf) return NULL;
+    const int cnt = MIN(s->y0 + s->rows, y + num) - row;
+    memcpy(out, s->buf + source->stride*(row - s->y0), source->stride*cnt);
+    out += source->stride*cnt;
+    row += cnt;
+  }
+  return scratch;
+}
+
 // internal function: to avoid exif blob reading + 8-bit byteorder flag + high-quality override
 int dt_imageio_export_with_flags(
   const uint32_t              imgid,
@@ -616,6 +707,7 @@ int dt_imageio_export_with_flags(
   dt_develop_t dev;
   dt_dev_init(&dev, 0);
   dt_mipmap_buffer_t buf;
+  // low quality thumbnails start from mip_f, which for raws is binned right while decoding
   if(thumbnail_export && dt_conf_get_bool("plugins/lighttable/low_quality_thumbnails"))
     dt_mipmap_cache_read_get(darktable.mipmap_cache, &buf, imgid, DT_MIPMAP_F, DT_MIPMAP_BLOCKING);
   else
@@ -629,8 +721,21 @@ int dt_imageio_export_with_flags(
 
   dt_times_t start;
   dt_get_times(&start);
+  /* images which would not fit into host memory as a whole (input, output and
+   * one intermediate buffer) are exported in strips, if the format can take
+   * its rows incrementally. the pipe cache then only needs to hold a strip. */
+  gboolean streaming = !thumbnail_export && !display_byteorder && format->write_image_rows
+                             && !dt_tiling_piece_fits_host_memory(wd, ht, 4*sizeof(float), 3.0f, 0);
+  int strip_rows = ht;
+  if(streaming)
+  {
+    // an eighth of the host memory limit per strip buffer leaves room for tiling inside the pipe
+    const size_t limit = (size_t)MAX(dt_conf_get_int("host_memory_limit"), 500) * 1024 * 1024;
+    strip_rows = CLAMP(limit / (8 * 4*sizeof(float) * (size_t)MAX(wd, 1)), 64, MAX(ht, 1));
+  }
+
   dt_dev_pixelpipe_t pipe;
-  res = thumbnail_export ? dt_dev_pixelpipe_init_thumbnail(&pipe, wd, ht) : dt_dev_pixelpipe_init_export(&pipe, wd, ht, format->levels(format_params));
+  res = thumbnail_export ? dt_dev_pixelpipe_init_thumbnail(&pipe, wd, ht) : dt_dev_pixelpipe_init_export(&pipe, wd, strip_rows, format->levels(format_params));
   if(!res)
   {
     dt_control_log(_("failed to allocate memory for %s, please lower the threads used for export or buy more memory."), thumbnail_export ? C_("noun", "thumbnail export") : C_("noun", "export"));
@@ -715,6 +820,18 @@ int dt_imageio_export_with_flags(
     if(!strncmp(filter, "post:", 5))
       dt_dev_pixelpipe_disable_before(&pipe, filter+5);
   }
+  // strips need the modules' overlap around them. for modules which can't be run
+  // on parts of the image at all, use the full buffer export like tiling does.
+  int strip_overlap = 0;
+  if(streaming)
+  {
+    strip_overlap = dt_dev_pixelpipe_region_overlap(&pipe, &dev, 1.0f);
+    if(strip_overlap < 0)
+    {
+      dt_print(DT_DEBUG_DEV, "[export] image %d has modules which can't be processed in strips, exporting in one go\n", imgid);
+      streaming = FALSE;
+    }
+  }
   dt_show_times(&start, "[export] creating pixelpipe", NULL);
 
   // find output color profile for this image:
@@ -747,8 +864,9 @@ int dt_imageio_export_with_flags(
   g_free(overprofile);
 
   // get only once at the beginning, in case the user changes it on the way:
+  // high quality downsampling needs the full size result in memory, streaming exports go without.
   const gboolean high_quality_processing = ((format_params->max_width  == 0 || format_params->max_width  >= pipe.processed_width ) &&
-      (format_params->max_height == 0 || format_params->max_height >= pipe.processed_height)) ? FALSE :
+      (format_params->max_height == 0 || format_params->max_height >= pipe.processed_height)) || streaming ? FALSE :
       high_quality;
   const int width  = high_quality_processing ? 0 : format_params->max_width;
   const int height = high_quality_processing ? 0 : format_params->max_height;
@@ -762,8 +880,13 @@ int dt_imageio_export_with_flags(
   // downsampling done last, if high quality processing was requested:
   uint8_t *outbuf = pipe.backbuf;
   uint8_t *moutbuf = NULL; // keep track of alloc'ed memory
+  dt_imageio_export_stream_t stream = { &pipe, &dev, processed_width, processed_height, bpp, scale, strip_rows, strip_overlap, 0, 0, NULL };
   dt_get_times(&start);
-  if(high_quality_processing)
+  if(streaming)
+  {
+    // the format pulls the strips while writing, see below
+  }
+  else if(high_quality_processing)
   {
     dt_dev_pixelpipe_process_no_gamma(&pipe, &dev, 0, 0, processed_width, processed_height, scale);
     const double scalex = format_params->max_width  > 0 ? fminf(format_params->max_width /(double)pipe.processed_width,  1.0) : 1.0;
@@ -796,7 +919,11 @@ int dt_imageio_export_with_flags(
   dt_show_times(&start, thumbnail_export ? "[dev_process_thumbnail] pixel pipeline processing" : "[dev_process_export] pixel pipeline processing", NULL);
 
   // downconversion to low-precision formats:
-  if(bpp == 8)
+  if(streaming)
+  {
+    // done strip by strip
+  }
+  else if(bpp == 8)
   {
     if(display_byteorder)
     {
@@ -866,6 +993,23 @@ int dt_imageio_export_with_flags(
   format_params->width  = processed_width;
   format_params->height = processed_height;
 
+  /* formats which can embed the xmp packet get it right away, so the file is
+   * written only once instead of being rewritten by exiv2 afterwards. */
+  char *xmp = NULL;
+  // dummy formats for thumbnails don't provide flags, and don't copy metadata either
+  const int format_flags = copy_metadata ? format->flags(format_params) : 0;
+  if(copy_metadata && (format_flags & FORMAT_FLAGS_SUPPORT_XMP) && (format_flags & FORMAT_FLAGS_EMBED_XMP))
+    xmp = dt_exif_xmp_read_string(imgid);
+
+  dt_imageio_module_row_source_t source;
+  if(streaming)
+  {
+    source.rows = _export_stream_rows;
+    source.stride = (size_t)4*bpp/8*processed_width;
+    source.buf = NULL;
+    source.data = &stream;
+  }
+
   if(!ignore_exif)
   {
     int length;
@@ -876,22 +1020,31 @@ int dt_imageio_export_with_flags(
     // last param is dng mode, it's false here
     length = dt_exif_read_blob(exif_profile, pathname, imgid, sRGB, processed_width, processed_height, 0);
 
-    res = format->write_image (format_params, filename, outbuf, exif_profile, length, imgid);
+    if(streaming)
+      res = format->write_image_rows (format_params, filename, &source, exif_profile, length, xmp, imgid);
+    else
+      res = format->write_image (format_params, filename, outbuf, exif_profile, length, xmp, imgid);
   }
   else
   {
-    res = format->write_image (format_params, filename, outbuf, NULL, 0, imgid);
+    if(streaming)
+      res = format->write_image_rows (format_params, filename, &source, NULL, 0, xmp, imgid);
+    else
+      res = format->write_image (format_params, filename, outbuf, NULL, 0, xmp, imgid);
   }
+  if(streaming)
+    dt_show_times(&start, "[dev_process_export] streaming pixel pipeline processing and writing", NULL);
 
   dt_dev_pixelpipe_cleanup(&pipe);
   dt_dev_cleanup(&dev);
   dt_mipmap_cache_read_release(darktable.mipmap_cache, &buf);
   dt_free_align(moutbuf);
-  /* now write xmp into that container, if possible */
-  if(copy_metadata && (format->flags(format_params) & FORMAT_FLAGS_SUPPORT_XMP)) {
+  /* now write xmp into that container, if possible and not done already */
+  if(copy_metadata && (format_flags & FORMAT_FLAGS_SUPPORT_XMP) && !xmp) {
     dt_exif_xmp_attach(imgid, filename);
     // no need to cancel the export if this fail
   }
+  g_free(xmp);
 
 
   if(!thumbnail_export && strcmp(format->mime(format_params), "memory"))
@@ -930,6 +1083,28 @@ dt_imageio_open_exotic(
 //   combined reading
 // =================================================
 
+dt_imageio_retval_t
+dt_imageio_open_downsampled(
+  dt_image_t  *img,
+  const char  *filename,
+  float       *buf,
+  uint32_t    *width,
+  uint32_t    *height)
+{
+  if(!g_file_test(filename, G_FILE_TEST_IS_REGULAR))
+    return !DT_IMAGEIO_OK;
+
+  // only raws can skip the full size buffer
+  if(dt_imageio_is_ldr(filename) || dt_imageio_is_hdr(filename))
+    return DT_IMAGEIO_FILE_CORRUPTED;
+
+#ifdef HAVE_RAWSPEED
+  return dt_imageio_open_rawspeed_downsampled(img, filename, buf, width, height);
+#else
+  return DT_IMAGEIO_FILE_CORRUPTED;
+#endif
+}
+
 dt_imageio_retval_t
 dt_imageio_open(
   dt_image_t  *img,               // non-const * means you hold a write lock!
@@ -50,6 +50,8 @@ dt_imageio_retval_t dt_imageio_open_raw(dt_image_t *img, const char *filename, d
 dt_imageio_retval_t dt_imageio_open_ldr(dt_image_t *img, const char *filename, dt_mipmap_cache_allocator_t a);
 // try both, first libraw.
 dt_imageio_retval_t dt_imageio_open(dt_image_t *img, const char *filename, dt_mipmap_cache_allocator_t a);
+// decode a raw straight to a demosaiced float4 buffer of at most *width x *height, as used for mip_f.
+dt_imageio_retval_t dt_imageio_open_downsampled(dt_image_t *img, const char *filename, float *buf, uint32_t *width, uint32_t *height);
 // tries to open the files not opened by the other routines using GraphicsMagick (if supported)
 dt_imageio_retval_t dt_imageio_open_exotic(dt_image_t *img, const char *filename, dt_mipmap_cache_allocator_t a);
 
@@ -60,6 +60,21 @@ _default_format_levels(dt_imageio_module_data_t *data)
 {
   return IMAGEIO_RGB | IMAGEIO_INT8;
 }
+static const void *
+_row_source_buffer_rows(dt_imageio_module_row_source_t *source, const int y, const int num, void *scratch)
+{
+  return (const uint8_t *)source->buf + source->stride*y;
+}
+
+void
+dt_imageio_module_row_source_buffer(dt_imageio_module_row_source_t *source, const void *buf, const size_t stride)
+{
+  source->rows = _row_source_buffer_rows;
+  source->stride = stride;
+  source->buf = buf;
+  source->data = NULL;
+}
+
 /** Default implementation of gui_init function (a NOP), used when no gui is existing. this is easier than checking for that case all over the place */
 static void _default_format_gui_init(struct dt_imageio_module_format_t *self){}
 
@@ -102,6 +117,7 @@ dt_imageio_load_module_format (dt_imageio_module_format_t *module, const char *l
   if(!g_module_symbol(module->module, "free_params",                  (gpointer)&(module->free_params)))                  goto error;
   if(!g_module_symbol(module->module, "set_params",                   (gpointer)&(module->set_params)))                   goto error;
   if(!g_module_symbol(module->module, "write_image",                  (gpointer)&(module->write_image)))                  goto error;
+  if(!g_module_symbol(module->module, "write_image_rows",             (gpointer)&(module->write_image_rows)))             module->write_image_rows = NULL;
   if(!g_module_symbol(module->module, "bpp",                          (gpointer)&(module->bpp)))                          goto error;
   if(!g_module_symbol(module->module, "flags",                        (gpointer)&(module->flags)))                        module->flags = _default_format_flags;
   if(!g_module_symbol(module->module, "levels",                       (gpointer)&(module->levels)))                       module->levels = _default_format_levels;
@@ -32,6 +32,8 @@
 
 /** Flag for the format modules */
 #define FORMAT_FLAGS_SUPPORT_XMP   1
+/** the format embeds the xmp packet passed to write_image() itself */
+#define FORMAT_FLAGS_EMBED_XMP     2
 
 /**
  * defines the plugin structure for image import and export.
@@ -54,6 +56,27 @@ typedef struct dt_imageio_module_data_t
 }
 dt_imageio_module_data_t;
 
+/*
+ * hands out processed rows to formats which can write their output
+ * incrementally. rows are requested top to bottom and come in the precision
+ * given by bpp(), with 4 channels per pixel (the fourth one is unused).
+ */
+typedef struct dt_imageio_module_row_source_t
+{
+  /* get rows [y, y+num), either in place or copied to scratch, which has to hold num rows.
+   * the returned pointer is valid until the next call, NULL on failure. */
+  const void* (*rows)(struct dt_imageio_module_row_source_t *source, const int y, const int num, void *scratch);
+  /* bytes per row of the returned buffer */
+  size_t stride;
+  /* private to the source */
+  const void *buf;
+  void *data;
+}
+dt_imageio_module_row_source_t;
+
+/** row source over a complete image in memory, as passed to write_image(). */
+void dt_imageio_module_row_source_buffer(dt_imageio_module_row_source_t *source, const void *buf, const size_t stride);
+
 struct dt_imageio_module_format_t;
 /* responsible for image encoding, such as jpg,png,etc */
 typedef struct dt_imageio_module_format_t
@@ -104,7 +127,9 @@ typedef struct dt_imageio_module_format_t
   /* bits per pixel and color channel we want to write: 8: char x3, 16: uint16_t x3, 32: float x3. */
   int (*bpp)(dt_imageio_module_data_t *data);
   /* write to file, with exif if not NULL, and icc profile if supported. */
-  int (*write_image)(dt_imageio_module_data_t *data, const char *filename, const void *in, void *exif, int exif_len, int imgid);
+  int (*write_image)(dt_imageio_module_data_t *data, const char *filename, const void *in, void *exif, int exif_len, const char *xmp, int imgid);
+  /* same as write_image, but pull the rows from source while encoding. optional, used to export images which don't fit into memory. */
+  int (*write_image_rows)(dt_imageio_module_data_t *data, const char *filename, dt_imageio_module_row_source_t *source, void *exif, int exif_len, const char *xmp, int imgid);
   /* flag that describes the available precision/levels of output format. mainly used for dithering. */
   int (*levels)(dt_imageio_module_data_t *data);
 
@@ -21,6 +21,12 @@
 #endif
 
 #include <memory>
+#if defined(__unix__) || defined(__APPLE__)
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
 
 #include "rawspeed/RawSpeed/StdAfx.h"
 #include "rawspeed/RawSpeed/FileReader.h"
@@ -55,6 +61,139 @@ using namespace RawSpeed;
 dt_imageio_retval_t dt_imageio_open_rawspeed_sraw(dt_image_t *img, RawImage r, dt_mipmap_cache_allocator_t a);
 static CameraMetaData *meta = NULL;
 
+/* memory mapped input file, unmapped when going out of scope */
+struct dt_rawspeed_mapping_t
+{
+  uchar8 *data;
+  size_t size;
+  dt_rawspeed_mapping_t() : data(NULL), size(0) {}
+  ~dt_rawspeed_mapping_t() { reset(); }
+  void reset()
+  {
+#if defined(__unix__) || defined(__APPLE__)
+    if(data) munmap(data, size);
+#endif
+    data = NULL;
+    size = 0;
+  }
+};
+
+#if defined(__unix__) || defined(__APPLE__)
+/* map the raw file instead of reading it into a heap copy. rawspeed's bit pumps
+ * may read up to 16 bytes past the end, so only map if those are still inside
+ * the last page of the file. returns NULL if the caller should fall back to FileReader. */
+static uchar8 *
+_rawspeed_map_file(const char *filename, size_t *size)
+{
+  int fd = open(filename, O_RDONLY);
+  if(fd < 0) return NULL;
+  struct stat st;
+  if(fstat(fd, &st) || st.st_size <= 0 || (uint64_t)st.st_size >= 0xffffffffu)
+  {
+    close(fd);
+    return NULL;
+  }
+  const size_t page = sysconf(_SC_PAGESIZE);
+  const size_t tail = (size_t)st.st_size % page;
+  if(tail == 0 || tail + 16 > page)
+  {
+    close(fd);
+    return NULL;
+  }
+  // private and writable, some parsers swap bytes in place
+  void *data = mmap(NULL, st.st_size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+  close(fd);
+  if(data == MAP_FAILED) return NULL;
+  madvise(data, st.st_size, MADV_WILLNEED);
+  *size = st.st_size;
+  return (uchar8 *)data;
+}
+#endif
+
+/* black and white point estimation of RawImageDataU16::scaleBlackWhite(), without
+ * touching the pixels. returns 0 if no scaling is needed. */
+static int
+_rawspeed_black_white(RawImage r)
+{
+  const int skipBorder = 250;
+  const int cpp = r->getCpp();
+  const int gw = (r->dim.x - skipBorder) * cpp;
+  if((r->blackAreas.empty() && r->blackLevelSeparate[0] < 0 && r->blackLevel < 0) || r->whitePoint >= 65536)
+  {
+    int b = 65536;
+    int m = 0;
+    for(int row = skipBorder*cpp; row < (r->dim.y - skipBorder); row++)
+    {
+      const uint16_t *pixel = (const uint16_t *)r->getData(skipBorder, row);
+      for(int col = skipBorder; col < gw; col++)
+      {
+        b = MIN(*pixel, b);
+        m = MAX(*pixel, m);
+        pixel++;
+      }
+    }
+    if(r->blackLevel < 0) r->blackLevel = b;
+    if(r->whitePoint >= 65536) r->whitePoint = m;
+  }
+
+  if((r->blackAreas.size() == 0 && r->blackLevel == 0 && r->whitePoint == 65535 && r->blackLevelSeparate[0] < 0) || r->dim.area() <= 0)
+    return 0;
+
+  if(r->blackLevelSeparate[0] < 0) r->calculateBlackAreas();
+  return 1;
+}
+
+/* scale to the full 16 bit range while copying the cropped sensor data into buf,
+ * instead of scaling the whole uncropped image in place and copying afterwards.
+ * same fixed point arithmetic and dither as rawspeed's scaleValues(). */
+static void
+_rawspeed_scale_copy_u16(RawImage r, uint16_t *const buf)
+{
+  const int cpp = r->getCpp();
+  const int width = r->dim.x;
+  const int height = r->dim.y;
+  const int gw = width * cpp;
+  const iPoint2D offset = r->getCropOffset();
+  const int dither = r->mDitherScale;
+
+  const float app_scale = 65535.0f / (r->whitePoint - r->blackLevelSeparate[0]);
+  const int full_scale_fp = (int)(app_scale * 4.0f);
+  const int half_scale_fp = (int)(app_scale * 4095.0f);
+
+  int mul[4], sub[4];
+  for(int i = 0; i < 4; i++)
+  {
+    int v = i;
+    if(offset.x & 1) v ^= 1;
+    if(offset.y & 1) v ^= 2;
+    mul[i] = (int)(16384.0f * 65535.0f / (float)(r->whitePoint - r->blackLevelSeparate[v]));
+    sub[i] = r->blackLevelSeparate[v];
+  }
+
+#ifdef _OPENMP
+  #pragma omp parallel for schedule(static)
+#endif
+  for(int y = 0; y < height; y++)
+  {
+    int v = width + y * 36969;
+    const uint16_t *in = (const uint16_t *)r->getData(0, y);
+    uint16_t *out = buf + (size_t)y * gw;
+    const int *mul_local = &mul[2*(y&1)];
+    const int *sub_local = &sub[2*(y&1)];
+    for(int x = 0; x < gw; x++)
+    {
+      int rand = 0;
+      if(dither)
+      {
+        v = 18000 * (v & 65535) + (v >> 16);
+        rand = half_scale_fp - (full_scale_fp * (v & 2047));
+      }
+      const int64_t o = ((int64_t)(in[x] - sub_local[x&1]) * mul_local[x&1] + 8192 + rand) >> 14;
+      out[x] = CLAMP(o, 0, 0xffff);
+    }
+  }
+}
+
 #if 0
 static void
 scale_black_white(uint16_t *const buf, const uint16_t black, const uint16_t white, const int width, const int height, const int stride)
@@ -75,15 +214,11 @@ scale_black_white(uint16_t *const buf, const uint16_t black, const uint16_t whit
 }
 #endif
 
-dt_imageio_retval_t
-dt_imageio_open_rawspeed(
-  dt_image_t  *img,
-  const char  *filename,
-  dt_mipmap_cache_allocator_t a)
+/* decode the raw file into r, including its metadata. returns 0 if no decoder
+ * could be found for it, throws on errors while decoding. */
+static int
+_rawspeed_decode(const char *filename, RawImage &r)
 {
-  if(!img->exif_inited)
-    (void) dt_exif_read(img, filename);
-
 #ifdef __WIN32__
   const size_t len = strlen(filename) + 1;
   wchar_t filen[len];
@@ -95,6 +230,9 @@ dt_imageio_open_rawspeed(
   FileReader f(filen);
 #endif
 
+  // released after d and m, which may point into it
+  dt_rawspeed_mapping_t mapping;
+
 #ifdef __APPLE__
   std::auto_ptr<RawDecoder> d;
   std::auto_ptr<FileMap> m;
@@ -103,48 +241,70 @@ dt_imageio_open_rawspeed(
   std::unique_ptr<FileMap> m;
 #endif
 
-  try
+  /* Load rawspeed cameras.xml meta file once */
+  if(meta == NULL)
   {
-    /* Load rawspeed cameras.xml meta file once */
+    dt_pthread_mutex_lock(&darktable.plugin_threadsafe);
     if(meta == NULL)
     {
-      dt_pthread_mutex_lock(&darktable.plugin_threadsafe);
-      if(meta == NULL)
-      {
-        char datadir[PATH_MAX], camfile[PATH_MAX];
-        dt_loc_get_datadir(datadir, sizeof(datadir));
-        snprintf(camfile, sizeof(camfile), "%s/rawspeed/cameras.xml", datadir);
-        // never cleaned up (only when dt closes)
-        meta = new CameraMetaData(camfile);
-      }
-      dt_pthread_mutex_unlock(&darktable.plugin_threadsafe);
+      char datadir[PATH_MAX], camfile[PATH_MAX];
+      dt_loc_get_datadir(datadir, sizeof(datadir));
+      snprintf(camfile, sizeof(camfile), "%s/rawspeed/cameras.xml", datadir);
+      // never cleaned up (only when dt closes)
+      meta = new CameraMetaData(camfile);
     }
+    dt_pthread_mutex_unlock(&darktable.plugin_threadsafe);
+  }
 
+#if defined(__unix__) || defined(__APPLE__)
+  mapping.data = _rawspeed_map_file(filename, &mapping.size);
+  if(mapping.data)
 #ifdef __APPLE__
-    m = auto_ptr<FileMap>(f.readFile());
+    m = auto_ptr<FileMap>(new FileMap(mapping.data, mapping.size));
 #else
-    m = unique_ptr<FileMap>(f.readFile());
+    m = unique_ptr<FileMap>(new FileMap(mapping.data, mapping.size));
+#endif
+  else
+#endif
+#ifdef __APPLE__
+  m = auto_ptr<FileMap>(f.readFile());
+#else
+  m = unique_ptr<FileMap>(f.readFile());
 #endif
 
-    RawParser t(m.get());
+  RawParser t(m.get());
 #ifdef __APPLE__
   d = auto_ptr<RawDecoder>(t.getDecoder());
 #else
-    d = unique_ptr<RawDecoder>(t.getDecoder());
+  d = unique_ptr<RawDecoder>(t.getDecoder());
 #endif
 
-    if(!d.get())
-      return DT_IMAGEIO_FILE_CORRUPTED;
+  if(!d.get())
+    return 0;
 
-    d->failOnUnknown = true;
-    d->checkSupport(meta);
-    d->decodeRaw();
-    d->decodeMetaData(meta);
-    RawImage r = d->mRaw;
+  d->failOnUnknown = true;
+  d->checkSupport(meta);
+  d->decodeRaw();
+  d->decodeMetaData(meta);
+  r = d->mRaw;
+  return 1;
+}
 
-    /* free auto pointers on spot */
-    d.reset();
-    m.reset();
+dt_imageio_retval_t
+dt_imageio_open_rawspeed(
+  dt_image_t  *img,
+  const char  *filename,
+  dt_mipmap_cache_allocator_t a)
+{
+  if(!img->exif_inited)
+    (void) dt_exif_read(img, filename);
+
+  try
+  {
+    // empty until decoded, RawImage can't be null
+    RawImage r = RawImage::create();
+    if(!_rawspeed_decode(filename, r))
+      return DT_IMAGEIO_FILE_CORRUPTED;
 
     img->filters = 0u;
     if( !r->isCFA )
@@ -153,9 +313,9 @@ dt_imageio_open_rawspeed(
       return ret;
     }
 
-    // only scale colors for sizeof(uint16_t) per pixel, not sizeof(float)
-    // if(r->getDataType() != TYPE_FLOAT32) scale_black_white((uint16_t *)r->getData(), r->blackLevel, r->whitePoint, r->dim.x, r->dim.y, r->pitch/r->getBpp());
-    if(r->getDataType() != TYPE_FLOAT32) r->scaleBlackWhite();
+    // only scale colors for sizeof(uint16_t) per pixel, not sizeof(float).
+    // the scaling itself happens while copying into the mipmap buffer below.
+    const int scale = (r->getDataType() != TYPE_FLOAT32) && _rawspeed_black_white(r);
     img->bpp = r->getBpp();
     img->filters = r->cfa.getDcrawFilter();
     if(img->filters)
@@ -166,6 +326,7 @@ dt_imageio_open_rawspeed(
       // special handling for x-trans sensors
       if (img->filters == 9u)
       {
+        img->flags |= DT_IMAGE_NO_BINNING;
         // get 6x6 CFA offset from top left of cropped image
         // NOTE: This is different from how things are done with Bayer
         // sensors. For these, the CFA in cameras.xml is pre-offset
@@ -192,7 +353,10 @@ dt_imageio_open_rawspeed(
     if(!buf)
       return DT_IMAGEIO_CACHE_FULL;
 
-    dt_imageio_flip_buffers((char *)buf, (char *)r->getData(), r->getBpp(), r->dim.x, r->dim.y, r->dim.x, r->dim.y, r->pitch, ORIENTATION_NONE);
+    if(scale)
+      _rawspeed_scale_copy_u16(r, (uint16_t *)buf);
+    else
+      dt_imageio_flip_buffers((char *)buf, (char *)r->getData(), r->getBpp(), r->dim.x, r->dim.y, r->dim.x, r->dim.y, r->pitch, ORIENTATION_NONE);
   }
   catch (const std::exception &exc)
   {
@@ -211,12 +375,170 @@ dt_imageio_open_rawspeed(
   return DT_IMAGEIO_OK;
 }
 
+static inline int
+_rawspeed_fc(const int row, const int col, const uint32_t filters)
+{
+  return filters >> (((row << 1 & 14) + (col & 1)) << 1) & 3;
+}
+
+/* bin 2x2 bayer blocks of the cropped sensor data into float4 rgb, like
+ * dt_iop_clip_and_zoom_demosaic_half_size() does on the scaled mipmap buffer.
+ * every sensor pixel is scaled by its black and white level and clipped to
+ * [0,1] before it is averaged, as in the full size path. */
+static void
+_rawspeed_bin_bayer_u16(RawImage r, const uint32_t filters, const int scale,
+                        float *const out, const int out_width, const int out_height)
+{
+  const int width = r->dim.x;
+  const int height = r->dim.y;
+  const iPoint2D offset = r->getCropOffset();
+  const float px_footprint = width / (float)out_width;
+
+  // move to an rggb block
+  int rggbx = 0, rggby = 0;
+  if(_rawspeed_fc(rggby, rggbx+1, filters) != 1) rggbx++;
+  if(_rawspeed_fc(rggby, rggbx, filters) != 0)
+  {
+    rggbx = (rggbx + 1)&1;
+    rggby++;
+  }
+
+  // black level and range of the four pixels of such a block, r g1 g2 b
+  float black[4], range[4];
+  int saturated = 0xffff;
+  for(int k = 0; k < 4; k++)
+  {
+    if(!scale)
+    {
+      black[k] = 0.0f;
+      range[k] = 65535.0f;
+      continue;
+    }
+    int v = ((rggbx + (k&1)) & 1) + 2*((rggby + (k>>1)) & 1);
+    if(offset.x & 1) v ^= 1;
+    if(offset.y & 1) v ^= 2;
+    black[k] = r->blackLevelSeparate[v];
+    range[k] = MAX(r->whitePoint - r->blackLevelSeparate[v], 1);
+    // same clipping threshold as for the scaled data
+    saturated = MIN(saturated, (int)(black[k] + range[k]*60000.0f/65535.0f));
+  }
+
+#ifdef _OPENMP
+  #pragma omp parallel for schedule(static)
+#endif
+  for(int y = 0; y < out_height; y++)
+  {
+    float *o = out + (size_t)4*out_width*y;
+    const int py = MIN((int)(y*px_footprint) & ~1, (height-4) & ~1) + rggby;
+    const int maxj = MAX(py, MIN(((height-3)&~1)+rggby, ((int)((y+1)*px_footprint) & ~1) + rggby - 2));
+    for(int x = 0; x < out_width; x++, o += 4)
+    {
+      const int px = MIN((int)(x*px_footprint) & ~1, (width-4) & ~1) + rggbx;
+      const int maxi = MAX(px, MIN(((width-3)&~1)+rggbx, ((int)((x+1)*px_footprint) & ~1) + rggbx - 2));
+
+      // as for the mipmaps, don't mix clipped and unclipped blocks
+      const uint16_t *c0 = (const uint16_t *)r->getData(px, py);
+      const uint16_t *c1 = (const uint16_t *)r->getData(px, py+1);
+      const int pc = MAX(MAX(c0[0], c0[1]), MAX(c1[0], c1[1])) >= saturated;
+
+      // every sensor pixel is scaled and clipped on its own, as the full size path does
+      float sum[4] = { 0.0f, 0.0f, 0.0f, 0.0f };
+      int num = 0;
+      for(int j = py; j <= maxj; j += 2)
+      {
+        const uint16_t *in0 = (const uint16_t *)r->getData(0, j);
+        const uint16_t *in1 = (const uint16_t *)r->getData(0, j+1);
+        for(int i = px; i <= maxi; i += 2)
+        {
+          const uint16_t p1 = in0[i], p2 = in0[i+1], p3 = in1[i], p4 = in1[i+1];
+          if(pc == (MAX(MAX(p1, p2), MAX(p3, p4)) >= saturated))
+          {
+            sum[0] += CLAMPS((p1 - black[0]) / range[0], 0.0f, 1.0f);
+            sum[1] += CLAMPS((p2 - black[1]) / range[1], 0.0f, 1.0f);
+            sum[2] += CLAMPS((p3 - black[2]) / range[2], 0.0f, 1.0f);
+            sum[3] += CLAMPS((p4 - black[3]) / range[3], 0.0f, 1.0f);
+            num++;
+          }
+        }
+      }
+      float v[4];
+      for(int k = 0; k < 4; k++) v[k] = sum[k] / num;
+      o[0] = v[0];
+      o[1] = 0.5f*(v[1] + v[2]);
+      o[2] = v[3];
+      o[3] = 0.0f;
+    }
+  }
+}
+
+dt_imageio_retval_t
+dt_imageio_open_rawspeed_downsampled(
+  dt_image_t  *img,
+  const char  *filename,
+  float       *buf,
+  uint32_t    *width,
+  uint32_t    *height)
+{
+  if(!img->exif_inited)
+    (void) dt_exif_read(img, filename);
+
+  try
+  {
+    RawImage r = RawImage::create();
+    if(!_rawspeed_decode(filename, r))
+      return DT_IMAGEIO_FILE_CORRUPTED;
+
+    // sraw, float and x-trans data go the usual way. remember that, so they aren't decoded twice again
+    const uint32_t filters = r->cfa.getDcrawFilter();
+    if(!r->isCFA || r->getCpp() != 1 || r->getDataType() == TYPE_FLOAT32 || !filters || filters == 9u)
+    {
+      img->flags |= DT_IMAGE_NO_BINNING;
+      return DT_IMAGEIO_FILE_CORRUPTED;
+    }
+    if(r->dim.x < 8 || r->dim.y < 8)
+      return DT_IMAGEIO_FILE_CORRUPTED;
+
+    const int scale = _rawspeed_black_white(r);
+
+    // the image struct gets the same as from a full load
+    img->bpp = r->getBpp();
+    img->filters = filters;
+    img->flags &= ~DT_IMAGE_LDR;
+    img->flags |= DT_IMAGE_RAW;
+    img->width  = r->dim.x;
+    img->height = r->dim.y;
+    img->raw_black_level = r->blackLevel;
+    img->raw_white_point = r->whitePoint;
+
+    // fit into the mip_f buffer as the full image would, but don't go beyond one pixel per 2x2 block
+    const float s = fminf(*width/(float)r->dim.x, *height/(float)r->dim.y);
+    const int out_width = MAX(1, MIN((int)(s*r->dim.x), r->dim.x/2));
+    const int out_height = MAX(1, MIN((int)(s*r->dim.y), r->dim.y/2));
+    _rawspeed_bin_bayer_u16(r, filters, scale, buf, out_width, out_height);
+    *width = out_width;
+    *height = out_height;
+  }
+  catch (const std::exception &exc)
+  {
+    printf("[rawspeed] %s\n", exc.what());
+    return DT_IMAGEIO_FILE_CORRUPTED;
+  }
+  catch (...)
+  {
+    printf("Unhandled exception in imageio_rawspeed\n");
+    return DT_IMAGEIO_FILE_CORRUPTED;
+  }
+
+  return DT_IMAGEIO_OK;
+}
+
 dt_imageio_retval_t
 dt_imageio_open_rawspeed_sraw(dt_image_t *img, RawImage r, dt_mipmap_cache_allocator_t a)
 {
   // sraw aren't real raw, but not ldr either (need white balance and stuff)
   img->flags &= ~DT_IMAGE_LDR;
   img->flags &= ~DT_IMAGE_RAW;
+  img->flags |= DT_IMAGE_NO_BINNING;
 
   img->width  = r->dim.x;
   img->height = r->dim.y;
@@ -27,6 +27,9 @@ extern "C"
 #include "common/mipmap_cache.h"
 
   dt_imageio_retval_t dt_imageio_open_rawspeed(dt_image_t *img, const char *filename, dt_mipmap_cache_allocator_t a);
+  /** decode the raw at a reduced size only, binned to float4 rgb of at most *width x *height pixels, for mip_f.
+   *  fills img as a full load would. fails for anything but bayer sensors with 16 bit data. */
+  dt_imageio_retval_t dt_imageio_open_rawspeed_downsampled(dt_image_t *img, const char *filename, float *buf, uint32_t *width, uint32_t *height);
 
 #ifdef __cplusplus
 }
@@ -26,6 +26,11 @@
 #include <inttypes.h>
 #include <glib.h>
 #include <assert.h>
+#include <string.h>
+#include <stdlib.h>
+#ifdef DT_HAVE_TARGET_AVX
+#include <immintrin.h>
+#endif
 
 /** Border extrapolation modes */
 enum border_mode
@@ -1269,6 +1274,267 @@ prepare_resampling_plan(
   return 0;
 }
 
+/* --------------------------------------------------------------------------
+ * Resampling plan cache
+ * ------------------------------------------------------------------------*/
+
+/* The darkroom resamples the very same regions over and over again (every
+ * parameter change reprocesses the preview and full pipes with unchanged
+ * rois), building the plans each time is a waste. Keep the most recently
+ * used 1D plans around, keyed by everything prepare_resampling_plan depends
+ * on. Plans in use by a resampler are pinned and never evicted. */
+#define RESAMPLING_PLAN_CACHE_SIZE 16
+
+typedef struct dt_resampling_plan_t
+{
+  // key
+  enum dt_interpolation_type itor;
+  int in;
+  int in_x0;
+  int out;
+  int out_x0;
+  float scale;
+  // plan, all arrays live in the single allocation pointed to by length
+  int* length;
+  float* kernel;
+  int* index;
+  int* meta;
+  int maxtaps;
+  // bookkeeping
+  int users;
+  int cached;
+  uint64_t last_used;
+}
+dt_resampling_plan_t;
+
+static dt_resampling_plan_t resampling_plan_cache[RESAMPLING_PLAN_CACHE_SIZE];
+static uint64_t resampling_plan_clock = 0;
+static dt_pthread_mutex_t resampling_plan_mutex;
+
+void
+dt_interpolation_init()
+{
+  memset(resampling_plan_cache, 0, sizeof(resampling_plan_cache));
+  resampling_plan_clock = 0;
+  dt_pthread_mutex_init(&resampling_plan_mutex, NULL);
+}
+
+void
+dt_interpolation_cleanup()
+{
+  for (int k=0; k<RESAMPLING_PLAN_CACHE_SIZE; k++)
+  {
+    dt_free_align(resampling_plan_cache[k].length);
+  }
+  memset(resampling_plan_cache, 0, sizeof(resampling_plan_cache));
+  dt_pthread_mutex_destroy(&resampling_plan_mutex);
+}
+
+static inline int
+resampling_plan_matches(
+  const dt_resampling_plan_t* p,
+  const struct dt_interpolation* itor,
+  int in,
+  int in_x0,
+  int out,
+  int out_x0,
+  float scale)
+{
+  return p->length && p->itor == itor->id && p->in == in && p->in_x0 == in_x0
+         && p->out == out && p->out_x0 == out_x0 && p->scale == scale;
+}
+
+/** Get a 1D resampling plan with meta information, from the cache if
+ * possible. The plan must be handed back with release_resampling_plan().
+ * @return the plan, or NULL when out of memory */
+static dt_resampling_plan_t*
+get_resampling_plan(
+  const struct dt_interpolation* itor,
+  int in,
+  const int in_x0,
+  int out,
+  const int out_x0,
+  float scale)
+{
+  dt_pthread_mutex_lock(&resampling_plan_mutex);
+  for (int k=0; k<RESAMPLING_PLAN_CACHE_SIZE; k++)
+  {
+    dt_resampling_plan_t* p = &resampling_plan_cache[k];
+    if (resampling_plan_matches(p, itor, in, in_x0, out, out_x0, scale))
+    {
+      p->users++;
+      p->last_used = ++resampling_plan_clock;
+      dt_pthread_mutex_unlock(&resampling_plan_mutex);
+      return p;
+    }
+  }
+  dt_pthread_mutex_unlock(&resampling_plan_mutex);
+
+  // Miss, build the plan outside of the lock
+  dt_resampling_plan_t plan;
+  memset(&plan, 0, sizeof(plan));
+  if (prepare_resampling_plan(itor, in, in_x0, out, out_x0, scale, &plan.length, &plan.kernel, &plan.index, &plan.meta)
+      || !plan.length)
+  {
+    return NULL;
+  }
+  plan.itor = itor->id;
+  plan.in = in;
+  plan.in_x0 = in_x0;
+  plan.out = out;
+  plan.out_x0 = out_x0;
+  plan.scale = scale;
+  plan.maxtaps = 0;
+  for (int k=0; k<out; k++)
+  {
+    plan.maxtaps = MAX(plan.maxtaps, plan.length[k]);
+  }
+  plan.users = 1;
+
+  dt_pthread_mutex_lock(&resampling_plan_mutex);
+  dt_resampling_plan_t* victim = NULL;
+  for (int k=0; k<RESAMPLING_PLAN_CACHE_SIZE; k++)
+  {
+    dt_resampling_plan_t* p = &resampling_plan_cache[k];
+    if (resampling_plan_matches(p, itor, in, in_x0, out, out_x0, scale))
+    {
+      // Somebody else was faster, use theirs
+      p->users++;
+      p->last_used = ++resampling_plan_clock;
+      dt_pthread_mutex_unlock(&resampling_plan_mutex);
+      dt_free_align(plan.length);
+      return p;
+    }
+    if (p->users == 0 && (!victim || !p->length || (victim->length && p->last_used < victim->last_used)))
+    {
+      victim = p;
+    }
+  }
+
+  if (victim)
+  {
+    dt_free_align(victim->length);
+    *victim = plan;
+    victim->cached = 1;
+    victim->last_used = ++resampling_plan_clock;
+    dt_pthread_mutex_unlock(&resampling_plan_mutex);
+    return victim;
+  }
+  dt_pthread_mutex_unlock(&resampling_plan_mutex);
+
+  // All slots pinned, hand out a private plan
+  dt_resampling_plan_t* p = (dt_resampling_plan_t*)malloc(sizeof(dt_resampling_plan_t));
+  if (!p)
+  {
+    dt_free_align(plan.length);
+    return NULL;
+  }
+  *p = plan;
+  p->cached = 0;
+  return p;
+}
+
+static void
+release_resampling_plan(
+  dt_resampling_plan_t* p)
+{
+  if (!p)
+  {
+    return;
+  }
+  if (!p->cached)
+  {
+    dt_free_align(p->length);
+    free(p);
+    return;
+  }
+  dt_pthread_mutex_lock(&resampling_plan_mutex);
+  p->users--;
+  dt_pthread_mutex_unlock(&resampling_plan_mutex);
+}
+
+/* --------------------------------------------------------------------------
+ * Separable resampling
+ * ------------------------------------------------------------------------*/
+
+/** Horizontally resample one input line into a line of out pixels */
+static inline void
+resample_line_horizontal(
+  const float* const i,
+  float* const o,
+  const int out,
+  const dt_resampling_plan_t* const h)
+{
+  int hkidx = 0;
+  int hiidx = 0;
+  for (int ox=0; ox<out; ox++)
+  {
+    const int hl = h->length[ox];
+    __m128 vhs = _mm_setzero_ps();
+    for (int ix=0; ix<hl; ix++)
+    {
+      // Apply the precomputed filter kernel
+      const size_t baseidx = (size_t)h->index[hiidx++]*4;
+      const __m128 vhtap = _mm_set_ps1(h->kernel[hkidx++]);
+      vhs = _mm_add_ps(vhs, _mm_mul_ps(_mm_load_ps(&i[baseidx]), vhtap));
+    }
+    _mm_store_ps(&o[4*ox], vhs);
+  }
+}
+
+/** Vertically combine vl horizontally resampled lines into output pixels
+ * [x0, x1) of one output line */
+static void
+resample_line_vertical_sse(
+  const float** const lines,
+  const float* const vkernel,
+  const int vl,
+  float* const o,
+  const int x0,
+  const int x1)
+{
+  for (int ox=x0; ox<x1; ox++)
+  {
+    __m128 vs = _mm_setzero_ps();
+    for (int iy=0; iy<vl; iy++)
+    {
+      const __m128 vvtap = _mm_set_ps1(vkernel[iy]);
+      vs = _mm_add_ps(vs, _mm_mul_ps(_mm_load_ps(&lines[iy][4*ox]), vvtap));
+    }
+    _mm_stream_ps(&o[4*ox], vs);
+  }
+}
+
+#ifdef DT_HAVE_TARGET_AVX
+/** Same as above, two pixels a time */
+__attribute__((target("avx")))
+static void
+resample_line_vertical_avx(
+  const float** const lines,
+  const float* const vkernel,
+  const int vl,
+  float* const o,
+  const int x0,
+  const int x1)
+{
+  int ox = x0;
+  for (; ox+2<=x1; ox+=2)
+  {
+    __m256 vs = _mm256_setzero_ps();
+    for (int iy=0; iy<vl; iy++)
+    {
+      const __m256 vvtap = _mm256_set1_ps(vkernel[iy]);
+      vs = _mm256_add_ps(vs, _mm256_mul_ps(_mm256_loadu_ps(&lines[iy][4*ox]), vvtap));
+    }
+    // Lines are only guaranteed to be 16 bytes aligned
+    _mm_stream_ps(&o[4*ox], _mm256_castps256_ps128(vs));
+    _mm_stream_ps(&o[4*ox+4], _mm256_extractf128_ps(vs, 1));
+  }
+  _mm256_zeroupper();
+  resample_line_vertical_sse(lines, vkernel, vl, o, ox, x1);
+}
+#endif
+
 void
 dt_interpolation_resample(
   const struct dt_interpolation* itor,
@@ -1279,15 +1545,10 @@ dt_interpolation_resample(
   const dt_iop_roi_t* const roi_in,
   const int32_t in_stride)
 {
-  int* hindex = NULL;
-  int* hlength = NULL;
-  float* hkernel = NULL;
-  int* vindex = NULL;
-  int* vlength = NULL;
-  float* vkernel = NULL;
-  int* vmeta = NULL;
-
-  int r;
+  dt_resampling_plan_t* hplan = NULL;
+  dt_resampling_plan_t* vplan = NULL;
+  float* ring = NULL;
+  int* ringtags = NULL;
 
   debug_info(
     "resampling %p (%dx%d@%dx%d scale %f) -> %p (%dx%d@%dx%d scale %f)\n",
@@ -1326,19 +1587,38 @@ dt_interpolation_resample(
   int64_t ts_plan = getts();
 #endif
 
-  // Prepare resampling plans once and for all
-  r = prepare_resampling_plan(itor, roi_in->width, roi_in->x, roi_out->width, roi_out->x, roi_out->scale, &hlength, &hkernel, &hindex, NULL);
-  if (r)
+  // Fetch the resampling plans, most of the time they are already cached
+  hplan = get_resampling_plan(itor, roi_in->width, roi_in->x, roi_out->width, roi_out->x, roi_out->scale);
+  vplan = get_resampling_plan(itor, roi_in->height, roi_in->y, roi_out->height, roi_out->y, roi_out->scale);
+  if (!hplan || !vplan)
   {
     goto exit;
   }
 
-  r = prepare_resampling_plan(itor, roi_in->height, roi_in->y, roi_out->height, roi_out->y, roi_out->scale, &vlength, &vkernel, &vindex, &vmeta);
-  if (r)
+  /* The filter is separable: each thread resamples the input lines it
+   * needs horizontally once into a ring of roi_out->width wide lines, output
+   * lines are then a vertical combination of vl ring lines. The vertical
+   * indexes of an output line form a contiguous range (border replication
+   * only repeats indexes) no longer than maxtaps, so a ring of maxtaps lines
+   * indexed by input line modulo maxtaps never evicts a line still needed
+   * for the current output line. The summation order is the same as the
+   * direct 2D kernel had. */
+  const int ringsize = vplan->maxtaps;
+  const size_t linefloats = (size_t)4*roi_out->width;
+  const size_t ringfloats = (ringsize*linefloats + 15) & ~(size_t)15;
+  const int nthreads = omp_get_max_threads();
+  ring = (float*)dt_alloc_align(64, sizeof(float)*ringfloats*nthreads);
+  ringtags = (int*)malloc(sizeof(int)*ringsize*nthreads);
+  if (!ring || !ringtags)
   {
     goto exit;
   }
 
+  int use_avx = 0;
+#ifdef DT_HAVE_TARGET_AVX
+  use_avx = (darktable.cpu_flags & DT_CPU_FLAG_AVX) != 0;
+#endif
+
 #if DEBUG_RESAMPLING_TIMING
   ts_plan = getts() - ts_plan;
 #endif
@@ -1347,78 +1627,58 @@ dt_interpolation_resample(
   int64_t ts_resampling = getts();
 #endif
 
-  // Process each output line
+  // Process each output line, static schedule keeps the lines of a thread
+  // adjacent so the ring is reused across output lines
 #ifdef _OPENMP
-  #pragma omp parallel for default(none) shared(out, hindex, hlength, hkernel, vindex, vlength, vkernel, vmeta)
+  #pragma omp parallel shared(out, hplan, vplan, ring, ringtags, use_avx)
 #endif
-  for (int oy=0; oy<roi_out->height; oy++)
   {
-    // Initialize column resampling indexes
-    int vlidx = vmeta[3*oy + 0]; // V(ertical) L(ength) I(n)d(e)x
-    int vkidx = vmeta[3*oy + 1]; // V(ertical) K(ernel) I(n)d(e)x
-    int viidx = vmeta[3*oy + 2]; // V(ertical) I(ndex) I(n)d(e)x
-
-    // Initialize row resampling indexes
-    int hlidx = 0; // H(orizontal) L(ength) I(n)d(e)x
-    int hkidx = 0; // H(orizontal) K(ernel) I(n)d(e)x
-    int hiidx = 0; // H(orizontal) I(ndex) I(n)d(e)x
-
-    // Number of lines contributing to the output line
-    int vl = vlength[vlidx++]; // V(ertical) L(ength)
-
-    // Process each output column
-    for (int ox=0; ox < roi_out->width; ox++)
+    const int thread = dt_get_thread_num();
+    float* const myring = ring + ringfloats*thread;
+    int* const mytags = ringtags + ringsize*thread;
+    for (int k=0; k<ringsize; k++)
     {
-      debug_extra("output %p [% 4d % 4d]\n", out, ox, oy);
-
-      // This will hold the resulting pixel
-      __m128 vs = _mm_setzero_ps();
+      mytags[k] = -1;
+    }
+    const float* lines[ringsize];
 
-      // Number of horizontal samples contributing to the output
-      int hl = hlength[hlidx++]; // H(orizontal) L(ength)
+#ifdef _OPENMP
+    #pragma omp for schedule(static)
+#endif
+    for (int oy=0; oy<roi_out->height; oy++)
+    {
+      const int vl = vplan->length[vplan->meta[3*oy + 0]]; // V(ertical) L(ength)
+      const float* const vkernel = vplan->kernel + vplan->meta[3*oy + 1];
+      const int* const vindex = vplan->index + vplan->meta[3*oy + 2];
 
-      for (int iy=0; iy < vl; iy++)
+      // Make sure all contributing input lines have been resampled horizontally
+      for (int iy=0; iy<vl; iy++)
       {
-        // This is our input line
-        const float* i = (float*)((char*)in + (size_t)in_stride*vindex[viidx++]);
-
-        __m128 vhs = _mm_setzero_ps();
-
-        for (int ix=0; ix< hl; ix++)
+        const int line = vindex[iy];
+        const int slot = line % ringsize;
+        float* const l = myring + slot*linefloats;
+        if (mytags[slot] != line)
         {
-          // Apply the precomputed filter kernel
-          size_t baseidx = (size_t)hindex[hiidx++]*4;
-          float htap = hkernel[hkidx++];
-          __m128 vhtap = _mm_set_ps1(htap);
-          vhs = _mm_add_ps(vhs, _mm_mul_ps(*(__m128*)&i[baseidx], vhtap));
+          const float* i = (float*)((char*)in + (size_t)in_stride*line);
+          resample_line_horizontal(i, l, roi_out->width, hplan);
+          mytags[slot] = line;
         }
-
-        // Accumulate contribution from this line
-        float vtap = vkernel[vkidx++];
-        __m128 vvtap = _mm_set_ps1(vtap);
-        vs = _mm_add_ps(vs, _mm_mul_ps(vhs, vvtap));
-
-        // Reset horizontal resampling context
-        hkidx -= hl;
-        hiidx -= hl;
+        lines[iy] = l;
       }
 
-      // Output pixel is ready
-      float* o = (float*)((char*)out + (size_t)oy*out_stride + (size_t)ox*4*sizeof(float));
-      _mm_stream_ps(o, vs);
-
-      // Reset vertical resampling context
-      viidx -= vl;
-      vkidx -= vl;
-
-      // Progress in horizontal context
-      hiidx += hl;
-      hkidx += hl;
+      // Output line is ready to be assembled
+      float* o = (float*)((char*)out + (size_t)oy*out_stride);
+#ifdef DT_HAVE_TARGET_AVX
+      if (use_avx)
+      {
+        resample_line_vertical_avx(lines, vkernel, vl, o, 0, roi_out->width);
+      }
+      else
+#endif
+      {
+        resample_line_vertical_sse(lines, vkernel, vl, o, 0, roi_out->width);
+      }
     }
-
-    // Progress in vertical context
-    viidx += vl;
-    vkidx += vl;
   }
 
   _mm_sfence();
@@ -1429,11 +1689,10 @@ dt_interpolation_resample(
 #endif
 
 exit:
-  /* Free the resampling plans. It's nasty to optimize allocs like that, but
-   * it simplifies the code :-D. The length array is in fact the only memory
-   * allocated. */
-  dt_free_align(hlength);
-  dt_free_align(vlength);
+  free(ringtags);
+  dt_free_align(ring);
+  release_resampling_plan(hplan);
+  release_resampling_plan(vplan);
 }
 
 
@@ -122,6 +122,12 @@ const struct dt_interpolation*
 dt_interpolation_new(
   enum dt_interpolation_type type);
 
+/** Set up the resampling plan cache, called once at startup */
+void dt_interpolation_init(void);
+
+/** Free the resampling plan cache */
+void dt_interpolation_cleanup(void);
+
 /** Image resampler.
  *
  * Resamples the image "in" to "out" according to roi values. Here is the
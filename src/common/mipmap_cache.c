@@ -20,6 +20,7 @@
 #include "common/exif.h"
 #include "common/grealpath.h"
 #include "common/image_cache.h"
+#include "common/image_compression.h"
 #include "common/imageio.h"
 #include "common/imageio_module.h"
 #include "common/imageio_jpeg.h"
@@ -46,6 +47,9 @@
 #define DT_MIPMAP_CACHE_FILE_MAGIC 0xD71337
 #define DT_MIPMAP_CACHE_FILE_VERSION 23
 #define DT_MIPMAP_CACHE_DEFAULT_FILE_NAME "mipmaps"
+// per image files with the float previews, in a directory next to the mipmap cache file
+#define DT_MIPMAP_F_STORE_MAGIC (DT_MIPMAP_CACHE_FILE_MAGIC + 0x100)
+#define DT_MIPMAP_F_STORE_VERSION 1
 
 #define DT_MIPMAP_BUFFER_DSC_FLAG_GENERATE (1<<0)
 
@@ -638,6 +642,12 @@ void dt_mipmap_cache_init(dt_mipmap_cache_t *cache)
   struct dt_mipmap_buffer_dsc *dsc = (struct dt_mipmap_buffer_dsc *)dt_mipmap_cache_static_dead_image;
   dead_image_f((dt_mipmap_buffer_t *)(dsc+1));
 
+  dt_pthread_mutex_init(&cache->removed_mutex, NULL);
+  cache->num_removed = 0;
+  dt_pthread_mutex_init(&cache->f_store_mutex, NULL);
+  cache->f_store_size = -1;
+  // stored float previews are only kept while the option is on
+  if(!dt_conf_get_bool("cache_float_previews")) _f_store_purge();
   cache->compression_type = 0;
   gchar *compression = dt_conf_get_string("cache_compression");
   if(compression)
@@ -788,6 +798,8 @@ void dt_mipmap_cache_cleanup(dt_mipmap_cache_t *cache)
     dt_cache_cleanup(&cache->scratchmem.cache);
     dt_free_align(cache->scratchmem.buf);
   }
+  dt_pthread_mutex_destroy(&cache->removed_mutex);
+  dt_pthread_mutex_destroy(&cache->f_store_mutex);
 }
 
 void dt_mipmap_cache_print(dt_mipmap_cache_t *cache)
@@ -1116,6 +1128,265 @@ dt_mipmap_cache_remove(
     const uint32_t key = get_key(imgid, k);
     dt_cache_remove(&cache->mip[k].cache, key);
   }
+  dt_pthread_mutex_lock(&cache->removed_mutex);
+  cache->removed[cache->num_removed++ % DT_MIPMAP_REMOVED_LOG] = imgid;
+  dt_pthread_mutex_unlock(&cache->removed_mutex);
+}
+
+int
+dt_mipmap_cache_get_removed(
+  dt_mipmap_cache_t *cache,
+  uint32_t *serial,
+  uint32_t *imgids)
+{
+  dt_pthread_mutex_lock(&cache->removed_mutex);
+  const uint32_t num = cache->num_removed - *serial;
+  if(num <= DT_MIPMAP_REMOVED_LOG)
+    for(uint32_t k=0; k<num; k++) imgids[k] = cache->removed[(*serial + k) % DT_MIPMAP_REMOVED_LOG];
+  *serial = cache->num_removed;
+  dt_pthread_mutex_unlock(&cache->removed_mutex);
+  return num <= DT_MIPMAP_REMOVED_LOG ? (int)num : -1;
+}
+
+/* header of a stored mip_f: it's valid as long as the source file hasn't changed
+ * and the mip_f size setting is the same. followed by the source path and
+ * width*height rgb half floats. */
+typedef struct _f_store_header_t
+{
+  int32_t magic;
+  int32_t max_width, max_height;
+  int32_t width, height;
+  int32_t path_len;
+  int64_t mtime, size;
+}
+_f_store_header_t;
+
+static int
+_f_store_dir(gchar *dir, size_t size)
+{
+  gchar base[PATH_MAX];
+  if(dt_mipmap_cache_get_filename(base, sizeof(base)) || !strcmp(base, ":memory:")) return 1;
+  snprintf(dir, size, "%s.f", base);
+  return 0;
+}
+
+static int
+_f_store_filename(const uint32_t imgid, gchar *filename, size_t size)
+{
+  if(!dt_conf_get_bool("cache_float_previews")) return 1;
+  gchar dir[PATH_MAX];
+  if(_f_store_dir(dir, sizeof(dir))) return 1;
+  snprintf(filename, size, "%s/%u.f16", dir, imgid);
+  return 0;
+}
+
+// delete all stored previews and the directory itself
+static void
+_f_store_purge()
+{
+  gchar dir[PATH_MAX];
+  if(_f_store_dir(dir, sizeof(dir))) return;
+  GDir *d = g_dir_open(dir, 0, NULL);
+  if(!d) return;
+  const gchar *name;
+  while((name = g_dir_read_name(d)))
+  {
+    gchar *path = g_build_filename(dir, name, NULL);
+    g_unlink(path);
+    g_free(path);
+  }
+  g_dir_close(d);
+  g_rmdir(dir);
+}
+
+typedef struct _f_store_entry_t
+{
+  gchar *path;
+  int64_t size;
+  int64_t mtime;
+}
+_f_store_entry_t;
+
+static gint
+_f_store_entry_cmp(gconstpointer a, gconstpointer b)
+{
+  const _f_store_entry_t *ea = (const _f_store_entry_t *)a, *eb = (const _f_store_entry_t *)b;
+  return ea->mtime < eb->mtime ? -1 : ea->mtime > eb->mtime;
+}
+
+/* returns the size of the store in bytes. if that's above limit, the least
+ * recently used previews (reads touch their file) are deleted down to target. */
+static int64_t
+_f_store_trim(const int64_t limit, const int64_t target)
+{
+  gchar dir[PATH_MAX];
+  if(_f_store_dir(dir, sizeof(dir))) return 0;
+  GDir *d = g_dir_open(dir, 0, NULL);
+  if(!d) return 0;
+  GList *entries = NULL;
+  int64_t total = 0;
+  const gchar *name;
+  while((name = g_dir_read_name(d)))
+  {
+    if(!g_str_has_suffix(name, ".f16")) continue;
+    gchar *path = g_build_filename(dir, name, NULL);
+    GStatBuf st;
+    if(g_stat(path, &st))
+    {
+      g_free(path);
+      continue;
+    }
+    _f_store_entry_t *e = (_f_store_entry_t *)malloc(sizeof(_f_store_entry_t));
+    e->path = path;
+    e->size = st.st_size;
+    e->mtime = st.st_mtime;
+    entries = g_list_prepend(entries, e);
+    total += e->size;
+  }
+  g_dir_close(d);
+
+  if(total > limit)
+  {
+    entries = g_list_sort(entries, _f_store_entry_cmp);
+    for(GList *l = entries; l && total > target; l = g_list_next(l))
+    {
+      _f_store_entry_t *e = (_f_store_entry_t *)l->data;
+      if(!g_unlink(e->path)) total -= e->size;
+    }
+    dt_print(DT_DEBUG_CACHE, "[mipmap_cache] float preview store trimmed to %" G_GINT64_FORMAT " bytes\n", total);
+  }
+  for(GList *l = entries; l; l = g_list_next(l))
+  {
+    _f_store_entry_t *e = (_f_store_entry_t *)l->data;
+    g_free(e->path);
+    free(e);
+  }
+  g_list_free(entries);
+  return total;
+}
+
+// account for a newly written preview, and evict old ones if the store got too big
+static void
+_f_store_add(const int64_t bytes)
+{
+  dt_mipmap_cache_t *cache = darktable.mipmap_cache;
+  const int64_t limit = dt_conf_get_int64("cache_float_previews_size");
+  dt_pthread_mutex_lock(&cache->f_store_mutex);
+  // the first write scans the directory, later ones just add up (overwrites overestimate)
+  if(cache->f_store_size < 0) cache->f_store_size = _f_store_trim(limit, limit - limit/4);
+  else cache->f_store_size += bytes;
+  if(cache->f_store_size > limit) cache->f_store_size = _f_store_trim(limit, limit - limit/4);
+  dt_pthread_mutex_unlock(&cache->f_store_mutex);
+}
+
+static int
+_f_store_read(
+  const uint32_t  imgid,
+  const char     *source,
+  float          *out,
+  uint32_t       *width,
+  uint32_t       *height)
+{
+  gchar filename[PATH_MAX];
+  if(_f_store_filename(imgid, filename, sizeof(filename))) return 1;
+
+  GStatBuf st;
+  if(g_stat(source, &st)) return 1;
+
+  FILE *f = g_fopen(filename, "rb");
+  if(!f) return 1;
+
+  int res = 1;
+  uint16_t *half = NULL;
+  _f_store_header_t h;
+  char path[PATH_MAX];
+  if(fread(&h, sizeof(h), 1, f) != 1) goto exit;
+  if(h.magic != DT_MIPMAP_F_STORE_MAGIC + DT_MIPMAP_F_STORE_VERSION ||
+     h.max_width != (int32_t)*width || h.max_height != (int32_t)*height ||
+     h.width <= 0 || h.height <= 0 || h.width > h.max_width || h.height > h.max_height ||
+     h.mtime != (int64_t)st.st_mtime || h.size != (int64_t)st.st_size ||
+     h.path_len != (int32_t)strlen(source) || h.path_len >= (int32_t)sizeof(path))
+    goto exit;
+  if(fread(path, 1, h.path_len, f) != (size_t)h.path_len || strncmp(path, source, h.path_len)) goto exit;
+
+  const size_t num = (size_t)h.width*h.height;
+  half = (uint16_t *)malloc(sizeof(uint16_t)*3*num);
+  if(!half || fread(half, sizeof(uint16_t)*3, num, f) != num) goto exit;
+  dt_image_unpack_half(half, out, num);
+  *width  = h.width;
+  *height = h.height;
+  res = 0;
+  // recently used, for the eviction
+  g_utime(filename, NULL);
+
+exit:
+  free(half);
+  fclose(f);
+  return res;
+}
+
+static void
+_f_store_write(
+  const uint32_t  imgid,
+  const char     *source,
+  const float    *in,
+  const uint32_t  max_width,
+  const uint32_t  max_height,
+  const uint32_t  width,
+  const uint32_t  height)
+{
+  gchar filename[PATH_MAX], tmpname[PATH_MAX];
+  if(width == 0 || height == 0) return;
+  if(_f_store_filename(imgid, filename, sizeof(filename))) return;
+
+  GStatBuf st;
+  if(g_stat(source, &st)) return;
+
+  gchar *dir = g_path_get_dirname(filename);
+  const int mkdir_failed = g_mkdir_with_parents(dir, 0750);
+  g_free(dir);
+  if(mkdir_failed) return;
+
+  const size_t num = (size_t)width*height;
+  uint16_t *half = (uint16_t *)malloc(sizeof(uint16_t)*3*num);
+  if(!half) return;
+  dt_image_pack_half(in, half, num);
+
+  _f_store_header_t h;
+  memset(&h, 0, sizeof(h));
+  h.magic = DT_MIPMAP_F_STORE_MAGIC + DT_MIPMAP_F_STORE_VERSION;
+  h.max_width = max_width;
+  h.max_height = max_height;
+  h.width = width;
+  h.height = height;
+  h.path_len = strlen(source);
+  h.mtime = st.st_mtime;
+  h.size = st.st_size;
+
+  // write to a temporary file first, readers never see a partial one
+  snprintf(tmpname, sizeof(tmpname), "%s.tmp", filename);
+  FILE *f = g_fopen(tmpname, "wb");
+  int ok = 0;
+  if(f)
+  {
+    ok = fwrite(&h, sizeof(h), 1, f) == 1 &&
+         fwrite(source, 1, h.path_len, f) == (size_t)h.path_len &&
+         fwrite(half, sizeof(uint16_t)*3, num, f) == num;
+    ok = (fclose(f) == 0) && ok;
+  }
+  if(ok) ok = !g_rename(tmpname, filename);
+  if(!ok) g_unlink(tmpname);
+  free(half);
+  if(ok) _f_store_add(sizeof(h) + h.path_len + sizeof(uint16_t)*3*num);
+}
+
+void
+dt_mipmap_cache_remove_stored(
+  const uint32_t imgid)
+{
+  gchar filename[PATH_MAX];
+  if(!_f_store_filename(imgid, filename, sizeof(filename)))
+    g_unlink(filename);
 }
 
 static void
@@ -1137,6 +1408,50 @@ _init_f(
     return;
   }
 
+  // stored on disk from an earlier session?
+  *width = wd;
+  *height = ht;
+  if(!_f_store_read(imgid, filename, out, width, height)) return;
+
+  // unless the full image is around anyway, try to bin raws right while
+  // decoding them, instead of loading and caching them at full size first.
+  if(!dt_cache_contains(&darktable.mipmap_cache->mip[DT_MIPMAP_FULL].cache, get_key(imgid, DT_MIPMAP_FULL)))
+  {
+    dt_image_t buffered_image;
+    const dt_image_t *cimg = dt_image_cache_read_get(darktable.image_cache, imgid);
+    buffered_image = *cimg;
+    dt_image_cache_read_release(darktable.image_cache, cimg);
+
+    // x-trans, float and sraw files would only be decoded to be rejected, and then again in full.
+    // filters is only known after a load in this session, the flags are kept in the library.
+    const int binnable = dt_image_is_raw(&buffered_image) && !dt_image_is_hdr(&buffered_image) &&
+                         !(buffered_image.flags & DT_IMAGE_NO_BINNING) && buffered_image.filters != 9u;
+
+    uint32_t w = wd, h = ht;
+    if(binnable && dt_imageio_open_downsampled(&buffered_image, filename, out, &w, &h) == DT_IMAGEIO_OK)
+    {
+      // the image struct got its dimensions and sensor info as with a full load
+      cimg = dt_image_cache_read_get(darktable.image_cache, imgid);
+      dt_image_t *img = dt_image_cache_write_get(darktable.image_cache, cimg);
+      *img = buffered_image;
+      dt_image_cache_write_release(darktable.image_cache, img, DT_IMAGE_CACHE_RELAXED);
+      dt_image_cache_read_release(darktable.image_cache, img);
+      *width  = w;
+      *height = h;
+      _f_store_write(imgid, filename, out, wd, ht, w, h);
+      return;
+    }
+    else if(binnable && (buffered_image.flags & DT_IMAGE_NO_BINNING))
+    {
+      // found out the hard way, don't try again next time
+      cimg = dt_image_cache_read_get(darktable.image_cache, imgid);
+      dt_image_t *img = dt_image_cache_write_get(darktable.image_cache, cimg);
+      img->flags |= DT_IMAGE_NO_BINNING;
+      dt_image_cache_write_release(darktable.image_cache, img, DT_IMAGE_CACHE_RELAXED);
+      dt_image_cache_read_release(darktable.image_cache, img);
+    }
+  }
+
   dt_mipmap_buffer_t buf;
   dt_mipmap_cache_read_get(darktable.mipmap_cache, &buf, imgid, DT_MIPMAP_FULL, DT_MIPMAP_BLOCKING);
 
@@ -1216,6 +1531,7 @@ _init_f(
 
   *width  = roi_out.width;
   *height = roi_out.height;
+  _f_store_write(imgid, filename, out, wd, ht, *width, *height);
 }
 
 
@@ -1239,6 +1555,12 @@ _bpp(dt_imageio_module_data_t *data)
   return 8;
 }
 
+static int
+_flags(dt_imageio_module_data_t *data)
+{
+  return 0;
+}
+
 static int
 _write_image(
   dt_imageio_module_data_t *data,
@@ -1246,6 +1568,7 @@ _write_image(
   const void               *in,
   void                     *exif,
   int                       exif_len,
+  const char               *xmp,
   int                       imgid)
 {
   _dummy_data_t *d = (_dummy_data_t *)data;
@@ -1337,7 +1660,9 @@ _init_8(
     _dummy_data_t dat;
     format.bpp = _bpp;
     format.write_image = _write_image;
+    format.write_image_rows = NULL;
     format.levels = _levels;
+    format.flags = _flags;
     dat.head.max_width  = wd;
     dat.head.max_height = ht;
     dat.buf = buf;
@@ -1420,7 +1745,7 @@ dt_mipmap_cache_compress(
     int flags = squish_dxt1;
     // low quality:
     if(darktable.mipmap_cache->compression_type == 1) flags |= squish_colour_range_fit;
-    squish_compress_image(scratchmem, buf->width, buf->height, buf->buf, squish_dxt1);
+    squish_compress_image(scratchmem, buf->width, buf->height, buf->buf, flags);
   }
   else
 #endif
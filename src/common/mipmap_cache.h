@@ -19,6 +19,7 @@
 #define DT_MIPMAP_CACHE_H
 
 #include "common/cache.h"
+#include "common/dtpthread.h"
 #include "common/image.h"
 
 
@@ -102,6 +103,9 @@ typedef struct dt_mipmap_cache_one_t
 }
 dt_mipmap_cache_one_t;
 
+// number of removed images remembered for dt_mipmap_cache_get_removed()
+#define DT_MIPMAP_REMOVED_LOG 64
+
 typedef struct dt_mipmap_cache_t
 {
   // one cache per mipmap level
@@ -110,6 +114,14 @@ typedef struct dt_mipmap_cache_t
   int compression_type; // 0 - none, 1 - low quality, 2 - slow
   // per-thread cache of uncompressed buffers, in case compression is requested.
   dt_mipmap_cache_one_t scratchmem;
+  // the last images passed to dt_mipmap_cache_remove(), for whoever keeps copies of
+  // their thumbnails (the lighttable). num_removed counts all removals so far.
+  dt_pthread_mutex_t removed_mutex;
+  uint32_t removed[DT_MIPMAP_REMOVED_LOG];
+  uint32_t num_removed;
+  // bytes in the float preview store on disk, -1 if not known yet
+  dt_pthread_mutex_t f_store_mutex;
+  int64_t f_store_size;
 }
 dt_mipmap_cache_t;
 
@@ -164,6 +176,20 @@ dt_mipmap_cache_remove(
   dt_mipmap_cache_t *cache,
   const uint32_t imgid);
 
+// images removed since the serial number *serial (0 the first time), at most DT_MIPMAP_REMOVED_LOG of them.
+// returns their number, or -1 if more than that were removed and copies of all thumbnails should go.
+// *serial is updated for the next call.
+int
+dt_mipmap_cache_get_removed(
+  dt_mipmap_cache_t *cache,
+  uint32_t *serial,
+  uint32_t *imgids);
+
+// drop the float preview stored on disk, for images leaving the library:
+void
+dt_mipmap_cache_remove_stored(
+  const uint32_t imgid);
+
 // return the closest mipmap size
 // for the given window you wish to draw.
 // a dt_mipmap_size_t has always a fixed resolution associated with it,
@@ -0,0 +1,158 @@
+/*
+    This file is part of darktable,
+    copyright (c) 2015 the darktable project.
+
+    darktable is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    darktable is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with darktable.  If not, see <http://www.gnu.org/licenses/>.
+*/
+#include "common/darktable.h"
+#include "common/image.h"
+#include "common/readahead.h"
+#include "control/conf.h"
+
+#include <fcntl.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+// the files are streamed through this much memory, the data itself ends up in the page cache.
+#define DT_READAHEAD_CHUNK (1<<20)
+
+static int
+_readahead_is_done(const dt_readahead_t *ra, const int imgid)
+{
+  for(int k=0; k<2*DT_READAHEAD_MAX; k++)
+    if(ra->done[k] == imgid) return 1;
+  return 0;
+}
+
+// returns the number of bytes read, or -1 if aborted or the file could not be opened.
+static ssize_t
+_readahead_file(dt_readahead_t *ra, const char *filename, char *buf)
+{
+  const int fd = open(filename, O_RDONLY);
+  if(fd == -1) return -1;
+#ifdef POSIX_FADV_WILLNEED
+  // lets the kernel start on the whole file right away, where the file system supports it
+  posix_fadvise(fd, 0, 0, POSIX_FADV_WILLNEED);
+#endif
+  // then pull it in explicitly, which also works on network and fuse mounts ignoring the hint.
+  ssize_t total = 0, res;
+  while((res = read(fd, buf, DT_READAHEAD_CHUNK)) > 0)
+  {
+    total += res;
+    if(ra->abort)
+    {
+      total = -1;
+      break;
+    }
+  }
+  close(fd);
+  return total;
+}
+
+static void *
+_readahead_thread(void *data)
+{
+  dt_readahead_t *ra = (dt_readahead_t *)data;
+  char *buf = malloc(DT_READAHEAD_CHUNK);
+  if(!buf) return NULL;
+
+  dt_pthread_mutex_lock(&ra->mutex);
+  while(!ra->quit)
+  {
+    if(ra->num_queued == 0)
+    {
+      dt_pthread_cond_wait(&ra->cond, &ra->mutex);
+      continue;
+    }
+    const int imgid = ra->queue[0];
+    memmove(ra->queue, ra->queue + 1, sizeof(int)*(--ra->num_queued));
+    if(_readahead_is_done(ra, imgid)) continue;
+    ra->current = imgid;
+    ra->abort = 0;
+    dt_pthread_mutex_unlock(&ra->mutex);
+
+    char filename[PATH_MAX] = { 0 };
+    gboolean from_cache = TRUE;
+    dt_image_full_path(imgid, filename, sizeof(filename), &from_cache);
+    const double start = dt_get_wtime();
+    const ssize_t bytes = filename[0] ? _readahead_file(ra, filename, buf) : -1;
+    if(bytes >= 0)
+      dt_print(DT_DEBUG_PERF, "[readahead] %s: %.1f MB in %.3f secs\n", filename, bytes/(1024.0*1024.0),
+               dt_get_wtime() - start);
+
+    dt_pthread_mutex_lock(&ra->mutex);
+    ra->current = -1;
+    if(bytes >= 0)
+    {
+      ra->done[ra->done_pos] = imgid;
+      ra->done_pos = (ra->done_pos + 1) % (2*DT_READAHEAD_MAX);
+    }
+  }
+  dt_pthread_mutex_unlock(&ra->mutex);
+  free(buf);
+  return NULL;
+}
+
+dt_readahead_t *dt_readahead_new()
+{
+  dt_readahead_t *ra = (dt_readahead_t *)calloc(1, sizeof(dt_readahead_t));
+  ra->current = -1;
+  for(int k=0; k<2*DT_READAHEAD_MAX; k++) ra->done[k] = -1;
+  dt_pthread_mutex_init(&ra->mutex, NULL);
+  pthread_cond_init(&ra->cond, NULL);
+  if(pthread_create(&ra->thread, NULL, &_readahead_thread, ra))
+  {
+    dt_pthread_mutex_destroy(&ra->mutex);
+    pthread_cond_destroy(&ra->cond);
+    free(ra);
+    return NULL;
+  }
+  return ra;
+}
+
+void dt_readahead_destroy(dt_readahead_t *ra)
+{
+  if(!ra) return;
+  dt_pthread_mutex_lock(&ra->mutex);
+  ra->quit = ra->abort = 1;
+  pthread_cond_signal(&ra->cond);
+  dt_pthread_mutex_unlock(&ra->mutex);
+  pthread_join(ra->thread, NULL);
+  dt_pthread_mutex_destroy(&ra->mutex);
+  pthread_cond_destroy(&ra->cond);
+  free(ra);
+}
+
+void dt_readahead_images(dt_readahead_t *ra, const int *imgids, const int num)
+{
+  if(!ra) return;
+  const int max = MIN(dt_conf_get_int("readahead_images"), DT_READAHEAD_MAX);
+  dt_pthread_mutex_lock(&ra->mutex);
+  // keep reading the current file if it is still wanted, drop it otherwise.
+  int keep_current = 0;
+  ra->num_queued = 0;
+  for(int k=0; k<MIN(num, max); k++)
+  {
+    if(imgids[k] == ra->current) keep_current = 1;
+    else if(!_readahead_is_done(ra, imgids[k])) ra->queue[ra->num_queued++] = imgids[k];
+  }
+  if(ra->current != -1 && !keep_current) ra->abort = 1;
+  if(ra->num_queued) pthread_cond_signal(&ra->cond);
+  dt_pthread_mutex_unlock(&ra->mutex);
+}
+
+// modelines: These editor modelines have been set for all relevant files by tools/update_modelines.sh
+// vim: shiftwidth=2 expandtab tabstop=2 cindent
+// kate: tab-indents: off; indent-width 2; replace-tabs on; indent-mode cstyle; remove-trailing-spaces modified;
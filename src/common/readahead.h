@@ -0,0 +1,60 @@
+/*
+    This file is part of darktable,
+    copyright (c) 2015 the darktable project.
+
+    darktable is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    darktable is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with darktable.  If not, see <http://www.gnu.org/licenses/>.
+*/
+#ifndef DT_READAHEAD_H
+#define DT_READAHEAD_H
+
+#include "common/darktable.h"
+#include "common/dtpthread.h"
+
+/** upper bound for the number of queued images */
+#define DT_READAHEAD_MAX 16
+
+/** reads the files of upcoming images into the page cache on a separate io thread,
+ *  so the decoder finds them in memory instead of waiting for slow (network) storage. */
+typedef struct dt_readahead_t
+{
+  dt_pthread_mutex_t mutex;
+  pthread_cond_t cond;
+  pthread_t thread;
+
+  // pending image ids, in the order they will be needed
+  int queue[DT_READAHEAD_MAX];
+  int num_queued;
+  // image being read right now, or -1
+  int current;
+  // set when current is no longer wanted, or on shutdown
+  volatile int abort, quit;
+
+  // recently completed image ids, not read again
+  int done[2*DT_READAHEAD_MAX];
+  int done_pos;
+}
+dt_readahead_t;
+
+/** starts the io thread. */
+dt_readahead_t *dt_readahead_new();
+/** stops the io thread and frees the context. */
+void dt_readahead_destroy(dt_readahead_t *ra);
+/** replaces the pending images by the given ones, of which the first few (config
+ *  key readahead_images) are read. the list should start with the image needed next. */
+void dt_readahead_images(dt_readahead_t *ra, const int *imgids, const int num);
+
+#endif
+// modelines: These editor modelines have been set for all relevant files by tools/update_modelines.sh
+// vim: shiftwidth=2 expandtab tabstop=2 cindent
+// kate: tab-indents: off; indent-width 2; replace-tabs on; indent-mode cstyle; remove-trailing-spaces modified;
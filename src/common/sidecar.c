@@ -0,0 +1,249 @@
+/*
+    This file is part of darktable,
+    copyright (c) 2015 the darktable project.
+
+    darktable is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    darktable is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with darktable.  If not, see <http://www.gnu.org/licenses/>.
+*/
+#include "common/darktable.h"
+#include "common/image.h"
+#include "common/sidecar.h"
+
+#include <stdlib.h>
+#include <sys/time.h>
+
+// a write is done this long after the last request for the image,
+#define DT_SIDECAR_DELAY 0.5
+// but not later than this after the first one, when the image keeps changing.
+#define DT_SIDECAR_MAX_DELAY 5.0
+
+typedef struct dt_sidecar_request_t
+{
+  int imgid;
+  double first, due;
+}
+dt_sidecar_request_t;
+
+static int
+_sidecar_is_writing(const dt_sidecar_t *s, const int imgid)
+{
+  for(int k=0; k<s->num_threads; k++)
+    if(s->writing[k] == imgid) return 1;
+  return 0;
+}
+
+// the first request that may be written now, or NULL. *next is set to the time the
+// next one is due. the queue is ordered by due time, so only the head needs looking at
+// apart from images another thread is still busy with.
+static GList *
+_sidecar_next(dt_sidecar_t *s, const double now, double *next)
+{
+  *next = -1.0;
+  for(GList *l = s->queue.head; l; l = g_list_next(l))
+  {
+    const dt_sidecar_request_t *r = (const dt_sidecar_request_t *)l->data;
+    if(_sidecar_is_writing(s, r->imgid)) continue;
+    if(r->due <= now || s->flushing || s->quit) return l;
+    *next = r->due;
+    return NULL;
+  }
+  return NULL;
+}
+
+typedef struct dt_sidecar_thread_t
+{
+  dt_sidecar_t *s;
+  int slot;
+}
+dt_sidecar_thread_t;
+
+static void *
+_sidecar_thread(void *data)
+{
+  dt_sidecar_thread_t *t = (dt_sidecar_thread_t *)data;
+  dt_sidecar_t *s = t->s;
+  const int slot = t->slot;
+  free(t);
+
+  dt_pthread_mutex_lock(&s->mutex);
+  while(!s->quit || s->queue.length)
+  {
+    double next;
+    GList *l = _sidecar_next(s, dt_get_wtime(), &next);
+    if(!l)
+    {
+      if(next < 0.0)
+      {
+        dt_pthread_cond_wait(&s->cond, &s->mutex);
+      }
+      else
+      {
+        // sleep until the next write is due, or something else happens
+        struct timeval now;
+        gettimeofday(&now, NULL);
+        const double wait = MAX(0.0, next - dt_get_wtime());
+        const double end = now.tv_sec + 1e-6*now.tv_usec + wait;
+        struct timespec abstime;
+        abstime.tv_sec = (time_t)end;
+        abstime.tv_nsec = (long)((end - abstime.tv_sec)*1e9);
+        dt_pthread_cond_timedwait(&s->cond, &s->mutex, &abstime);
+      }
+      continue;
+    }
+
+    dt_sidecar_request_t *r = (dt_sidecar_request_t *)l->data;
+    const int imgid = r->imgid;
+    g_queue_delete_link(&s->queue, l);
+    g_hash_table_remove(s->pending, GINT_TO_POINTER(imgid));
+    free(r);
+    s->writing[slot] = imgid;
+    dt_pthread_mutex_unlock(&s->mutex);
+
+    // the xmp is made from the database now, so it has everything requested up to here.
+    dt_image_write_sidecar_file_sync(imgid);
+
+    dt_pthread_mutex_lock(&s->mutex);
+    s->writing[slot] = -1;
+    // another request for the same image may have been waiting for us
+    pthread_cond_broadcast(&s->cond);
+    pthread_cond_broadcast(&s->done);
+  }
+  dt_pthread_mutex_unlock(&s->mutex);
+  return NULL;
+}
+
+dt_sidecar_t *dt_sidecar_new()
+{
+  dt_sidecar_t *s = (dt_sidecar_t *)calloc(1, sizeof(dt_sidecar_t));
+  g_queue_init(&s->queue);
+  s->pending = g_hash_table_new(g_direct_hash, g_direct_equal);
+  for(int k=0; k<DT_SIDECAR_THREADS; k++) s->writing[k] = -1;
+  dt_pthread_mutex_init(&s->mutex, NULL);
+  pthread_cond_init(&s->cond, NULL);
+  pthread_cond_init(&s->done, NULL);
+  for(int k=0; k<DT_SIDECAR_THREADS; k++)
+  {
+    dt_sidecar_thread_t *t = (dt_sidecar_thread_t *)malloc(sizeof(dt_sidecar_thread_t));
+    t->s = s;
+    t->slot = k;
+    if(pthread_create(&s->thread[k], NULL, &_sidecar_thread, t))
+    {
+      free(t);
+      break;
+    }
+    s->num_threads++;
+  }
+  if(!s->num_threads)
+  {
+    // no threads, the files are written synchronously then
+    g_hash_table_destroy(s->pending);
+    dt_pthread_mutex_destroy(&s->mutex);
+    pthread_cond_destroy(&s->cond);
+    pthread_cond_destroy(&s->done);
+    free(s);
+    return NULL;
+  }
+  return s;
+}
+
+void dt_sidecar_destroy(dt_sidecar_t *s)
+{
+  if(!s) return;
+  // the threads write everything still queued before they quit
+  dt_pthread_mutex_lock(&s->mutex);
+  s->quit = 1;
+  pthread_cond_broadcast(&s->cond);
+  dt_pthread_mutex_unlock(&s->mutex);
+  for(int k=0; k<s->num_threads; k++) pthread_join(s->thread[k], NULL);
+  g_hash_table_destroy(s->pending);
+  dt_pthread_mutex_destroy(&s->mutex);
+  pthread_cond_destroy(&s->cond);
+  pthread_cond_destroy(&s->done);
+  free(s);
+}
+
+void dt_sidecar_write(dt_sidecar_t *s, const int imgid)
+{
+  if(imgid <= 0) return;
+  if(!s)
+  {
+    dt_image_write_sidecar_file_sync(imgid);
+    return;
+  }
+
+  const double now = dt_get_wtime();
+  dt_pthread_mutex_lock(&s->mutex);
+  GList *l = (GList *)g_hash_table_lookup(s->pending, GINT_TO_POINTER(imgid));
+  if(l)
+  {
+    // postpone the pending write, unless it has waited long enough already.
+    // moving it to the end keeps the queue ordered by due time.
+    dt_sidecar_request_t *r = (dt_sidecar_request_t *)l->data;
+    if(now + DT_SIDECAR_DELAY < r->first + DT_SIDECAR_MAX_DELAY)
+    {
+      r->due = now + DT_SIDECAR_DELAY;
+      g_queue_unlink(&s->queue, l);
+      g_queue_push_tail_link(&s->queue, l);
+    }
+  }
+  else
+  {
+    dt_sidecar_request_t *r = (dt_sidecar_request_t *)malloc(sizeof(dt_sidecar_request_t));
+    r->imgid = imgid;
+    r->first = now;
+    r->due = now + DT_SIDECAR_DELAY;
+    g_queue_push_tail(&s->queue, r);
+    g_hash_table_insert(s->pending, GINT_TO_POINTER(imgid), s->queue.tail);
+    pthread_cond_signal(&s->cond);
+  }
+  dt_pthread_mutex_unlock(&s->mutex);
+}
+
+void dt_sidecar_cancel(dt_sidecar_t *s, const int imgid)
+{
+  if(!s) return;
+  dt_pthread_mutex_lock(&s->mutex);
+  GList *l = (GList *)g_hash_table_lookup(s->pending, GINT_TO_POINTER(imgid));
+  if(l)
+  {
+    free(l->data);
+    g_queue_delete_link(&s->queue, l);
+    g_hash_table_remove(s->pending, GINT_TO_POINTER(imgid));
+  }
+  // let a write in progress finish, the caller is about to delete what it writes
+  while(_sidecar_is_writing(s, imgid))
+    dt_pthread_cond_wait(&s->done, &s->mutex);
+  dt_pthread_mutex_unlock(&s->mutex);
+}
+
+void dt_sidecar_flush(dt_sidecar_t *s)
+{
+  if(!s) return;
+  dt_pthread_mutex_lock(&s->mutex);
+  s->flushing++;
+  pthread_cond_broadcast(&s->cond);
+  for(;;)
+  {
+    int busy = s->queue.length > 0;
+    for(int k=0; k<s->num_threads; k++)
+      if(s->writing[k] != -1) busy = 1;
+    if(!busy) break;
+    dt_pthread_cond_wait(&s->done, &s->mutex);
+  }
+  s->flushing--;
+  dt_pthread_mutex_unlock(&s->mutex);
+}
+
+// modelines: These editor modelines have been set for all relevant files by tools/update_modelines.sh
+// vim: shiftwidth=2 expandtab tabstop=2 cindent
+// kate: tab-indents: off; indent-width 2; replace-tabs on; indent-mode cstyle; remove-trailing-spaces modified;
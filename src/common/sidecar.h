@@ -0,0 +1,66 @@
+/*
+    This file is part of darktable,
+    copyright (c) 2015 the darktable project.
+
+    darktable is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    darktable is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with darktable.  If not, see <http://www.gnu.org/licenses/>.
+*/
+#ifndef DT_SIDECAR_H
+#define DT_SIDECAR_H
+
+#include "common/darktable.h"
+#include "common/dtpthread.h"
+
+/** number of threads writing xmp files */
+#define DT_SIDECAR_THREADS 2
+
+/** writes the xmp sidecar files in the background. repeated requests for the same
+ *  image within a short time end up as one write, and an image is never written by two
+ *  threads at once, so its file always ends up with the last state from the database. */
+typedef struct dt_sidecar_t
+{
+  dt_pthread_mutex_t mutex;
+  // signalled on new requests and on shutdown
+  pthread_cond_t cond;
+  // signalled whenever a write is done, for dt_sidecar_flush()
+  pthread_cond_t done;
+  pthread_t thread[DT_SIDECAR_THREADS];
+  int num_threads;
+
+  // pending dt_sidecar_request_t, ordered by the time they are due
+  GQueue queue;
+  // imgid -> link in the queue
+  GHashTable *pending;
+  // images being written right now, or -1
+  int writing[DT_SIDECAR_THREADS];
+  // number of threads waiting in dt_sidecar_flush(), everything is written right away then
+  int flushing;
+  int quit;
+}
+dt_sidecar_t;
+
+/** starts the writer threads. */
+dt_sidecar_t *dt_sidecar_new();
+/** writes what is still pending and stops the threads. */
+void dt_sidecar_destroy(dt_sidecar_t *s);
+/** requests the xmp of the image to be written. written right away if s is NULL. */
+void dt_sidecar_write(dt_sidecar_t *s, const int imgid);
+/** drops a pending write, for images being removed. */
+void dt_sidecar_cancel(dt_sidecar_t *s, const int imgid);
+/** returns once all requests made so far are written. */
+void dt_sidecar_flush(dt_sidecar_t *s);
+
+#endif
+// modelines: These editor modelines have been set for all relevant files by tools/update_modelines.sh
+// vim: shiftwidth=2 expandtab tabstop=2 cindent
+// kate: tab-indents: off; indent-width 2; replace-tabs on; indent-mode cstyle; remove-trailing-spaces modified;
@@ -421,27 +421,25 @@ dt_styles_create_from_image (const char *name,const char *description,int32_t im
 void
 dt_styles_apply_to_selection(const char *name,gboolean duplicate)
 {
-  gboolean selected = FALSE;
-
   /* write current history changes so nothing gets lost, do that only in the darkroom as there is nothing to be
      save when in the lighttable (and it would write over current history stack) */
   const dt_view_t *cv = dt_view_manager_get_current_view(darktable.view_manager);
   if(cv->view((dt_view_t*)cv) == DT_VIEW_DARKROOM)
     dt_dev_write_history(darktable.develop);
 
-  /* for each selected image apply style */
+  /* apply style to all selected images at once */
+  GList *imgs = NULL;
   sqlite3_stmt *stmt;
-  DT_DEBUG_SQLITE3_PREPARE_V2(dt_database_get(darktable.db), "select * from selected_images", -1, &stmt, NULL);
+  DT_DEBUG_SQLITE3_PREPARE_V2(dt_database_get(darktable.db), "select imgid from selected_images", -1, &stmt, NULL);
   while(sqlite3_step(stmt) == SQLITE_ROW)
-  {
-    int imgid = sqlite3_column_int (stmt, 0);
-    dt_styles_apply_to_image (name,duplicate,imgid);
-    selected = TRUE;
-  }
+    imgs = g_list_prepend(imgs, GINT_TO_POINTER(sqlite3_column_int (stmt, 0)));
   sqlite3_finalize(stmt);
 
-  if (!selected)
+  if (!imgs)
     dt_control_log(_("no image selected!"));
+  else
+    dt_styles_apply_to_images(name, duplicate, imgs);
+  g_list_free(imgs);
 }
 
 void
@@ -465,76 +463,82 @@ dt_styles_create_from_selection()
 
 void
 dt_styles_apply_to_image(const char *name,gboolean duplicate, int32_t imgid)
+{
+  GList *imgs = g_list_append(NULL, GINT_TO_POINTER(imgid));
+  dt_styles_apply_to_images(name, duplicate, imgs);
+  g_list_free(imgs);
+}
+
+void
+dt_styles_apply_to_images(const char *name,gboolean duplicate, GList *imgs)
 {
   int id=0;
   sqlite3_stmt *stmt;
-  int32_t newimgid;
+  GList *newimgs = NULL;
 
-  if ((id=dt_styles_get_id_by_name(name)) != 0)
+  if ((id=dt_styles_get_id_by_name(name)) == 0)
+    return;
+
+  /* check if we should make duplicates before applying style */
+  for(GList *l = imgs; l; l = g_list_next(l))
   {
-    /* check if we should make a duplicate before applying style */
+    const int32_t imgid = GPOINTER_TO_INT(l->data);
+    int32_t newimgid = imgid;
     if (duplicate)
     {
       newimgid = dt_image_duplicate (imgid);
       if(newimgid != -1) dt_history_copy_and_paste_on_image(imgid, newimgid, FALSE, NULL);
     }
-    else
-      newimgid = imgid;
+    if(newimgid > 0) newimgs = g_list_prepend(newimgs, GINT_TO_POINTER(newimgid));
+  }
 
-    /* merge onto history stack, let's find history offest in destination image */
-    int32_t offs = 0;
-    DT_DEBUG_SQLITE3_PREPARE_V2(dt_database_get(darktable.db), "SELECT MAX(num)+1 FROM history WHERE imgid = ?1", -1, &stmt, NULL);
-    DT_DEBUG_SQLITE3_BIND_INT(stmt, 1, newimgid);
-    if (sqlite3_step (stmt) == SQLITE_ROW) offs = sqlite3_column_int (stmt, 0);
-    sqlite3_finalize (stmt);
+  /* all images are done with the same statements in one transaction */
+  sqlite3_exec(dt_database_get(darktable.db), "BEGIN TRANSACTION", NULL, NULL, NULL);
 
-    /* delete all items from the temp styles_items, this table is used only to get a ROWNUM of the results */
-    DT_DEBUG_SQLITE3_EXEC(dt_database_get(darktable.db), "DELETE FROM memory.style_items",NULL,NULL,NULL);
+  /* merge onto history stacks, this also finds the history offset in each destination image */
+  dt_history_fill_bulk_images(newimgs, -1);
 
-    /* copy history items from styles onto temp table */
-    DT_DEBUG_SQLITE3_PREPARE_V2
-      (dt_database_get(darktable.db),
-       "INSERT INTO MEMORY.style_items SELECT * FROM style_items WHERE styleid=?1 ORDER BY multi_priority DESC;", -1, &stmt, NULL);
-    DT_DEBUG_SQLITE3_BIND_INT(stmt, 1, id);
-    sqlite3_step (stmt);
-    sqlite3_finalize (stmt);
+  /* delete all items from the temp styles_items, this table is used only to get a ROWNUM of the results */
+  DT_DEBUG_SQLITE3_EXEC(dt_database_get(darktable.db), "DELETE FROM memory.style_items",NULL,NULL,NULL);
 
-    /* copy the style items into the history */
-    DT_DEBUG_SQLITE3_PREPARE_V2
-      (dt_database_get(darktable.db),
-       "INSERT INTO history (imgid,num,module,operation,op_params,enabled,blendop_params,blendop_version,multi_priority,multi_name) SELECT ?1,?2+rowid,module,operation,op_params,enabled,blendop_params,blendop_version,multi_priority,multi_name FROM MEMORY.style_items", -1, &stmt, NULL);
-    DT_DEBUG_SQLITE3_BIND_INT(stmt, 1, newimgid);
-    DT_DEBUG_SQLITE3_BIND_INT(stmt, 2, offs);
-    sqlite3_step (stmt);
-    sqlite3_finalize (stmt);
+  /* copy history items from styles onto temp table */
+  DT_DEBUG_SQLITE3_PREPARE_V2
+    (dt_database_get(darktable.db),
+     "INSERT INTO MEMORY.style_items SELECT * FROM style_items WHERE styleid=?1 ORDER BY multi_priority DESC;", -1, &stmt, NULL);
+  DT_DEBUG_SQLITE3_BIND_INT(stmt, 1, id);
+  sqlite3_step (stmt);
+  sqlite3_finalize (stmt);
 
-    /* add tag */
-    guint tagid=0;
-    gchar ntag[512]= {0};
-    g_snprintf(ntag,sizeof(ntag),"darktable|style|%s",name);
-    if (dt_tag_new(ntag,&tagid))
-      dt_tag_attach(tagid,newimgid);
+  /* copy the style items into the history of every image */
+  DT_DEBUG_SQLITE3_EXEC
+    (dt_database_get(darktable.db),
+     "INSERT INTO history (imgid,num,module,operation,op_params,enabled,blendop_params,blendop_version,multi_priority,multi_name) SELECT b.imgid,b.offs+s.rowid,s.module,s.operation,s.op_params,s.enabled,s.blendop_params,s.blendop_version,s.multi_priority,s.multi_name FROM MEMORY.bulk_images b, MEMORY.style_items s", NULL, NULL, NULL);
 
-    /* if current image in develop reload history */
-    if (dt_dev_is_current_image(darktable.develop, newimgid))
-    {
-      dt_dev_reload_history_items (darktable.develop);
-      dt_dev_modulegroups_set(darktable.develop, dt_dev_modulegroups_get(darktable.develop));
-    }
+  /* add tag */
+  guint tagid=0;
+  gchar ntag[512]= {0};
+  g_snprintf(ntag,sizeof(ntag),"darktable|style|%s",name);
+  if (dt_tag_new(ntag,&tagid))
+  {
+    DT_DEBUG_SQLITE3_PREPARE_V2(dt_database_get(darktable.db),
+                                "INSERT OR IGNORE INTO tagged_images SELECT imgid, ?1 FROM MEMORY.bulk_images", -1, &stmt, NULL);
+    DT_DEBUG_SQLITE3_BIND_INT(stmt, 1, tagid);
+    sqlite3_step (stmt);
+    sqlite3_finalize (stmt);
+  }
 
-    /* update xmp file */
-    dt_image_synch_xmp(newimgid);
+  sqlite3_exec(dt_database_get(darktable.db), "COMMIT", NULL, NULL, NULL);
 
-    /* remove old obsolete thumbnails */
-    dt_mipmap_cache_remove(darktable.mipmap_cache, newimgid);
+  /* reload develop, remove old obsolete thumbnails and update the xmp files */
+  dt_history_update_images(newimgs);
+  g_list_free(newimgs);
 
-    /* if we have created a duplicate, reset collected images */
-    if (duplicate)
-      dt_control_signal_raise(darktable.signals, DT_SIGNAL_COLLECTION_CHANGED);
+  /* if we have created a duplicate, reset collected images */
+  if (duplicate)
+    dt_control_signal_raise(darktable.signals, DT_SIGNAL_COLLECTION_CHANGED);
 
-    /* redraw center view to update visible mipmaps */
-    dt_control_queue_redraw_center();
-  }
+  /* redraw center view to update visible mipmaps */
+  dt_control_queue_redraw_center();
 }
 
 void
@@ -65,6 +65,9 @@ void dt_styles_apply_to_selection (const char *name,gboolean duplicate);
 /** applies the style to image by imgid*/
 void dt_styles_apply_to_image (const char *name,gboolean dulpicate,int32_t imgid);
 
+/** applies the style to all the images in one transaction */
+void dt_styles_apply_to_images (const char *name,gboolean duplicate,GList *imgs);
+
 /** delete a style by name */
 void dt_styles_delete_by_name (const char *name);
 
@@ -0,0 +1,456 @@
+/*
+    This file is part of darktable,
+    copyright (c) 2015 the darktable project.
+
+    darktable is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    darktable is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with darktable.  If not, see <http://www.gnu.org/licenses/>.
+*/
+#include "common/darktable.h"
+#include "common/database.h"
+#include "common/debug.h"
+#include "common/tag_index.h"
+#include "common/tags.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+typedef struct dt_tag_index_key_t
+{
+  // points into folded of the key for the whole name
+  const gchar *key;
+  // the case folded name, owned by the first key of a tag and NULL for the others
+  gchar *folded;
+  guint id;
+}
+dt_tag_index_key_t;
+
+typedef struct dt_tag_index_match_t
+{
+  guint id;
+  int count;
+}
+dt_tag_index_match_t;
+
+static void
+_key_free(dt_tag_index_key_t *k)
+{
+  g_free(k->folded);
+  g_free(k);
+}
+
+static gint
+_key_cmp(gconstpointer a, gconstpointer b)
+{
+  const dt_tag_index_key_t *ka = *(const dt_tag_index_key_t **)a;
+  const dt_tag_index_key_t *kb = *(const dt_tag_index_key_t **)b;
+  return strcmp(ka->key, kb->key);
+}
+
+static gint
+_match_cmp(gconstpointer a, gconstpointer b)
+{
+  const dt_tag_index_match_t *ma = (const dt_tag_index_match_t *)a;
+  const dt_tag_index_match_t *mb = (const dt_tag_index_match_t *)b;
+  if(ma->count != mb->count) return mb->count - ma->count;
+  return ma->id < mb->id ? -1 : ma->id > mb->id;
+}
+
+static void
+_add_keys(dt_tag_index_t *idx, const guint id, const gchar *name)
+{
+  gchar *folded = g_utf8_casefold(name, -1);
+  const gchar *c = folded;
+  while(c)
+  {
+    dt_tag_index_key_t *k = (dt_tag_index_key_t *)g_malloc(sizeof(dt_tag_index_key_t));
+    k->key = c;
+    k->folded = c == folded ? folded : NULL;
+    k->id = id;
+    g_ptr_array_add(idx->keys, k);
+    // next word, after the next run of separators
+    c = strpbrk(c, "| ");
+    while(c && (*c == '|' || *c == ' ')) c++;
+    if(c && !*c) c = NULL;
+  }
+  idx->sorted = FALSE;
+}
+
+// drops the keys of all tags in ids, keeping the order of the others.
+static void
+_remove_keys(dt_tag_index_t *idx, GHashTable *ids)
+{
+  guint j = 0;
+  for(guint i = 0; i < idx->keys->len; i++)
+  {
+    dt_tag_index_key_t *k = (dt_tag_index_key_t *)g_ptr_array_index(idx->keys, i);
+    if(g_hash_table_lookup_extended(ids, GUINT_TO_POINTER(k->id), NULL, NULL)) _key_free(k);
+    else idx->keys->pdata[j++] = k;
+  }
+  g_ptr_array_set_size(idx->keys, j);
+}
+
+static int
+_get_count(dt_tag_index_t *idx, const guint id1, const guint id2)
+{
+  GHashTable *row = (GHashTable *)g_hash_table_lookup(idx->related, GUINT_TO_POINTER(id1));
+  return row ? GPOINTER_TO_INT(g_hash_table_lookup(row, GUINT_TO_POINTER(id2))) : 0;
+}
+
+// one direction only, pairs without images are not stored.
+static void
+_set_count(dt_tag_index_t *idx, const guint id1, const guint id2, const int count)
+{
+  GHashTable *row = (GHashTable *)g_hash_table_lookup(idx->related, GUINT_TO_POINTER(id1));
+  if(count > 0)
+  {
+    if(!row)
+    {
+      row = g_hash_table_new(NULL, NULL);
+      g_hash_table_insert(idx->related, GUINT_TO_POINTER(id1), row);
+    }
+    g_hash_table_insert(row, GUINT_TO_POINTER(id2), GINT_TO_POINTER(count));
+  }
+  else if(row)
+  {
+    g_hash_table_remove(row, GUINT_TO_POINTER(id2));
+    if(g_hash_table_size(row) == 0) g_hash_table_remove(idx->related, GUINT_TO_POINTER(id1));
+  }
+}
+
+static void
+_mark_dirty(dt_tag_index_t *idx, const guint id1, const guint id2)
+{
+  gint64 *pair = (gint64 *)g_malloc(sizeof(gint64));
+  *pair = ((gint64)MIN(id1, id2) << 32) | MAX(id1, id2);
+  g_hash_table_replace(idx->dirty, pair, pair);
+}
+
+static void
+_add_count(dt_tag_index_t *idx, const guint id1, const guint id2, const int delta)
+{
+  const int count = MAX(_get_count(idx, id1, id2) + delta, 0);
+  _set_count(idx, id1, id2, count);
+  if(id1 != id2) _set_count(idx, id2, id1, count);
+  _mark_dirty(idx, id1, id2);
+}
+
+static void
+_remove_tag(dt_tag_index_t *idx, const guint id)
+{
+  GHashTable *row = (GHashTable *)g_hash_table_lookup(idx->related, GUINT_TO_POINTER(id));
+  if(row)
+  {
+    GHashTableIter it;
+    gpointer key;
+    g_hash_table_iter_init(&it, row);
+    while(g_hash_table_iter_next(&it, &key, NULL))
+    {
+      const guint other = GPOINTER_TO_UINT(key);
+      if(other != id) _set_count(idx, other, id, 0);
+      _mark_dirty(idx, id, other);
+    }
+    g_hash_table_remove(idx->related, GUINT_TO_POINTER(id));
+  }
+  g_hash_table_remove(idx->names, GUINT_TO_POINTER(id));
+}
+
+// the last row of a change log. rows added later, by other threads, are left for the next update.
+static int
+_last_rowid(const char *query)
+{
+  sqlite3_stmt *stmt;
+  int last = 0;
+  DT_DEBUG_SQLITE3_PREPARE_V2(dt_database_get(darktable.db), query, -1, &stmt, NULL);
+  if(sqlite3_step(stmt) == SQLITE_ROW) last = sqlite3_column_int(stmt, 0);
+  sqlite3_finalize(stmt);
+  return last;
+}
+
+static void
+_sync(dt_tag_index_t *idx)
+{
+  idx->last_sync = dt_get_wtime();
+  if(g_hash_table_size(idx->dirty) == 0) return;
+
+  sqlite3 *db = dt_database_get(darktable.db);
+  sqlite3_stmt *ins, *del;
+  // we might be called from within someone else's transaction
+  const int own_transaction = sqlite3_get_autocommit(db);
+  if(own_transaction) sqlite3_exec(db, "BEGIN TRANSACTION", NULL, NULL, NULL);
+  DT_DEBUG_SQLITE3_PREPARE_V2(db, "INSERT OR REPLACE INTO tagxtag (id1, id2, count) VALUES (?1, ?2, ?3)",
+                              -1, &ins, NULL);
+  DT_DEBUG_SQLITE3_PREPARE_V2(db, "DELETE FROM tagxtag WHERE id1 = ?1 AND id2 = ?2", -1, &del, NULL);
+
+  GHashTableIter it;
+  gpointer key;
+  g_hash_table_iter_init(&it, idx->dirty);
+  while(g_hash_table_iter_next(&it, &key, NULL))
+  {
+    const guint id1 = (guint)(*(gint64 *)key >> 32);
+    const guint id2 = (guint)(*(gint64 *)key & 0xffffffff);
+    const int count = _get_count(idx, id1, id2);
+    sqlite3_stmt *stmt = count > 0 ? ins : del;
+    DT_DEBUG_SQLITE3_BIND_INT(stmt, 1, id1);
+    DT_DEBUG_SQLITE3_BIND_INT(stmt, 2, id2);
+    if(count > 0) DT_DEBUG_SQLITE3_BIND_INT(stmt, 3, count);
+    sqlite3_step(stmt);
+    sqlite3_reset(stmt);
+    sqlite3_clear_bindings(stmt);
+  }
+  sqlite3_finalize(ins);
+  sqlite3_finalize(del);
+  if(own_transaction) sqlite3_exec(db, "COMMIT", NULL, NULL, NULL);
+
+  dt_print(DT_DEBUG_PERF, "[tag_index] wrote %u tag pairs in %.3f secs\n", g_hash_table_size(idx->dirty),
+           dt_get_wtime() - idx->last_sync);
+  g_hash_table_remove_all(idx->dirty);
+}
+
+static void
+_update(dt_tag_index_t *idx)
+{
+  sqlite3 *db = dt_database_get(darktable.db);
+  sqlite3_stmt *stmt;
+
+  // images getting or losing tags
+  int last = _last_rowid("SELECT MAX(rowid) FROM tagxtag_delta");
+  if(last > 0)
+  {
+    DT_DEBUG_SQLITE3_PREPARE_V2(db, "SELECT id1, id2, SUM(delta) FROM tagxtag_delta WHERE rowid <= ?1 "
+                                    "GROUP BY id1, id2",
+                                -1, &stmt, NULL);
+    DT_DEBUG_SQLITE3_BIND_INT(stmt, 1, last);
+    while(sqlite3_step(stmt) == SQLITE_ROW)
+    {
+      const int delta = sqlite3_column_int(stmt, 2);
+      if(delta) _add_count(idx, sqlite3_column_int(stmt, 0), sqlite3_column_int(stmt, 1), delta);
+    }
+    sqlite3_finalize(stmt);
+    DT_DEBUG_SQLITE3_PREPARE_V2(db, "DELETE FROM tagxtag_delta WHERE rowid <= ?1", -1, &stmt, NULL);
+    DT_DEBUG_SQLITE3_BIND_INT(stmt, 1, last);
+    sqlite3_step(stmt);
+    sqlite3_finalize(stmt);
+  }
+
+  // new, renamed and deleted tags
+  last = _last_rowid("SELECT MAX(rowid) FROM tags_changed");
+  if(last > 0)
+  {
+    // id -> current name, NULL if the tag is gone
+    GHashTable *changed = g_hash_table_new_full(NULL, NULL, NULL, g_free);
+    DT_DEBUG_SQLITE3_PREPARE_V2(db, "SELECT DISTINCT c.id, t.name FROM tags_changed c "
+                                    "LEFT JOIN tags t ON t.id = c.id WHERE c.rowid <= ?1",
+                                -1, &stmt, NULL);
+    DT_DEBUG_SQLITE3_BIND_INT(stmt, 1, last);
+    while(sqlite3_step(stmt) == SQLITE_ROW)
+    {
+      const char *name = (const char *)sqlite3_column_text(stmt, 1);
+      g_hash_table_insert(changed, GUINT_TO_POINTER(sqlite3_column_int(stmt, 0)), g_strdup(name));
+    }
+    sqlite3_finalize(stmt);
+    DT_DEBUG_SQLITE3_PREPARE_V2(db, "DELETE FROM tags_changed WHERE rowid <= ?1", -1, &stmt, NULL);
+    DT_DEBUG_SQLITE3_BIND_INT(stmt, 1, last);
+    sqlite3_step(stmt);
+    sqlite3_finalize(stmt);
+
+    _remove_keys(idx, changed);
+    GHashTableIter it;
+    gpointer key, value;
+    g_hash_table_iter_init(&it, changed);
+    while(g_hash_table_iter_next(&it, &key, &value))
+    {
+      if(value)
+      {
+        _add_keys(idx, GPOINTER_TO_UINT(key), (const gchar *)value);
+        g_hash_table_replace(idx->names, key, g_strdup((const gchar *)value));
+      }
+      else
+        _remove_tag(idx, GPOINTER_TO_UINT(key));
+    }
+    g_hash_table_destroy(changed);
+  }
+
+  if(dt_get_wtime() - idx->last_sync > DT_TAG_INDEX_SYNC_INTERVAL) _sync(idx);
+}
+
+dt_tag_index_t *dt_tag_index_new()
+{
+  dt_tag_index_t *idx = (dt_tag_index_t *)calloc(1, sizeof(dt_tag_index_t));
+  dt_pthread_mutex_init(&idx->mutex, NULL);
+  idx->keys = g_ptr_array_new();
+  idx->names = g_hash_table_new_full(NULL, NULL, NULL, g_free);
+  idx->related = g_hash_table_new_full(NULL, NULL, NULL, (GDestroyNotify)g_hash_table_destroy);
+  idx->dirty = g_hash_table_new_full(g_int64_hash, g_int64_equal, g_free, NULL);
+
+  const double start = dt_get_wtime();
+  sqlite3 *db = dt_database_get(darktable.db);
+  sqlite3_stmt *stmt;
+  DT_DEBUG_SQLITE3_PREPARE_V2(db, "SELECT id, name FROM tags WHERE name IS NOT NULL", -1, &stmt, NULL);
+  while(sqlite3_step(stmt) == SQLITE_ROW)
+  {
+    const guint id = sqlite3_column_int(stmt, 0);
+    const gchar *name = (const gchar *)sqlite3_column_text(stmt, 1);
+    _add_keys(idx, id, name);
+    g_hash_table_insert(idx->names, GUINT_TO_POINTER(id), g_strdup(name));
+  }
+  sqlite3_finalize(stmt);
+  DT_DEBUG_SQLITE3_PREPARE_V2(db, "SELECT id1, id2, count FROM tagxtag WHERE count > 0", -1, &stmt, NULL);
+  while(sqlite3_step(stmt) == SQLITE_ROW)
+  {
+    const guint id1 = sqlite3_column_int(stmt, 0), id2 = sqlite3_column_int(stmt, 1);
+    const int count = sqlite3_column_int(stmt, 2);
+    _set_count(idx, id1, id2, count);
+    _set_count(idx, id2, id1, count);
+  }
+  sqlite3_finalize(stmt);
+  idx->last_sync = dt_get_wtime();
+  // tags attached before we got here are not in tagxtag yet
+  _update(idx);
+
+  g_ptr_array_sort(idx->keys, _key_cmp);
+  idx->sorted = TRUE;
+  dt_print(DT_DEBUG_PERF, "[tag_index] loaded %u tags in %.3f secs\n", g_hash_table_size(idx->names),
+           dt_get_wtime() - start);
+  return idx;
+}
+
+void dt_tag_index_destroy(dt_tag_index_t *idx)
+{
+  if(!idx) return;
+  dt_pthread_mutex_lock(&idx->mutex);
+  _update(idx);
+  _sync(idx);
+  dt_pthread_mutex_unlock(&idx->mutex);
+
+  for(guint i = 0; i < idx->keys->len; i++) _key_free((dt_tag_index_key_t *)g_ptr_array_index(idx->keys, i));
+  g_ptr_array_free(idx->keys, TRUE);
+  g_hash_table_destroy(idx->names);
+  g_hash_table_destroy(idx->related);
+  g_hash_table_destroy(idx->dirty);
+  dt_pthread_mutex_destroy(&idx->mutex);
+  free(idx);
+}
+
+void dt_tag_index_update(dt_tag_index_t *idx)
+{
+  if(!idx) return;
+  dt_pthread_mutex_lock(&idx->mutex);
+  _update(idx);
+  dt_pthread_mutex_unlock(&idx->mutex);
+}
+
+void dt_tag_index_sync(dt_tag_index_t *idx)
+{
+  if(!idx) return;
+  dt_pthread_mutex_lock(&idx->mutex);
+  _update(idx);
+  _sync(idx);
+  dt_pthread_mutex_unlock(&idx->mutex);
+}
+
+static void
+_append_result(dt_tag_index_t *idx, const guint id, GList **result, uint32_t *count)
+{
+  const gchar *name = (const gchar *)g_hash_table_lookup(idx->names, GUINT_TO_POINTER(id));
+  if(!name || g_str_has_prefix(name, "darktable|")) return;
+  dt_tag_t *t = g_malloc(sizeof(dt_tag_t));
+  t->tag = g_strdup(name);
+  t->id = id;
+  *result = g_list_prepend(*result, t);
+  (*count)++;
+}
+
+uint32_t dt_tag_index_get_suggestions(dt_tag_index_t *idx, const gchar *keyword, GList **result)
+{
+  if(!idx || !keyword) return 0;
+  dt_pthread_mutex_lock(&idx->mutex);
+  _update(idx);
+  if(!idx->sorted)
+  {
+    g_ptr_array_sort(idx->keys, _key_cmp);
+    idx->sorted = TRUE;
+  }
+
+  // the range of keys starting with the keyword
+  gchar *prefix = g_utf8_casefold(keyword, -1);
+  const size_t len = strlen(prefix);
+  guint lo = 0, hi = idx->keys->len;
+  while(lo < hi)
+  {
+    const guint mid = lo + (hi - lo) / 2;
+    if(strcmp(((dt_tag_index_key_t *)g_ptr_array_index(idx->keys, mid))->key, prefix) < 0) lo = mid + 1;
+    else hi = mid;
+  }
+
+  // the matching tags, most used first
+  GHashTable *matched = g_hash_table_new(NULL, NULL);
+  GArray *matches = g_array_new(FALSE, FALSE, sizeof(dt_tag_index_match_t));
+  for(guint i = lo; i < idx->keys->len; i++)
+  {
+    const dt_tag_index_key_t *k = (dt_tag_index_key_t *)g_ptr_array_index(idx->keys, i);
+    if(strncmp(k->key, prefix, len)) break;
+    if(g_hash_table_lookup_extended(matched, GUINT_TO_POINTER(k->id), NULL, NULL)) continue;
+    g_hash_table_insert(matched, GUINT_TO_POINTER(k->id), NULL);
+    const dt_tag_index_match_t m = { k->id, _get_count(idx, k->id, k->id) };
+    g_array_append_val(matches, m);
+  }
+  g_free(prefix);
+  g_array_sort(matches, _match_cmp);
+
+  // followed by the tags attached to the same images, by the number of images shared with all matches
+  GHashTable *scores = g_hash_table_new(NULL, NULL);
+  for(guint i = 0; i < matches->len; i++)
+  {
+    GHashTable *row = (GHashTable *)g_hash_table_lookup(idx->related,
+                                                        GUINT_TO_POINTER(g_array_index(matches, dt_tag_index_match_t, i).id));
+    if(!row) continue;
+    GHashTableIter it;
+    gpointer key, value;
+    g_hash_table_iter_init(&it, row);
+    while(g_hash_table_iter_next(&it, &key, &value))
+    {
+      if(g_hash_table_lookup_extended(matched, key, NULL, NULL)) continue;
+      const int score = GPOINTER_TO_INT(g_hash_table_lookup(scores, key)) + GPOINTER_TO_INT(value);
+      g_hash_table_insert(scores, key, GINT_TO_POINTER(score));
+    }
+  }
+  GArray *related = g_array_sized_new(FALSE, FALSE, sizeof(dt_tag_index_match_t), g_hash_table_size(scores));
+  GHashTableIter it;
+  gpointer key, value;
+  g_hash_table_iter_init(&it, scores);
+  while(g_hash_table_iter_next(&it, &key, &value))
+  {
+    const dt_tag_index_match_t m = { GPOINTER_TO_UINT(key), GPOINTER_TO_INT(value) };
+    g_array_append_val(related, m);
+  }
+  g_array_sort(related, _match_cmp);
+
+  uint32_t count = 0;
+  GList *list = NULL;
+  for(guint i = 0; i < matches->len; i++)
+    _append_result(idx, g_array_index(matches, dt_tag_index_match_t, i).id, &list, &count);
+  for(guint i = 0; i < related->len; i++)
+    _append_result(idx, g_array_index(related, dt_tag_index_match_t, i).id, &list, &count);
+  dt_pthread_mutex_unlock(&idx->mutex);
+
+  *result = g_list_concat(*result, g_list_reverse(list));
+  g_hash_table_destroy(matched);
+  g_hash_table_destroy(scores);
+  g_array_free(matches, TRUE);
+  g_array_free(related, TRUE);
+  return count;
+}
+
+// modelines: These editor modelines have been set for all relevant files by tools/update_modelines.sh
+// vim: shiftwidth=2 expandtab tabstop=2 cindent
+// kate: tab-indents: off; indent-width 2; replace-tabs on; indent-mode cstyle; remove-trailing-spaces modified;
@@ -0,0 +1,67 @@
+/*
+    This file is part of darktable,
+    copyright (c) 2015 the darktable project.
+
+    darktable is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    darktable is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with darktable.  If not, see <http://www.gnu.org/licenses/>.
+*/
+#ifndef DT_TAG_INDEX_H
+#define DT_TAG_INDEX_H
+
+#include "common/darktable.h"
+#include "common/dtpthread.h"
+
+#include <glib.h>
+
+/** seconds between writing changed co-occurrence counts back to tagxtag */
+#define DT_TAG_INDEX_SYNC_INTERVAL 60.0
+
+/** the tag names and the co-occurrence counts of tagxtag, kept in memory for the
+ *  suggestions of the tagging module. changes to tags and tagged_images are logged by
+ *  temp triggers (see database.c) and picked up before each lookup, the counts go back
+ *  to the database once in a while and on shutdown. */
+typedef struct dt_tag_index_t
+{
+  dt_pthread_mutex_t mutex;
+
+  // dt_tag_index_key_t, sorted by key: the case folded name and the rest of it after
+  // every '|' and space, so a binary search finds all tags with a word starting with a prefix.
+  GPtrArray *keys;
+  gboolean sorted;
+  // tag id -> name
+  GHashTable *names;
+  // tag id -> (tag id -> number of images having both), symmetric. the entry of a tag
+  // for itself is the number of images it is attached to.
+  GHashTable *related;
+  // pairs (id1 << 32 | id2, id1 <= id2) changed since the last write to tagxtag
+  GHashTable *dirty;
+  double last_sync;
+}
+dt_tag_index_t;
+
+/** loads the tags and tagxtag. */
+dt_tag_index_t *dt_tag_index_new();
+/** writes the pending counts and frees the index. */
+void dt_tag_index_destroy(dt_tag_index_t *idx);
+/** applies the changes logged in the database since the last call. */
+void dt_tag_index_update(dt_tag_index_t *idx);
+/** writes the changed counts to tagxtag. */
+void dt_tag_index_sync(dt_tag_index_t *idx);
+/** appends the tags with a word starting with keyword (most used first) followed by
+ *  the tags used together with them (most often first) to result, as dt_tag_t. */
+uint32_t dt_tag_index_get_suggestions(dt_tag_index_t *idx, const gchar *keyword, GList **result);
+
+#endif
+// modelines: These editor modelines have been set for all relevant files by tools/update_modelines.sh
+// vim: shiftwidth=2 expandtab tabstop=2 cindent
+// kate: tab-indents: off; indent-width 2; replace-tabs on; indent-mode cstyle; remove-trailing-spaces modified;
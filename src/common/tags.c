@@ -18,6 +18,7 @@
 */
 
 #include "common/darktable.h"
+#include "common/tag_index.h"
 #include "common/tags.h"
 #include "common/debug.h"
 #include "control/conf.h"
@@ -168,14 +169,13 @@ gboolean dt_tag_exists(const char *name,guint *tagid)
   return FALSE;
 }
 
-//FIXME: shall we increment count in tagxtag if the image was already tagged?
 void dt_tag_attach(guint tagid,gint imgid)
 {
   sqlite3_stmt *stmt;
   if(imgid > 0)
   {
     DT_DEBUG_SQLITE3_PREPARE_V2(dt_database_get(darktable.db),
-                                "INSERT OR REPLACE INTO tagged_images (imgid, tagid) VALUES (?1, ?2)",
+                                "INSERT OR IGNORE INTO tagged_images (imgid, tagid) VALUES (?1, ?2)",
                                 -1, &stmt, NULL);
     DT_DEBUG_SQLITE3_BIND_INT(stmt, 1, imgid);
     DT_DEBUG_SQLITE3_BIND_INT(stmt, 2, tagid);
@@ -186,12 +186,13 @@ void dt_tag_attach(guint tagid,gint imgid)
   {
     // insert into tagged_images if not there already.
     DT_DEBUG_SQLITE3_PREPARE_V2(dt_database_get(darktable.db),
-                                "INSERT OR REPLACE INTO tagged_images SELECT imgid, ?1 "
+                                "INSERT OR IGNORE INTO tagged_images SELECT imgid, ?1 "
                                 "FROM selected_images", -1, &stmt, NULL);
     DT_DEBUG_SQLITE3_BIND_INT(stmt, 1, tagid);
     sqlite3_step(stmt);
     sqlite3_finalize(stmt);
   }
+  dt_tag_index_update(darktable.tag_index);
 }
 
 void dt_tag_attach_list(GList *tags,gint imgid)
@@ -255,6 +256,7 @@ void dt_tag_detach(guint tagid,gint imgid)
     sqlite3_step(stmt);
     sqlite3_finalize(stmt);
   }
+  dt_tag_index_update(darktable.tag_index);
 }
 
 void dt_tag_detach_by_string(const char *name, gint imgid)
@@ -383,110 +385,18 @@ gchar *dt_tag_get_hierarchical(gint imgid, const gchar *separator)
 }
 
 /*
- * dt_tag_get_suggestions() takes a string (keyword) and searches the
- * tagxtags table for possibly-related tags. The list we construct at
- * the end of the function is made up as follows:
- *
- * * Tags which appear as tagxtag.id2, where (keyword's name = tagxtag.id1)
- *   are listed first, ordered by count of times seen already.
- * * Tags which appear as tagxtag.id1, where (keyword's name = tagxtag.id2)
- *   are listed second, ordered as before.
- *
- * We do not suggest tags which have not yet been matched up in tagxtag,
- * because it is up to the user to add new tags to the list and thereby
- * make the association.
- *
- * Expressing these as separate queries avoids making the sqlite3 engine
- * do a large number of operations and thus makes the user experience
- * snappy.
- *
- * SELECT T.id FROM tags T WHERE T.name LIKE '?1';  --> into temp table
- * SELECT TXT.id2 FROM tagxtag TXT WHERE TXT.id1 IN (temp table)
- *   AND TXT.count > 0 ORDER BY TXT.count DESC;
- * SELECT TXT.id1 FROM tagxtag TXT WHERE TXT.id2 IN (temp table)
- *   AND TXT.count > 0 ORDER BY TXT.count DESC;
- *
- * SELECT DISTINCT(T.name) FROM tags T JOIN memoryquery MQ on MQ.id = T.id;
+ * dt_tag_get_suggestions() lists the tags having a word starting with
+ * keyword, most used first, followed by the tags attached to the same
+ * images as those, most often first. We do not suggest tags which have
+ * not yet been used together, because it is up to the user to add new
+ * tags to the list and thereby make the association.
  *
+ * This is called on every keystroke, so it is answered from the tag
+ * names and tagxtag counts kept in memory by common/tag_index.c.
  */
 uint32_t dt_tag_get_suggestions(const gchar *keyword, GList **result)
 {
-  sqlite3_stmt *stmt;
-  char query[1024];
-  /*
-   * Earlier versions of this function used a large collation of selects
-   * and joins, resulting in multi-*second* timings for sqlite3_exec().
-   *
-   * Breaking the query into several smaller ones allows the sqlite3
-   * execution engine to work more effectively, which is very important
-   * for interactive response since we call this function several times
-   * in quick succession (on every keystroke).
-   */
-
-  /* Quick sanity check - is keyword empty? If so .. return 0 */
-  if (keyword == 0)
-    return 0;
-
-  /* SELECT T.id FROM tags T WHERE T.name LIKE '%%%s%%';  --> into temp table */
-  memset(query, 0, sizeof(query));
-  snprintf(query, sizeof(query),
-           "INSERT INTO memory.tagq (id) SELECT id FROM tags T WHERE "
-           "T.name LIKE '%%%s%%' ", keyword);
-  DT_DEBUG_SQLITE3_EXEC(dt_database_get(darktable.db), query,
-                        NULL, NULL, NULL);
-
-  /*
-   * SELECT TXT.id2 FROM tagxtag TXT WHERE TXT.id1 IN (temp table)
-   *   AND TXT.count > 0 ORDER BY TXT.count DESC;
-   */
-  DT_DEBUG_SQLITE3_EXEC(dt_database_get(darktable.db),
-                        "INSERT INTO memory.taglist (id, count) "
-                        "SELECT DISTINCT(TXT.id2), TXT.count FROM tagxtag TXT "
-                        "WHERE TXT.count > 0 "
-                        " AND TXT.id1 IN (SELECT id FROM memory.tagq) "
-                        "ORDER BY TXT.count DESC",
-                        NULL, NULL, NULL);
-
-  /*
-   * SELECT TXT.id1 FROM tagxtag TXT WHERE TXT.id2 IN (temp table)
-   *   AND TXT.count > 0 ORDER BY TXT.count DESC;
-   */
-  DT_DEBUG_SQLITE3_EXEC(dt_database_get(darktable.db),
-                        "INSERT OR REPLACE INTO memory.taglist (id, count) "
-                        "SELECT DISTINCT(TXT.id1), TXT.count FROM tagxtag TXT "
-                        "WHERE TXT.count > 0 "
-                        " AND TXT.id2 IN (SELECT id FROM memory.tagq) "
-                        "ORDER BY TXT.count DESC",
-                        NULL, NULL, NULL);
-
-  /* Now put all the bits together */
-  DT_DEBUG_SQLITE3_PREPARE_V2(dt_database_get(darktable.db),
-                              "SELECT T.name, T.id FROM tags T "
-                              "JOIN memory.taglist MT ON MT.id = T.id "
-                              "WHERE T.id IN (SELECT DISTINCT(MT.id) FROM memory.taglist MT) "
-                              "  AND T.name NOT LIKE 'darktable|%%' "
-                              "ORDER BY MT.count DESC",
-                              -1, &stmt, NULL);
-
-  /* ... and create the result list to send upwards */
-  uint32_t count=0;
-  dt_tag_t *t;
-  while(sqlite3_step(stmt) == SQLITE_ROW)
-  {
-    t = g_malloc(sizeof(dt_tag_t));
-    t->tag = g_strdup((char *)sqlite3_column_text(stmt, 0));
-    t->id = sqlite3_column_int(stmt, 1);
-    *result = g_list_append((*result),t);
-    count++;
-  }
-
-  sqlite3_finalize(stmt);
-  DT_DEBUG_SQLITE3_EXEC(dt_database_get(darktable.db),
-                        "DELETE from memory.taglist", NULL, NULL, NULL);
-  DT_DEBUG_SQLITE3_EXEC(dt_database_get(darktable.db),
-                        "DELETE from memory.tagq", NULL, NULL, NULL);
-
-  return count;
+  return dt_tag_index_get_suggestions(darktable.tag_index, keyword, result);
 }
 
 static void _free_result_item(dt_tag_t *t,gpointer unused)
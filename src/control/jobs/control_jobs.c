@@ -31,6 +31,7 @@
 #include "common/tags.h"
 #include "common/debug.h"
 #include "common/gpx.h"
+#include "common/readahead.h"
 #include "control/conf.h"
 #include "control/jobs/control_jobs.h"
 #include "control/progress.h"
@@ -50,7 +51,7 @@ typedef struct dt_control_time_offset_t
 
 typedef struct dt_control_gpx_apply_t
 {
-  gchar *filename;
+  GList *filenames;
   gchar *tz;
 } dt_control_gpx_apply_t;
 
@@ -661,108 +662,41 @@ static int32_t dt_control_delete_images_job_run(dt_job_t *job)
 static int32_t dt_control_gpx_apply_job_run(dt_job_t *job)
 {
   dt_control_image_enumerator_t *params = dt_control_job_get_params(job);
-  GList *t = params->index;
   struct dt_gpx_t *gpx = NULL;
-  uint32_t cntr = 0;
   const dt_control_gpx_apply_t *d = params->data;
-  const gchar *filename = d->filename;
-  const gchar *tz = d->tz;
+  int res = 1;
 
   /* do we have any selected images */
-  if (!t)
+  if (!params->index)
     goto bail_out;
 
-  /* try parse the gpx data */
-  gpx = dt_gpx_new(filename);
+  /* try parse the gpx data, all files make up one track */
+  for(GList *f = d->filenames; f; f = g_list_next(f))
+  {
+    if(!gpx)
+      gpx = dt_gpx_new((const gchar *)f->data);
+    else if(!dt_gpx_add(gpx, (const gchar *)f->data))
+      fprintf(stderr, "[gpx apply] failed to parse `%s'\n", (const gchar *)f->data);
+  }
   if (!gpx)
   {
     dt_control_log(_("failed to parse GPX file"));
     goto bail_out;
   }
 
-  GTimeZone *tz_camera = (tz == NULL)?g_time_zone_new_utc():g_time_zone_new(tz);
-  if(!tz_camera)
-    goto bail_out;
-  GTimeZone *tz_utc = g_time_zone_new_utc();
-
-  /* go thru each selected image and lookup location in gpx */
-  do
-  {
-    GTimeVal timestamp;
-    GDateTime *exif_time, *utc_time;
-    gdouble lon,lat;
-    int imgid = GPOINTER_TO_INT(t->data);
-
-    /* get image */
-    const dt_image_t *cimg = dt_image_cache_read_get(darktable.image_cache, imgid);
-    if (!cimg)
-      continue;
-
-    /* convert exif datetime
-       TODO: exiv2 dates should be iso8601 and we are probably doing some ugly
-       conversion before inserting into database.
-     */
-    gint year;
-    gint month;
-    gint day;
-    gint hour;
-    gint minute;
-    gint  seconds;
-
-    if (sscanf(cimg->exif_datetime_taken, "%d:%d:%d %d:%d:%d",
-               (int*)&year, (int*)&month, (int*)&day,
-               (int*)&hour,(int*)&minute,(int*)&seconds) != 6)
-    {
-      fprintf(stderr,"broken exif time in db, '%s'\n", cimg->exif_datetime_taken);
-      dt_image_cache_read_release(darktable.image_cache, cimg);
-      continue;
-    }
-
-    /* release the lock */
-    dt_image_cache_read_release(darktable.image_cache, cimg);
-
-    exif_time = g_date_time_new(tz_camera, year, month, day, hour, minute, seconds);
-    if(!exif_time)
-      continue;
-    utc_time = g_date_time_to_timezone(exif_time, tz_utc);
-    g_date_time_unref(exif_time);
-    if(!utc_time)
-      continue;
-    gboolean res = g_date_time_to_timeval(utc_time, &timestamp);
-    g_date_time_unref(utc_time);
-    if(!res)
-      continue;
-
-    /* only update image location if time is within gpx tack range */
-    if(dt_gpx_get_location(gpx, &timestamp, &lon, &lat))
-    {
-      dt_image_set_location(imgid, lon, lat);
-      cntr++;
-    }
-
-  }
-  while((t = g_list_next(t)) != NULL);
-
+  const int cntr = dt_gpx_apply(gpx, params->index, d->tz);
   dt_control_log(_("applied matched GPX location onto %d image(s)"), cntr);
-
-  g_time_zone_unref(tz_camera);
-  g_time_zone_unref(tz_utc);
-  dt_gpx_destroy(gpx);
-  g_free(d->filename);
-  g_free(d->tz);
-  g_free(params->data);
-  free(params);
-  return 0;
+  res = 0;
 
 bail_out:
   if (gpx)
     dt_gpx_destroy(gpx);
 
-  g_free(d->filename);
+  g_list_free_full(d->filenames, g_free);
   g_free(d->tz);
   g_free(params->data);
   free(params);
-  return 1;
+  return res;
 }
 
 static int32_t dt_control_move_images_job_run(dt_job_t *job)
@@ -912,6 +846,11 @@ static int32_t dt_control_export_job_run(dt_job_t *job)
           imgid = GPOINTER_TO_INT(t->data);
           t = g_list_delete_link(t, t);
           num = total - g_list_length(t);
+          // have the raws of the next images read while this one is processed
+          int upcoming[DT_READAHEAD_MAX], num_upcoming = 0;
+          for(const GList *u = t; u && num_upcoming < DT_READAHEAD_MAX; u = g_list_next(u))
+            upcoming[num_upcoming++] = GPOINTER_TO_INT(u->data);
+          dt_readahead_images(darktable.readahead, upcoming, num_upcoming);
         }
       }
       // remove 'changed' tag from image
@@ -967,7 +906,7 @@ static int32_t dt_control_export_job_run(dt_job_t *job)
   return 0;
 }
 
-static dt_job_t * dt_control_gpx_apply_job_create(const gchar *filename, int32_t filmid, const gchar *tz)
+static dt_job_t * dt_control_gpx_apply_job_create(GList *filenames, int32_t filmid, const gchar *tz)
 {
   dt_job_t *job = dt_control_job_create(&dt_control_gpx_apply_job_run, "gpx apply");
   if(!job) return NULL;
@@ -984,7 +923,9 @@ static dt_job_t * dt_control_gpx_apply_job_create(const gchar *filename, int32_t
     dt_control_image_enumerator_job_selected_init(params);
 
   dt_control_gpx_apply_t *data = (dt_control_gpx_apply_t*)malloc(sizeof(dt_control_gpx_apply_t));
-  data->filename = g_strdup(filename);
+  data->filenames = NULL;
+  for(GList *f = g_list_last(filenames); f; f = g_list_previous(f))
+    data->filenames = g_list_prepend(data->filenames, g_strdup((const gchar *)f->data));
   data->tz = g_strdup(tz);
   params->data = data;
   return job;
@@ -997,7 +938,14 @@ void dt_control_merge_hdr()
 
 void dt_control_gpx_apply(const gchar *filename, int32_t filmid, const gchar *tz)
 {
-  dt_control_add_job(darktable.control, DT_JOB_QUEUE_USER_FG, dt_control_gpx_apply_job_create(filename, filmid, tz));
+  GList *filenames = g_list_append(NULL, (gpointer)filename);
+  dt_control_gpx_apply_files(filenames, filmid, tz);
+  g_list_free(filenames);
+}
+
+void dt_control_gpx_apply_files(GList *filenames, int32_t filmid, const gchar *tz)
+{
+  dt_control_add_job(darktable.control, DT_JOB_QUEUE_USER_FG, dt_control_gpx_apply_job_create(filenames, filmid, tz));
 }
 
 void dt_control_duplicate_images()
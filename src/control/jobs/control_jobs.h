@@ -39,6 +39,8 @@ typedef struct dt_control_image_enumerator_t
 dt_control_image_enumerator_t;
 
 void dt_control_gpx_apply(const gchar *filename, int32_t filmid, const gchar *tz);
+/** geotags from several gpx files at once, merged into one track */
+void dt_control_gpx_apply_files(GList *filenames, int32_t filmid, const gchar *tz);
 
 void dt_control_time_offset(const long int offset, int imgid);
 
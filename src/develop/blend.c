@@ -23,6 +23,8 @@
 #include "common/gaussian.h"
 #include "blend.h"
 
+#include <xmmintrin.h>
+
 #define CLAMP_RANGE(x,y,z)      (CLAMP(x,y,z))
 
 typedef void (_blend_row_func)(dt_iop_colorspace_type_t cst,const float *a, float *b, const float *mask, size_t stride, int flag);
@@ -407,8 +409,117 @@ static void _blend_make_mask(dt_iop_colorspace_type_t cst, const unsigned int bl
 
 
 
+/* sse version of _blend_make_mask(), producing the same mask for four pixels
+   at a time. it covers Lab and rgb as long as no hue/chroma/saturation based
+   channel is involved, everything else is left to the per pixel version. */
+static void _blend_make_mask_sse(dt_iop_colorspace_type_t cst, const unsigned int blendif, const float *blendif_parameters, const unsigned int mask_mode, const unsigned int mask_combine,
+                                 const float gopacity, const float *a, const float *b, float *mask, size_t stride)
+{
+  const int conditional = mask_mode & DEVELOP_MASK_CONDITIONAL;
+  if(cst == iop_cs_RAW || (conditional && (blendif & 0x7f00)))
+  {
+    _blend_make_mask(cst, blendif, blendif_parameters, mask_mode, mask_combine, gopacity, a, b, mask, stride);
+    return;
+  }
+
+  const int incl = mask_combine & DEVELOP_COMBINE_INCL;
+  const unsigned int channel_mask = (cst == iop_cs_Lab) ? DEVELOP_BLENDIF_Lab_MASK : DEVELOP_BLENDIF_RGB_MASK;
+
+  /* channels with sliders spanning the whole range contribute a constant factor,
+     the others are evaluated per pixel. with the HSL/LCh channels excluded
+     above only the first eight can be active. without a conditional mask the
+     result stays at 1, which yields the same neutral value as _blendif_factor(). */
+  float constant = 1.0f;
+  int active[8], nactive = 0;
+  __m128 p0[8], p1[8], p2[8], p3[8], ilo[8], ihi[8];
+  for(int ch=0; conditional && ch<=DEVELOP_BLENDIF_MAX; ch++)
+  {
+    if((channel_mask & (1<<ch)) == 0) continue;
+    if((blendif & (1<<ch)) == 0)
+    {
+      constant *= !(blendif & (1<<(ch+16))) == !incl ? 1.0f : 0.0f;
+      continue;
+    }
+    const float *par = blendif_parameters + 4*ch;
+    p0[nactive] = _mm_set1_ps(par[0]);
+    p1[nactive] = _mm_set1_ps(par[1]);
+    p2[nactive] = _mm_set1_ps(par[2]);
+    p3[nactive] = _mm_set1_ps(par[3]);
+    ilo[nactive] = _mm_set1_ps(1.0f/fmax(0.01f, par[1]-par[0]));
+    ihi[nactive] = _mm_set1_ps(1.0f/fmax(0.01f, par[3]-par[2]));
+    active[nactive++] = ch;
+  }
+
+  const __m128 zero = _mm_setzero_ps();
+  const __m128 one = _mm_set1_ps(1.0f);
+  const __m128 gop = _mm_set1_ps(gopacity);
+  const size_t npixels = stride/4;
+  size_t i = 0;
+  for(; i+4<=npixels; i+=4)
+  {
+    __m128 result = _mm_set1_ps(constant);
+    if(nactive)
+    {
+      __m128 a0 = _mm_loadu_ps(a + 4*i), a1 = _mm_loadu_ps(a + 4*i + 4), a2 = _mm_loadu_ps(a + 4*i + 8), a3 = _mm_loadu_ps(a + 4*i + 12);
+      __m128 b0 = _mm_loadu_ps(b + 4*i), b1 = _mm_loadu_ps(b + 4*i + 4), b2 = _mm_loadu_ps(b + 4*i + 8), b3 = _mm_loadu_ps(b + 4*i + 12);
+      _MM_TRANSPOSE4_PS(a0, a1, a2, a3);
+      _MM_TRANSPOSE4_PS(b0, b1, b2, b3);
+
+      __m128 scaled[8];
+      if(cst == iop_cs_Lab)
+      {
+        const __m128 c100 = _mm_set1_ps(1.0f/100.0f), c128 = _mm_set1_ps(128.0f), c256 = _mm_set1_ps(1.0f/256.0f);
+        scaled[DEVELOP_BLENDIF_L_in] = _mm_mul_ps(a0, c100);
+        scaled[DEVELOP_BLENDIF_A_in] = _mm_mul_ps(_mm_add_ps(a1, c128), c256);
+        scaled[DEVELOP_BLENDIF_B_in] = _mm_mul_ps(_mm_add_ps(a2, c128), c256);
+        scaled[3] = zero;
+        scaled[DEVELOP_BLENDIF_L_out] = _mm_mul_ps(b0, c100);
+        scaled[DEVELOP_BLENDIF_A_out] = _mm_mul_ps(_mm_add_ps(b1, c128), c256);
+        scaled[DEVELOP_BLENDIF_B_out] = _mm_mul_ps(_mm_add_ps(b2, c128), c256);
+        scaled[7] = zero;
+      }
+      else
+      {
+        const __m128 wr = _mm_set1_ps(0.3f), wg = _mm_set1_ps(0.59f), wb = _mm_set1_ps(0.11f);
+        scaled[DEVELOP_BLENDIF_GRAY_in] = _mm_add_ps(_mm_add_ps(_mm_mul_ps(wr, a0), _mm_mul_ps(wg, a1)), _mm_mul_ps(wb, a2));
+        scaled[DEVELOP_BLENDIF_RED_in] = a0;
+        scaled[DEVELOP_BLENDIF_GREEN_in] = a1;
+        scaled[DEVELOP_BLENDIF_BLUE_in] = a2;
+        scaled[DEVELOP_BLENDIF_GRAY_out] = _mm_add_ps(_mm_add_ps(_mm_mul_ps(wr, b0), _mm_mul_ps(wg, b1)), _mm_mul_ps(wb, b2));
+        scaled[DEVELOP_BLENDIF_RED_out] = b0;
+        scaled[DEVELOP_BLENDIF_GREEN_out] = b1;
+        scaled[DEVELOP_BLENDIF_BLUE_out] = b2;
+      }
+
+      for(int k=0; k<nactive; k++)
+      {
+        const int ch = active[k];
+        const __m128 v = _mm_min_ps(one, _mm_max_ps(zero, scaled[ch]));
+        const __m128 in_mid = _mm_and_ps(_mm_cmpge_ps(v, p1[k]), _mm_cmple_ps(v, p2[k]));
+        const __m128 in_lo = _mm_and_ps(_mm_cmpgt_ps(v, p0[k]), _mm_cmplt_ps(v, p1[k]));
+        const __m128 in_hi = _mm_andnot_ps(in_lo, _mm_and_ps(_mm_cmpgt_ps(v, p2[k]), _mm_cmplt_ps(v, p3[k])));
+        __m128 factor = _mm_or_ps(_mm_and_ps(in_mid, one),
+                                  _mm_or_ps(_mm_and_ps(in_lo, _mm_mul_ps(_mm_sub_ps(v, p0[k]), ilo[k])),
+                                            _mm_and_ps(in_hi, _mm_sub_ps(one, _mm_mul_ps(_mm_sub_ps(v, p2[k]), ihi[k])))));
+        if(blendif & (1<<(ch+16))) factor = _mm_sub_ps(one, factor);  // inverted channel?
+        result = _mm_mul_ps(result, incl ? _mm_sub_ps(one, factor) : factor);
+      }
+    }
+    const __m128 cond = incl ? _mm_sub_ps(one, result) : result;
+
+    const __m128 form = _mm_loadu_ps(mask + i);
+    __m128 opacity = incl ? _mm_sub_ps(one, _mm_mul_ps(_mm_sub_ps(one, form), _mm_sub_ps(one, cond))) : _mm_mul_ps(form, cond);
+    if(mask_combine & DEVELOP_COMBINE_INV) opacity = _mm_sub_ps(one, opacity);
+    _mm_storeu_ps(mask + i, _mm_mul_ps(opacity, gop));
+  }
+  if(i < npixels)
+    _blend_make_mask(cst, blendif, blendif_parameters, mask_mode, mask_combine, gopacity, a + 4*i, b + 4*i, mask + i, stride - 4*i);
+}
+
+
+
 /* normal blend with clamping */
-static void _blend_normal_bounded(dt_iop_colorspace_type_t cst,const float *a, float *b, const float *mask, size_t stride, int flag)
+static inline void _blend_normal_bounded(dt_iop_colorspace_type_t cst,const float *a, float *b, const float *mask, size_t stride, int flag)
 {
   float ta[3], tb[3];
   int channels = _blend_colorspace_channels(cst);
@@ -449,7 +560,7 @@ static void _blend_normal_bounded(dt_iop_colorspace_type_t cst,const float *a, f
 }
 
 /* normal blend without any clamping */
-static void _blend_normal_unbounded(dt_iop_colorspace_type_t cst,const float *a, float *b, const float *mask, size_t stride, int flag)
+static inline void _blend_normal_unbounded(dt_iop_colorspace_type_t cst,const float *a, float *b, const float *mask, size_t stride, int flag)
 {
   float ta[3], tb[3];
   int channels = _blend_colorspace_channels(cst);
@@ -492,7 +603,7 @@ static void _blend_normal_unbounded(dt_iop_colorspace_type_t cst,const float *a,
 
 
 /* lighten */
-static void _blend_lighten(dt_iop_colorspace_type_t cst,const float *a, float *b, const float *mask, size_t stride, int flag)
+static inline void _blend_lighten(dt_iop_colorspace_type_t cst,const float *a, float *b, const float *mask, size_t stride, int flag)
 {
   int channels = _blend_colorspace_channels(cst);
   float ta[3], tb[3], tbo;
@@ -534,7 +645,7 @@ static void _blend_lighten(dt_iop_colorspace_type_t cst,const float *a, float *b
 }
 
 /* darken */
-static void _blend_darken(dt_iop_colorspace_type_t cst,const float *a, float *b, const float *mask, size_t stride, int flag)
+static inline void _blend_darken(dt_iop_colorspace_type_t cst,const float *a, float *b, const float *mask, size_t stride, int flag)
 {
   int channels = _blend_colorspace_channels(cst);
   float ta[3], tb[3], tbo;
@@ -578,7 +689,7 @@ static void _blend_darken(dt_iop_colorspace_type_t cst,const float *a, float *b,
 
 
 /* multiply */
-static void _blend_multiply(dt_iop_colorspace_type_t cst,const float *a, float *b, const float *mask, size_t stride, int flag)
+static inline void _blend_multiply(dt_iop_colorspace_type_t cst,const float *a, float *b, const float *mask, size_t stride, int flag)
 {
   float ta[3], tb[3];
   int channels = _blend_colorspace_channels(cst);
@@ -641,7 +752,7 @@ static void _blend_multiply(dt_iop_colorspace_type_t cst,const float *a, float *
 
 
 /* average */
-static void _blend_average(dt_iop_colorspace_type_t cst,const float *a, float *b, const float *mask, size_t stride, int flag)
+static inline void _blend_average(dt_iop_colorspace_type_t cst,const float *a, float *b, const float *mask, size_t stride, int flag)
 {
   float ta[3], tb[3];
   int channels = _blend_colorspace_channels(cst);
@@ -684,7 +795,7 @@ static void _blend_average(dt_iop_colorspace_type_t cst,const float *a, float *b
 
 
 /* add */
-static void _blend_add(dt_iop_colorspace_type_t cst,const float *a, float *b, const float *mask, size_t stride, int flag)
+static inline void _blend_add(dt_iop_colorspace_type_t cst,const float *a, float *b, const float *mask, size_t stride, int flag)
 {
   float ta[3], tb[3];
   int channels = _blend_colorspace_channels(cst);
@@ -730,7 +841,7 @@ static void _blend_add(dt_iop_colorspace_type_t cst,const float *a, float *b, co
 
 
 /* substract */
-static void _blend_substract(dt_iop_colorspace_type_t cst,const float *a, float *b, const float *mask, size_t stride, int flag)
+static inline void _blend_substract(dt_iop_colorspace_type_t cst,const float *a, float *b, const float *mask, size_t stride, int flag)
 {
   float ta[3], tb[3];
   int channels = _blend_colorspace_channels(cst);
@@ -776,7 +887,7 @@ static void _blend_substract(dt_iop_colorspace_type_t cst,const float *a, float
 
 
 /* difference (deprecated) */
-static void _blend_difference(dt_iop_colorspace_type_t cst,const float *a, float *b, const float *mask, size_t stride, int flag)
+static inline void _blend_difference(dt_iop_colorspace_type_t cst,const float *a, float *b, const float *mask, size_t stride, int flag)
 {
   float ta[3], tb[3];
   int channels = _blend_colorspace_channels(cst);
@@ -837,7 +948,7 @@ static void _blend_difference(dt_iop_colorspace_type_t cst,const float *a, float
 
 
 /* difference 2 (new) */
-static void _blend_difference2(dt_iop_colorspace_type_t cst,const float *a, float *b, const float *mask, size_t stride, int flag)
+static inline void _blend_difference2(dt_iop_colorspace_type_t cst,const float *a, float *b, const float *mask, size_t stride, int flag)
 {
   float ta[3], tb[3];
   int channels = _blend_colorspace_channels(cst);
@@ -894,7 +1005,7 @@ static void _blend_difference2(dt_iop_colorspace_type_t cst,const float *a, floa
 
 
 /* screen */
-static void _blend_screen(dt_iop_colorspace_type_t cst,const float *a, float *b, const float *mask, size_t stride, int flag)
+static inline void _blend_screen(dt_iop_colorspace_type_t cst,const float *a, float *b, const float *mask, size_t stride, int flag)
 {
   float ta[3], tb[3];
   int channels = _blend_colorspace_channels(cst);
@@ -960,7 +1071,7 @@ static void _blend_screen(dt_iop_colorspace_type_t cst,const float *a, float *b,
 }
 
 /* overlay */
-static void _blend_overlay(dt_iop_colorspace_type_t cst,const float *a, float *b, const float *mask, size_t stride, int flag)
+static inline void _blend_overlay(dt_iop_colorspace_type_t cst,const float *a, float *b, const float *mask, size_t stride, int flag)
 {
   float ta[3], tb[3];
   int channels = _blend_colorspace_channels(cst);
@@ -1038,7 +1149,7 @@ static void _blend_overlay(dt_iop_colorspace_type_t cst,const float *a, float *b
 }
 
 /* softlight */
-static void _blend_softlight(dt_iop_colorspace_type_t cst,const float *a, float *b, const float *mask, size_t stride, int flag)
+static inline void _blend_softlight(dt_iop_colorspace_type_t cst,const float *a, float *b, const float *mask, size_t stride, int flag)
 {
   float ta[3], tb[3];
   int channels = _blend_colorspace_channels(cst);
@@ -1112,7 +1223,7 @@ static void _blend_softlight(dt_iop_colorspace_type_t cst,const float *a, float
 }
 
 /* hardlight */
-static void _blend_hardlight(dt_iop_colorspace_type_t cst,const float *a, float *b, const float *mask, size_t stride, int flag)
+static inline void _blend_hardlight(dt_iop_colorspace_type_t cst,const float *a, float *b, const float *mask, size_t stride, int flag)
 {
   float ta[3], tb[3];
   int channels = _blend_colorspace_channels(cst);
@@ -1192,7 +1303,7 @@ static void _blend_hardlight(dt_iop_colorspace_type_t cst,const float *a, float
 
 
 /* vividlight */
-static void _blend_vividlight(dt_iop_colorspace_type_t cst,const float *a, float *b, const float *mask, size_t stride, int flag)
+static inline void _blend_vividlight(dt_iop_colorspace_type_t cst,const float *a, float *b, const float *mask, size_t stride, int flag)
 {
   float ta[3], tb[3];
   int channels = _blend_colorspace_channels(cst);
@@ -1269,7 +1380,7 @@ static void _blend_vividlight(dt_iop_colorspace_type_t cst,const float *a, float
 }
 
 /* linearlight */
-static void _blend_linearlight(dt_iop_colorspace_type_t cst,const float *a, float *b, const float *mask, size_t stride, int flag)
+static inline void _blend_linearlight(dt_iop_colorspace_type_t cst,const float *a, float *b, const float *mask, size_t stride, int flag)
 {
   float ta[3], tb[3];
   int channels = _blend_colorspace_channels(cst);
@@ -1340,7 +1451,7 @@ static void _blend_linearlight(dt_iop_colorspace_type_t cst,const float *a, floa
 }
 
 /* pinlight */
-static void _blend_pinlight(dt_iop_colorspace_type_t cst,const float *a, float *b, const float *mask, size_t stride, int flag)
+static inline void _blend_pinlight(dt_iop_colorspace_type_t cst,const float *a, float *b, const float *mask, size_t stride, int flag)
 {
   float ta[3], tb[3];
   int channels = _blend_colorspace_channels(cst);
@@ -1403,7 +1514,7 @@ static void _blend_pinlight(dt_iop_colorspace_type_t cst,const float *a, float *
 
 
 /* lightness blend */
-static void _blend_lightness(dt_iop_colorspace_type_t cst,const float *a, float *b, const float *mask, size_t stride, int flag)
+static inline void _blend_lightness(dt_iop_colorspace_type_t cst,const float *a, float *b, const float *mask, size_t stride, int flag)
 {
   float ta[3], tb[3];
   float tta[3], ttb[3];
@@ -1457,7 +1568,7 @@ static void _blend_lightness(dt_iop_colorspace_type_t cst,const float *a, float
 
 
 /* chroma blend */
-static void _blend_chroma(dt_iop_colorspace_type_t cst,const float *a, float *b, const float *mask, size_t stride, int flag)
+static inline void _blend_chroma(dt_iop_colorspace_type_t cst,const float *a, float *b, const float *mask, size_t stride, int flag)
 {
   float ta[3], tb[3];
   float tta[3], ttb[3];
@@ -1515,7 +1626,7 @@ static void _blend_chroma(dt_iop_colorspace_type_t cst,const float *a, float *b,
 
 
 /* hue blend */
-static void _blend_hue(dt_iop_colorspace_type_t cst,const float *a, float *b, const float *mask, size_t stride, int flag)
+static inline void _blend_hue(dt_iop_colorspace_type_t cst,const float *a, float *b, const float *mask, size_t stride, int flag)
 {
   float ta[3], tb[3];
   float tta[3], ttb[3];
@@ -1579,7 +1690,7 @@ static void _blend_hue(dt_iop_colorspace_type_t cst,const float *a, float *b, co
 
 
 /* color blend; blend hue and chroma, but not lightness */
-static void _blend_color(dt_iop_colorspace_type_t cst,const float *a, float *b, const float *mask, size_t stride, int flag)
+static inline void _blend_color(dt_iop_colorspace_type_t cst,const float *a, float *b, const float *mask, size_t stride, int flag)
 {
   float ta[3], tb[3];
   float tta[3], ttb[3];
@@ -1644,7 +1755,7 @@ static void _blend_color(dt_iop_colorspace_type_t cst,const float *a, float *b,
 }
 
 /* color adjustment; blend hue and chroma; take lightness from module output */
-static void _blend_coloradjust(dt_iop_colorspace_type_t cst,const float *a, float *b, const float *mask, size_t stride, int flag)
+static inline void _blend_coloradjust(dt_iop_colorspace_type_t cst,const float *a, float *b, const float *mask, size_t stride, int flag)
 {
   float ta[3], tb[3];
   float tta[3], ttb[3];
@@ -1710,7 +1821,7 @@ static void _blend_coloradjust(dt_iop_colorspace_type_t cst,const float *a, floa
 
 
 /* inverse blend */
-static void _blend_inverse(dt_iop_colorspace_type_t cst,const float *a, float *b, const float *mask, size_t stride, int flag)
+static inline void _blend_inverse(dt_iop_colorspace_type_t cst,const float *a, float *b, const float *mask, size_t stride, int flag)
 {
   float ta[3], tb[3];
   int channels = _blend_colorspace_channels(cst);
@@ -1753,7 +1864,7 @@ static void _blend_inverse(dt_iop_colorspace_type_t cst,const float *a, float *b
 
 
 /* blend only lightness in Lab color space without any clamping (a noop for other color spaces) */
-static void _blend_Lab_lightness(dt_iop_colorspace_type_t cst,const float *a, float *b, const float *mask, size_t stride, int flag)
+static inline void _blend_Lab_lightness(dt_iop_colorspace_type_t cst,const float *a, float *b, const float *mask, size_t stride, int flag)
 {
   float ta[3], tb[3];
   int channels = _blend_colorspace_channels(cst);
@@ -1786,7 +1897,7 @@ static void _blend_Lab_lightness(dt_iop_colorspace_type_t cst,const float *a, fl
 
 
 /* blend only color in Lab color space without any clamping (a noop for other color spaces) */
-static void _blend_Lab_color(dt_iop_colorspace_type_t cst,const float *a, float *b, const float *mask, size_t stride, int flag)
+static inline void _blend_Lab_color(dt_iop_colorspace_type_t cst,const float *a, float *b, const float *mask, size_t stride, int flag)
 {
   float ta[3], tb[3];
   int channels = _blend_colorspace_channels(cst);
@@ -1825,7 +1936,7 @@ static void _blend_Lab_color(dt_iop_colorspace_type_t cst,const float *a, float
 }
 
 /* blend only lightness in HSV color space without any clamping (a noop for other color spaces) */
-static void _blend_HSV_lightness(dt_iop_colorspace_type_t cst,const float *a, float *b, const float *mask, size_t stride, int flag)
+static inline void _blend_HSV_lightness(dt_iop_colorspace_type_t cst,const float *a, float *b, const float *mask, size_t stride, int flag)
 {
   float ta[3], tb[3];
   int channels = _blend_colorspace_channels(cst);
@@ -1858,7 +1969,7 @@ static void _blend_HSV_lightness(dt_iop_colorspace_type_t cst,const float *a, fl
 
 
 /* blend only color in HSV color space without any clamping (a noop for other color spaces) */
-static void _blend_HSV_color(dt_iop_colorspace_type_t cst,const float *a, float *b, const float *mask, size_t stride, int flag)
+static inline void _blend_HSV_color(dt_iop_colorspace_type_t cst,const float *a, float *b, const float *mask, size_t stride, int flag)
 {
   float ta[3], tb[3];
   int channels = _blend_colorspace_channels(cst);
@@ -1903,123 +2014,150 @@ static void _blend_HSV_color(dt_iop_colorspace_type_t cst,const float *a, float
 
 
 
-void dt_develop_blend_process (struct dt_iop_module_t *self, struct dt_dev_pixelpipe_iop_t *piece, void *i, void *o, const struct dt_iop_roi_t *roi_in, const struct dt_iop_roi_t *roi_out)
-{
-  int ch = piece->colors;
-  _blend_row_func *blend = NULL;
-  dt_develop_blend_params_t *d = (dt_develop_blend_params_t *)piece->blendop_data;
-
-  if (!d) return;
-
-  const unsigned int blend_mode = d->blend_mode;
-  const unsigned int mask_mode = d->mask_mode;
-  const int xoffs = roi_out->x - roi_in->x;
-  const int yoffs = roi_out->y - roi_in->y;
-  const int iwidth = roi_in->width;
-
-  /* check if blend is disabled */
-  if (!(mask_mode & DEVELOP_MASK_ENABLED)) return;
-
-  /* we can only handle blending if roi_out and roi_in have the same scale and
-     if roi_out fits into the area given by roi_in */
-  if (roi_out->scale != roi_in->scale || xoffs < 0 || yoffs < 0
-      || ((xoffs > 0 || yoffs > 0) && (roi_out->width + xoffs > roi_in->width || roi_out->height + yoffs > roi_in->height)))
-  {
-    //printf("%s: scale %f/%f %d\n", self->op, roi_out->scale, roi_in->scale, roi_out->scale == roi_in->scale);
-    //printf("xoffs %d, yoffs %d, out %d, %d, in %d, %d\n", xoffs, yoffs, roi_out->width, roi_out->height, roi_in->width, roi_in->height);
-    dt_control_log(_("skipped blending in module '%s': roi's do not match"), self->op);
-    return;
-  }
+/* the blend operators above handle all colorspaces and decide per pixel what
+   to do. wrap each of them once per colorspace, so the compiler can resolve
+   these branches at compile time, and pick the right one once per call. */
+#define _BLEND_SPECIALIZE(name) \
+static void name##_RAW(dt_iop_colorspace_type_t cst, const float *a, float *b, const float *mask, size_t stride, int flag) \
+{ \
+  name(iop_cs_RAW, a, b, mask, stride, flag); \
+} \
+static void name##_Lab(dt_iop_colorspace_type_t cst, const float *a, float *b, const float *mask, size_t stride, int flag) \
+{ \
+  name(iop_cs_Lab, a, b, mask, stride, flag); \
+} \
+static void name##_rgb(dt_iop_colorspace_type_t cst, const float *a, float *b, const float *mask, size_t stride, int flag) \
+{ \
+  name(iop_cs_rgb, a, b, mask, stride, flag); \
+}
 
-  /* select the blend operator */
+_BLEND_SPECIALIZE(_blend_normal_bounded)
+_BLEND_SPECIALIZE(_blend_normal_unbounded)
+_BLEND_SPECIALIZE(_blend_lighten)
+_BLEND_SPECIALIZE(_blend_darken)
+_BLEND_SPECIALIZE(_blend_multiply)
+_BLEND_SPECIALIZE(_blend_average)
+_BLEND_SPECIALIZE(_blend_add)
+_BLEND_SPECIALIZE(_blend_substract)
+_BLEND_SPECIALIZE(_blend_difference)
+_BLEND_SPECIALIZE(_blend_difference2)
+_BLEND_SPECIALIZE(_blend_screen)
+_BLEND_SPECIALIZE(_blend_overlay)
+_BLEND_SPECIALIZE(_blend_softlight)
+_BLEND_SPECIALIZE(_blend_hardlight)
+_BLEND_SPECIALIZE(_blend_vividlight)
+_BLEND_SPECIALIZE(_blend_linearlight)
+_BLEND_SPECIALIZE(_blend_pinlight)
+_BLEND_SPECIALIZE(_blend_lightness)
+_BLEND_SPECIALIZE(_blend_chroma)
+_BLEND_SPECIALIZE(_blend_hue)
+_BLEND_SPECIALIZE(_blend_color)
+_BLEND_SPECIALIZE(_blend_coloradjust)
+_BLEND_SPECIALIZE(_blend_inverse)
+_BLEND_SPECIALIZE(_blend_Lab_lightness)
+_BLEND_SPECIALIZE(_blend_Lab_color)
+_BLEND_SPECIALIZE(_blend_HSV_lightness)
+_BLEND_SPECIALIZE(_blend_HSV_color)
+
+#define _BLEND_PICK(cst, name) \
+  ((cst) == iop_cs_Lab ? name##_Lab : (cst) == iop_cs_rgb ? name##_rgb : (cst) == iop_cs_RAW ? name##_RAW : name)
+
+static _blend_row_func *_blend_select(const unsigned int blend_mode, const dt_iop_colorspace_type_t cst)
+{
   switch (blend_mode)
   {
     case DEVELOP_BLEND_LIGHTEN:
-      blend = _blend_lighten;
-      break;
+      return _BLEND_PICK(cst, _blend_lighten);
     case DEVELOP_BLEND_DARKEN:
-      blend = _blend_darken;
-      break;
+      return _BLEND_PICK(cst, _blend_darken);
     case DEVELOP_BLEND_MULTIPLY:
-      blend = _blend_multiply;
-      break;
+      return _BLEND_PICK(cst, _blend_multiply);
     case DEVELOP_BLEND_AVERAGE:
-      blend = _blend_average;
-      break;
+      return _BLEND_PICK(cst, _blend_average);
     case DEVELOP_BLEND_ADD:
-      blend = _blend_add;
-      break;
+      return _BLEND_PICK(cst, _blend_add);
     case DEVELOP_BLEND_SUBSTRACT:
-      blend = _blend_substract;
-      break;
+      return _BLEND_PICK(cst, _blend_substract);
     case DEVELOP_BLEND_DIFFERENCE:
-      blend = _blend_difference;
-      break;
+      return _BLEND_PICK(cst, _blend_difference);
     case DEVELOP_BLEND_DIFFERENCE2:
-      blend = _blend_difference2;
-      break;
+      return _BLEND_PICK(cst, _blend_difference2);
     case DEVELOP_BLEND_SCREEN:
-      blend = _blend_screen;
-      break;
+      return _BLEND_PICK(cst, _blend_screen);
     case DEVELOP_BLEND_OVERLAY:
-      blend = _blend_overlay;
-      break;
+      return _BLEND_PICK(cst, _blend_overlay);
     case DEVELOP_BLEND_SOFTLIGHT:
-      blend = _blend_softlight;
-      break;
+      return _BLEND_PICK(cst, _blend_softlight);
     case DEVELOP_BLEND_HARDLIGHT:
-      blend = _blend_hardlight;
-      break;
+      return _BLEND_PICK(cst, _blend_hardlight);
     case DEVELOP_BLEND_VIVIDLIGHT:
-      blend = _blend_vividlight;
-      break;
+      return _BLEND_PICK(cst, _blend_vividlight);
     case DEVELOP_BLEND_LINEARLIGHT:
-      blend = _blend_linearlight;
-      break;
+      return _BLEND_PICK(cst, _blend_linearlight);
     case DEVELOP_BLEND_PINLIGHT:
-      blend = _blend_pinlight;
-      break;
+      return _BLEND_PICK(cst, _blend_pinlight);
     case DEVELOP_BLEND_LIGHTNESS:
-      blend = _blend_lightness;
-      break;
+      return _BLEND_PICK(cst, _blend_lightness);
     case DEVELOP_BLEND_CHROMA:
-      blend = _blend_chroma;
-      break;
+      return _BLEND_PICK(cst, _blend_chroma);
     case DEVELOP_BLEND_HUE:
-      blend = _blend_hue;
-      break;
+      return _BLEND_PICK(cst, _blend_hue);
     case DEVELOP_BLEND_COLOR:
-      blend = _blend_color;
-      break;
+      return _BLEND_PICK(cst, _blend_color);
     case DEVELOP_BLEND_INVERSE:
-      blend = _blend_inverse;
-      break;
+      return _BLEND_PICK(cst, _blend_inverse);
     case DEVELOP_BLEND_NORMAL:
     case DEVELOP_BLEND_BOUNDED:
-      blend = _blend_normal_bounded;
-      break;
+      return _BLEND_PICK(cst, _blend_normal_bounded);
     case DEVELOP_BLEND_COLORADJUST:
-      blend = _blend_coloradjust;
-      break;
+      return _BLEND_PICK(cst, _blend_coloradjust);
     case DEVELOP_BLEND_LAB_LIGHTNESS:
-      blend = _blend_Lab_lightness;
-      break;
+      return _BLEND_PICK(cst, _blend_Lab_lightness);
     case DEVELOP_BLEND_LAB_COLOR:
-      blend = _blend_Lab_color;
-      break;
+      return _BLEND_PICK(cst, _blend_Lab_color);
     case DEVELOP_BLEND_HSV_LIGHTNESS:
-      blend = _blend_HSV_lightness;
-      break;
+      return _BLEND_PICK(cst, _blend_HSV_lightness);
     case DEVELOP_BLEND_HSV_COLOR:
-      blend = _blend_HSV_color;
-      break;
+      return _BLEND_PICK(cst, _blend_HSV_color);
 
       /* fallback to normal blend */
     case DEVELOP_BLEND_NORMAL2:
     case DEVELOP_BLEND_UNBOUNDED:
     default:
-      blend = _blend_normal_unbounded;
-      break;
+      return _BLEND_PICK(cst, _blend_normal_unbounded);
+  }
+}
+
+#undef _BLEND_PICK
+#undef _BLEND_SPECIALIZE
+
+
+void dt_develop_blend_process (struct dt_iop_module_t *self, struct dt_dev_pixelpipe_iop_t *piece, void *i, void *o, const struct dt_iop_roi_t *roi_in, const struct dt_iop_roi_t *roi_out)
+{
+  int ch = piece->colors;
+  _blend_row_func *blend = NULL;
+  dt_develop_blend_params_t *d = (dt_develop_blend_params_t *)piece->blendop_data;
+
+  if (!d) return;
+
+  const unsigned int blend_mode = d->blend_mode;
+  const unsigned int mask_mode = d->mask_mode;
+  const int xoffs = roi_out->x - roi_in->x;
+  const int yoffs = roi_out->y - roi_in->y;
+  const int iwidth = roi_in->width;
+
+  /* check if blend is disabled */
+  if (!(mask_mode & DEVELOP_MASK_ENABLED)) return;
+
+  /* we can only handle blending if roi_out and roi_in have the same scale and
+     if roi_out fits into the area given by roi_in */
+  if (roi_out->scale != roi_in->scale || xoffs < 0 || yoffs < 0
+      || ((xoffs > 0 || yoffs > 0) && (roi_out->width + xoffs > roi_in->width || roi_out->height + yoffs > roi_in->height)))
+  {
+    //printf("%s: scale %f/%f %d\n", self->op, roi_out->scale, roi_in->scale, roi_out->scale == roi_in->scale);
+    //printf("xoffs %d, yoffs %d, out %d, %d, in %d, %d\n", xoffs, yoffs, roi_out->width, roi_out->height, roi_in->width, roi_in->height);
+    dt_control_log(_("skipped blending in module '%s': roi's do not match"), self->op);
+    return;
   }
 
   /* get the clipped opacity value  0 - 1 */
@@ -2034,42 +2172,113 @@ void dt_develop_blend_process (struct dt_iop_module_t *self, struct dt_dev_pixel
   /* get channel max values depending on colorspace */
   const dt_iop_colorspace_type_t cst = dt_iop_module_colorspace(self);
 
+  /* select the blend operator, specialized for the colorspace */
+  blend = _blend_select(blend_mode, cst);
+
   /* correct bpp per pixel for raw
      \TODO actually invest why channels per pixel is 4 in raw..
   */
   if(cst==iop_cs_RAW)
     ch = 1;
 
-  /* allocate space for blend mask */
-  float *mask = dt_alloc_align(64, (size_t)roi_out->width*roi_out->height*sizeof(float));
-  if(!mask)
-  {
-    dt_control_log(_("could not allocate buffer for blending"));
-    return;
-  }
+  /* check if mask should be suppressed temporarily (i.e. just set to global opacity value) */
+  const int suppress = self->suppress_mask && self->dev->gui_attached && (self == self->dev->gui_module) && (piece->pipe == self->dev->pipe) && (mask_mode & DEVELOP_MASK_BOTH);
 
-  if(mask_mode == DEVELOP_MASK_ENABLED)
+  const int maskblur = fabs(d->radius) <= 0.1f ? 0 : 1;
+  const int gaussian = d->radius > 0.0f ? 1 : 0;
+  const float radius = fabs(d->radius);
+
+  /* get the drawn mask if there is one */
+  dt_masks_form_t *form = NULL;
+  const int drawn = (mask_mode != DEVELOP_MASK_ENABLED) && !suppress && !(self->flags()&IOP_FLAGS_NO_MASKS) && (d->mask_mode & DEVELOP_MASK_MASK);
+  if(drawn) form = dt_masks_get_from_id(self->dev,d->mask_id);
+
+  if(mask_mode == DEVELOP_MASK_ENABLED || suppress || !(maskblur && gaussian))
   {
-    /* blend uniformly (no drawn or parametric mask) */
+    /* no mask blur, so every row of the mask only depends on the same row of
+       input and output: compute the mask and blend in a single pass. a full
+       size mask is only needed if there is a drawn shape to render. */
+    float *mask = NULL;
+    if(form)
+    {
+      mask = dt_alloc_align(64, (size_t)roi_out->width*roi_out->height*sizeof(float));
+      if(!mask)
+      {
+        dt_control_log(_("could not allocate buffer for blending"));
+        return;
+      }
+      dt_masks_group_render_roi(self,piece,form,roi_out,mask);
+    }
+
+    const int uniform = (mask_mode == DEVELOP_MASK_ENABLED || suppress);
+    /* value of the mask before blendif is applied, if there is no drawn shape */
+    const float fill = uniform ? opacity
+                       : drawn ? ((d->mask_combine & DEVELOP_COMBINE_MASKS_POS) ? 0.0f : 1.0f)
+                       : ((d->mask_combine & DEVELOP_COMBINE_INCL) ? 0.0f : 1.0f);
+    const int invert_form = (d->mask_combine & DEVELOP_COMBINE_MASKS_POS) ? 1 : 0;
+
+    /* one mask row per thread, allocated up front so we can still bail out */
+    const size_t rowstride = ((size_t)roi_out->width + 15) & ~(size_t)15;
+    float *rows = dt_alloc_align(64, rowstride*dt_get_num_threads()*sizeof(float));
+    if(!rows)
+    {
+      dt_control_log(_("could not allocate buffer for blending"));
+      dt_free_align(mask);
+      return;
+    }
 
-    const size_t buffsize = (size_t)roi_out->width*roi_out->height;
 #ifdef _OPENMP
-#if !defined(__SUNOS__) && !defined(__NetBSD__)
-    #pragma omp parallel for default(none) shared(mask)
-#else
-    #pragma omp parallel for shared(mask)
+    #pragma omp parallel shared(i,roi_out,o,mask,rows,blend,d,ch)
 #endif
+    {
+      float *row = rows + rowstride*dt_get_thread_num();
+      /* a uniform mask is never modified, fill it once per thread */
+      if(uniform)
+        for(int k=0; k<roi_out->width; k++) row[k] = fill;
+#ifdef _OPENMP
+      #pragma omp for schedule(static)
 #endif
-    for (size_t i=0; i<buffsize; i++) mask[i] = opacity;
+      for (size_t y=0; y<roi_out->height; y++)
+      {
+        size_t iindex = ((size_t)(y + yoffs) * iwidth + xoffs)*ch;
+        size_t oindex = (size_t)y * roi_out->width*ch;
+        size_t stride = (size_t)roi_out->width*ch;
+        float *in = (float *)i + iindex;
+        float *out = (float *)o + oindex;
+        float *m = row;
+        if(mask)
+        {
+          const float *fm = mask + y * roi_out->width;
+          for(int k=0; k<roi_out->width; k++) m[k] = invert_form ? 1.0f - fm[k] : fm[k];
+        }
+        else if(!uniform)
+          for(int k=0; k<roi_out->width; k++) m[k] = fill;
+
+        if(!uniform)
+          _blend_make_mask_sse(cst, d->blendif, d->blendif_parameters, d->mask_mode, d->mask_combine, opacity, in, out, m, stride);
+
+        blend(cst, in, out, m, stride, blendflag);
+
+        if(mask_display && cst != iop_cs_RAW)
+          for(size_t j=0; j<stride; j+=4)
+            out[j+3] = in[j+3];
+      }
+    }
+
+    dt_free_align(rows);
+    dt_free_align(mask);
   }
   else
   {
-    /* we blend with a drawn and/or parametric mask */
+    /* the mask is blurred, so it has to be complete before blending */
+    float *mask = dt_alloc_align(64, (size_t)roi_out->width*roi_out->height*sizeof(float));
+    if(!mask)
+    {
+      dt_control_log(_("could not allocate buffer for blending"));
+      return;
+    }
 
-    /* get the drawn mask if there is one */
-    dt_masks_form_t *form = dt_masks_get_from_id(self->dev,d->mask_id);
-  
-    if (form && (!(self->flags()&IOP_FLAGS_NO_MASKS)) && (d->mask_mode & DEVELOP_MASK_MASK))
+    if (form)
     {
       dt_masks_group_render_roi(self,piece,form,roi_out,mask);
 
@@ -2087,7 +2296,7 @@ void dt_develop_blend_process (struct dt_iop_module_t *self, struct dt_dev_pixel
         for (size_t i=0; i<buffsize; i++) mask[i] = 1.0f - mask[i];
       }
     }
-    else if ((!(self->flags()&IOP_FLAGS_NO_MASKS)) && (d->mask_mode & DEVELOP_MASK_MASK))
+    else if (drawn)
     {
       //no form defined but drawn mask active
       //we fill the buffer with 1.0f or 0.0f depending on mask_combine
@@ -2117,13 +2326,8 @@ void dt_develop_blend_process (struct dt_iop_module_t *self, struct dt_dev_pixel
       for (size_t i=0; i<buffsize; i++) mask[i] = fill;
     }
 
-  
 #ifdef _OPENMP
-#if !defined(__SUNOS__) && !defined(__NetBSD__) && !defined(__WIN32__)
-    #pragma omp parallel for default(none) shared(i,roi_out,o,mask,blend,d,stderr,ch)
-#else
-    #pragma omp parallel for shared(i,roi_out,o,mask,blend,d,ch)
-#endif
+    #pragma omp parallel for schedule(static) shared(i,roi_out,o,mask,d,ch)
 #endif
     for (size_t y=0; y<roi_out->height; y++)
     {
@@ -2133,75 +2337,41 @@ void dt_develop_blend_process (struct dt_iop_module_t *self, struct dt_dev_pixel
       float *in = (float *)i + iindex;
       float *out = (float *)o + oindex;
       float *m = (float *)mask + y * roi_out->width;
-      _blend_make_mask(cst, d->blendif, d->blendif_parameters, d->mask_mode, d->mask_combine, opacity, in, out, m, stride);
+      _blend_make_mask_sse(cst, d->blendif, d->blendif_parameters, d->mask_mode, d->mask_combine, opacity, in, out, m, stride);
     }
 
+    const float sigma = radius * roi_out->scale / piece ->iscale;
 
-    const int maskblur = fabs(d->radius) <= 0.1f ? 0 : 1;
-    const int gaussian = d->radius > 0.0f ? 1 : 0;
-    const float radius = fabs(d->radius);
+    const float mmax[] = { 1.0f };
+    const float mmin[] = { 0.0f };
 
-    if(maskblur)
+    dt_gaussian_t *g = dt_gaussian_init(roi_out->width, roi_out->height, 1, mmax, mmin, sigma, 0);
+    if(g)
     {
-      if(gaussian)
-      {
-        const float sigma = radius * roi_out->scale / piece ->iscale;
-
-        const float mmax[] = { 1.0f };
-        const float mmin[] = { 0.0f };
-
-        dt_gaussian_t *g = dt_gaussian_init(roi_out->width, roi_out->height, 1, mmax, mmin, sigma, 0);
-        if(g)
-        {
-          dt_gaussian_blur(g, mask, mask);
-          dt_gaussian_free(g);
-        }
-      }
-      else
-      {
-        // potential further blend algorithm (bilateral grid?)
-      }
+      dt_gaussian_blur(g, mask, mask);
+      dt_gaussian_free(g);
     }
 
-
-    /* check if mask should be suppressed temporarily (i.e. just set to global opacity value) */
-    if(self->suppress_mask && self->dev->gui_attached && (self == self->dev->gui_module) && (piece->pipe == self->dev->pipe) && (mask_mode & DEVELOP_MASK_BOTH))
-    {
+    /* now apply blending with per-pixel opacity value as defined in mask */
 #ifdef _OPENMP
-#if !defined(__SUNOS__) && !defined(__WIN32__)
-      #pragma omp parallel for default(none) shared(roi_out,mask,stderr)
-#else
-      #pragma omp parallel for shared(roi_out,mask)
-#endif
+    #pragma omp parallel for schedule(static) shared(i,roi_out,o,mask,blend,ch)
 #endif
-      for (size_t k=0; k<(size_t)roi_out->height*roi_out->width; k++)
-      {
-        mask[k] = opacity;
-      }
+    for (size_t y=0; y<roi_out->height; y++)
+    {
+      size_t iindex = ((size_t)(y + yoffs) * iwidth + xoffs)*ch;
+      size_t oindex = (size_t)y * roi_out->width*ch;
+      size_t stride = (size_t)roi_out->width*ch;
+      float *in = (float *)i + iindex;
+      float *out = (float *)o + oindex;
+      float *m = (float *)mask + y * roi_out->width;
+      blend(cst, in, out, m, stride, blendflag);
+
+      if(mask_display && cst != iop_cs_RAW)
+        for(size_t j=0; j<stride; j+=4)
+          out[j+3] = in[j+3];
     }
-  }
 
-  /* now apply blending with per-pixel opacity value as defined in mask */
-#ifdef _OPENMP
-#if !defined(__SUNOS__) && !defined(__WIN32__)
-  #pragma omp parallel for default(none) shared(i,roi_out,o,mask,blend,stderr,ch)
-#else
-  #pragma omp parallel for shared(i,roi_out,o,mask,blend,ch)
-#endif
-#endif
-  for (size_t y=0; y<roi_out->height; y++)
-  {
-    size_t iindex = ((size_t)(y + yoffs) * iwidth + xoffs)*ch;
-    size_t oindex = (size_t)y * roi_out->width*ch;
-    size_t stride = (size_t)roi_out->width*ch;
-    float *in = (float *)i + iindex;
-    float *out = (float *)o + oindex;
-    float *m = (float *)mask + y * roi_out->width;
-    blend(cst, in, out, m, stride, blendflag);
-
-    if(mask_display && cst != iop_cs_RAW)
-      for(size_t j=0; j<stride; j+=4)
-        out[j+3] = in[j+3];
+    dt_free_align(mask);
   }
 
   /* check if _this_ module should expose mask. */
@@ -2209,8 +2379,6 @@ void dt_develop_blend_process (struct dt_iop_module_t *self, struct dt_dev_pixel
   {
     piece->pipe->mask_display = 1;
   }
-
-  dt_free_align(mask);
 }
 
 
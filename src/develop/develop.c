@@ -44,6 +44,12 @@
 #define DT_DEV_AVERAGE_DELAY_START            250
 #define DT_DEV_PREVIEW_AVERAGE_DELAY_START     50
 #define DT_DEV_AVERAGE_DELAY_COUNT              5
+// full pipe runs slower than this (in ms) show a coarse pass first after parameter changes
+#define DT_DEV_PROGRESSIVE_DELAY              150
+#define DT_DEV_PROGRESSIVE_MAX_FACTOR           8
+// bounds (in ms) for the time without changes before the full pipe starts, and for waiting at all
+#define DT_DEV_SCHEDULE_QUIET_MIN              20
+#define DT_DEV_SCHEDULE_MAX_WAIT             1000
 
 const gchar* dt_dev_histogram_type_names[DT_DEV_HISTOGRAM_N] = { "logarithmic", "linear", "waveform" };
 
@@ -67,6 +73,8 @@ void dt_dev_init(dt_develop_t *dev, int32_t gui_attached)
 
   dt_image_init(&dev->image_storage);
   dev->image_status = dev->preview_status = DT_DEV_PIXELPIPE_DIRTY;
+  dev->image_coarse = 0;
+  dev->last_change = 0.0;
   dev->image_loading = dev->preview_loading = 0;
   dev->image_force_reload = 0;
   dev->preview_input_changed = 0;
@@ -171,6 +179,7 @@ void dt_dev_invalidate(dt_develop_t *dev)
 {
   dev->image_status = DT_DEV_PIXELPIPE_DIRTY;
   dev->timestamp++;
+  dev->last_change = dt_get_wtime();
   if(dev->preview_pipe) dev->preview_pipe->input_timestamp = dev->timestamp;
 }
 
@@ -178,6 +187,7 @@ void dt_dev_invalidate_all(dt_develop_t *dev)
 {
   dev->image_status = dev->preview_status = DT_DEV_PIXELPIPE_DIRTY;
   dev->timestamp++;
+  dev->last_change = dt_get_wtime();
 }
 
 void dt_dev_process_preview_job(dt_develop_t *dev)
@@ -262,6 +272,30 @@ restart:
   dt_mipmap_cache_read_release(darktable.mipmap_cache, &buf);
 }
 
+// holds back the full pipe while changes keep coming in, and while the preview works on the newest
+// ones: the preview is what the user looks at during a drag, and both would fight for the same cores.
+// the quiet period follows the preview timings, so it roughly spans the gap between slider updates.
+// it is not worth it if the full pipe itself takes less than that. returns 1 if the pipe changed.
+// a quiet period of 0 in the preferences disables all of this.
+static int _dev_process_image_wait(dt_develop_t *dev)
+{
+  const double quiet = 1e-3*MIN(dt_conf_get_int("darkroom/ui/render_quiet_period"),
+                                MAX(DT_DEV_SCHEDULE_QUIET_MIN, 2*dev->preview_average_delay));
+  if(quiet <= 0.0 || 1e-3*dev->average_delay <= quiet) return 0;
+
+  const double start = dt_get_wtime();
+  while(1)
+  {
+    if(dev->pipe->changed != DT_DEV_PIPE_UNCHANGED || dev->gui_leaving) return 1;
+    const double now = dt_get_wtime();
+    if(now - start > 1e-3*DT_DEV_SCHEDULE_MAX_WAIT) return 0;
+    const int preview_busy = dev->preview_status == DT_DEV_PIXELPIPE_RUNNING ||
+                             dev->preview_status == DT_DEV_PIXELPIPE_DIRTY;
+    if(now - dev->last_change >= quiet && !preview_busy) return 0;
+    g_usleep(5000);
+  }
+}
+
 void dt_dev_process_image_job(dt_develop_t *dev)
 {
   dt_pthread_mutex_lock(&dev->pipe_mutex);
@@ -322,6 +356,7 @@ restart:
   {
     dt_mipmap_cache_read_release(darktable.mipmap_cache, &buf);
     dt_control_log_busy_leave();
+    dev->image_coarse = 0;
     dev->image_status = DT_DEV_PIXELPIPE_INVALID;
     dt_pthread_mutex_unlock(&dev->pipe_mutex);
     return;
@@ -359,14 +394,46 @@ restart:
   x = MAX(0, scale*dev->pipe->processed_width *(.5+zoom_x)-dev->capwidth/2);
   y = MAX(0, scale*dev->pipe->processed_height*(.5+zoom_y)-dev->capheight/2);
 
+  // a coarse pass from an older zoom level or image would be drawn in the wrong place
+  if(dev->image_loading || (pipe_changed & DT_DEV_PIPE_ZOOMED)) dev->image_coarse = 0;
+
+  // progressive mode: if the last full passes were slow, show the result of a parameter change
+  // at a fraction of the resolution first, with the smallest power of two factor that is expected
+  // to be quick enough. this doesn't help zooming and panning, the preview covers that.
+  int coarse = 1;
+  if(dev->gui_attached && !dev->image_loading && (pipe_changed & ~DT_DEV_PIPE_ZOOMED) &&
+     dt_conf_get_bool("darkroom/ui/progressive"))
+  {
+    while(coarse < DT_DEV_PROGRESSIVE_MAX_FACTOR &&
+          dev->average_delay > DT_DEV_PROGRESSIVE_DELAY*coarse*coarse)
+      coarse *= 2;
+  }
+  if(coarse > 1)
+  {
+    dt_get_times(&start);
+    if(dt_dev_pixelpipe_process_coarse(dev->pipe, dev, x/coarse, y/coarse, MAX(1, dev->capwidth/coarse),
+                                       MAX(1, dev->capheight/coarse), scale/coarse))
+      goto interrupted;
+    dt_show_times(&start, "[dev_process_image] coarse pixel pipeline processing", NULL);
+    if(dev->pipe->changed != DT_DEV_PIPE_UNCHANGED) goto restart;
+
+    dev->image_coarse = 1;
+    dt_control_queue_redraw_center();
+  }
+
+  // coalesce bursts of changes: only start the full pass once they stopped for a moment.
+  if(dev->gui_attached && !dev->image_loading && _dev_process_image_wait(dev)) goto restart;
+
   dt_get_times(&start);
-  if(dt_dev_pixelpipe_process(dev->pipe, dev, x, y, dev->capwidth, dev->capheight, scale))
+  if(dt_dev_pixelpipe_process_tiled(dev->pipe, dev, x, y, dev->capwidth, dev->capheight, scale))
   {
+interrupted:
     // interrupted because image changed?
     if(dev->image_force_reload)
     {
       dt_mipmap_cache_read_release(darktable.mipmap_cache, &buf);
       dt_control_log_busy_leave();
+      dev->image_coarse = 0;
       dev->image_status = DT_DEV_PIXELPIPE_INVALID;
       dt_pthread_mutex_unlock(&dev->pipe_mutex);
       return;
@@ -381,6 +448,7 @@ restart:
   if(dev->pipe->changed != DT_DEV_PIPE_UNCHANGED) goto restart;
 
   // cool, we got a new image!
+  dev->image_coarse = 0;
   dev->image_status = DT_DEV_PIXELPIPE_VALID;
   dev->image_loading = 0;
 
@@ -78,7 +78,9 @@ typedef struct dt_develop_t
   int32_t image_loading, first_load, image_force_reload;
   int32_t preview_loading, preview_input_changed;
   dt_dev_pixelpipe_status_t image_status, preview_status;
+  int32_t image_coarse; // set while the backbuf holds a coarse pass of the running full resolution pass.
   uint32_t timestamp;
+  double last_change; // wall time of the last invalidation, to tell when a burst of changes is over.
   uint32_t average_delay;
   uint32_t preview_average_delay;
   struct dt_iop_module_t *gui_module; // this module claims gui expose/event callbacks.
@@ -1784,6 +1784,23 @@ int dt_iop_breakpoint(struct dt_develop_t *dev, struct dt_dev_pixelpipe_t *pipe)
   return 0;
 }
 
+int dt_iop_cancelled(dt_dev_pixelpipe_iop_t *piece)
+{
+  dt_dev_pixelpipe_t *pipe = piece->pipe;
+  if(pipe->cancelled) return 1;
+  dt_develop_t *dev = piece->module->dev;
+  // same conditions as dt_iop_breakpoint(), but without giving up the time slice.
+  if(pipe->shutdown || dev->gui_leaving ||
+     (pipe != dev->preview_pipe && pipe->changed == DT_DEV_PIPE_ZOOMED) ||
+     (pipe->changed != DT_DEV_PIPE_UNCHANGED && pipe->changed != DT_DEV_PIPE_ZOOMED))
+  {
+    // remember it, the pipe needs to know the output is incomplete.
+    pipe->cancelled = 1;
+    return 1;
+  }
+  return 0;
+}
+
 void dt_iop_nap(int32_t usec)
 {
   if(usec <= 0) return;
@@ -83,7 +83,9 @@ typedef enum dt_iop_flags_t
   IOP_FLAGS_ONE_INSTANCE         = 1<<7,   // The module doesn't support multiple instances
   IOP_FLAGS_PREVIEW_NON_OPENCL   = 1<<8,   // Preview pixelpipe of this module must not run on GPU but always on CPU
   IOP_FLAGS_NO_HISTORY_STACK     = 1<<9,   // This iop will never show up in the history stack
-  IOP_FLAGS_NO_MASKS             = 1<<10   // The module doesn't support masks (used with SUPPORT_BLENDING)
+  IOP_FLAGS_NO_MASKS             = 1<<10,  // The module doesn't support masks (used with SUPPORT_BLENDING)
+  IOP_FLAGS_POINTWISE            = 1<<11,  // Output pixels only depend on the input pixel at the same position, roi_in == roi_out. May be run fused with its neighbours over strips.
+  IOP_FLAGS_REGION_STATISTICS    = 1<<12   // Output depends on statistics of the whole processed region (e.g. its maximum). Must not be run over parts of the image. Histogram requests are checked separately.
 }
 dt_iop_flags_t;
 
@@ -465,6 +467,11 @@ void dt_iop_cleanup_histogram(gpointer data, gpointer user_data);
 /** let plugins have breakpoints: */
 int dt_iop_breakpoint(struct dt_develop_t *dev, struct dt_dev_pixelpipe_t *pipe);
 
+/** returns non-zero if the result of the running process() is not needed any more, because the
+ *  parameters changed in the meantime. cheap enough to be checked per row or per tile in long running
+ *  modules, which may then return early with incomplete output. the pipe throws that away. */
+int dt_iop_cancelled(struct dt_dev_pixelpipe_iop_t *piece);
+
 /** allow plugins to relinquish CPU and go to sleep for some time */
 void dt_iop_nap(int32_t usec);
 
@@ -214,6 +214,82 @@ void dt_dev_pixelpipe_cache_print(dt_dev_pixelpipe_cache_t *cache)
   printf("cache hit rate so far: %.3f\n", (cache->queries - cache->misses)/(float)cache->queries);
 }
 
+int dt_dev_pixelpipe_tiles_init(dt_dev_pixelpipe_tiles_t *tiles, int entries, int tile_size)
+{
+  tiles->entries = entries;
+  tiles->tile_size = tile_size;
+  tiles->data = (uint8_t *)dt_alloc_align(16, (size_t)entries*tile_size*tile_size*4);
+  tiles->hash = (uint64_t *)malloc(sizeof(uint64_t)*entries);
+  tiles->stamp = (uint32_t *)calloc(entries, sizeof(uint32_t));
+  tiles->clock = 0;
+  tiles->output = NULL;
+  tiles->output_size = 0;
+  if(!tiles->data || !tiles->hash || !tiles->stamp)
+  {
+    if(tiles->data) dt_free_align(tiles->data);
+    free(tiles->hash);
+    free(tiles->stamp);
+    tiles->entries = 0;
+    return 0;
+  }
+  for(int k=0; k<entries; k++) tiles->hash[k] = -1;
+  return 1;
+}
+
+void dt_dev_pixelpipe_tiles_cleanup(dt_dev_pixelpipe_tiles_t *tiles)
+{
+  dt_free_align(tiles->data);
+  dt_free_align(tiles->output);
+  free(tiles->hash);
+  free(tiles->stamp);
+  tiles->entries = 0;
+}
+
+uint64_t dt_dev_pixelpipe_tiles_hash(uint64_t pipe_hash, int tx, int ty)
+{
+  // same as the region of interest in dt_dev_pixelpipe_cache_hash()
+  uint64_t hash = pipe_hash;
+  const int pos[2] = { tx, ty };
+  const char *str = (const char *)pos;
+  for(size_t i=0; i<sizeof(pos); i++) hash = ((hash << 5) + hash) ^ str[i];
+  return hash;
+}
+
+uint8_t *dt_dev_pixelpipe_tiles_get(dt_dev_pixelpipe_tiles_t *tiles, const uint64_t hash)
+{
+  const size_t tile_bytes = (size_t)tiles->tile_size*tiles->tile_size*4;
+  for(int k=0; k<tiles->entries; k++)
+  {
+    if(tiles->hash[k] == hash)
+    {
+      tiles->stamp[k] = ++tiles->clock;
+      return tiles->data + k*tile_bytes;
+    }
+  }
+  return NULL;
+}
+
+uint8_t *dt_dev_pixelpipe_tiles_put(dt_dev_pixelpipe_tiles_t *tiles, const uint64_t hash)
+{
+  const size_t tile_bytes = (size_t)tiles->tile_size*tiles->tile_size*4;
+  int lru = 0;
+  for(int k=1; k<tiles->entries; k++)
+    if(tiles->stamp[k] < tiles->stamp[lru]) lru = k;
+  tiles->hash[lru] = hash;
+  tiles->stamp[lru] = ++tiles->clock;
+  return tiles->data + lru*tile_bytes;
+}
+
+void dt_dev_pixelpipe_tiles_flush(dt_dev_pixelpipe_tiles_t *tiles)
+{
+  for(int k=0; k<tiles->entries; k++)
+  {
+    tiles->hash[k] = -1;
+    tiles->stamp[k] = 0;
+  }
+  tiles->clock = 0;
+}
+
 // modelines: These editor modelines have been set for all relevant files by tools/update_modelines.sh
 // vim: shiftwidth=2 expandtab tabstop=2 cindent
 // kate: tab-indents: off; indent-width 2; replace-tabs on; indent-mode cstyle; remove-trailing-space on;
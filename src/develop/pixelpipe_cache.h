@@ -73,6 +73,42 @@ void dt_dev_pixelpipe_cache_invalidate(dt_dev_pixelpipe_cache_t *cache, void *da
 /** print out cache lines/hashes (debug). */
 void dt_dev_pixelpipe_cache_print(dt_dev_pixelpipe_cache_t *cache);
 
+/**
+ * the final 8-bit output of a pipe, cut into square tiles on a grid aligned to the origin
+ * of the processed image at a given scale. this way panning only needs to process the
+ * newly exposed parts of the view. there are a few hundred entries, lookups are O(N) still.
+ */
+typedef struct dt_dev_pixelpipe_tiles_t
+{
+  int32_t  entries;
+  int32_t  tile_size;
+  uint8_t *data;
+  uint64_t *hash;
+  // time of last access, the oldest tile is replaced first
+  uint32_t *stamp;
+  uint32_t  clock;
+  // the tiles of the last request put together, this is what the backbuf points to.
+  uint8_t *output;
+  size_t   output_size;
+}
+dt_dev_pixelpipe_tiles_t;
+
+/** allocates entries tiles of tile_size^2 pixels with 4 bytes each. returns 0 on failure. */
+int dt_dev_pixelpipe_tiles_init(dt_dev_pixelpipe_tiles_t *tiles, int entries, int tile_size);
+void dt_dev_pixelpipe_tiles_cleanup(dt_dev_pixelpipe_tiles_t *tiles);
+
+/** hash of the tile at tile coordinates tx, ty, for the pipe output with the given hash. */
+uint64_t dt_dev_pixelpipe_tiles_hash(uint64_t pipe_hash, int tx, int ty);
+
+/** returns the pixels of the tile with the given hash, or NULL if it is not cached. */
+uint8_t *dt_dev_pixelpipe_tiles_get(dt_dev_pixelpipe_tiles_t *tiles, const uint64_t hash);
+
+/** returns the least recently used tile, to be filled with the pixels for the given hash. */
+uint8_t *dt_dev_pixelpipe_tiles_put(dt_dev_pixelpipe_tiles_t *tiles, const uint64_t hash);
+
+/** invalidates all tiles. */
+void dt_dev_pixelpipe_tiles_flush(dt_dev_pixelpipe_tiles_t *tiles);
+
 #endif
 // modelines: These editor modelines have been set for all relevant files by tools/update_modelines.sh
 // vim: shiftwidth=2 expandtab tabstop=2 cindent
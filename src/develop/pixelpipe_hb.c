@@ -55,6 +55,9 @@ dt_pixelpipe_flow_t;
 // this is to ensure compatibility with pixelpipe_gegl.c, which does not need to build the other module:
 #include "develop/pixelpipe_cache.c"
 
+// edge length of the output tiles kept for panning, in pixels
+#define DT_DEV_PIXELPIPE_TILE_SIZE 128
+
 static char *_pipe_type_to_str(int pipe_type)
 {
   char *r;
@@ -121,14 +124,20 @@ int dt_dev_pixelpipe_init_cached(dt_dev_pixelpipe_t *pipe, size_t size, int32_t
   pipe->changed = DT_DEV_PIPE_UNCHANGED;
   pipe->processed_width  = pipe->backbuf_width  = pipe->iwidth = 0;
   pipe->processed_height = pipe->backbuf_height = pipe->iheight = 0;
+  pipe->backbuf_scale = 1.0f;
   pipe->nodes = NULL;
   pipe->backbuf_size = size;
   if(!dt_dev_pixelpipe_cache_init(&(pipe->cache), entries, pipe->backbuf_size))
     return 0;
+  pipe->coarse_cache.entries = 0;
+  pipe->coarse_output = NULL;
+  pipe->coarse_output_size = 0;
+  pipe->tiles.entries = 0;
   pipe->cache_obsolete = 0;
   pipe->backbuf = NULL;
   pipe->processing = 0;
   pipe->shutdown = 0;
+  pipe->cancelled = 0;
   pipe->opencl_error = 0;
   pipe->tiling = 0;
   pipe->mask_display = 0;
@@ -157,6 +166,10 @@ void dt_dev_pixelpipe_cleanup(dt_dev_pixelpipe_t *pipe)
   dt_dev_pixelpipe_cleanup_nodes(pipe);
   // so now it's safe to clean up cache:
   dt_dev_pixelpipe_cache_cleanup(&(pipe->cache));
+  if(pipe->coarse_cache.entries) dt_dev_pixelpipe_cache_cleanup(&(pipe->coarse_cache));
+  dt_free_align(pipe->coarse_output);
+  pipe->coarse_output = NULL;
+  if(pipe->tiles.entries) dt_dev_pixelpipe_tiles_cleanup(&(pipe->tiles));
   dt_pthread_mutex_unlock(&pipe->backbuf_mutex);
   dt_pthread_mutex_destroy(&(pipe->backbuf_mutex));
   dt_pthread_mutex_destroy(&(pipe->busy_mutex));
@@ -669,6 +682,169 @@ pixelpipe_picker_cl(int devid, dt_iop_module_t *module, cl_mem img, const dt_iop
 #endif
 
 
+// bytes of a strip per thread when running fused pointwise modules. the strip and
+// its ping-pong partner should stay in the per-core caches from one module to the next.
+#define DT_PIXELPIPE_FUSE_STRIP_BYTES (128*1024)
+
+static int
+dt_dev_pixelpipe_process_rec(dt_dev_pixelpipe_t *pipe, dt_develop_t *dev, void **output, void **cl_mem_output, int *out_bpp,
+                             const dt_iop_roi_t *roi_out, GList *modules, GList *pieces, int pos);
+
+static inline int
+_pixelpipe_piece_skipped(dt_develop_t *dev, dt_iop_module_t *module, dt_dev_pixelpipe_iop_t *piece)
+{
+  return !piece->enabled || (dev->gui_module && dev->gui_module->operation_tags_filter() & module->operation_tags());
+}
+
+// does this module sample its whole input in this pipe, for a histogram or the color picker?
+static int
+_pixelpipe_piece_samples_input(dt_dev_pixelpipe_t *pipe, dt_develop_t *dev, dt_iop_module_t *module)
+{
+  if((dev->gui_attached || !(module->request_histogram & DT_REQUEST_ONLY_IN_GUI)) &&
+      (module->request_histogram_source & pipe->type) && (module->request_histogram & DT_REQUEST_ON)) return 1;
+  if(module == dev->gui_module && module->request_color_pick != DT_REQUEST_COLORPICK_OFF) return 1;
+  return 0;
+}
+
+// can this module be run as part of a fused group of pointwise modules?
+static int
+_pixelpipe_piece_fusable(dt_dev_pixelpipe_t *pipe, dt_develop_t *dev, dt_iop_module_t *module, dt_dev_pixelpipe_iop_t *piece)
+{
+  if(!(module->flags() & IOP_FLAGS_POINTWISE)) return 0;
+  if(get_output_bpp(module, pipe, piece, dev) != 4*sizeof(float)) return 0;
+  // blending needs masks of the whole roi, histograms and color pickers the whole input
+  const dt_develop_blend_params_t *b = (const dt_develop_blend_params_t *)piece->blendop_data;
+  if(b && (b->mask_mode & DEVELOP_MASK_ENABLED)) return 0;
+  if(_pixelpipe_piece_samples_input(pipe, dev, module)) return 0;
+  return 1;
+}
+
+// fused execution only pays off (and only preserves caching behaviour) where
+// intermediate buffers are never looked at again: exports and thumbnails on the cpu.
+static int
+_pixelpipe_fusion_allowed(dt_dev_pixelpipe_t *pipe)
+{
+  if(!(pipe->type & (DT_DEV_PIXELPIPE_EXPORT | DT_DEV_PIXELPIPE_THUMBNAIL))) return 0;
+#ifdef HAVE_OPENCL
+  if(dt_opencl_is_inited() && pipe->opencl_enabled && pipe->devid >= 0) return 0;
+#endif
+  return 1;
+}
+
+/** runs the pointwise modules first_module..modules as one pass over strips of roi_out.
+ *  only the output of the last module ends up in the cache, as hash. */
+static int
+_pixelpipe_process_fused(dt_dev_pixelpipe_t *pipe, dt_develop_t *dev, void **output, const dt_iop_roi_t *roi_out,
+                         GList *first_module, GList *first_piece, int first_pos, GList *modules, const uint64_t hash,
+                         const size_t bufsize)
+{
+  const size_t bpp = 4*sizeof(float);
+  const int width = roi_out->width;
+  const int height = roi_out->height;
+
+  // pointwise modules do not change the roi, the group input has the same as its output
+  void *input = NULL;
+  void *cl_mem_input = NULL;
+  int in_bpp;
+  if(dt_dev_pixelpipe_process_rec(pipe, dev, &input, &cl_mem_input, &in_bpp, roi_out,
+                                  g_list_previous(first_module), g_list_previous(first_piece), first_pos-1)) return 1;
+
+  dt_pthread_mutex_lock(&pipe->busy_mutex);
+  if(pipe->shutdown)
+  {
+    dt_pthread_mutex_unlock(&pipe->busy_mutex);
+    return 1;
+  }
+  (void) dt_dev_pixelpipe_cache_get(&(pipe->cache), hash, bufsize, output);
+
+  dt_times_t start;
+  dt_get_times(&start);
+
+  int count = 0;
+  for(GList *m = first_module; m != g_list_next(modules); m = g_list_next(m)) count++;
+
+  const int rows = CLAMP((int)(DT_PIXELPIPE_FUSE_STRIP_BYTES * (size_t)dt_get_num_threads() / (bpp*width)), 1, height);
+  float *strip[2];
+  strip[0] = dt_alloc_align(64, (size_t)rows*width*bpp);
+  strip[1] = dt_alloc_align(64, (size_t)rows*width*bpp);
+  // processed maximum as seen before each module of the group, and after the last one
+  float (*maximum)[3] = malloc(sizeof(float)*3*(count+1));
+  if(!strip[0] || !strip[1] || !maximum)
+  {
+    dt_free_align(strip[0]);
+    dt_free_align(strip[1]);
+    free(maximum);
+    dt_pthread_mutex_unlock(&pipe->busy_mutex);
+    return 1;
+  }
+  for(int k=0; k<3; k++) maximum[0][k] = pipe->processed_maximum[k];
+
+  for(int y=0; y<height; y+=rows)
+  {
+    if(pipe->shutdown)
+    {
+      dt_free_align(strip[0]);
+      dt_free_align(strip[1]);
+      free(maximum);
+      dt_pthread_mutex_unlock(&pipe->busy_mutex);
+      return 1;
+    }
+
+    dt_iop_roi_t roi = *roi_out;
+    roi.y = roi_out->y + y;
+    roi.height = MIN(rows, height - y);
+
+    const size_t offset = (size_t)y*width*4;
+    float *in = (float *)input + offset;
+    GList *p = first_piece;
+    int n = 0;
+    for(GList *m = first_module; m != g_list_next(modules); m = g_list_next(m), p = g_list_next(p))
+    {
+      dt_iop_module_t *module = (dt_iop_module_t *)m->data;
+      dt_dev_pixelpipe_iop_t *piece = (dt_dev_pixelpipe_iop_t *)p->data;
+      if(_pixelpipe_piece_skipped(dev, module, piece)) continue;
+
+      float *out = (m == modules) ? (float *)*output + offset : strip[n & 1];
+
+      // modules may update the processed maximum, as with tiling every strip starts from the same one
+      for(int k=0; k<3; k++) pipe->processed_maximum[k] = maximum[n][k];
+      module->process(module, piece, in, out, &roi, &roi);
+      if(y == 0) for(int k=0; k<3; k++) maximum[n+1][k] = pipe->processed_maximum[k];
+
+      in = out;
+      n++;
+    }
+    count = n;
+  }
+
+  // leave the pipe as if the modules had run one by one
+  GList *p = first_piece;
+  int n = 0;
+  GString *names = g_string_new(NULL);
+  for(GList *m = first_module; m != g_list_next(modules); m = g_list_next(m), p = g_list_next(p))
+  {
+    dt_iop_module_t *module = (dt_iop_module_t *)m->data;
+    dt_dev_pixelpipe_iop_t *piece = (dt_dev_pixelpipe_iop_t *)p->data;
+    if(_pixelpipe_piece_skipped(dev, module, piece)) continue;
+    n++;
+    for(int k=0; k<3; k++) piece->processed_maximum[k] = maximum[n][k];
+    gchar *module_label = dt_history_item_get_name(module);
+    g_string_append_printf(names, "%s`%s'", names->len ? ", " : "", module_label);
+    g_free(module_label);
+  }
+  for(int k=0; k<3; k++) pipe->processed_maximum[k] = maximum[count][k];
+
+  dt_show_times(&start, "[dev_pixelpipe]", "processed %s fused in strips of %d rows on CPU [%s]", names->str, rows,
+                _pipe_type_to_str(pipe->type));
+  g_string_free(names, TRUE);
+
+  dt_free_align(strip[0]);
+  dt_free_align(strip[1]);
+  free(maximum);
+  dt_pthread_mutex_unlock(&pipe->busy_mutex);
+  return 0;
+}
+
 // recursive helper for process:
 static int
 dt_dev_pixelpipe_process_rec(dt_dev_pixelpipe_t *pipe, dt_develop_t *dev, void **output, void **cl_mem_output, int *out_bpp,
@@ -798,7 +974,40 @@ dt_dev_pixelpipe_process_rec(dt_dev_pixelpipe_t *pipe, dt_develop_t *dev, void *
   }
   else
   {
-    // 3b) recurse and obtain output array in &input
+    // 3b) consecutive pointwise modules ending here run as a single pass over strips
+    if(_pixelpipe_fusion_allowed(pipe) && _pixelpipe_piece_fusable(pipe, dev, module, piece))
+    {
+      GList *first_module = modules, *first_piece = pieces;
+      int first_pos = pos, count = 1;
+      GList *m = g_list_previous(modules), *p = g_list_previous(pieces);
+      int k = pos-1;
+      dt_iop_module_t *boundary = NULL;
+      dt_dev_pixelpipe_iop_t *boundary_piece = NULL;
+      for(; m; m = g_list_previous(m), p = g_list_previous(p), k--)
+      {
+        dt_iop_module_t *mod = (dt_iop_module_t *)m->data;
+        dt_dev_pixelpipe_iop_t *pc = (dt_dev_pixelpipe_iop_t *)p->data;
+        if(_pixelpipe_piece_skipped(dev, mod, pc)) continue;
+        // stop at modules which are not pointwise, or whose output we already have
+        dt_pthread_mutex_lock(&pipe->busy_mutex);
+        const int cached = dt_dev_pixelpipe_cache_available(&(pipe->cache), dt_dev_pixelpipe_cache_hash(pipe->image.id, roi_out, pipe, k));
+        dt_pthread_mutex_unlock(&pipe->busy_mutex);
+        if(cached || !_pixelpipe_piece_fusable(pipe, dev, mod, pc))
+        {
+          boundary = mod;
+          boundary_piece = pc;
+          break;
+        }
+        first_module = m;
+        first_piece = p;
+        first_pos = k;
+        count++;
+      }
+      if(count > 1 && get_output_bpp(boundary, pipe, boundary_piece, dev) == bpp)
+        return _pixelpipe_process_fused(pipe, dev, output, roi_out, first_module, first_piece, first_pos, modules, hash, bufsize);
+    }
+
+    // 3c) recurse and obtain output array in &input
 
     // get region of interest which is needed in input
     dt_pthread_mutex_lock(&pipe->busy_mutex);
@@ -1613,6 +1822,18 @@ dt_dev_pixelpipe_process_rec(dt_dev_pixelpipe_t *pipe, dt_develop_t *dev, void *
     pixelpipe_flow &= ~(PIXELPIPE_FLOW_BLENDED_ON_GPU);
 #endif
 
+    if(pipe->cancelled)
+    {
+      // the module returned early, don't keep its incomplete output around.
+      dt_dev_pixelpipe_cache_invalidate(&(pipe->cache), *output);
+#ifdef HAVE_OPENCL
+      if(*cl_mem_output != NULL) dt_opencl_release_mem_object(*cl_mem_output);
+      *cl_mem_output = NULL;
+#endif
+      dt_pthread_mutex_unlock(&pipe->busy_mutex);
+      return 1;
+    }
+
     char histogram_log[32] = "";
     if(!(pixelpipe_flow & PIXELPIPE_FLOW_HISTOGRAM_NONE))
     {
@@ -2180,8 +2401,10 @@ dt_dev_pixelpipe_process_rec_and_backcopy(dt_dev_pixelpipe_t *pipe, dt_develop_t
 #endif
 }
 
-
-int dt_dev_pixelpipe_process(dt_dev_pixelpipe_t *pipe, dt_develop_t *dev, int x, int y, int width, int height, float scale)
+// runs the pipe on the given region, the result ends up in *output, which is a line of pipe->cache.
+static int
+dt_dev_pixelpipe_process_region(dt_dev_pixelpipe_t *pipe, dt_develop_t *dev, int x, int y, int width, int height,
+                                float scale, void **output)
 {
   pipe->processing = 1;
   pipe->opencl_enabled = dt_opencl_update_enabled(); // update enabled flag from preferences
@@ -2222,6 +2445,7 @@ restart:
 
   // mask display off as a starting point
   pipe->mask_display = 0;
+  pipe->cancelled = 0;
 
   void *buf = NULL;
   void *cl_mem_out = NULL;
@@ -2274,22 +2498,296 @@ restart:
     return 1;
   }
 
-  // terminate
-  dt_pthread_mutex_lock(&pipe->backbuf_mutex);
+  *output = buf;
+  // printf("pixelpipe homebrew process end\n");
+  pipe->processing = 0;
+  return 0;
+}
+
+// the caller holds the backbuf mutex
+static void
+_pixelpipe_set_backbuf_locked(dt_dev_pixelpipe_t *pipe, void *buf, int x, int y, int width, int height, float scale)
+{
+  dt_iop_roi_t roi = (dt_iop_roi_t)
+  {
+    x, y, width, height, scale
+  };
   pipe->backbuf_hash = dt_dev_pixelpipe_cache_hash(pipe->image.id, &roi, pipe, 0);
   pipe->backbuf = buf;
   pipe->backbuf_width  = width;
   pipe->backbuf_height = height;
+  pipe->backbuf_scale  = scale;
+}
+
+static void
+dt_dev_pixelpipe_set_backbuf(dt_dev_pixelpipe_t *pipe, void *buf, int x, int y, int width, int height, float scale)
+{
+  dt_pthread_mutex_lock(&pipe->backbuf_mutex);
+  _pixelpipe_set_backbuf_locked(pipe, buf, x, y, width, height, scale);
   dt_pthread_mutex_unlock(&pipe->backbuf_mutex);
+}
 
-  // printf("pixelpipe homebrew process end\n");
-  pipe->processing = 0;
+int dt_dev_pixelpipe_process(dt_dev_pixelpipe_t *pipe, dt_develop_t *dev, int x, int y, int width, int height, float scale)
+{
+  void *buf = NULL;
+  if(dt_dev_pixelpipe_process_region(pipe, dev, x, y, width, height, scale, &buf)) return 1;
+
+  // terminate
+  dt_dev_pixelpipe_set_backbuf(pipe, buf, x, y, width, height, scale);
+  return 0;
+}
+
+// copies the intersection of two 4 byte per pixel buffers at positions (dx, dy) and (sx, sy)
+static void
+_copy_intersection(uint8_t *dst, int dx, int dy, int dw, int dh,
+                   const uint8_t *src, int sx, int sy, int sw, int sh)
+{
+  const int x0 = MAX(dx, sx), x1 = MIN(dx + dw, sx + sw);
+  const int y0 = MAX(dy, sy), y1 = MIN(dy + dh, sy + sh);
+  if(x0 >= x1 || y0 >= y1) return;
+  for(int j=y0; j<y1; j++)
+    memcpy(dst + 4*((size_t)dw*(j - dy) + x0 - dx), src + 4*((size_t)sw*(j - sy) + x0 - sx), 4*(x1 - x0));
+}
+
+int dt_dev_pixelpipe_process_tiled(dt_dev_pixelpipe_t *pipe, dt_develop_t *dev, int x, int y, int width, int height, float scale)
+{
+  dt_dev_pixelpipe_tiles_t *tiles = &pipe->tiles;
+  if(!tiles->entries)
+  {
+    // enough tiles for a few screens worth of the largest view.
+    const int ts = DT_DEV_PIXELPIPE_TILE_SIZE;
+    const int per_view = (darktable.thumbnail_width/ts + 2) * (darktable.thumbnail_height/ts + 2);
+    if(!dt_dev_pixelpipe_tiles_init(tiles, 3*per_view, ts))
+      return dt_dev_pixelpipe_process(pipe, dev, x, y, width, height, scale);
+  }
+  const int ts = tiles->tile_size;
+  // size of the processed image at this scale, tiles at the right and bottom edge are cut off there
+  const int iwd = pipe->processed_width * scale, iht = pipe->processed_height * scale;
+  const int tx0 = x / ts, tx1 = (x + width - 1) / ts;
+  const int ty0 = y / ts, ty1 = (y + height - 1) / ts;
+  const int tw = tx1 - tx0 + 1, th = ty1 - ty0 + 1;
+  if(x < 0 || y < 0 || width <= 0 || height <= 0 || x + width > iwd || y + height > iht || 2*tw*th > tiles->entries)
+    return dt_dev_pixelpipe_process(pipe, dev, x, y, width, height, scale);
+  // regions are processed with this margin around them which is cut off again, so tiles match
+  // their neighbours. if some module depends on the region as a whole, tiles can't be mixed at all.
+  const int overlap = dt_dev_pixelpipe_region_overlap(pipe, dev, scale);
+  if(overlap < 0)
+    return dt_dev_pixelpipe_process(pipe, dev, x, y, width, height, scale);
+
+  // process() flushes the cache lines by itself, but would never see the flag if all tiles are there.
+  if(pipe->cache_obsolete)
+  {
+    dt_dev_pixelpipe_cache_flush(&pipe->cache);
+    dt_dev_pixelpipe_tiles_flush(tiles);
+    pipe->cache_obsolete = 0;
+  }
+
+  // the output of the whole stack, independent of the region:
+  const dt_iop_roi_t roi_stack = (dt_iop_roi_t)
+  {
+    0, 0, 0, 0, scale
+  };
+  const uint64_t pipe_hash = dt_dev_pixelpipe_cache_hash(pipe->image.id, &roi_stack, pipe, g_list_length(pipe->nodes));
+
+  uint8_t **tile = (uint8_t **)calloc(tw*th, sizeof(uint8_t *));
+  int hits = 0;
+  for(int j=0; j<th; j++) for(int i=0; i<tw; i++)
+  {
+    tile[tw*j + i] = dt_dev_pixelpipe_tiles_get(tiles, dt_dev_pixelpipe_tiles_hash(pipe_hash, tx0 + i, ty0 + j));
+    if(tile[tw*j + i]) hits++;
+  }
+
+  if(!hits)
+  {
+    // nothing to reuse (new parameters or zoom level): process exactly the view as always,
+    // and keep the tiles it covers completely, and far enough from its edges, for later.
+    void *buf = NULL;
+    if(dt_dev_pixelpipe_process_region(pipe, dev, x, y, width, height, scale, &buf))
+    {
+      free(tile);
+      return 1;
+    }
+    const int vx0 = x > 0 ? x + overlap : 0, vy0 = y > 0 ? y + overlap : 0;
+    const int vx1 = x + width < iwd ? x + width - overlap : iwd, vy1 = y + height < iht ? y + height - overlap : iht;
+    for(int j=0; j<th; j++) for(int i=0; i<tw; i++)
+    {
+      const int px = (tx0 + i)*ts, py = (ty0 + j)*ts;
+      const int pw = MIN(ts, iwd - px), ph = MIN(ts, iht - py);
+      if(px < vx0 || py < vy0 || px + pw > vx1 || py + ph > vy1) continue;
+      tile[tw*j + i] = dt_dev_pixelpipe_tiles_put(tiles, dt_dev_pixelpipe_tiles_hash(pipe_hash, tx0 + i, ty0 + j));
+      _copy_intersection(tile[tw*j + i], px, py, ts, ts, buf, x, y, width, height);
+    }
+    free(tile);
+    dt_dev_pixelpipe_set_backbuf(pipe, buf, x, y, width, height, scale);
+    return 0;
+  }
+
+  // process the missing tiles in as few rectangles as possible: runs of missing tiles in a row,
+  // merged with the run of the same columns in the rows above. after a pan that is one strip
+  // at each edge that moved into view.
+  int *rect = (int *)malloc(sizeof(int)*4*tw*th); // first column, first row, last column, last row
+  int num_rects = 0, err = 0;
+  for(int j=0; j<th; j++)
+  {
+    for(int i=0; i<tw; i++)
+    {
+      if(tile[tw*j + i]) continue;
+      int i1 = i;
+      while(i1 + 1 < tw && !tile[tw*j + i1 + 1]) i1++;
+      int r = 0;
+      for(; r<num_rects; r++)
+        if(rect[4*r] == i && rect[4*r+2] == i1 && rect[4*r+3] == j - 1) break;
+      if(r == num_rects)
+      {
+        rect[4*r] = i;
+        rect[4*r+1] = j;
+        rect[4*r+2] = i1;
+        num_rects++;
+      }
+      rect[4*r+3] = j;
+      i = i1;
+    }
+  }
+  for(int r=0; r<num_rects && !err; r++)
+  {
+    // grown by the overlap, so the new tiles continue seamlessly into the cached ones
+    const int px = MAX(0, (tx0 + rect[4*r])*ts - overlap), py = MAX(0, (ty0 + rect[4*r+1])*ts - overlap);
+    const int pw = MIN((tx0 + rect[4*r+2] + 1)*ts + overlap, iwd) - px;
+    const int ph = MIN((ty0 + rect[4*r+3] + 1)*ts + overlap, iht) - py;
+    void *buf = NULL;
+    if(dt_dev_pixelpipe_process_region(pipe, dev, px, py, pw, ph, scale, &buf))
+    {
+      err = 1;
+      break;
+    }
+    for(int j=rect[4*r+1]; j<=rect[4*r+3]; j++) for(int i=rect[4*r]; i<=rect[4*r+2]; i++)
+    {
+      tile[tw*j + i] = dt_dev_pixelpipe_tiles_put(tiles, dt_dev_pixelpipe_tiles_hash(pipe_hash, tx0 + i, ty0 + j));
+      _copy_intersection(tile[tw*j + i], (tx0 + i)*ts, (ty0 + j)*ts, ts, ts, buf, px, py, pw, ph);
+    }
+    dt_print(DT_DEBUG_DEV, "[pixelpipe_process_tiled] processed %dx%d at %d %d for a %dx%d view\n", pw, ph, px, py,
+             width, height);
+  }
+  free(rect);
+  if(err)
+  {
+    free(tile);
+    return 1;
+  }
+
+  // put the view together. the old output might be on screen right now, so do it under the lock.
+  dt_pthread_mutex_lock(&pipe->backbuf_mutex);
+  const size_t size = (size_t)width*height*4;
+  if(tiles->output_size < size)
+  {
+    if(pipe->backbuf == tiles->output) pipe->backbuf = NULL;
+    dt_free_align(tiles->output);
+    tiles->output = (uint8_t *)dt_alloc_align(16, size);
+    tiles->output_size = tiles->output ? size : 0;
+  }
+  if(tiles->output)
+  {
+    for(int j=0; j<th; j++) for(int i=0; i<tw; i++)
+      _copy_intersection(tiles->output, x, y, width, height, tile[tw*j + i], (tx0 + i)*ts, (ty0 + j)*ts, ts, ts);
+  }
+  dt_pthread_mutex_unlock(&pipe->backbuf_mutex);
+  free(tile);
+  if(!tiles->output) return dt_dev_pixelpipe_process(pipe, dev, x, y, width, height, scale);
+  dt_dev_pixelpipe_set_backbuf(pipe, tiles->output, x, y, width, height, scale);
+  return 0;
+}
+
+int dt_dev_pixelpipe_process_coarse(dt_dev_pixelpipe_t *pipe, dt_develop_t *dev, int x, int y, int width, int height, float scale)
+{
+  if(!pipe->coarse_cache.entries)
+  {
+    // cache lines grow on demand, start out with a quarter of the full ones.
+    if(!dt_dev_pixelpipe_cache_init(&pipe->coarse_cache, pipe->cache.entries, pipe->backbuf_size/4))
+    {
+      pipe->coarse_cache.entries = 0;
+      return dt_dev_pixelpipe_process(pipe, dev, x, y, width, height, scale);
+    }
+  }
+  // process() only flushes the cache it runs on, take care of the other one:
+  if(pipe->cache_obsolete) dt_dev_pixelpipe_cache_flush(&pipe->cache);
+
+  const dt_dev_pixelpipe_cache_t full_cache = pipe->cache;
+  pipe->cache = pipe->coarse_cache;
+  void *buf = NULL;
+  const int ret = dt_dev_pixelpipe_process_region(pipe, dev, x, y, width, height, scale, &buf);
+  pipe->coarse_cache = pipe->cache;
+  pipe->cache = full_cache;
+  if(ret) return ret;
+
+  // the coarse output stays on screen while the full pass runs, and the next coarse pass
+  // would write to the same cache line underneath it. show a copy, made under the lock.
+  dt_pthread_mutex_lock(&pipe->backbuf_mutex);
+  const size_t size = (size_t)width*height*4;
+  if(pipe->coarse_output_size < size)
+  {
+    if(pipe->backbuf == pipe->coarse_output) pipe->backbuf = NULL;
+    dt_free_align(pipe->coarse_output);
+    pipe->coarse_output = (uint8_t *)dt_alloc_align(16, size);
+    pipe->coarse_output_size = pipe->coarse_output ? size : 0;
+  }
+  if(pipe->coarse_output)
+  {
+    memcpy(pipe->coarse_output, buf, size);
+    buf = pipe->coarse_output;
+  }
+  _pixelpipe_set_backbuf_locked(pipe, buf, x, y, width, height, scale);
+  dt_pthread_mutex_unlock(&pipe->backbuf_mutex);
   return 0;
 }
 
 void dt_dev_pixelpipe_flush_caches(dt_dev_pixelpipe_t *pipe)
 {
   dt_dev_pixelpipe_cache_flush(&pipe->cache);
+  if(pipe->coarse_cache.entries) dt_dev_pixelpipe_cache_flush(&pipe->coarse_cache);
+  if(pipe->tiles.entries) dt_dev_pixelpipe_tiles_flush(&pipe->tiles);
+}
+
+int dt_dev_pixelpipe_region_overlap(dt_dev_pixelpipe_t *pipe, struct dt_develop_t *dev, float scale)
+{
+  // overlaps add up along the pipe. buf_in/buf_out are set up by dt_dev_pixelpipe_get_dimensions().
+  int overlap = 0;
+  dt_pthread_mutex_lock(&pipe->busy_mutex);
+  GList *modules = dev->iop;
+  GList *pieces  = pipe->nodes;
+  while(modules && pieces)
+  {
+    dt_iop_module_t *module = (dt_iop_module_t *)modules->data;
+    dt_dev_pixelpipe_iop_t *piece = (dt_dev_pixelpipe_iop_t *)pieces->data;
+    modules = g_list_next(modules);
+    pieces = g_list_next(pieces);
+    if(_pixelpipe_piece_skipped(dev, module, piece)) continue;
+
+    const int flags = module->flags();
+    // a histogram of the region would be computed per strip or tile (auto levels, deflicker)
+    if((flags & IOP_FLAGS_REGION_STATISTICS) || _pixelpipe_piece_samples_input(pipe, dev, module))
+    {
+      overlap = -1;
+      break;
+    }
+    // a blurred blend mask reaches beyond the region, even for pointwise modules
+    const dt_develop_blend_params_t *b = (const dt_develop_blend_params_t *)piece->blendop_data;
+    if(b && (b->mask_mode & DEVELOP_MASK_ENABLED) && fabsf(b->radius) > 0.1f)
+      overlap += ceilf(3.0f*fabsf(b->radius)*scale/piece->iscale);
+    if(flags & IOP_FLAGS_POINTWISE) continue;
+    if(!(flags & IOP_FLAGS_ALLOW_TILING)) { overlap = -1; break; }
+
+    dt_iop_roi_t roi_in = piece->buf_in, roi_out = piece->buf_out;
+    roi_in.width  = MAX(1, roi_in.width*scale);
+    roi_in.height = MAX(1, roi_in.height*scale);
+    roi_out.width  = MAX(1, roi_out.width*scale);
+    roi_out.height = MAX(1, roi_out.height*scale);
+    roi_in.scale = roi_out.scale = scale;
+    dt_develop_tiling_t tiling = { 0 };
+    module->tiling_callback(module, piece, &roi_in, &roi_out, &tiling);
+    overlap += tiling.overlap;
+  }
+  dt_pthread_mutex_unlock(&pipe->busy_mutex);
+  return overlap;
 }
 
 void dt_dev_pixelpipe_get_dimensions(dt_dev_pixelpipe_t *pipe, struct dt_develop_t *dev, int width_in, int height_in, int *width, int *height)
@@ -79,6 +79,13 @@ typedef struct dt_dev_pixelpipe_t
 {
   // store history/zoom caches
   dt_dev_pixelpipe_cache_t cache;
+  // separate cache lines for coarse passes, allocated on first use
+  dt_dev_pixelpipe_cache_t coarse_cache;
+  // copy of the last coarse output shown in the backbuf, the next coarse pass reuses the cache lines
+  uint8_t *coarse_output;
+  size_t coarse_output_size;
+  // tiles of the final output for reuse after panning, allocated on first use
+  dt_dev_pixelpipe_tiles_t tiles;
   // set to non-zero in order to obsolete old cache entries on next pixelpipe run
   int cache_obsolete;
   // input buffer
@@ -101,6 +108,7 @@ typedef struct dt_dev_pixelpipe_t
   uint8_t *backbuf;
   size_t backbuf_size;
   int backbuf_width, backbuf_height;
+  float backbuf_scale;
   uint64_t backbuf_hash;
   dt_pthread_mutex_t backbuf_mutex, busy_mutex;
   // working?
@@ -113,6 +121,8 @@ typedef struct dt_dev_pixelpipe_t
   int opencl_error;
   // running in a tiling context?
   int tiling;
+  // set if a module stopped processing early because its result was not needed any more
+  int cancelled;
   // should this pixelpipe display a mask in the end?
   int mask_display;
   // input data based on this timestamp:
@@ -166,6 +176,15 @@ void dt_dev_pixelpipe_synch_top(dt_dev_pixelpipe_t *pipe, struct dt_develop_t *d
 
 // process region of interest of pixels. returns 1 if pipe was altered during processing.
 int dt_dev_pixelpipe_process(dt_dev_pixelpipe_t *pipe, struct dt_develop_t *dev, int x, int y, int width, int height, float scale);
+// same as above, but runs on separate cache lines. meant for quick low resolution passes in between
+// full ones, which would otherwise evict the full resolution intermediates from the cache.
+int dt_dev_pixelpipe_process_coarse(dt_dev_pixelpipe_t *pipe, struct dt_develop_t *dev, int x, int y, int width, int height, float scale);
+// same as dt_dev_pixelpipe_process(), but keeps the output in tiles and only processes the ones not
+// cached already. the backbuf is then put together from the tiles, so panning reuses the visible part.
+int dt_dev_pixelpipe_process_tiled(dt_dev_pixelpipe_t *pipe, struct dt_develop_t *dev, int x, int y, int width, int height, float scale);
+/** how many output pixels around a region the enabled modules need to see to process it
+ * like the whole image, or -1 if some module can't be run on parts of the image at all. */
+int dt_dev_pixelpipe_region_overlap(dt_dev_pixelpipe_t *pipe, struct dt_develop_t *dev, float scale);
 // convenience method that does not gamma-compress the image.
 int dt_dev_pixelpipe_process_no_gamma(dt_dev_pixelpipe_t *pipe, struct dt_develop_t *dev, int x, int y, int width, int height, float scale);
 
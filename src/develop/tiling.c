@@ -724,6 +724,9 @@ _default_process_tiling_ptp (struct dt_iop_module_t *self, struct dt_dev_pixelpi
   for(size_t tx=0; tx<tiles_x; tx++)
     for(size_t ty=0; ty<tiles_y; ty++)
     {
+      /* skip the remaining tiles if the result is not needed any more */
+      if(dt_iop_cancelled(piece)) continue;
+
       piece->pipe->tiling = 1;
 
       size_t wd = tx * tile_wd + width > roi_in->width  ? roi_in->width - tx * tile_wd : width;
@@ -957,6 +960,9 @@ _default_process_tiling_roi (struct dt_iop_module_t *self, struct dt_dev_pixelpi
   for(size_t tx=0; tx<tiles_x; tx++)
     for(size_t ty=0; ty<tiles_y; ty++)
     {
+      /* skip the remaining tiles if the result is not needed any more */
+      if(dt_iop_cancelled(piece)) continue;
+
       piece->pipe->tiling = 1;
 
       /* the output dimensions of the good part of this specific tile */
@@ -1296,6 +1302,9 @@ _default_process_tiling_cl_ptp (struct dt_iop_module_t *self, struct dt_dev_pixe
   for(size_t tx=0; tx<tiles_x; tx++)
     for(size_t ty=0; ty<tiles_y; ty++)
     {
+      /* skip the remaining tiles if the result is not needed any more */
+      if(dt_iop_cancelled(piece)) continue;
+
       piece->pipe->tiling = 1;
 
       size_t wd = tx * tile_wd + width > roi_in->width  ? roi_in->width - tx * tile_wd : width;
@@ -1621,6 +1630,9 @@ _default_process_tiling_cl_roi (struct dt_iop_module_t *self, struct dt_dev_pixe
   for(size_t tx=0; tx<tiles_x; tx++)
     for(size_t ty=0; ty<tiles_y; ty++)
     {
+      /* skip the remaining tiles if the result is not needed any more */
+      if(dt_iop_cancelled(piece)) continue;
+
       piece->pipe->tiling = 1;
 
       /* the output dimensions of the good part of this specific tile */
@@ -208,7 +208,13 @@ mime(dt_imageio_module_data_t *data)
 }
 
 static int
-write_image (dt_imageio_module_data_t *data, const char *filename, const void *in, void *exif, int exif_len, int imgid)
+flags(dt_imageio_module_data_t *data)
+{
+  return 0;
+}
+
+static int
+write_image (dt_imageio_module_data_t *data, const char *filename, const void *in, void *exif, int exif_len, const char *xmp, int imgid)
 {
   const int offx = (width  - data->width )/2;
   const int offy = (height - data->height)/2;
@@ -252,7 +258,9 @@ process_next_image()
   buf.mime = mime;
   buf.levels = levels;
   buf.bpp = bpp;
+  buf.flags = flags;
   buf.write_image = write_image;
+  buf.write_image_rows = NULL;
   dat.max_width  = width;
   dat.max_height = height;
   dat.style[0] = '\0';
@@ -24,6 +24,7 @@
    -------------------------------------------------------------------------- */
    
 #include "colourblock.h"
+#include <cstring>
 
 namespace squish {
 
@@ -157,13 +158,9 @@ static int Unpack565( u8 const* packed, u8* colour )
 	return value;
 }
 
-void DecompressColour( u8* rgba, void const* block, bool isDxt1 )
+static void DecompressPalette( u8* codes, u8 const* bytes, bool isDxt1 )
 {
-	// get the block bytes
-	u8 const* bytes = reinterpret_cast< u8 const* >( block );
-	
 	// unpack the endpoints
-	u8 codes[16];
 	int a = Unpack565( bytes, codes );
 	int b = Unpack565( bytes + 2, codes + 4 );
 	
@@ -188,6 +185,16 @@ void DecompressColour( u8* rgba, void const* block, bool isDxt1 )
 	// fill in alpha for the intermediate values
 	codes[8 + 3] = 255;
 	codes[12 + 3] = ( isDxt1 && a <= b ) ? 0 : 255;
+}
+
+void DecompressColour( u8* rgba, void const* block, bool isDxt1 )
+{
+	// get the block bytes
+	u8 const* bytes = reinterpret_cast< u8 const* >( block );
+	
+	// unpack the endpoints and midpoints
+	u8 codes[16];
+	DecompressPalette( codes, bytes, isDxt1 );
 	
 	// unpack the indices
 	u8 indices[16];
@@ -211,4 +218,23 @@ void DecompressColour( u8* rgba, void const* block, bool isDxt1 )
 	}
 }
 
+void DecompressColour( u8* rgba, int pitch, int cols, int rows, void const* block, bool isDxt1 )
+{
+	// get the block bytes
+	u8 const* bytes = reinterpret_cast< u8 const* >( block );
+	
+	// unpack the endpoints and midpoints
+	u8 codes[16];
+	DecompressPalette( codes, bytes, isDxt1 );
+	
+	// look up the colours straight into the image rows
+	for( int i = 0; i < rows; ++i )
+	{
+		u8* row = rgba + i*pitch;
+		u8 packed = bytes[4 + i];
+		for( int j = 0; j < cols; ++j, packed >>= 2 )
+			std::memcpy( row + 4*j, codes + 4*( packed & 0x3 ), 4 );
+	}
+}
+
 } // namespace squish
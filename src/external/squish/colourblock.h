@@ -36,6 +36,11 @@ void WriteColourBlock4( Vec3::Arg start, Vec3::Arg end, u8 const* indices, void*
 
 void DecompressColour( u8* rgba, void const* block, bool isDxt1 );
 
+// decompresses the colours of the top left cols x rows pixels of a block
+// directly into an image with rows pitch bytes apart, alpha is not touched
+// beyond the colour block.
+void DecompressColour( u8* rgba, int pitch, int cols, int rows, void const* block, bool isDxt1 );
+
 } // namespace squish
 
 #endif // ndef SQUISH_COLOURBLOCK_H
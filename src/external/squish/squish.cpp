@@ -143,7 +143,7 @@ void CompressImage( u8 const* rgba, const int width, const int height, void* blo
 
 	// loop over blocks
 #ifdef _OPENMP
-#pragma omp parallel for default(none) schedule(dynamic) shared(blocks, rgba)
+#pragma omp parallel for schedule(dynamic)
 #endif
 	for( int y = 0; y < height; y += 4 )
 	{
@@ -199,9 +199,28 @@ void DecompressImage( u8* rgba, const int width, const int height, void const* b
 
 	const int bytesPerBlock = ( ( flags & kDxt1 ) != 0 ) ? 8 : 16;
 
+	// dxt1 has no separate alpha block, decode the colours straight into the image
+	if( ( flags & kDxt1 ) != 0 )
+	{
+#ifdef _OPENMP
+#pragma omp parallel for schedule(static)
+#endif
+		for( int y = 0; y < height; y += 4 )
+		{
+			u8 const* sourceBlock = reinterpret_cast< u8 const* >( blocks ) + bytesPerBlock*((width+3)/4)*(y/4);
+			const int rows = std::min( 4, height - y );
+			for( int x = 0; x < width; x += 4 )
+			{
+				DecompressColour( rgba + 4*( width*y + x ), 4*width, std::min( 4, width - x ), rows, sourceBlock, true );
+				sourceBlock += bytesPerBlock;
+			}
+		}
+		return;
+	}
+
 	// loop over blocks
 #ifdef _OPENMP
-#pragma omp parallel for default(none) schedule(dynamic) shared(blocks, rgba)
+#pragma omp parallel for schedule(dynamic)
 #endif
 	for( int y = 0; y < height; y += 4 )
 	{
@@ -90,7 +90,7 @@ extern "C"
 
   void cleanup(dt_imageio_module_format_t *self) {}
 
-  int write_image (dt_imageio_module_data_t *tmp, const char *filename, const void *in_tmp, void *exif, int exif_len, int imgid)
+  int write_image (dt_imageio_module_data_t *tmp, const char *filename, const void *in_tmp, void *exif, int exif_len, const char *xmp, int imgid)
   {
     dt_imageio_exr_t * exr = (dt_imageio_exr_t*) tmp;
 
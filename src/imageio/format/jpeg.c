@@ -24,12 +24,14 @@
 #include "common/imageio_module.h"
 #include "common/imageio.h"
 #include "common/colorspaces.h"
+#include "common/exif.h"
 #include "control/conf.h"
 #include "common/imageio_format.h"
 #include "dtgtk/slider.h"
 #include <setjmp.h>
 #include <stdlib.h>
 #include <stdio.h>
+#include <string.h>
 #include <inttypes.h>
 // this fixes a rather annoying, long time bug in libjpeg :(
 #undef HAVE_STDLIB_H
@@ -321,23 +323,35 @@ read_icc_profile (j_decompress_ptr cinfo,
 #undef MAX_SEQ_NO
 
 
+// namespace signature of an xmp APP1 marker, including the terminating zero
+#define XMP_HEADER "http://ns.adobe.com/xap/1.0/"
+#define XMP_HEADER_LEN 29
+
 int
-write_image (dt_imageio_module_data_t *jpg_tmp, const char *filename, const void *in_tmp, void *exif, int exif_len, int imgid)
+write_image_rows (dt_imageio_module_data_t *jpg_tmp, const char *filename, dt_imageio_module_row_source_t *source, void *exif, int exif_len, const char *xmp, int imgid)
 {
   dt_imageio_jpeg_t *jpg = (dt_imageio_jpeg_t*)jpg_tmp;
-  const uint8_t*in =(const uint8_t*)in_tmp;
   struct dt_imageio_jpeg_error_mgr jerr;
+  // in case the source has to copy the scanline somewhere
+  uint8_t *scratch = (uint8_t *)malloc((size_t)4*jpg->width);
+  if(!scratch) return 1;
 
   jpg->cinfo.err = jpeg_std_error(&jerr.pub);
   jerr.pub.error_exit = dt_imageio_jpeg_error_exit;
   if (setjmp(jerr.setjmp_buffer))
   {
     jpeg_destroy_compress(&(jpg->cinfo));
+    free(scratch);
     return 1;
   }
   jpeg_create_compress(&(jpg->cinfo));
   FILE *f = fopen(filename, "wb");
-  if(!f) return 1;
+  if(!f)
+  {
+    jpeg_destroy_compress(&(jpg->cinfo));
+    free(scratch);
+    return 1;
+  }
   jpeg_stdio_dest(&(jpg->cinfo), f);
 
   jpg->cinfo.image_width = jpg->width;
@@ -374,12 +388,38 @@ write_image (dt_imageio_module_data_t *jpg_tmp, const char *filename, const void
   if(exif && exif_len > 0 && exif_len < 65534)
     jpeg_write_marker(&(jpg->cinfo), JPEG_APP0+1, exif, exif_len);
 
+  // the xmp packet goes into its own APP1 marker, if it fits into one
+  int xmp_embedded = 0;
+  if(xmp)
+  {
+    const size_t xmp_len = strlen(xmp);
+    if(XMP_HEADER_LEN + xmp_len <= 65533)
+    {
+      JOCTET *marker = (JOCTET *)malloc(XMP_HEADER_LEN + xmp_len);
+      if(marker)
+      {
+        memcpy(marker, XMP_HEADER, XMP_HEADER_LEN);
+        memcpy(marker + XMP_HEADER_LEN, xmp, xmp_len);
+        jpeg_write_marker(&(jpg->cinfo), JPEG_APP0+1, marker, XMP_HEADER_LEN + xmp_len);
+        free(marker);
+        xmp_embedded = 1;
+      }
+    }
+  }
+
   uint8_t row[3*jpg->width];
   const uint8_t *buf;
   while(jpg->cinfo.next_scanline < jpg->cinfo.image_height)
   {
     JSAMPROW tmp[1];
-    buf = in + (size_t)jpg->cinfo.next_scanline * jpg->cinfo.image_width * 4;
+    buf = source->rows(source, jpg->cinfo.next_scanline, 1, scratch);
+    if(!buf)
+    {
+      jpeg_destroy_compress(&(jpg->cinfo));
+      fclose(f);
+      free(scratch);
+      return 1;
+    }
     for(int i=0; i<jpg->width; i++) for(int k=0; k<3; k++) row[3*i+k] = buf[4*i+k];
     tmp[0] = row;
     jpeg_write_scanlines(&(jpg->cinfo), tmp, 1);
@@ -387,9 +427,22 @@ write_image (dt_imageio_module_data_t *jpg_tmp, const char *filename, const void
   jpeg_finish_compress (&(jpg->cinfo));
   jpeg_destroy_compress(&(jpg->cinfo));
   fclose(f);
+  free(scratch);
+
+  // huge packets would need extended xmp, let exiv2 deal with those
+  if(xmp && !xmp_embedded)
+    dt_exif_xmp_attach(imgid, filename);
   return 0;
 }
 
+int
+write_image (dt_imageio_module_data_t *jpg, const char *filename, const void *in, void *exif, int exif_len, const char *xmp, int imgid)
+{
+  dt_imageio_module_row_source_t source;
+  dt_imageio_module_row_source_buffer(&source, in, (size_t)4*jpg->width);
+  return write_image_rows(jpg, filename, &source, exif, exif_len, xmp, imgid);
+}
+
 int read_header(const char *filename, dt_imageio_jpeg_t *jpg)
 {
   jpg->f = fopen(filename, "rb");
@@ -505,7 +558,7 @@ extension(dt_imageio_module_data_t *data)
 int
 flags(dt_imageio_module_data_t *data)
 {
-  return FORMAT_FLAGS_SUPPORT_XMP;
+  return FORMAT_FLAGS_SUPPORT_XMP | FORMAT_FLAGS_EMBED_XMP;
 }
 
 void init(dt_imageio_module_format_t *self)
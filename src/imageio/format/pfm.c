@@ -28,37 +28,55 @@
 
 DT_MODULE(1)
 
-int write_image (dt_imageio_module_data_t *data, const char *filename, const void *ivoid, void *exif, int exif_len, int imgid)
+// rows fetched from the source at a time
+#define PFM_ROWS 64
+
+int write_image_rows (dt_imageio_module_data_t *data, const char *filename, dt_imageio_module_row_source_t *source, void *exif, int exif_len, const char *xmp, int imgid)
 {
   const dt_imageio_module_data_t * const pfm = data;
-  int status = 0;
+  int status = 1;
   FILE *f = fopen(filename, "wb");
-  if(f)
+  if(!f) return 1;
+
+  const int header = fprintf(f, "PF\n%d %d\n-1.0\n", pfm->width, pfm->height);
+  const size_t rowbytes = 3*sizeof(float)*pfm->width;
+  float *scratch = dt_alloc_align(16, 4*sizeof(float)*(size_t)pfm->width*PFM_ROWS);
+  float *chunk = dt_alloc_align(16, rowbytes*PFM_ROWS);
+  if(header < 0 || !scratch || !chunk) goto error;
+
+  //NOTE: pfm has rows in reverse order. we get them top down, so every chunk
+  // is flipped in memory and goes to its place near the end of the file.
+  for(int y=0; y<pfm->height; y+=PFM_ROWS)
   {
-    //INFO: per-line fwrite call seems to perform best. LebedevRI, 18.04.2014
-    (void)fprintf(f, "PF\n%d %d\n-1.0\n", pfm->width, pfm->height);
-    void *buf_line = dt_alloc_align(16, 3*sizeof(float)*pfm->width);
-    for(int j=0; j<pfm->height; j++)
+    const int rows = MIN(PFM_ROWS, pfm->height-y);
+    const uint8_t *ivoid = source->rows(source, y, rows, scratch);
+    if(!ivoid) goto error;
+    for(int j=0; j<rows; j++)
     {
-      //NOTE: pfm has rows in reverse order
-      const int row_in = pfm->height-1 - j;
-      const float *in = (const float *)ivoid + 4*(size_t)pfm->width*row_in;
-      float *out = (float *)buf_line;
+      const float *in = (const float *)(ivoid + source->stride*j);
+      float *out = chunk + 3*(size_t)pfm->width*(rows-1-j);
       for(int i = 0; i < pfm->width; i++, in+=4, out+=3)
-      {
         memcpy(out, in, 3*sizeof(float));
-      }
-      int cnt = fwrite(buf_line, 3*sizeof(float), pfm->width, f);
-      if(cnt != pfm->width) status = 1;
-      else status = 0;
     }
-    dt_free_align(buf_line);
-    buf_line = NULL;
-    fclose(f);
+    if(fseek(f, header + rowbytes*(pfm->height-y-rows), SEEK_SET)) goto error;
+    if(fwrite(chunk, rowbytes, rows, f) != rows) goto error;
   }
+  status = 0;
+
+error:
+  dt_free_align(chunk);
+  dt_free_align(scratch);
+  fclose(f);
   return status;
 }
 
+int write_image (dt_imageio_module_data_t *data, const char *filename, const void *ivoid, void *exif, int exif_len, const char *xmp, int imgid)
+{
+  dt_imageio_module_row_source_t source;
+  dt_imageio_module_row_source_buffer(&source, ivoid, 4*sizeof(float)*(size_t)data->width);
+  return write_image_rows(data, filename, &source, exif, exif_len, xmp, imgid);
+}
+
 size_t
 params_size(dt_imageio_module_format_t *self)
 {
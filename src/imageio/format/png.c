@@ -35,7 +35,7 @@
 #include "dtgtk/slider.h"
 #include "common/imageio_format.h"
 
-DT_MODULE(1)
+DT_MODULE(2)
 
 typedef struct dt_imageio_png_t
 {
@@ -43,6 +43,7 @@ typedef struct dt_imageio_png_t
   int width, height;
   char style[128];
   int bpp;
+  int compression;
   FILE *f;
   png_structp png_ptr;
   png_infop info_ptr;
@@ -52,6 +53,7 @@ dt_imageio_png_t;
 typedef struct dt_imageio_png_gui_t
 {
   GtkToggleButton *b8, *b16;
+  GtkDarktableSlider *compression;
 }
 dt_imageio_png_gui_t;
 
@@ -124,23 +126,148 @@ static void PNGwriteRawProfile(png_struct *ping,
   png_free(ping, text);
 }
 
+// size of the independently deflated pieces of the IDAT stream
+#define DT_PNG_CHUNK_SIZE (256*1024)
+// deflate window, also the amount of dictionary handed from one piece to the next
+#define DT_PNG_WINDOW_SIZE (32*1024)
+
+static inline int
+_png_paeth(const int a, const int b, const int c)
+{
+  const int p = a + b - c;
+  const int pa = abs(p - a), pb = abs(p - b), pc = abs(p - c);
+  if(pa <= pb && pa <= pc) return a;
+  if(pb <= pc) return b;
+  return c;
+}
+
+/* filter one row of rowbytes with bytes per pixel bpp, out receives the filter
+ * type byte followed by the filtered row. like libpng, try all five filters and
+ * keep the one with the smallest sum of absolute values. */
+static void
+_png_filter_row(const uint8_t *row, const uint8_t *prev, const size_t rowbytes, const int bpp,
+                uint8_t *out, uint8_t *scratch)
+{
+  uint64_t best_sum = UINT64_MAX;
+  for(int filter = 0; filter < 5; filter++)
+  {
+    uint8_t *f = (filter == 0) ? out + 1 : scratch;
+    uint64_t sum = 0;
+    for(size_t i = 0; i < rowbytes; i++)
+    {
+      const int a = i >= (size_t)bpp ? row[i-bpp] : 0;
+      const int b = prev ? prev[i] : 0;
+      const int c = (prev && i >= (size_t)bpp) ? prev[i-bpp] : 0;
+      int pred = 0;
+      switch(filter)
+      {
+        case 1: pred = a; break;
+        case 2: pred = b; break;
+        case 3: pred = (a + b) >> 1; break;
+        case 4: pred = _png_paeth(a, b, c); break;
+        default: break;
+      }
+      const uint8_t v = row[i] - pred;
+      f[i] = v;
+      sum += v < 128 ? v : 256 - v;
+    }
+    if(sum < best_sum)
+    {
+      best_sum = sum;
+      out[0] = filter;
+      if(filter) memcpy(out + 1, scratch, rowbytes);
+    }
+  }
+}
+
+// pack one image row as big endian rgb
+static void
+_png_pack_row(const dt_imageio_png_t *p, const uint8_t *in, uint8_t *row)
+{
+  const int width = p->width;
+  if(p->bpp > 8)
+  {
+    for(int x=0; x<width; x++) for(int k=0; k<3; k++)
+      {
+        uint16_t pix = ((uint16_t *)in)[4*x + k];
+        uint16_t swapped = (0xff00 & (pix<<8)) | (pix>>8);
+        ((uint16_t *)row)[3*x+k] = swapped;
+      }
+  }
+  else
+  {
+    for(int x=0; x<width; x++) for(int k=0; k<3; k++) row[3*x+k] = in[4*x + k];
+  }
+}
+
+/* deflate len bytes at src as a raw deflate piece which can be concatenated with
+ * the others, primed with up to DT_PNG_WINDOW_SIZE bytes of the preceding data. */
+static int
+_png_deflate_piece(const uint8_t *dict, const size_t dict_len, const uint8_t *src, const size_t len,
+                   const int last, const int level, uint8_t *dst, size_t *dst_len)
+{
+  z_stream z;
+  memset(&z, 0, sizeof(z));
+  if(deflateInit2(&z, level, Z_DEFLATED, -15, 8, Z_DEFAULT_STRATEGY) != Z_OK) return 1;
+  if(dict_len && deflateSetDictionary(&z, dict, dict_len) != Z_OK)
+  {
+    deflateEnd(&z);
+    return 1;
+  }
+  z.next_in = (Bytef *)src;
+  z.avail_in = len;
+  z.next_out = dst;
+  z.avail_out = *dst_len;
+  // a sync flush ends the piece on a byte boundary, only the very last one closes the stream
+  const int ret = deflate(&z, last ? Z_FINISH : Z_SYNC_FLUSH);
+  *dst_len = *dst_len - z.avail_out;
+  deflateEnd(&z);
+  return (last ? ret != Z_STREAM_END : ret != Z_OK) || z.avail_in;
+}
+
 int
-write_image (dt_imageio_module_data_t *p_tmp, const char *filename, const void *in_void, void *exif, int exif_len, int imgid)
+write_image_rows (dt_imageio_module_data_t *p_tmp, const char *filename, dt_imageio_module_row_source_t *source, void *exif, int exif_len, const char *xmp, int imgid)
 {
   dt_imageio_png_t*p=(dt_imageio_png_t*)p_tmp;
   const int width = p->width, height = p->height;
-  const uint8_t *in = (uint8_t *)in_void;
+  const int level = CLAMP(p->compression, 0, 9);
   FILE *f = fopen(filename, "wb");
   if (!f) return 1;
 
-  png_structp png_ptr;
-  png_infop info_ptr;
-
-  png_ptr = png_create_write_struct(PNG_LIBPNG_VER_STRING, NULL, NULL, NULL);
+  /* libpng deflates the whole image on one core, which for big 16-bit exports
+   * takes longer than processing it. filter rows and deflate the zlib stream
+   * in independent pieces in parallel (like pigz does), each primed with the
+   * preceding 32k of data so the compression ratio hardly suffers. a band of
+   * pieces is done at a time to bound memory. */
+  const int bytespp = 3*p->bpp/8;
+  const size_t rowbytes = (size_t)bytespp*width;
+  const size_t linebytes = rowbytes + 1;
+  const int nthreads = dt_get_num_threads();
+  const int rows_per_piece = MAX(1, DT_PNG_CHUNK_SIZE / linebytes);
+  const int pieces_per_band = 2*nthreads;
+  const int rows_per_band = rows_per_piece*pieces_per_band;
+  const size_t band_bytes = linebytes*MIN(rows_per_band, height);
+  const size_t zbound = deflateBound(NULL, linebytes*rows_per_piece) + 16;
+  const size_t in_stride = (size_t)4*p->bpp/8*width;
+
+  // room for the dictionary of the previous band in front of the filtered data
+  uint8_t *filtered = malloc(DT_PNG_WINDOW_SIZE + band_bytes);
+  uint8_t *zbuf = malloc(zbound*pieces_per_band);
+  size_t *zlen = malloc(sizeof(size_t)*pieces_per_band);
+  uint8_t *rows = malloc(3*rowbytes*nthreads);
+  // input rows of one band, and the last packed row of the previous band to filter against
+  uint8_t *scratch = malloc(in_stride*MIN(rows_per_band, height));
+  uint8_t *last_row = malloc(rowbytes);
+
+  png_structp png_ptr = NULL;
+  png_infop info_ptr = NULL;
+
+  if(filtered && zbuf && zlen && rows && scratch && last_row)
+    png_ptr = png_create_write_struct(PNG_LIBPNG_VER_STRING, NULL, NULL, NULL);
   if (!png_ptr)
   {
     fclose(f);
-    return 1;
+    goto error;
   }
 
   info_ptr = png_create_info_struct(png_ptr);
@@ -148,65 +275,135 @@ write_image (dt_imageio_module_data_t *p_tmp, const char *filename, const void *
   {
     fclose(f);
     png_destroy_write_struct(&png_ptr, NULL);
-    return 1;
+    goto error;
   }
 
   if (setjmp(png_jmpbuf(png_ptr)))
   {
     fclose(f);
     png_destroy_write_struct(&png_ptr, NULL);
-    return 1;
+    goto error;
   }
 
   png_init_io(png_ptr, f);
 
-  png_set_compression_level(png_ptr, Z_BEST_COMPRESSION);
-  png_set_compression_mem_level(png_ptr, 8);
-  png_set_compression_strategy(png_ptr, Z_DEFAULT_STRATEGY);
-  png_set_compression_window_bits(png_ptr, 15);
-  png_set_compression_method(png_ptr, 8);
-  png_set_compression_buffer_size(png_ptr, 8192);
-
   png_set_IHDR(png_ptr, info_ptr, width, height,
                p->bpp, PNG_COLOR_TYPE_RGB, PNG_INTERLACE_NONE,
                PNG_COMPRESSION_TYPE_DEFAULT, PNG_FILTER_TYPE_DEFAULT);
 
+  // exif goes in front of the image data, we write IDAT and IEND ourselves
+  PNGwriteRawProfile(png_ptr, info_ptr, "exif", exif, exif_len);
+
+#ifdef PNG_iTXt_SUPPORTED
+  // the xmp packet as an uncompressed international text chunk, as adobe does it
+  if(xmp)
+  {
+    png_text text;
+    memset(&text, 0, sizeof(text));
+    text.compression = PNG_ITXT_COMPRESSION_NONE;
+    text.key = (png_charp)"XML:com.adobe.xmp";
+    text.text = (png_charp)xmp;
+    text.itxt_length = strlen(xmp);
+    text.lang = (png_charp)"";
+    text.lang_key = (png_charp)"";
+    png_set_text(png_ptr, info_ptr, &text, 1);
+  }
+#endif
+
+  // TODO: embed icc profile!
+
   png_write_info(png_ptr, info_ptr);
 
-  // png_bytep row_pointer = (png_bytep) in;
-  png_byte row[6*width];
-  // unsigned long rowbytes = png_get_rowbytes(png_ptr, info_ptr);
+  uint8_t *const band = filtered + DT_PNG_WINDOW_SIZE;
 
-  if(p->bpp > 8)
+  // zlib header, window of 32k, no preset dictionary
+  const int flevel = level < 2 ? 0 : (level < 6 ? 1 : (level == 6 ? 2 : 3));
+  uint8_t header[2] = { 0x78, flevel << 6 };
+  header[1] += 31 - ((header[0] << 8) + header[1]) % 31;
+  png_write_chunk(png_ptr, (png_const_bytep)"IDAT", header, 2);
+
+  uLong adler = adler32(0L, Z_NULL, 0);
+  size_t dict_len = 0;
+  for(int y0 = 0; y0 < height; y0 += rows_per_band)
   {
-    for (int y = 0; y < height; y++)
+    const int band_rows = MIN(rows_per_band, height - y0);
+    const int pieces = (band_rows + rows_per_piece - 1) / rows_per_piece;
+    int failed = 0;
+    const uint8_t *in = source->rows(source, y0, band_rows, scratch);
+    if(!in) png_error(png_ptr, "reading rows failed");
+
+#ifdef _OPENMP
+    #pragma omp parallel for schedule(static) num_threads(nthreads) shared(p, in, rows, failed)
+#endif
+    for(int y = y0; y < y0 + band_rows; y++)
     {
-      for(int x=0; x<width; x++) for(int k=0; k<3; k++)
-        {
-          uint16_t pix = ((uint16_t *)in)[(size_t)4*width*y + 4*x + k];
-          uint16_t swapped = (0xff00 & (pix<<8)) | (pix>>8);
-          ((uint16_t *)row)[3*x+k] = swapped;
-        }
-      png_write_row(png_ptr, row);
+      uint8_t *row = rows + (size_t)3*rowbytes*dt_get_thread_num();
+      uint8_t *prev = row + rowbytes;
+      _png_pack_row(p, in + in_stride*(y-y0), row);
+      if(y > y0) _png_pack_row(p, in + in_stride*(y-y0-1), prev);
+      else if(y > 0) memcpy(prev, last_row, rowbytes);
+      _png_filter_row(row, y > 0 ? prev : NULL, rowbytes, bytespp, band + linebytes*(y-y0), prev + rowbytes);
     }
-  }
-  else
-  {
-    for (int y = 0; y < height; y++)
+    _png_pack_row(p, in + in_stride*(band_rows-1), last_row);
+
+#ifdef _OPENMP
+    #pragma omp parallel for schedule(dynamic) num_threads(nthreads) shared(zbuf, zlen, failed)
+#endif
+    for(int k = 0; k < pieces; k++)
     {
-      for(int x=0; x<width; x++) for(int k=0; k<3; k++) row[3*x+k] = in[(size_t)4*width*y + 4*x + k];
-      png_write_row(png_ptr, row);
+      const size_t start = linebytes*rows_per_piece*k;
+      const size_t len = linebytes*MIN(rows_per_piece, band_rows - rows_per_piece*k);
+      // the tail of the previous band sits right in front of band
+      const size_t dlen = MIN((size_t)DT_PNG_WINDOW_SIZE, k ? start : dict_len);
+      const int last = (y0 + band_rows == height) && (k == pieces - 1);
+      zlen[k] = zbound;
+      if(_png_deflate_piece(band + start - dlen, dlen, band + start, len, last, level,
+                            zbuf + zbound*k, &zlen[k]))
+        failed = 1;
     }
-  }
+    if(failed) png_error(png_ptr, "deflate failed");
 
-  PNGwriteRawProfile(png_ptr, info_ptr, "exif", exif, exif_len);
+    for(int k = 0; k < pieces; k++)
+      if(zlen[k]) png_write_chunk(png_ptr, (png_const_bytep)"IDAT", zbuf + zbound*k, zlen[k]);
 
-  // TODO: embed icc profile!
+    const size_t filled = linebytes*band_rows;
+    adler = adler32(adler, band, filled);
+
+    // keep the last 32k as dictionary for the next band
+    dict_len = MIN((size_t)DT_PNG_WINDOW_SIZE, filled);
+    memmove(band - dict_len, band + filled - dict_len, dict_len);
+  }
+
+  const uint8_t trailer[4] = { adler >> 24, (adler >> 16) & 0xff, (adler >> 8) & 0xff, adler & 0xff };
+  png_write_chunk(png_ptr, (png_const_bytep)"IDAT", (png_bytep)trailer, 4);
+  png_write_chunk(png_ptr, (png_const_bytep)"IEND", NULL, 0);
 
-  png_write_end(png_ptr, info_ptr);
   png_destroy_write_struct(&png_ptr, &info_ptr);
+  free(filtered);
+  free(zbuf);
+  free(zlen);
+  free(rows);
+  free(scratch);
+  free(last_row);
   fclose(f);
   return 0;
+
+error:
+  free(filtered);
+  free(zbuf);
+  free(zlen);
+  free(rows);
+  free(scratch);
+  free(last_row);
+  return 1;
+}
+
+int
+write_image (dt_imageio_module_data_t *p, const char *filename, const void *in, void *exif, int exif_len, const char *xmp, int imgid)
+{
+  dt_imageio_module_row_source_t source;
+  dt_imageio_module_row_source_buffer(&source, in, (size_t)4*((dt_imageio_png_t *)p)->bpp/8*p->width);
+  return write_image_rows(p, filename, &source, exif, exif_len, xmp, imgid);
 }
 
 int read_header(const char *filename, dt_imageio_module_data_t *p_tmp)
@@ -335,7 +532,23 @@ int read_image (dt_imageio_module_data_t *p_tmp, uint8_t *out)
 size_t
 params_size(dt_imageio_module_format_t *self)
 {
-  return sizeof(dt_imageio_module_data_t) + sizeof(int);
+  return sizeof(dt_imageio_module_data_t) + 2*sizeof(int);
+}
+
+void*
+legacy_params(dt_imageio_module_format_t *self, const void *const old_params, const size_t old_params_size,
+              const int old_version, const int new_version, size_t *new_size)
+{
+  if(old_version == 1 && new_version == 2)
+  {
+    // version 1 always used the best (and slowest) compression
+    dt_imageio_png_t *new_params = (dt_imageio_png_t *)calloc(1, sizeof(dt_imageio_png_t));
+    memcpy(new_params, old_params, old_params_size);
+    new_params->compression = Z_BEST_COMPRESSION;
+    *new_size = self->params_size(self);
+    return new_params;
+  }
+  return NULL;
 }
 
 void*
@@ -345,6 +558,8 @@ get_params(dt_imageio_module_format_t *self)
   d->bpp = dt_conf_get_int("plugins/imageio/format/png/bpp");
   if(d->bpp < 12) d->bpp = 8;
   else            d->bpp = 16;
+  d->compression = dt_conf_get_int("plugins/imageio/format/png/compression");
+  if(d->compression < 0 || d->compression > 9) d->compression = 6;
   return d;
 }
 
@@ -363,6 +578,8 @@ set_params(dt_imageio_module_format_t *self, const void *params, const int size)
   if(d->bpp < 12) gtk_toggle_button_set_active(g->b8, TRUE);
   else            gtk_toggle_button_set_active(g->b16, TRUE);
   dt_conf_set_int("plugins/imageio/format/png/bpp", d->bpp);
+  dtgtk_slider_set_value(g->compression, d->compression);
+  dt_conf_set_int("plugins/imageio/format/png/compression", d->compression);
   return 0;
 }
 
@@ -402,6 +619,13 @@ radiobutton_changed (GtkRadioButton *radiobutton, gpointer user_data)
     dt_conf_set_int("plugins/imageio/format/png/bpp", bpp);
 }
 
+static void
+compression_changed (GtkDarktableSlider *slider, gpointer user_data)
+{
+  int compression = (int)dtgtk_slider_get_value(slider);
+  dt_conf_set_int("plugins/imageio/format/png/compression", compression);
+}
+
 void init(dt_imageio_module_format_t *self)
 {
 #ifdef USE_LUA
@@ -411,23 +635,33 @@ void init(dt_imageio_module_format_t *self)
 }
 void cleanup(dt_imageio_module_format_t *self) {}
 
-// TODO: some quality/compression stuff?
 void gui_init (dt_imageio_module_format_t *self)
 {
   dt_imageio_png_gui_t *gui = (dt_imageio_png_gui_t *)malloc(sizeof(dt_imageio_png_gui_t));
   self->gui_data = (void *)gui;
   int bpp = dt_conf_get_int("plugins/imageio/format/png/bpp");
-  self->widget = gtk_hbox_new(TRUE, 5);
+  int compression = dt_conf_get_int("plugins/imageio/format/png/compression");
+  if(compression < 0 || compression > 9) compression = 6;
+  self->widget = gtk_vbox_new(TRUE, 5);
+  GtkWidget *hbox = gtk_hbox_new(TRUE, 5);
+  gtk_box_pack_start(GTK_BOX(self->widget), hbox, TRUE, TRUE, 0);
   GtkWidget *radiobutton = gtk_radio_button_new_with_label(NULL, _("8-bit"));
   gui->b8 = GTK_TOGGLE_BUTTON(radiobutton);
-  gtk_box_pack_start(GTK_BOX(self->widget), radiobutton, TRUE, TRUE, 0);
+  gtk_box_pack_start(GTK_BOX(hbox), radiobutton, TRUE, TRUE, 0);
   g_signal_connect(G_OBJECT(radiobutton), "toggled", G_CALLBACK(radiobutton_changed), GINT_TO_POINTER(8));
   if(bpp < 12) gtk_toggle_button_set_active(GTK_TOGGLE_BUTTON(radiobutton), TRUE);
   radiobutton = gtk_radio_button_new_with_label_from_widget(GTK_RADIO_BUTTON(radiobutton), _("16-bit"));
   gui->b16 = GTK_TOGGLE_BUTTON(radiobutton);
-  gtk_box_pack_start(GTK_BOX(self->widget), radiobutton, TRUE, TRUE, 0);
+  gtk_box_pack_start(GTK_BOX(hbox), radiobutton, TRUE, TRUE, 0);
   g_signal_connect(G_OBJECT(radiobutton), "toggled", G_CALLBACK(radiobutton_changed), GINT_TO_POINTER(16));
   if(bpp >= 12) gtk_toggle_button_set_active(GTK_TOGGLE_BUTTON(radiobutton), TRUE);
+
+  // deflate level, 0 stores the data uncompressed, 9 gives the smallest files
+  gui->compression = DTGTK_SLIDER(dtgtk_slider_new_with_range(DARKTABLE_SLIDER_BAR, 0, 9, 1, compression, 0));
+  dtgtk_slider_set_label(gui->compression, _("compression"));
+  dtgtk_slider_set_default_value(gui->compression, 6);
+  gtk_box_pack_start(GTK_BOX(self->widget), GTK_WIDGET(gui->compression), TRUE, TRUE, 0);
+  g_signal_connect(G_OBJECT(gui->compression), "value-changed", G_CALLBACK(compression_changed), NULL);
 }
 
 void gui_cleanup (dt_imageio_module_format_t *self)
@@ -439,7 +673,11 @@ void gui_reset (dt_imageio_module_format_t *self) {}
 
 int flags(dt_imageio_module_data_t *data)
 {
+#ifdef PNG_iTXt_SUPPORTED
+  return FORMAT_FLAGS_SUPPORT_XMP | FORMAT_FLAGS_EMBED_XMP;
+#else
   return FORMAT_FLAGS_SUPPORT_XMP;
+#endif
 }
 
 // modelines: These editor modelines have been set for all relevant files by tools/update_modelines.sh
@@ -29,7 +29,7 @@ DT_MODULE(1)
 void init(dt_imageio_module_format_t *self) {}
 void cleanup(dt_imageio_module_format_t *self) {}
 
-int write_image (dt_imageio_module_data_t *ppm, const char *filename, const void *in_tmp, void *exif, int exif_len, int imgid)
+int write_image (dt_imageio_module_data_t *ppm, const char *filename, const void *in_tmp, void *exif, int exif_len, const char *xmp, int imgid)
 {
   const uint16_t* in = (const uint16_t*) in_tmp;
   int status=0;
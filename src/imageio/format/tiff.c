@@ -21,6 +21,7 @@
 #include <stddef.h>
 #include <inttypes.h>
 #include <tiffio.h>
+#include <zlib.h>
 #include "common/darktable.h"
 #include "common/imageio_module.h"
 #include "common/imageio.h"
@@ -28,9 +29,10 @@
 #include "common/colorspaces.h"
 #include "control/conf.h"
 #include "common/imageio_format.h"
+#include "dtgtk/slider.h"
 #define DT_TIFFIO_STRIPE 64
 
-DT_MODULE(1)
+DT_MODULE(2)
 
 typedef struct dt_imageio_tiff_t
 {
@@ -39,6 +41,7 @@ typedef struct dt_imageio_tiff_t
   char style[128];
   int bpp;
   int compress;
+  int level;
   TIFF *handle;
 }
 dt_imageio_tiff_t;
@@ -47,11 +50,66 @@ typedef struct dt_imageio_tiff_gui_t
 {
   GtkComboBox *bpp;
   GtkComboBox *compress;
+  GtkDarktableSlider *level;
 }
 dt_imageio_tiff_gui_t;
 
 
-int write_image (dt_imageio_module_data_t *d_tmp, const char *filename, const void *in_void, void *exif, int exif_len, int imgid)
+/* pack rows [y0, y0+rows) into a strip of 3 channels, applying the
+ * horizontal (2) or floating point (3) predictor like libtiff would do it. */
+static void
+_tiff_pack_strip(const dt_imageio_tiff_t *d, const uint8_t *in_rows, const size_t in_stride, const int rows,
+                 const int predictor, uint8_t *strip, uint8_t *scratch)
+{
+  const size_t rowsize = (size_t)(d->width*3) * d->bpp / 8;
+  for (int y = 0; y < rows; y++)
+  {
+    const void *in_void = in_rows + in_stride*y;
+    uint8_t *row = strip + y*rowsize;
+    if (d->bpp == 32)
+    {
+      const float *in = (const float *)in_void;
+      float *out = (float *)row;
+      for (int x = 0; x < d->width; x++, in+=4, out+=3) memcpy(out, in, 3*sizeof(float));
+      if (predictor == 3)
+      {
+        // byte planes, most significant first, then byte differencing
+        const size_t wc = (size_t)3*d->width;
+        memcpy(scratch, row, rowsize);
+        for (size_t count = 0; count < wc; count++)
+          for (int byte = 0; byte < 4; byte++)
+            row[(3 - byte)*wc + count] = scratch[4*count + byte];
+        for (size_t k = rowsize-1; k >= 3; k--) row[k] -= row[k-3];
+      }
+      else if (predictor == 2)
+      {
+        uint32_t *w = (uint32_t *)row;
+        for (size_t k = (size_t)3*d->width-1; k >= 3; k--) w[k] -= w[k-3];
+      }
+    }
+    else if (d->bpp == 16)
+    {
+      const uint16_t *in = (const uint16_t *)in_void;
+      uint16_t *out = (uint16_t *)row;
+      for (int x = 0; x < d->width; x++, in+=4, out+=3) memcpy(out, in, 3*sizeof(uint16_t));
+      if (predictor == 2)
+      {
+        uint16_t *w = (uint16_t *)row;
+        for (size_t k = (size_t)3*d->width-1; k >= 3; k--) w[k] -= w[k-3];
+      }
+    }
+    else
+    {
+      const uint8_t *in = (const uint8_t *)in_void;
+      uint8_t *out = row;
+      for (int x = 0; x < d->width; x++, in+=4, out+=3) memcpy(out, in, 3*sizeof(uint8_t));
+      if (predictor == 2)
+        for (size_t k = rowsize-1; k >= 3; k--) row[k] -= row[k-3];
+    }
+  }
+}
+
+int write_image_rows (dt_imageio_module_data_t *d_tmp, const char *filename, dt_imageio_module_row_source_t *source, void *exif, int exif_len, const char *xmp, int imgid)
 {
   dt_imageio_tiff_t *d=(dt_imageio_tiff_t*)d_tmp;
 
@@ -60,10 +118,13 @@ int write_image (dt_imageio_module_data_t *d_tmp, const char *filename, const vo
 
   TIFF* tif = NULL;
 
-  void* rowdata = NULL;
+  uint8_t* stripdata = NULL;
+  uint8_t* rowdata = NULL;
+  uint8_t* zdata = NULL;
+  uLongf* zsize = NULL;
   uint32_t rowsize = 0;
   uint32_t stripesize = 0;
-  uint32_t stripe = 0;
+  int predictor = 1;
 
   int rc = 1; // default to error
 
@@ -92,6 +153,8 @@ int write_image (dt_imageio_module_data_t *d_tmp, const char *filename, const vo
     goto exit;
   }
 
+  const int level = CLAMP(d->level, 1, 9);
+
   // http://partners.adobe.com/public/developer/en/tiff/TIFFphotoshop.pdf (dated 2002)
   // "A proprietary ZIP/Flate compression code (0x80b2) has been used by some"
   // "software vendors. This code should be considered obsolete. We recommend"
@@ -101,24 +164,22 @@ int write_image (dt_imageio_module_data_t *d_tmp, const char *filename, const vo
   // http://www.awaresystems.be/imaging/tiff/tifftags/predictor.html
   if (d->compress == 1)
   {
-    TIFFSetField(tif, TIFFTAG_COMPRESSION, (uint16_t)COMPRESSION_ADOBE_DEFLATE);
-    TIFFSetField(tif, TIFFTAG_PREDICTOR, (uint16_t)1);
-    TIFFSetField(tif, TIFFTAG_ZIPQUALITY, (uint16_t)9);
+    predictor = 1;
   }
   else if (d->compress == 2)
   {
-    TIFFSetField(tif, TIFFTAG_COMPRESSION, (uint16_t)COMPRESSION_ADOBE_DEFLATE);
-    TIFFSetField(tif, TIFFTAG_PREDICTOR, (uint16_t)2);
-    TIFFSetField(tif, TIFFTAG_ZIPQUALITY, (uint16_t)9);
+    predictor = 2;
   }
   else if (d->compress == 3)
+  {
+    predictor = (d->bpp == 32) ? 3 : 2;
+  }
+
+  if (d->compress >= 1 && d->compress <= 3)
   {
     TIFFSetField(tif, TIFFTAG_COMPRESSION, (uint16_t)COMPRESSION_ADOBE_DEFLATE);
-    if (d->bpp == 32)
-      TIFFSetField(tif, TIFFTAG_PREDICTOR, (uint16_t)3);
-    else
-      TIFFSetField(tif, TIFFTAG_PREDICTOR, (uint16_t)2);
-    TIFFSetField(tif, TIFFTAG_ZIPQUALITY, (uint16_t)9);
+    TIFFSetField(tif, TIFFTAG_PREDICTOR, (uint16_t)predictor);
+    TIFFSetField(tif, TIFFTAG_ZIPQUALITY, (uint16_t)level);
   }
   else // (d->compress == 0)
   {
@@ -130,6 +191,10 @@ int write_image (dt_imageio_module_data_t *d_tmp, const char *filename, const vo
   {
     TIFFSetField(tif, TIFFTAG_ICCPROFILE, (uint32_t)profile_len, profile);
   }
+  if (xmp != NULL)
+  {
+    TIFFSetField(tif, TIFFTAG_XMLPACKET, (uint32_t)strlen(xmp), xmp);
+  }
   TIFFSetField(tif, TIFFTAG_SAMPLESPERPIXEL, (uint16_t)3);
   TIFFSetField(tif, TIFFTAG_BITSPERSAMPLE, (uint16_t)d->bpp);
   TIFFSetField(tif, TIFFTAG_SAMPLEFORMAT, (uint16_t)(d->bpp == 32 ? SAMPLEFORMAT_IEEEFP : SAMPLEFORMAT_UINT));
@@ -150,85 +215,94 @@ int write_image (dt_imageio_module_data_t *d_tmp, const char *filename, const vo
 
   rowsize = (d->width*3) * d->bpp / 8;
   stripesize = rowsize * DT_TIFFIO_STRIPE;
-  stripe = 0;
-
-  rowdata = malloc(stripesize);
-  if (!rowdata)
-  {
-    rc = 1;
-    goto exit;
-  }
+  const int stripes = (d->height + DT_TIFFIO_STRIPE - 1) / DT_TIFFIO_STRIPE;
+  const size_t in_stride = (size_t)4 * d->width * d->bpp / 8;
 
-  if (d->bpp == 32)
+  if (d->compress == 0)
   {
-    float* wdata = rowdata;
-
-    for (int y = 0; y < d->height; y++)
+    stripdata = dt_alloc_align(64, stripesize);
+    rowdata = dt_alloc_align(64, in_stride * DT_TIFFIO_STRIPE);
+    if (!stripdata || !rowdata)
     {
-      float* in = (float*)in_void + (size_t)4*y*d->width;
-
-      for (int x = 0; x < d->width; x++, in+=4, wdata+=3)
+      rc = 1;
+      goto exit;
+    }
+    for (int stripe = 0; stripe < stripes; stripe++)
+    {
+      const int y0 = stripe*DT_TIFFIO_STRIPE;
+      const int rows = MIN(DT_TIFFIO_STRIPE, d->height - y0);
+      const uint8_t *in = source->rows(source, y0, rows, rowdata);
+      if (!in)
       {
-        memcpy(wdata, in, 3*sizeof(float));
+        rc = 1;
+        goto exit;
       }
-
-      if ((uintptr_t)wdata - (uintptr_t)rowdata == (uintptr_t)stripesize)
+      _tiff_pack_strip(d, in, source->stride, rows, 1, stripdata, NULL);
+      if (TIFFWriteEncodedStrip(tif, stripe, stripdata, (tmsize_t)rowsize*rows) < 0)
       {
-        TIFFWriteEncodedStrip(tif, stripe++, rowdata, (size_t)(rowsize * DT_TIFFIO_STRIPE));
-        wdata = rowdata;
+        rc = 1;
+        goto exit;
       }
     }
-    if ((uintptr_t)wdata - (uintptr_t)rowdata != (uintptr_t)stripesize)
-    {
-      TIFFWriteEncodedStrip(tif, stripe++, rowdata, (size_t)((uintptr_t)wdata - (uintptr_t)rowdata));
-    }
   }
-  else if (d->bpp == 16)
+  else
   {
-    uint16_t* wdata = rowdata;
-    for (int y = 0; y < d->height; y++)
+    /* deflate is the bottleneck for big exports. the strips are independent
+     * zlib streams, so encode a batch of them in parallel ourselves and hand
+     * them to libtiff in order as raw strips. */
+    const int nthreads = dt_get_num_threads();
+    const int batch = MIN(stripes, 2*nthreads);
+    const uLong zbound = compressBound(stripesize);
+    stripdata = dt_alloc_align(64, (size_t)(stripesize + rowsize) * nthreads);
+    zdata = malloc((size_t)zbound * batch);
+    zsize = malloc(sizeof(uLongf) * batch);
+    rowdata = dt_alloc_align(64, in_stride * DT_TIFFIO_STRIPE * batch);
+    if (!stripdata || !zdata || !zsize || !rowdata)
     {
-      uint16_t* in = (uint16_t*)in_void + (size_t)4*y*d->width;
+      rc = 1;
+      goto exit;
+    }
 
-      for(int x = 0; x < d->width; x++, in+=4, wdata+=3)
+    for (int first = 0; first < stripes; first += batch)
+    {
+      const int count = MIN(batch, stripes - first);
+      int failed = 0;
+      // input rows of the whole batch, pulled from the source in one go
+      const int y_first = first*DT_TIFFIO_STRIPE;
+      const uint8_t *in = source->rows(source, y_first, MIN(count*DT_TIFFIO_STRIPE, d->height - y_first), rowdata);
+      if (!in)
       {
-        memcpy(wdata, in, 3*sizeof(uint16_t));
+        rc = 1;
+        goto exit;
       }
-
-      if((uintptr_t)wdata - (uintptr_t)rowdata == (uintptr_t)stripesize)
+      const size_t stride = source->stride;
+#ifdef _OPENMP
+      #pragma omp parallel for schedule(dynamic) num_threads(nthreads) shared(d, in, stripdata, zdata, zsize, failed)
+#endif
+      for (int k = 0; k < count; k++)
       {
-        TIFFWriteEncodedStrip(tif, stripe++, rowdata, (size_t)(rowsize * DT_TIFFIO_STRIPE));
-        wdata = rowdata;
+        const int y0 = (first + k)*DT_TIFFIO_STRIPE;
+        const int rows = MIN(DT_TIFFIO_STRIPE, d->height - y0);
+        uint8_t *strip = stripdata + (size_t)(stripesize + rowsize) * dt_get_thread_num();
+        _tiff_pack_strip(d, in + stride*(y0 - y_first), stride, rows, predictor, strip, strip + stripesize);
+        zsize[k] = zbound;
+        if (compress2(zdata + (size_t)zbound*k, &zsize[k], strip, (uLong)rowsize*rows, level) != Z_OK)
+          failed = 1;
       }
-    }
-    if ((uintptr_t)wdata - (uintptr_t)rowdata != (uintptr_t)stripesize)
-    {
-      TIFFWriteEncodedStrip(tif, stripe, rowdata, (size_t)((uintptr_t)wdata - (uintptr_t)rowdata));
-    }
-  }
-  else
-  {
-    uint8_t* wdata = rowdata;
-
-    for (int y = 0; y < d->height; y++)
-    {
-      uint8_t* in = (uint8_t*)in_void + (size_t)4*y*d->width;
-
-      for(int x = 0; x < d->width; x++, in+=4, wdata+=3)
+      if (failed)
       {
-        memcpy(wdata, in, 3*sizeof(uint8_t));
+        rc = 1;
+        goto exit;
       }
-
-      if((uintptr_t)wdata - (uintptr_t)rowdata == (uintptr_t)stripesize)
+      for (int k = 0; k < count; k++)
       {
-        TIFFWriteEncodedStrip(tif, stripe++, rowdata, (size_t)(rowsize * DT_TIFFIO_STRIPE));
-        wdata = rowdata;
+        if (TIFFWriteRawStrip(tif, first + k, zdata + (size_t)zbound*k, zsize[k]) < 0)
+        {
+          rc = 1;
+          goto exit;
+        }
       }
     }
-    if((uintptr_t)wdata - (uintptr_t)rowdata != (uintptr_t)stripesize)
-    {
-      TIFFWriteEncodedStrip(tif, stripe, rowdata, (size_t)((uintptr_t)wdata - (uintptr_t)rowdata));
-    }
   }
 
   // success
@@ -249,12 +323,22 @@ exit:
   }
   free(profile);
   profile = NULL;
-  free(rowdata);
-  rowdata = NULL;
+  dt_free_align(stripdata);
+  stripdata = NULL;
+  dt_free_align(rowdata);
+  free(zdata);
+  free(zsize);
 
   return rc;
 }
 
+int write_image (dt_imageio_module_data_t *d, const char *filename, const void *in_void, void *exif, int exif_len, const char *xmp, int imgid)
+{
+  dt_imageio_module_row_source_t source;
+  dt_imageio_module_row_source_buffer(&source, in_void, (size_t)4 * d->width * ((dt_imageio_tiff_t *)d)->bpp / 8);
+  return write_image_rows(d, filename, &source, exif, exif_len, xmp, imgid);
+}
+
 #if 0
 int dt_imageio_tiff_read_header(const char *filename, dt_imageio_tiff_t *tiff)
 {
@@ -280,6 +364,22 @@ params_size(dt_imageio_module_format_t *self)
   return sizeof(dt_imageio_tiff_t) - sizeof(TIFF*);
 }
 
+void*
+legacy_params(dt_imageio_module_format_t *self, const void *const old_params, const size_t old_params_size,
+              const int old_version, const int new_version, size_t *new_size)
+{
+  if(old_version == 1 && new_version == 2)
+  {
+    // version 1 always used the best (and slowest) compression
+    dt_imageio_tiff_t *new_params = (dt_imageio_tiff_t *)calloc(1, sizeof(dt_imageio_tiff_t));
+    memcpy(new_params, old_params, old_params_size);
+    new_params->level = 9;
+    *new_size = self->params_size(self);
+    return new_params;
+  }
+  return NULL;
+}
+
 void*
 get_params(dt_imageio_module_format_t *self)
 {
@@ -289,6 +389,8 @@ get_params(dt_imageio_module_format_t *self)
   else if(d->bpp == 32) d->bpp = 32;
   else d->bpp = 8;
   d->compress = dt_conf_get_int("plugins/imageio/format/tiff/compress");
+  d->level = dt_conf_get_int("plugins/imageio/format/tiff/level");
+  if (d->level < 1 || d->level > 9) d->level = 6;
   return d;
 }
 
@@ -313,6 +415,8 @@ set_params(dt_imageio_module_format_t *self, const void *params, const int size)
     gtk_combo_box_set_active(g->bpp, 0);
 
   gtk_combo_box_set_active(g->compress, d->compress);
+  dtgtk_slider_set_value(g->level, d->level);
+  dt_conf_set_int("plugins/imageio/format/tiff/level", d->level);
 
   return 0;
 }
@@ -379,6 +483,13 @@ compress_combobox_changed(GtkComboBox *widget, gpointer user_data)
   dt_conf_set_int("plugins/imageio/format/tiff/compress", compress);
 }
 
+static void
+level_changed(GtkDarktableSlider *slider, gpointer user_data)
+{
+  int level = (int)dtgtk_slider_get_value(slider);
+  dt_conf_set_int("plugins/imageio/format/tiff/level", level);
+}
+
 void init(dt_imageio_module_format_t *self)
 {
 #ifdef USE_LUA
@@ -422,6 +533,15 @@ void gui_init (dt_imageio_module_format_t *self)
   gtk_combo_box_set_active(GTK_COMBO_BOX(compress_combo), compress);
   gtk_box_pack_start(GTK_BOX(self->widget), GTK_WIDGET(compress_combo), TRUE, TRUE, 0);
   g_signal_connect(G_OBJECT(compress_combo), "changed", G_CALLBACK(compress_combobox_changed), NULL);
+
+  // deflate level, 1 is fastest, 9 gives the smallest files
+  int level = dt_conf_get_int("plugins/imageio/format/tiff/level");
+  if (level < 1 || level > 9) level = 6;
+  gui->level = DTGTK_SLIDER(dtgtk_slider_new_with_range(DARKTABLE_SLIDER_BAR, 1, 9, 1, level, 0));
+  dtgtk_slider_set_label(gui->level, _("compression"));
+  dtgtk_slider_set_default_value(gui->level, 6);
+  gtk_box_pack_start(GTK_BOX(self->widget), GTK_WIDGET(gui->level), TRUE, TRUE, 0);
+  g_signal_connect(G_OBJECT(gui->level), "value-changed", G_CALLBACK(level_changed), NULL);
 }
 
 void gui_cleanup (dt_imageio_module_format_t *self)
@@ -436,7 +556,7 @@ void gui_reset   (dt_imageio_module_format_t *self)
 
 int flags(dt_imageio_module_data_t *data)
 {
-  return FORMAT_FLAGS_SUPPORT_XMP;
+  return FORMAT_FLAGS_SUPPORT_XMP | FORMAT_FLAGS_EMBED_XMP;
 }
 
 // modelines: These editor modelines have been set for all relevant files by tools/update_modelines.sh
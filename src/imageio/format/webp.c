@@ -112,7 +112,7 @@ FileWriter(const uint8_t* data, size_t data_size, const WebPPicture* const pic)
 }
 
 int
-write_image (dt_imageio_module_data_t *webp, const char *filename, const void *in_tmp, void *exif, int exif_len, int imgid)
+write_image (dt_imageio_module_data_t *webp, const char *filename, const void *in_tmp, void *exif, int exif_len, const char *xmp, int imgid)
 {
   dt_imageio_webp_t *webp_data = (dt_imageio_webp_t*) webp;
   FILE *out = fopen(filename, "wb");
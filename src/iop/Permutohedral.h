@@ -29,6 +29,7 @@ THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
 #include <stdlib.h>
 #include <stdio.h>
 #include <string.h>
+#include <xmmintrin.h>
 
 /*******************************************************************
  * Hash table implementation for permutohedral lattice             *
@@ -57,6 +58,16 @@ public:
     memset(values, 0, sizeof(float)*VD*capacity/2);
   }
 
+  /* Empties the table but keeps the storage (and thus the capacity it has
+   * grown to) around, so the next image does not need to grow it again. */
+  void clear()
+  {
+    memset(values, 0, sizeof(float)*VD*filled);
+    for (size_t i = 0; i < capacity; i++)
+      entries[i] = Entry();
+    filled = 0;
+  }
+
   ~HashTablePermutohedral()
   {
     delete[] entries;
@@ -140,8 +151,26 @@ public:
     else return values + offset;
   };
 
+  /* Read-only variant of lookupOffset(..., false). Never grows the table,
+   * so it is safe to call from several threads as long as nobody inserts. */
+  int find(const short *key) const
+  {
+    size_t h = hash(key) & capacity_bits;
+    while (1)
+    {
+      const Entry e = entries[h];
+      if (e.keyIdx == -1) return -1;
+      bool match = true;
+      for (int i = 0; i < KD && match; i++)
+        match = keys[e.keyIdx+i] == key[i];
+      if (match) return e.valueIdx;
+      h++;
+      if (h == capacity) h = 0;
+    }
+  }
+
   /* Hash function used in this implementation. A simple base conversion. */
-  size_t hash(const short *key)
+  size_t hash(const short *key) const
   {
     size_t k = 0;
     for (int i = 0; i < KD; i++)
@@ -206,6 +235,12 @@ private:
   unsigned long capacity_bits;
 };
 
+/* Lattices filtering more points than this are not kept in the pipe data
+ * between runs: for full and export sized buffers the replay buffer and the
+ * hash tables would otherwise be held for the lifetime of the pipe. A preview
+ * pipe stays below this. */
+#define PERMUTOHEDRAL_MAX_KEPT_POINTS ((size_t)1<<21)
+
 /******************************************************************
  * The algorithm class that performs the filter                   *
  *                                                                *
@@ -222,7 +257,8 @@ public:
    * nData_ : number of points in the input
    */
   PermutohedralLattice(size_t nData_, int nThreads_=1) :
-    nData(nData_), nThreads(nThreads_)
+    nData(nData_), nThreads(nThreads_), replayCapacity(nData_),
+    blurBuffer(NULL), blurCapacity(0)
   {
 
     // Allocate storage for various arrays
@@ -275,6 +311,32 @@ public:
     delete[] replay;
     delete[] canonical;
     delete[] hashTables;
+    delete[] blurBuffer;
+  }
+
+  /* Prepares the lattice for filtering another set of nData_ points. This
+   * reuses the replay buffer, the hash tables and the blur scratch buffer of
+   * the previous run, which is what makes keeping a lattice around in the
+   * pixelpipe piece worthwhile. Storage is only given back if it is much
+   * too large, so a pipe switching from full to preview size doesn't keep
+   * hogging memory.
+   */
+  void reset(size_t nData_)
+  {
+    nData = nData_;
+    if (nData > replayCapacity || nData < replayCapacity/4)
+    {
+      delete[] replay;
+      replay = new ReplayEntry[nData*(D+1)];
+      replayCapacity = nData;
+    }
+    for (int i = 0; i < nThreads; i++)
+      hashTables[i].clear();
+  }
+
+  int threads() const
+  {
+    return nThreads;
   }
 
 
@@ -372,8 +434,11 @@ public:
       float * val = hashTables[thread_index].lookup(key, true);
 
       // Accumulate values with barycentric weight.
-      for (int i = 0; i < VD; i++)
-        val[i] += barycentric[remainder]*value[i];
+      if (VD == 4)
+        _mm_storeu_ps(val, _mm_add_ps(_mm_loadu_ps(val),
+                                      _mm_mul_ps(_mm_set1_ps(barycentric[remainder]), _mm_loadu_ps(value))));
+      else for (int i = 0; i < VD; i++)
+          val[i] += barycentric[remainder]*value[i];
 
       // Record this interaction to use later when slicing
       replay[replay_index*(D+1)+remainder].table = thread_index;
@@ -388,26 +453,59 @@ public:
     if (nThreads <= 1)
       return;
 
-    /* Merge the multiple hash tables into one, creating an offset remap table. */
+    /* Merge the multiple hash tables into one, creating an offset remap table.
+     * Neighbouring rows end up in different tables but share most of their
+     * lattice points, so nearly all keys already exist in table 0. These are
+     * found in parallel, only the few missing ones have to be inserted
+     * serially afterwards. */
     int *offset_remap[nThreads];
     for (int i = 1; i < nThreads; i++)
     {
       const short *oldKeys = hashTables[i].getKeys();
+      const int filled = hashTables[i].size();
+      int *remap = offset_remap[i] = new int[filled];
+#ifdef _OPENMP
+      #pragma omp parallel for schedule(static) shared(remap, oldKeys)
+#endif
+      for (int j = 0; j < filled; j++)
+        remap[j] = hashTables[0].find(oldKeys+j*D);
+    }
+
+    for (int i = 1; i < nThreads; i++)
+    {
+      const short *oldKeys = hashTables[i].getKeys();
+      const int filled = hashTables[i].size();
+      for (int j = 0; j < filled; j++)
+        if (offset_remap[i][j] < 0)
+          offset_remap[i][j] = hashTables[0].lookup(oldKeys+j*D, true) - hashTables[0].getValues();
+    }
+
+    /* Accumulate the values. Keys are unique within one table, so the
+     * entries of a single table can be added in parallel. */
+    for (int i = 1; i < nThreads; i++)
+    {
       const float *oldVals = hashTables[i].getValues();
       const int filled = hashTables[i].size();
-      offset_remap[i] = new int[filled];
+      const int *remap = offset_remap[i];
+      float *base = hashTables[0].getValues();
+#ifdef _OPENMP
+      #pragma omp parallel for schedule(static) shared(remap, oldVals, base)
+#endif
       for (int j = 0; j < filled; j++)
       {
-        float *val = hashTables[0].lookup(oldKeys+j*D, true);
+        float *val = base + remap[j];
         const float *oldVal = oldVals + j*VD;
         for (int k = 0; k < VD; k++)
           val[k] += oldVal[k];
-        offset_remap[i][j] = val - hashTables[0].getValues();
       }
     }
 
     /* Rewrite the offsets in the replay structure from the above generated table. */
-    for (int i = 0; i < nData*(D+1); i++)
+    const size_t nReplay = (size_t)nData*(D+1);
+#ifdef _OPENMP
+    #pragma omp parallel for schedule(static) shared(offset_remap)
+#endif
+    for (size_t i = 0; i < nReplay; i++)
       if (replay[i].table > 0)
         replay[i].offset = offset_remap[replay[i].table][replay[i].offset/VD];
 
@@ -422,13 +520,21 @@ public:
   void slice(float *col, size_t replay_index)
   {
     float *base = hashTables[0].getValues();
+    const ReplayEntry *r = replay + replay_index*(D+1);
+    if (VD == 4)
+    {
+      __m128 sum = _mm_setzero_ps();
+      for (int i = 0; i <= D; i++)
+        sum = _mm_add_ps(sum, _mm_mul_ps(_mm_set1_ps(r[i].weight), _mm_loadu_ps(base + r[i].offset)));
+      _mm_storeu_ps(col, sum);
+      return;
+    }
     for (int j = 0; j < VD; j++) col[j] = 0;
     for (int i = 0; i <= D; i++)
     {
-      ReplayEntry r = replay[replay_index*(D+1)+i];
       for (int j = 0; j < VD; j++)
       {
-        col[j] += r.weight*base[r.offset + j];
+        col[j] += r[i].weight*base[r[i].offset + j];
       }
     }
   }
@@ -436,8 +542,14 @@ public:
   /* Performs a Gaussian blur along each projected axis in the hyperplane. */
   void blur()
   {
-    // Prepare arrays
-    float *newValue = new float[VD*hashTables[0].size()];
+    // Prepare arrays, the scratch buffer is kept across runs
+    if (blurCapacity < (size_t)hashTables[0].size())
+    {
+      delete[] blurBuffer;
+      blurCapacity = hashTables[0].size();
+      blurBuffer = new float[VD*blurCapacity];
+    }
+    float *newValue = blurBuffer;
     float *oldValue = hashTables[0].getValues();
     float *hashTableBase = oldValue;
 
@@ -469,17 +581,21 @@ public:
 
         float *vm1, *vp1;
 
-        vm1 = hashTables[0].lookup(neighbor1, false); // look up first neighbor
-        if (vm1) vm1 = vm1 - hashTableBase + oldValue;
-        else vm1 = zero;
+        // the table is not modified here, so use the read-only lookup which is
+        // safe to run concurrently.
+        const int om1 = hashTables[0].find(neighbor1); // look up first neighbor
+        vm1 = om1 < 0 ? zero : oldValue + om1;
 
-        vp1 = hashTables[0].lookup(neighbor2, false); // look up second neighbor
-        if (vp1) vp1 = vp1 - hashTableBase + oldValue;
-        else vp1 = zero;
+        const int op1 = hashTables[0].find(neighbor2); // look up second neighbor
+        vp1 = op1 < 0 ? zero : oldValue + op1;
 
         // Mix values of the three vertices
-        for (int k = 0; k < VD; k++)
-          newVal[k] = (0.25f*vm1[k] + 0.5f*oldVal[k] + 0.25f*vp1[k]);
+        if (VD == 4)
+          _mm_storeu_ps(newVal, _mm_add_ps(_mm_mul_ps(_mm_set1_ps(0.5f), _mm_loadu_ps(oldVal)),
+                                           _mm_mul_ps(_mm_set1_ps(0.25f),
+                                                      _mm_add_ps(_mm_loadu_ps(vm1), _mm_loadu_ps(vp1)))));
+        else for (int k = 0; k < VD; k++)
+            newVal[k] = (0.25f*vm1[k] + 0.5f*oldVal[k] + 0.25f*vp1[k]);
       }
       float *tmp = newValue;
       newValue = oldValue;
@@ -489,20 +605,14 @@ public:
 
     // depending where we ended up, we may have to copy data
     if (oldValue != hashTableBase)
-    {
       memcpy(hashTableBase, oldValue, hashTables[0].size()*VD*sizeof(float));
-      delete[] oldValue;
-    }
-    else
-    {
-      delete[] newValue;
-    }
   }
 
 private:
 
-  int nData;
+  size_t nData;
   int nThreads;
+  size_t replayCapacity;
   const float *scaleFactor;
   const int *canonical;
 
@@ -515,6 +625,10 @@ private:
   } *replay;
 
   HashTablePermutohedral<D,VD> *hashTables;
+
+  // scratch space for blur(), reused between runs
+  float *blurBuffer;
+  size_t blurCapacity;
 };
 
 #endif
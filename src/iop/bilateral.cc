@@ -64,6 +64,9 @@ extern "C"
   typedef struct dt_iop_bilateral_data_t
   {
     float sigma[5];
+    // kept alive for the lifetime of the pipe, so hash tables and replay
+    // buffers don't need to be allocated again on every run.
+    PermutohedralLattice<5,4> *lattice;
   }
   dt_iop_bilateral_data_t;
 
@@ -189,7 +192,10 @@ extern "C"
     else
     {
       for(int k=0; k<5; k++) sigma[k] = 1.0f/sigma[k];
-      PermutohedralLattice<5,4> lattice((size_t)roi_in->width*roi_in->height, omp_get_max_threads());
+      const size_t npoints = (size_t)roi_in->width*roi_in->height;
+      if(!data->lattice) data->lattice = new PermutohedralLattice<5,4>(0, omp_get_max_threads());
+      PermutohedralLattice<5,4> &lattice = *data->lattice;
+      lattice.reset(npoints);
 
       // splat into the lattice
 #ifdef _OPENMP
@@ -230,6 +236,13 @@ extern "C"
           out += ch;
         }
       }
+
+      // only small lattices are worth keeping around for the next run
+      if(npoints > PERMUTOHEDRAL_MAX_KEPT_POINTS)
+      {
+        delete data->lattice;
+        data->lattice = NULL;
+      }
     }
 
     if(piece->pipe->mask_display)
@@ -259,16 +272,27 @@ extern "C"
     dt_iop_bilateral_params_t *p = (dt_iop_bilateral_params_t *)p1;
     dt_iop_bilateral_data_t *d = (dt_iop_bilateral_data_t *)piece->data;
     for(int k=0; k<5; k++) d->sigma[k] = p->sigma[k];
+    // a disabled module doesn't need its lattice storage
+    if(!piece->enabled)
+    {
+      delete d->lattice;
+      d->lattice = NULL;
+    }
   }
 
   void init_pipe (struct dt_iop_module_t *self, dt_dev_pixelpipe_t *pipe, dt_dev_pixelpipe_iop_t *piece)
   {
-    piece->data = malloc(sizeof(dt_iop_bilateral_data_t));
+    dt_iop_bilateral_data_t *d = (dt_iop_bilateral_data_t *)malloc(sizeof(dt_iop_bilateral_data_t));
+    // allocated on first use
+    d->lattice = NULL;
+    piece->data = d;
     self->commit_params(self, self->default_params, pipe, piece);
   }
 
   void cleanup_pipe (struct dt_iop_module_t *self, dt_dev_pixelpipe_t *pipe, dt_dev_pixelpipe_iop_t *piece)
   {
+    dt_iop_bilateral_data_t *d = (dt_iop_bilateral_data_t *)piece->data;
+    delete d->lattice;
     free(piece->data);
     piece->data = NULL;
   }
@@ -24,6 +24,7 @@
 #include "develop/tiling.h"
 #include "control/control.h"
 #include "gui/accelerators.h"
+#include "common/box_filters.h"
 #include "common/opencl.h"
 #include "gui/gtk.h"
 #include <gtk/gtk.h>
@@ -141,82 +142,11 @@ void process (struct dt_iop_module_t *self, dt_dev_pixelpipe_iop_t *piece, void
   }
 
 
-  /* horizontal blur into memchannel lightness */
+  /* blur memchannel lightness */
   const int range = 2*radius+1;
   const int hr = range/2;
 
-  const int size = roi_out->width>roi_out->height?roi_out->width:roi_out->height;
-
-  for(int iteration=0; iteration<BOX_ITERATIONS; iteration++)
-  {
-#ifdef _OPENMP
-    #pragma omp parallel for default(none) shared(blurlightness,roi_out) schedule(static)
-#endif
-    for(int y=0; y<roi_out->height; y++)
-    {
-      float scanline[size];
-      float L=0;
-      int hits = 0;
-      size_t index = (size_t)y * roi_out->width;
-      for(int x=-hr; x<roi_out->width; x++)
-      {
-        int op = x - hr-1;
-        int np = x+hr;
-        if(op>=0)
-        {
-          L-=blurlightness[index+op];
-          hits--;
-        }
-        if(np < roi_out->width)
-        {
-          L+=blurlightness[index+np];
-          hits++;
-        }
-        if(x>=0)
-          scanline[x] = L/hits;
-      }
-
-      for (int x=0; x<roi_out->width; x++)
-        blurlightness[index+x]=scanline[x];
-    }
-
-    /* vertical pass on blurlightness */
-    const int opoffs = -(hr+1)*roi_out->width;
-    const int npoffs = (hr)*roi_out->width;
-#ifdef _OPENMP
-    #pragma omp parallel for default(none) shared(blurlightness,roi_out) schedule(static)
-#endif
-    for(int x=0; x < roi_out->width; x++)
-    {
-      float scanline[size];
-      float L=0;
-      int hits=0;
-      size_t index = (size_t)x - hr*roi_out->width;
-      for(int y=-hr; y<roi_out->height; y++)
-      {
-        int op=y-hr-1;
-        int np= y + hr;
-
-        if(op>=0)
-        {
-          L-=blurlightness[index+opoffs];
-          hits--;
-        }
-        if(np < roi_out->height)
-        {
-          L+=blurlightness[index+npoffs];
-          hits++;
-        }
-        if(y>=0)
-          scanline[y] = L/hits;
-        index += roi_out->width;
-      }
-
-      for (int y=0; y<roi_out->height; y++)
-        blurlightness[y*roi_out->width+x]=scanline[y];
-
-    }
-  }
+  dt_box_mean(blurlightness, roi_out->width, roi_out->height, 1, hr, BOX_ITERATIONS);
 
   /* screen blend lightness with original */
 #ifdef _OPENMP
@@ -577,7 +577,8 @@ void process_wavelets(
   buf1 = (float *)ovoid;
   buf2 = tmp;
 
-  for(int scale=0; scale<max_scale; scale++)
+  // the scales are checked for cancellation, incomplete output will be discarded by the pipe.
+  for(int scale=0; scale<max_scale && !dt_iop_cancelled(piece); scale++)
   {
     const float sigma = 1.0f;
     const float varf = sqrtf(2.0f + 2.0f * 4.0f*4.0f + 6.0f*6.0f)/16.0f; // about 0.5
@@ -610,7 +611,7 @@ void process_wavelets(
   }
 
   // now do everything backwards, so the result will end up in *ovoid
-  for(int scale=max_scale-1; scale>=0; scale--)
+  for(int scale=max_scale-1; scale>=0 && !dt_iop_cancelled(piece); scale--)
   {
 #if 1
     // variance stabilizing transform maps sigma to unity.
@@ -712,10 +713,10 @@ void process_nlmeans(
   };
   precondition((float *)ivoid, in, roi_in->width, roi_in->height, aa, bb);
 
-  // for each shift vector
-  for(int kj=-K; kj<=K; kj++)
+  // for each shift vector, until the result is not wanted any more
+  for(int kj=-K; kj<=K && !dt_iop_cancelled(piece); kj++)
   {
-    for(int ki=-K; ki<=K; ki++)
+    for(int ki=-K; ki<=K && !dt_iop_cancelled(piece); ki++)
     {
       // TODO: adaptive K tests here!
       // TODO: expf eval for real bilateral experience :)
@@ -139,7 +139,8 @@ void process (struct dt_iop_module_t *self, dt_dev_pixelpipe_iop_t *piece, void
     tmp[k] = (float *)malloc((size_t)sizeof(float)*wd*ht);
   }
 
-  for(int level=1; level<numl_cap; level++) dt_iop_equalizer_wtf(out, tmp, level, width, height);
+  // levels are checked for cancellation, incomplete output will be discarded by the pipe.
+  for(int level=1; level<numl_cap && !dt_iop_cancelled(piece); level++) dt_iop_equalizer_wtf(out, tmp, level, width, height);
 
 #if 0
   // printf("transformed\n");
@@ -175,7 +176,7 @@ void process (struct dt_iop_module_t *self, dt_dev_pixelpipe_iop_t *piece, void
 #endif
   // printf("histogrammed\n");
 
-  for(int l=1; l<numl_cap; l++)
+  for(int l=1; l<numl_cap && !dt_iop_cancelled(piece); l++)
   {
     const float lv = (lm-l1)*(l-1)/(float)(numl_cap-1) + l1; // appr level in real image.
     const float band = CLAMP((1.0 - lv / d->num_levels), 0, 1.0);
@@ -198,7 +199,7 @@ void process (struct dt_iop_module_t *self, dt_dev_pixelpipe_iop_t *piece, void
     }
   }
   // printf("applied\n");
-  for(int level=numl_cap-1; level>0; level--) dt_iop_equalizer_iwtf(out, tmp, level, width, height);
+  for(int level=numl_cap-1; level>0 && !dt_iop_cancelled(piece); level--) dt_iop_equalizer_iwtf(out, tmp, level, width, height);
 
   for(int k=1; k<numl_cap; k++) free(tmp[k]);
   free(tmp);
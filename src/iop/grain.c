@@ -33,6 +33,7 @@
 #include "gui/gtk.h"
 #include <gtk/gtk.h>
 #include <inttypes.h>
+#include <xmmintrin.h>
 
 #define GRAIN_LIGHTNESS_STRENGTH_SCALE 0.15
 // (m_pi/2)/4 = half hue colorspan
@@ -43,6 +44,13 @@
 
 #define GRAIN_SCALE_FACTOR 213.2
 
+// the simplex noise repeats itself every 768 units along x and y: the
+// permutation table has 256 entries and the skew moves a step of 768 along
+// one axis by 1024 and 256 lattice cells.
+#define GRAIN_NOISE_PERIOD 768.0
+// largest edge length of a precomputed noise tile
+#define GRAIN_TILE_MAX 1024
+
 #define CLIP(x) ((x<0)?0.0:(x>1.0)?1.0:x)
 DT_MODULE_INTROSPECTION(1, dt_iop_grain_params_t)
 
@@ -77,6 +85,13 @@ typedef struct dt_iop_grain_data_t
   _dt_iop_grain_channel_t channel;
   float scale;
   float strength;
+
+  // seamless noise tile for preview pipes, and what it was computed for
+  float *tile;
+  int tile_size;
+  unsigned int tile_hash;
+  double tile_zoom, tile_filtermul;
+  int tile_filter;
 }
 dt_iop_grain_data_t;
 
@@ -106,152 +121,108 @@ static void _simplex_noise_init()
 {
   for(int i=0; i<512; i++) perm[i] = p[i & 255];
 }
-static double dot(int g[], double x, double y, double z)
-{
-  return g[0]*x + g[1]*y + g[2]*z;
-}
-
-#define FASTFLOOR(x) ( x>0 ? (int)(x) : (int)(x)-1 )
-
-static double _simplex_noise(double xin, double yin, double zin)
-{
-  double n0, n1, n2, n3; // Noise contributions from the four corners
-// Skew the input space to determine which simplex cell we're in
-  double F3 = 1.0/3.0;
-  double s = (xin+yin+zin)*F3; // Very nice and simple skew factor for 3D
-  int i = FASTFLOOR(xin+s);
-  int j = FASTFLOOR(yin+s);
-  int k = FASTFLOOR(zin+s);
-  double G3 = 1.0/6.0; // Very nice and simple unskew factor, too
-  double t = (i+j+k)*G3;
-  double X0 = i-t; // Unskew the cell origin back to (x,y,z) space
-  double Y0 = j-t;
-  double Z0 = k-t;
-  double x0 = xin-X0; // The x,y,z distances from the cell origin
-  double y0 = yin-Y0;
-  double z0 = zin-Z0;
-// For the 3D case, the simplex shape is a slightly irregular tetrahedron.
-// Determine which simplex we are in.
-  int i1, j1, k1; // Offsets for second corner of simplex in (i,j,k) coords
-  int i2, j2, k2; // Offsets for third corner of simplex in (i,j,k) coords
-  if(x0>=y0)
-  {
-    if(y0>=z0)
-    {
-      i1=1;  // X Y Z order
-      j1=0;
-      k1=0;
-      i2=1;
-      j2=1;
-      k2=0;
-    }
-    else if(x0>=z0)
-    {
-      i1=1;  // X Z Y order
-      j1=0;
-      k1=0;
-      i2=1;
-      j2=0;
-      k2=1;
-    }
-    else
-    {
-      i1=0;  // Z X Y order
-      j1=0;
-      k1=1;
-      i2=1;
-      j2=0;
-      k2=1;
-    }
-  }
-  else   // x0<y0
-  {
-    if(y0<z0)
-    {
-      i1=0;  // Z Y X order
-      j1=0;
-      k1=1;
-      i2=0;
-      j2=1;
-      k2=1;
-    }
-    else if(x0<z0)
-    {
-      i1=0;  // Y Z X order
-      j1=1;
-      k1=0;
-      i2=0;
-      j2=1;
-      k2=1;
-    }
-    else
-    {
-      i1=0;  // Y X Z order
-      j1=1;
-      k1=0;
-      i2=1;
-      j2=1;
-      k2=0;
-    }
-  }
-//  A step of (1,0,0) in (i,j,k) means a step of (1-c,-c,-c) in (x,y,z),
-//  a step of (0,1,0) in (i,j,k) means a step of (-c,1-c,-c) in (x,y,z), and
-//  a step of (0,0,1) in (i,j,k) means a step of (-c,-c,1-c) in (x,y,z), where
-//  c = 1/6.
-  double   x1 = x0 - i1 + G3; // Offsets for second corner in (x,y,z) coords
-  double   y1 = y0 - j1 + G3;
-  double   z1 = z0 - k1 + G3;
-  double   x2 = x0 - i2 + 2.0*G3; // Offsets for third corner in (x,y,z) coords
-  double   y2 = y0 - j2 + 2.0*G3;
-  double   z2 = z0 - k2 + 2.0*G3;
-  double   x3 = x0 - 1.0 + 3.0*G3; // Offsets for last corner in (x,y,z) coords
-  double   y3 = y0 - 1.0 + 3.0*G3;
-  double   z3 = z0 - 1.0 + 3.0*G3;
-  // Work out the hashed gradient indices of the four simplex corners
-  int ii = i & 255;
-  int jj = j & 255;
-  int kk = k & 255;
-  int gi0 = perm[ii+perm[jj+perm[kk]]] % 12;
-  int gi1 = perm[ii+i1+perm[jj+j1+perm[kk+k1]]] % 12;
-  int gi2 = perm[ii+i2+perm[jj+j2+perm[kk+k2]]] % 12;
-  int gi3 = perm[ii+1+perm[jj+1+perm[kk+1]]] % 12;
-  // Calculate the contribution from the four corners
-  double t0 = 0.6 - x0*x0 - y0*y0 - z0*z0;
-  if(t0<0) n0 = 0.0;
-  else
-  {
-    t0 *= t0;
-    n0 = t0 * t0 * dot(grad3[gi0], x0, y0, z0);
-  }
-  double t1 = 0.6 - x1*x1 - y1*y1 - z1*z1;
-  if(t1<0) n1 = 0.0;
-  else
-  {
-    t1 *= t1;
-    n1 = t1 * t1 * dot(grad3[gi1], x1, y1, z1);
-  }
-  double t2 = 0.6 - x2*x2 - y2*y2 - z2*z2;
-  if(t2<0) n2 = 0.0;
-  else
-  {
-    t2 *= t2;
-    n2 = t2 * t2 * dot(grad3[gi2], x2, y2, z2);
-  }
-  double t3 = 0.6 - x3*x3 - y3*y3 - z3*z3;
-  if(t3<0) n3 = 0.0;
-  else
-  {
-    t3 *= t3;
-    n3 = t3 * t3 * dot(grad3[gi3], x3, y3, z3);
-  }
-  // Add contributions from each corner to get the final noise value.
-  // The result is scaled to stay just inside [-1,1]
-  return 32.0*(n0 + n1 + n2 + n3);
+// coordinates are wrapped into the period of the noise in double precision,
+// so the noise itself can be evaluated in single precision.
+static inline double _wrap_noise_coord(const double x)
+{
+  return x - GRAIN_NOISE_PERIOD*floor(x*(1.0/GRAIN_NOISE_PERIOD));
 }
 
+// FASTFLOOR(x) = x>0 ? (int)x : (int)x-1
+static inline __m128i _fastfloor_sse(const __m128 x)
+{
+  const __m128i t = _mm_cvttps_epi32(x);
+  const __m128i pos = _mm_castps_si128(_mm_cmpgt_ps(x, _mm_setzero_ps()));
+  return _mm_add_epi32(t, _mm_andnot_si128(pos, _mm_set1_epi32(-1)));
+}
 
+static inline __m128 _simplex_corner_sse(const __m128 x, const __m128 y, const __m128 z, const int gi[4])
+{
+  const __m128 gx = _mm_set_ps(grad3[gi[3]][0], grad3[gi[2]][0], grad3[gi[1]][0], grad3[gi[0]][0]);
+  const __m128 gy = _mm_set_ps(grad3[gi[3]][1], grad3[gi[2]][1], grad3[gi[1]][1], grad3[gi[0]][1]);
+  const __m128 gz = _mm_set_ps(grad3[gi[3]][2], grad3[gi[2]][2], grad3[gi[1]][2], grad3[gi[0]][2]);
+  __m128 t = _mm_sub_ps(_mm_set1_ps(0.6f),
+                        _mm_add_ps(_mm_add_ps(_mm_mul_ps(x, x), _mm_mul_ps(y, y)), _mm_mul_ps(z, z)));
+  t = _mm_max_ps(t, _mm_setzero_ps());
+  t = _mm_mul_ps(t, t);
+  t = _mm_mul_ps(t, t);
+  const __m128 dot = _mm_add_ps(_mm_add_ps(_mm_mul_ps(gx, x), _mm_mul_ps(gy, y)), _mm_mul_ps(gz, z));
+  return _mm_mul_ps(t, dot);
+}
 
+// 3d simplex noise for four points at once
+static __m128 _simplex_noise_sse(const __m128 xin, const __m128 yin, const __m128 zin)
+{
+  const __m128 F3 = _mm_set1_ps(1.0f/3.0f);
+  const __m128 G3 = _mm_set1_ps(1.0f/6.0f);
+  const __m128 one = _mm_set1_ps(1.0f);
+  // Skew the input space to determine which simplex cell we're in
+  const __m128 s = _mm_mul_ps(_mm_add_ps(_mm_add_ps(xin, yin), zin), F3);
+  const __m128i i = _fastfloor_sse(_mm_add_ps(xin, s));
+  const __m128i j = _fastfloor_sse(_mm_add_ps(yin, s));
+  const __m128i k = _fastfloor_sse(_mm_add_ps(zin, s));
+  const __m128 t = _mm_mul_ps(_mm_cvtepi32_ps(_mm_add_epi32(_mm_add_epi32(i, j), k)), G3);
+  // The x,y,z distances from the unskewed cell origin
+  const __m128 x0 = _mm_sub_ps(xin, _mm_sub_ps(_mm_cvtepi32_ps(i), t));
+  const __m128 y0 = _mm_sub_ps(yin, _mm_sub_ps(_mm_cvtepi32_ps(j), t));
+  const __m128 z0 = _mm_sub_ps(zin, _mm_sub_ps(_mm_cvtepi32_ps(k), t));
+  // Determine which simplex we are in, branch free version of the
+  // X Y Z, X Z Y, Z X Y, Z Y X, Y Z X and Y X Z cases
+  const __m128 xy = _mm_cmpge_ps(x0, y0);
+  const __m128 yz = _mm_cmpge_ps(y0, z0);
+  const __m128 xz = _mm_cmpge_ps(x0, z0);
+  const __m128 i1 = _mm_and_ps(_mm_and_ps(xy, xz), one);
+  const __m128 j1 = _mm_and_ps(_mm_andnot_ps(xy, yz), one);
+  const __m128 k1 = _mm_andnot_ps(_mm_or_ps(yz, xz), one);
+  const __m128 i2 = _mm_and_ps(_mm_or_ps(xy, xz), one);
+  const __m128 j2 = _mm_andnot_ps(_mm_andnot_ps(yz, xy), one);
+  const __m128 k2 = _mm_andnot_ps(_mm_and_ps(xz, yz), one);
+  // Offsets for the other three corners in (x,y,z) coords
+  const __m128 x1 = _mm_add_ps(_mm_sub_ps(x0, i1), G3);
+  const __m128 y1 = _mm_add_ps(_mm_sub_ps(y0, j1), G3);
+  const __m128 z1 = _mm_add_ps(_mm_sub_ps(z0, k1), G3);
+  const __m128 G3_2 = _mm_set1_ps(2.0f/6.0f);
+  const __m128 x2 = _mm_add_ps(_mm_sub_ps(x0, i2), G3_2);
+  const __m128 y2 = _mm_add_ps(_mm_sub_ps(y0, j2), G3_2);
+  const __m128 z2 = _mm_add_ps(_mm_sub_ps(z0, k2), G3_2);
+  const __m128 G3_3 = _mm_set1_ps(3.0f/6.0f - 1.0f);
+  const __m128 x3 = _mm_add_ps(x0, G3_3);
+  const __m128 y3 = _mm_add_ps(y0, G3_3);
+  const __m128 z3 = _mm_add_ps(z0, G3_3);
+
+  // Work out the hashed gradient indices of the four simplex corners.
+  // there is no gather in sse, so this is done per lane.
+  __attribute__((aligned(16))) int I[4], J[4], K[4];
+  __attribute__((aligned(16))) float I1[4], J1[4], K1[4], I2[4], J2[4], K2[4];
+  _mm_store_si128((__m128i *)I, i);
+  _mm_store_si128((__m128i *)J, j);
+  _mm_store_si128((__m128i *)K, k);
+  _mm_store_ps(I1, i1);
+  _mm_store_ps(J1, j1);
+  _mm_store_ps(K1, k1);
+  _mm_store_ps(I2, i2);
+  _mm_store_ps(J2, j2);
+  _mm_store_ps(K2, k2);
+  int gi0[4], gi1[4], gi2[4], gi3[4];
+  for(int l=0; l<4; l++)
+  {
+    const int ii = I[l] & 255;
+    const int jj = J[l] & 255;
+    const int kk = K[l] & 255;
+    const int a1 = I1[l], b1 = J1[l], c1 = K1[l];
+    const int a2 = I2[l], b2 = J2[l], c2 = K2[l];
+    gi0[l] = perm[ii+perm[jj+perm[kk]]] % 12;
+    gi1[l] = perm[ii+a1+perm[jj+b1+perm[kk+c1]]] % 12;
+    gi2[l] = perm[ii+a2+perm[jj+b2+perm[kk+c2]]] % 12;
+    gi3[l] = perm[ii+1+perm[jj+1+perm[kk+1]]] % 12;
+  }
 
+  // Add contributions from each corner to get the final noise value.
+  // The result is scaled to stay just inside [-1,1]
+  const __m128 n = _mm_add_ps(_mm_add_ps(_simplex_corner_sse(x0, y0, z0, gi0), _simplex_corner_sse(x1, y1, z1, gi1)),
+                              _mm_add_ps(_simplex_corner_sse(x2, y2, z2, gi2), _simplex_corner_sse(x3, y3, z3, gi3)));
+  return _mm_mul_ps(_mm_set1_ps(32.0f), n);
+}
 
 #define PRIME_LEVELS 4
 //static uint64_t _low_primes[PRIME_LEVELS] ={ 12503,14029,15649, 11369 };
@@ -307,20 +278,35 @@ static double _perlin_2d_noise(double x,double y,uint32_t octaves,double persist
   return total;
 }*/
 
-static double _simplex_2d_noise(double x,double y,uint32_t octaves,double persistance,double z)
+// x and y are expected to be in noise space already, i.e. divided by the zoom
+// and wrapped with _wrap_noise_coord(). this is what the former three octave
+// loop with persistance 1 boils down to: octaves 0 and 2 with frequencies 1
+// and 2 and unit amplitude, the middle one had a weight of zero.
+static inline __m128 _simplex_2d_noise_sse(const __m128 x, const __m128 y)
 {
-  double f=1,a=1,total=0;
+  const __m128 two = _mm_set1_ps(2.0f);
+  return _mm_add_ps(_simplex_noise_sse(x, y, _mm_setzero_ps()),
+                    _simplex_noise_sse(_mm_mul_ps(two, x), _mm_mul_ps(two, y), two));
+}
 
-  for(uint32_t o=0; o<octaves; o++)
+// noise for four pixels in noise space, optionally filtered by a rank-1 lattice
+static inline __m128 _grain_noise_sse(const __m128 x, const __m128 y, const int filter, const float filtermul)
+{
+  if(!filter) return _simplex_2d_noise_sse(x, y);
+
+  // if zoomed out a lot, use rank-1 lattice downsampling
+  const float fib1 = 34.0, fib2 = 21.0;
+  __m128 noise = _mm_setzero_ps();
+  for(int l=0; l<fib2; l++)
   {
-    total+= (_simplex_noise(x*f/z,y*f/z,o)*a);
-    f=2*o;
-    a=persistance*o;
+    float px = l/fib2, py = l*(fib1/fib2);
+    py -= (int)py;
+    const __m128 dx = _mm_set1_ps(px*filtermul), dy = _mm_set1_ps(py*filtermul);
+    noise = _mm_add_ps(noise, _simplex_2d_noise_sse(_mm_add_ps(x, dx), _mm_add_ps(y, dy)));
   }
-  return total;
+  return _mm_mul_ps(noise, _mm_set1_ps(1.0f/fib2));
 }
 
-
 const char *name()
 {
   return _("grain");
@@ -363,6 +349,42 @@ static unsigned int _hash_string(char *s)
   return h;
 }
 
+/* build a tile of noise which wraps around seamlessly after size pixels, in
+ * the same world space coordinates used by process(). size is chosen such
+ * that it covers exactly one period of the noise at the current scale. */
+static void _grain_build_tile(dt_iop_grain_data_t *d, const int size, const unsigned int hash, const double zoom,
+                              const int filter, const float filtermul)
+{
+  if(d->tile_size != size)
+  {
+    dt_free_align(d->tile);
+    d->tile = dt_alloc_align(16, sizeof(float)*size*size);
+  }
+  d->tile_size = size;
+  d->tile_hash = hash;
+  d->tile_zoom = zoom;
+  d->tile_filter = filter;
+  d->tile_filtermul = filtermul;
+
+  float *tile = d->tile;
+  const double step = GRAIN_NOISE_PERIOD/size;
+  const float xoff = _wrap_noise_coord(hash/zoom);
+#ifdef _OPENMP
+  #pragma omp parallel for schedule(static) shared(tile)
+#endif
+  for(int v=0; v<size; v++)
+  {
+    const __m128 y = _mm_set1_ps(v*step);
+    for(int u=0; u<size; u+=4)
+    {
+      __attribute__((aligned(16))) float n[4];
+      const __m128 x = _mm_set_ps(xoff + (u+3)*step, xoff + (u+2)*step, xoff + (u+1)*step, xoff + u*step);
+      _mm_store_ps(n, _grain_noise_sse(x, y, filter, filtermul));
+      for(int l=0; l<4 && u+l<size; l++) tile[(size_t)v*size + u + l] = n[l];
+    }
+  }
+}
+
 void process (struct dt_iop_module_t *self, dt_dev_pixelpipe_iop_t *piece, void *ivoid, void *ovoid, const dt_iop_roi_t *roi_in, const dt_iop_roi_t *roi_out)
 {
   dt_iop_grain_data_t *data = (dt_iop_grain_data_t *)piece->data;
@@ -371,57 +393,83 @@ void process (struct dt_iop_module_t *self, dt_dev_pixelpipe_iop_t *piece, void
 
   const int ch = piece->colors;
   // Apply grain to image
-  const double strength=(data->strength/100.0);
-  const double octaves=3;
+  const float strength = 100.0*(data->strength/100.0)*GRAIN_LIGHTNESS_STRENGTH_SCALE;
   // double zoom=1.0+(8*(data->scale/100.0));
   const double wd = fminf(piece->buf_in.width, piece->buf_in.height);
   const double zoom=(1.0+8*data->scale/100)/800.0;
   const int filter = fabsf(roi_out->scale - 1.0f) > 0.01;
   // filter width depends on world space (i.e. reverse wd norm and roi->scale, as well as buffer input to pixelpipe iscale)
-  const double filtermul = piece->iscale/(roi_out->scale*wd);
+  // and is converted to noise space here.
+  const float filtermul = piece->iscale/(roi_out->scale*wd)/zoom;
+
+  // pipes which are only ever displayed sample a precomputed tile instead. it
+  // spans one period of the noise, which is small enough when zoomed out.
+  // exports always evaluate the noise directly.
+  const double period = GRAIN_NOISE_PERIOD*zoom*wd*roi_out->scale;
+  const int tile_size = (int)(period + 0.5);
+  if((piece->pipe->type == DT_DEV_PIXELPIPE_PREVIEW || piece->pipe->type == DT_DEV_PIXELPIPE_THUMBNAIL)
+      && tile_size >= 16 && tile_size <= GRAIN_TILE_MAX
+      && (size_t)tile_size*tile_size < (size_t)roi_out->width*roi_out->height)
+  {
+    if(!data->tile || data->tile_size != tile_size || data->tile_hash != hash || data->tile_zoom != zoom
+        || data->tile_filter != filter || data->tile_filtermul != filtermul)
+      _grain_build_tile(data, tile_size, hash, zoom, filter, filtermul);
+
+    const float *tile = data->tile;
+#ifdef _OPENMP
+    #pragma omp parallel for schedule(static) shared(roi_out, ivoid, ovoid, tile)
+#endif
+    for(int j=0; j<roi_out->height; j++)
+    {
+      const float *in  = ((float *)ivoid) + (size_t)roi_out->width * j * ch;
+      float *out = ((float *)ovoid) + (size_t)roi_out->width * j * ch;
+      const int v = ((roi_out->y + j) % tile_size + tile_size) % tile_size;
+      const float *trow = tile + (size_t)v*tile_size;
+      int u = ((roi_out->x) % tile_size + tile_size) % tile_size;
+      for(int i=0; i<roi_out->width; i++, in+=ch, out+=ch)
+      {
+        out[0] = in[0] + trow[u]*strength;
+        out[1] = in[1];
+        out[2] = in[2];
+        out[3] = in[3];
+        if(++u == tile_size) u = 0;
+      }
+    }
+    return;
+  }
+
 #ifdef _OPENMP
-  #pragma omp parallel for default(none) shared(roi_out, roi_in, ovoid, ivoid, data, hash)
+  #pragma omp parallel for default(none) schedule(static) shared(roi_out, roi_in, ovoid, ivoid, data, hash)
 #endif
   for(int j=0; j<roi_out->height; j++)
   {
     float *in  = ((float *)ivoid) + (size_t)roi_out->width * j * ch;
     float *out = ((float *)ovoid) + (size_t)roi_out->width * j * ch;
-    for(int i=0; i<roi_out->width; i++)
+    // calculate x, y in a resolution independent way:
+    // wx,wy: worldspace in full image pixel coords,
+    // normalized to shorter side of image, so with pixel aspect = 1.
+    const double wy = (roi_out->y + j)/roi_out->scale;
+    const __m128 y = _mm_set1_ps(_wrap_noise_coord(wy / wd / zoom));
+    for(int i=0; i<roi_out->width; i+=4)
     {
-      // calculate x, y in a resolution independent way:
-      // wx,wy: worldspace in full image pixel coords:
-      double wx = (roi_out->x + i)/roi_out->scale;
-      double wy = (roi_out->y + j)/roi_out->scale;
-      // x, y: normalized to shorter side of image, so with pixel aspect = 1.
-      // printf("scale %f\n", wd);
-      double x = wx / wd;
-      double y = wy / wd;
-      //  double noise=_perlin_2d_noise(x, y, octaves,0.25, zoom)*1.5;
-      double noise = 0.0;
-      if(filter)
+      __attribute__((aligned(16))) float xs[4], noise[4];
+      for(int l=0; l<4; l++)
       {
-        // if zoomed out a lot, use rank-1 lattice downsampling
-        const float fib1 = 34.0, fib2 = 21.0;
-        for(int l=0; l<fib2; l++)
-        {
-          float px = l/fib2, py = l*(fib1/fib2);
-          py -= (int)py;
-          float dx = px*filtermul, dy = py*filtermul;
-          noise += (1.0/fib2) * _simplex_2d_noise(x+dx+hash, y+dy, octaves, 1.0, zoom);
-        }
-      }
-      else
-      {
-        noise = _simplex_2d_noise(x+hash, y, octaves, 1.0, zoom);
+        const double wx = (roi_out->x + i + l)/roi_out->scale;
+        xs[l] = _wrap_noise_coord((wx / wd + hash) / zoom);
       }
+      _mm_store_ps(noise, _grain_noise_sse(_mm_load_ps(xs), y, filter, filtermul));
 
-      out[0] = in[0]+((100.0*(noise*(strength)))*GRAIN_LIGHTNESS_STRENGTH_SCALE);
-      out[1] = in[1];
-      out[2] = in[2];
-      out[3] = in[3];
+      for(int l=0; l<4 && i+l<roi_out->width; l++)
+      {
+        out[0] = in[0] + noise[l]*strength;
+        out[1] = in[1];
+        out[2] = in[2];
+        out[3] = in[3];
 
-      out += ch;
-      in += ch;
+        out += ch;
+        in += ch;
+      }
     }
   }
 }
@@ -479,6 +527,8 @@ void cleanup_pipe (struct dt_iop_module_t *self, dt_dev_pixelpipe_t *pipe, dt_de
   (void)gegl_node_remove_child(pipe->gegl, piece->input);
   // no free necessary, no data is alloc'ed
 #else
+  dt_iop_grain_data_t *d = (dt_iop_grain_data_t *)piece->data;
+  dt_free_align(d->tile);
   free(piece->data);
   piece->data = NULL;
 #endif
@@ -30,6 +30,7 @@
 #include "develop/imageop.h"
 #include "develop/tiling.h"
 #include "control/control.h"
+#include "common/box_filters.h"
 #include "common/opencl.h"
 #include "gui/accelerators.h"
 #include "gui/gtk.h"
@@ -286,99 +287,43 @@ void process (struct dt_iop_module_t *self, dt_dev_pixelpipe_iop_t *piece, void
   const int ch = piece->colors;
 
   /* create inverted image and then blur */
+  float *blurred = dt_alloc_align(64, (size_t)roi_out->width*roi_out->height*sizeof(float));
+  if(!blurred)
+  {
+    // pass the image through unchanged rather than leaving garbage downstream
+    memcpy(ovoid, ivoid, (size_t)sizeof(float)*ch*roi_out->width*roi_out->height);
+    return;
+  }
 #ifdef _OPENMP
-  #pragma omp parallel for default(none) shared(in,out,roi_out) schedule(static)
+  #pragma omp parallel for default(none) shared(in,blurred,roi_out) schedule(static)
 #endif
   for(size_t k=0; k<(size_t)roi_out->width*roi_out->height; k++)
-    out[ch*k] = 100.0f-LCLIP(in[ch*k]);	// only L in Lab space
+    blurred[k] = 100.0f-LCLIP(in[ch*k]);	// only L in Lab space
 
 
   int rad = MAX_RADIUS*(fmin(100.0,data->sharpness+1)/100.0);
   const int radius = MIN(MAX_RADIUS, ceilf(rad * roi_in->scale / piece->iscale));
 
-  /* horizontal blur out into out */
   const int range = 2*radius+1;
   const int hr = range/2;
 
-  const int size = roi_out->width>roi_out->height?roi_out->width:roi_out->height;
-  float *scanline = calloc(size, sizeof(float));
-
-  for(int iteration=0; iteration<BOX_ITERATIONS; iteration++)
-  {
-    for(int y=0; y<roi_out->height; y++)
-    {
-      float L=0;
-      int hits = 0;
-      size_t index = (size_t)y*roi_out->width;
-      for(int x=-hr; x<roi_out->width; x++)
-      {
-        int op = x - hr-1;
-        int np = x+hr;
-        if(op>=0)
-        {
-          L-=out[(index+op)*ch];
-          hits--;
-        }
-        if(np < roi_out->width)
-        {
-          L+=out[(index+np)*ch];
-          hits++;
-        }
-        if(x>=0)
-          scanline[x] = L/hits;
-      }
-
-      for (int x=0; x<roi_out->width; x++)
-        out[(index+x)*ch] = scanline[x];
-    }
-
-    /* vertical pass on blurlightness */
-    const int opoffs = -(hr+1)*roi_out->width;
-    const int npoffs = (hr)*roi_out->width;
-    for(int x=0; x < roi_out->width; x++)
-    {
-      float L=0;
-      int hits=0;
-      size_t index = (size_t)x - hr*roi_out->width;
-      for(int y=-hr; y<roi_out->height; y++)
-      {
-        int op=y-hr-1;
-        int np= y + hr;
-        if(op>=0)
-        {
-          L-=out[(index+opoffs)*ch];
-          hits--;
-        }
-        if(np < roi_out->height)
-        {
-          L+=out[(index+npoffs)*ch];
-          hits++;
-        }
-        if(y>=0)
-          scanline[y] = L/hits;
-        index += roi_out->width;
-      }
-
-      for (int y=0; y<roi_out->height; y++)
-        out[((size_t)y*roi_out->width+x)*ch] = scanline[y];
-    }
-  }
-
-  free(scanline);
+  dt_box_mean(blurred, roi_out->width, roi_out->height, 1, hr, BOX_ITERATIONS);
 
   const float contrast_scale=((data->contrast/100.0)*7.5);
 #ifdef _OPENMP
-  #pragma omp parallel for default(none) shared(roi_out, in, out, data) schedule(static)
+  #pragma omp parallel for default(none) shared(roi_out, in, out, data, blurred) schedule(static)
 #endif
   for(size_t k=0; k<(size_t)roi_out->width*roi_out->height; k++)
   {
     size_t index = ch*k;
     // Mix out and in
-    out[index] = out[index]*0.5 + in[index]*0.5;
+    out[index] = blurred[k]*0.5 + in[index]*0.5;
     out[index] = LCLIP(50.0f+((out[index]-50.0f)*contrast_scale));
     out[index+1] = out[index+2] = 0.0f;		// desaturate a and b in Lab space
     out[index+3] = in[index+3];
   }
+
+  dt_free_align(blurred);
 }
 
 static void
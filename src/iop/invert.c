@@ -70,7 +70,7 @@ groups ()
 
 int flags ()
 {
-  return IOP_FLAGS_ONE_INSTANCE;
+  return IOP_FLAGS_ONE_INSTANCE | IOP_FLAGS_POINTWISE;
 }
 
 void init_key_accels(dt_iop_module_so_t *self)
@@ -397,10 +397,12 @@ process (dt_iop_module_t *self, dt_dev_pixelpipe_iop_t *piece, const void * cons
       void *buf = dt_alloc_align(16, bufsize*dt_get_num_threads()*sizeof(float));
 
 #ifdef _OPENMP
-      #pragma omp parallel for default(none) shared(buf, modifier, ovoid) schedule(static)
+      #pragma omp parallel for default(none) shared(buf, modifier, ovoid, piece) schedule(static)
 #endif
       for (int y = 0; y < roi_out->height; y++)
       {
+        // skip the remaining rows if the result is not needed any more
+        if(dt_iop_cancelled(piece)) continue;
         float *bufptr = ((float *)buf) + (size_t)bufsize*dt_get_thread_num();
         lf_modifier_apply_subpixel_geometry_distortion(
           modifier, roi_out->x, roi_out->y+y, roi_out->width, 1, bufptr);
@@ -487,10 +489,12 @@ process (dt_iop_module_t *self, dt_dev_pixelpipe_iop_t *piece, const void * cons
       void *buf2 = dt_alloc_align(16, buf2size*sizeof(float)*dt_get_num_threads());
 
 #ifdef _OPENMP
-      #pragma omp parallel for default(none) shared(buf2, buf, modifier, ovoid) schedule(static)
+      #pragma omp parallel for default(none) shared(buf2, buf, modifier, ovoid, piece) schedule(static)
 #endif
       for (int y = 0; y < roi_out->height; y++)
       {
+        // skip the remaining rows if the result is not needed any more
+        if(dt_iop_cancelled(piece)) continue;
         float *buf2ptr = ((float *)buf2) + (size_t)buf2size*dt_get_thread_num();
         lf_modifier_apply_subpixel_geometry_distortion (
           modifier, roi_out->x, roi_out->y+y, roi_out->width, 1, buf2ptr);
@@ -400,10 +400,10 @@ void process (struct dt_iop_module_t *self, dt_dev_pixelpipe_iop_t *piece, void
   // we want to sum up weights in col[3], so need to init to 0:
   memset(ovoid, 0x0, (size_t)sizeof(float)*roi_out->width*roi_out->height*4);
 
-  // for each shift vector
-  for(int kj=-K; kj<=K; kj++)
+  // for each shift vector, until the result is not wanted any more
+  for(int kj=-K; kj<=K && !dt_iop_cancelled(piece); kj++)
   {
-    for(int ki=-K; ki<=K; ki++)
+    for(int ki=-K; ki<=K && !dt_iop_cancelled(piece); ki++)
     {
       int inited_slide = 0;
       // don't construct summed area tables but use sliding window! (applies to cpu version res < 1k only, or else we will add up errors)
@@ -26,6 +26,7 @@
 #include <gegl.h>
 #endif
 #include "bauhaus/bauhaus.h"
+#include "common/box_filters.h"
 #include "common/colorspaces.h"
 #include "common/opencl.h"
 #include "develop/develop.h"
@@ -146,78 +147,7 @@ void process (struct dt_iop_module_t *self, dt_dev_pixelpipe_iop_t *piece, void
   int rad = mrad*(fmin(100.0,data->size+1)/100.0);
   const int radius = MIN(mrad, ceilf(rad * roi_in->scale / piece->iscale));
 
-  const int size = roi_out->width > roi_out->height ? roi_out->width : roi_out->height;
-
-  for(int iteration=0; iteration<BOX_ITERATIONS; iteration++)
-  {
-#ifdef _OPENMP
-  #pragma omp parallel for default(none) shared(out,roi_out) schedule(static)
-#endif
-    /* horizontal blur out into out */
-    for(int y=0; y<roi_out->height; y++)
-    {
-      __m128 scanline[size];
-      size_t index = (size_t)y * roi_out->width;
-      __m128 L = _mm_setzero_ps();
-      int hits = 0;
-      for(int x=-radius; x<roi_out->width; x++)
-      {
-        int op = x - radius-1;
-        int np = x+radius;
-        if(op>=0)
-        {
-          L = _mm_sub_ps(L, _mm_load_ps(&out[(index+op)*ch]));
-          hits--;
-        }
-        if(np < roi_out->width)
-        {
-          L =  _mm_add_ps(L, _mm_load_ps(&out[(index+np)*ch]));
-          hits++;
-        }
-        if(x>=0)
-          scanline[x] = _mm_div_ps(L, _mm_set_ps1(hits));
-      }
-
-      for (int x=0; x<roi_out->width; x++)
-        _mm_store_ps(&out[(index+x)*ch], scanline[x]);
-    }
-
-    /* vertical pass on blurlightness */
-    const int opoffs = -(radius+1)*roi_out->width;
-    const int npoffs = (radius)*roi_out->width;
-#ifdef _OPENMP
-  #pragma omp parallel for default(none) shared(out,roi_out) schedule(static)
-#endif
-    for(int x=0; x < roi_out->width; x++)
-    {
-      __m128 scanline[size];
-      __m128 L = _mm_setzero_ps();
-      int hits=0;
-      size_t index = (size_t)x - radius*roi_out->width;
-      for(int y=-radius; y<roi_out->height; y++)
-      {
-        int op=y-radius-1;
-        int np= y + radius;
-
-        if(op>=0)
-        {
-          L = _mm_sub_ps(L, _mm_load_ps(&out[(index+opoffs)*ch]));
-          hits--;
-        }
-        if(np < roi_out->height)
-        {
-          L = _mm_add_ps(L, _mm_load_ps(&out[(index+npoffs)*ch]));
-          hits++;
-        }
-        if(y>=0)
-          scanline[y] = _mm_div_ps(L, _mm_set_ps1(hits));
-        index += roi_out->width;
-      }
-
-      for (int y=0; y<roi_out->height; y++)
-        _mm_store_ps(&out[((size_t)y*roi_out->width+x)*ch], scanline[y]);
-    }
-  }
+  dt_box_mean(out, roi_out->width, roi_out->height, ch, radius, BOX_ITERATIONS);
 
 
   const __m128 amount = _mm_set1_ps(data->amount/100.0);
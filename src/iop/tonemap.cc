@@ -71,6 +71,8 @@ extern "C"
   typedef struct dt_iop_tonemapping_data_t
   {
     float contrast,Fsize;
+    // reused between runs of the pipe, see Permutohedral.h
+    PermutohedralLattice<3,2> *lattice;
   }
   dt_iop_tonemapping_data_t;
 
@@ -129,12 +131,14 @@ extern "C"
     if(inv_sigma_s<3.0) inv_sigma_s=3.0;
     inv_sigma_s = 1.0/inv_sigma_s;
 
-    PermutohedralLattice<3,2> lattice(size, omp_get_max_threads());
+    if(!data->lattice) data->lattice = new PermutohedralLattice<3,2>(0, omp_get_max_threads());
+    PermutohedralLattice<3,2> &lattice = *data->lattice;
+    lattice.reset(size);
 
     // Build I=log(L)
     // and splat into the lattice
 #ifdef _OPENMP
-    #pragma omp parallel for shared(lattice)
+    #pragma omp parallel for
 #endif
     for(int j=0; j<height; j++)
     {
@@ -203,6 +207,12 @@ extern "C"
         out[3]=in[3];
       }
     }
+    // only small lattices are worth keeping around for the next run
+    if(size > PERMUTOHEDRAL_MAX_KEPT_POINTS)
+    {
+      delete data->lattice;
+      data->lattice = NULL;
+    }
     // also process the clipping point, as good as we can without knowing
     // the local environment (i.e. assuming detail == 0)
     float *pmax = piece->pipe->processed_maximum;
@@ -242,16 +252,27 @@ extern "C"
     dt_iop_tonemapping_data_t *d = (dt_iop_tonemapping_data_t *)piece->data;
     d->contrast = p->contrast;
     d->Fsize = p->Fsize;
+    // a disabled module doesn't need its lattice storage
+    if(!piece->enabled)
+    {
+      delete d->lattice;
+      d->lattice = NULL;
+    }
   }
 
   void init_pipe (struct dt_iop_module_t *self, dt_dev_pixelpipe_t *pipe, dt_dev_pixelpipe_iop_t *piece)
   {
-    piece->data = malloc(sizeof(dt_iop_tonemapping_data_t));
+    dt_iop_tonemapping_data_t *d = (dt_iop_tonemapping_data_t *)malloc(sizeof(dt_iop_tonemapping_data_t));
+    // allocated on first use
+    d->lattice = NULL;
+    piece->data = d;
     self->commit_params(self, self->default_params, pipe, piece);
   }
 
   void cleanup_pipe (struct dt_iop_module_t *self, dt_dev_pixelpipe_t *pipe, dt_dev_pixelpipe_iop_t *piece)
   {
+    dt_iop_tonemapping_data_t *d = (dt_iop_tonemapping_data_t *)piece->data;
+    delete d->lattice;
     free(piece->data);
     piece->data = NULL;
   }
@@ -0,0 +1,388 @@
+/*
+    This file is part of darktable,
+    copyright (c) 2015 the darktable project.
+
+    darktable is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    darktable is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with darktable.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+/*
+ * throughput benchmark for the rawspeed decoders over a directory of sample raws.
+ *
+ * every file is read into memory once and then decoded the way
+ * dt_imageio_open_rawspeed() does it (checkSupport, decodeRaw, decodeMetaData),
+ * the best of a few runs counts. results are summed up per file extension:
+ * compressed MB/s, megapixels/s, peak resident set size and the speedup of the
+ * threaded (startThreads) decoders when going from one to all cores.
+ *
+ * the summary can be written to a file and compared against on the next run,
+ * formats which got slower than the threshold are reported and make the
+ * program exit with status 2.
+ */
+
+#include "rawspeed/RawSpeed/StdAfx.h"
+#include "rawspeed/RawSpeed/FileReader.h"
+#include "rawspeed/RawSpeed/RawDecoder.h"
+#include "rawspeed/RawSpeed/RawParser.h"
+#include "rawspeed/RawSpeed/CameraMetaData.h"
+
+#include <algorithm>
+#include <dirent.h>
+#include <limits.h>
+#include <strings.h>
+#include <sys/resource.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+#ifndef DT_RAWSPEED_CAMERAS_XML
+#define DT_RAWSPEED_CAMERAS_XML "cameras.xml"
+#endif
+
+using namespace RawSpeed;
+
+// number of threads rawspeed will use for startThreads(), changed between passes.
+static int num_threads = 1;
+
+// define this function, it is only declared in rawspeed:
+int
+rawspeed_get_number_of_processor_cores()
+{
+  return num_threads;
+}
+
+typedef struct bench_file_t
+{
+  string path, format;
+  size_t bytes;
+  double megapixels;
+  size_t peak_rss;          // in kB
+  vector<double> seconds;   // best time per thread count
+}
+bench_file_t;
+
+typedef struct bench_format_t
+{
+  int files;
+  double bytes, megapixels;
+  size_t peak_rss;
+  vector<double> seconds;
+}
+bench_format_t;
+
+static const char *extensions[] =
+{
+  "3fr", "ari", "arw", "cr2", "crw", "dcr", "dng", "erf", "iiq", "kdc", "mef", "mos", "mrw",
+  "nef", "nrw", "orf", "pef", "raf", "raw", "rw2", "rwl", "sr2", "srf", "srw", "x3f", NULL
+};
+
+static double
+get_time()
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + 1e-9*ts.tv_nsec;
+}
+
+// reset the high water mark of the resident set, linux >= 4.0 only.
+static void
+reset_peak_rss()
+{
+  FILE *f = fopen("/proc/self/clear_refs", "w");
+  if(!f) return;
+  fputs("5", f);
+  fclose(f);
+}
+
+static size_t
+get_peak_rss()
+{
+  size_t kb = 0;
+  FILE *f = fopen("/proc/self/status", "r");
+  if(f)
+  {
+    char line[256];
+    while(fgets(line, sizeof(line), f))
+      if(!strncmp(line, "VmHWM:", 6))
+      {
+        kb = strtoul(line + 6, NULL, 10);
+        break;
+      }
+    fclose(f);
+  }
+  if(!kb)
+  {
+    struct rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+    kb = usage.ru_maxrss;
+  }
+  return kb;
+}
+
+static string
+get_format(const char *filename)
+{
+  const char *c = strrchr(filename, '.');
+  if(!c) return "";
+  for(int k=0; extensions[k]; k++)
+    if(!strcasecmp(c+1, extensions[k]))
+    {
+      string format(extensions[k]);
+      transform(format.begin(), format.end(), format.begin(), ::toupper);
+      return format;
+    }
+  return "";
+}
+
+static void
+collect_files(const string &dirname, vector<string> &files)
+{
+  DIR *dir = opendir(dirname.c_str());
+  if(!dir) return;
+  struct dirent *entry;
+  while((entry = readdir(dir)))
+  {
+    if(entry->d_name[0] == '.') continue;
+    const string path = dirname + "/" + entry->d_name;
+    struct stat st;
+    if(stat(path.c_str(), &st)) continue;
+    if(S_ISDIR(st.st_mode)) collect_files(path, files);
+    else if(S_ISREG(st.st_mode) && !get_format(entry->d_name).empty()) files.push_back(path);
+  }
+  closedir(dir);
+}
+
+// decode once, returns the time in seconds or a negative value on failure.
+static double
+decode(FileMap *input, CameraMetaData *meta, double *megapixels)
+{
+  RawDecoder *d = NULL;
+  double seconds = -1.0;
+  try
+  {
+    const double start = get_time();
+    RawParser t(input);
+    d = t.getDecoder();
+    if(d)
+    {
+      d->failOnUnknown = true;
+      d->checkSupport(meta);
+      d->decodeRaw();
+      d->decodeMetaData(meta);
+      seconds = get_time() - start;
+      RawImage r = d->mRaw;
+      *megapixels = r->dim.x * (double)r->dim.y * 1e-6;
+    }
+  }
+  catch(const std::exception &exc)
+  {
+    fprintf(stderr, "[rawspeed-bench] %s\n", exc.what());
+    seconds = -1.0;
+  }
+  delete d;
+  return seconds;
+}
+
+static int
+read_baseline(const char *filename, map<string, double> &baseline)
+{
+  FILE *f = fopen(filename, "r");
+  if(!f) return 1;
+  char line[1024];
+  while(fgets(line, sizeof(line), f))
+  {
+    char format[64];
+    double mp_s;
+    if(line[0] == '#') continue;
+    if(sscanf(line, "%63s %*d %*f %lf", format, &mp_s) == 2) baseline[format] = mp_s;
+  }
+  fclose(f);
+  return 0;
+}
+
+static void
+usage(const char *argv0)
+{
+  fprintf(stderr, "usage: %s [options] <directory>\n"
+          "  -c <cameras.xml>  rawspeed camera definitions (default " DT_RAWSPEED_CAMERAS_XML ")\n"
+          "  -r <runs>         decode every file this often, keep the fastest (default 3)\n"
+          "  -t <threads>      largest thread count to measure (default all cores)\n"
+          "  -b <file>         compare against the results of a previous run\n"
+          "  -o <file>         write the results, suitable for -b\n"
+          "  -T <percent>      slowdown reported as a regression (default 5)\n", argv0);
+}
+
+int
+main(int argc, char *argv[])
+{
+  const char *cameras = DT_RAWSPEED_CAMERAS_XML, *baseline_file = NULL, *output_file = NULL;
+  int runs = 3;
+  int max_threads = sysconf(_SC_NPROCESSORS_ONLN);
+  double threshold = 5.0;
+  int opt;
+  while((opt = getopt(argc, argv, "c:r:t:b:o:T:h")) != -1)
+  {
+    switch(opt)
+    {
+      case 'c': cameras = optarg; break;
+      case 'r': runs = std::max(1, atoi(optarg)); break;
+      case 't': max_threads = atoi(optarg); break;
+      case 'b': baseline_file = optarg; break;
+      case 'o': output_file = optarg; break;
+      case 'T': threshold = atof(optarg); break;
+      default: usage(argv[0]); return 1;
+    }
+  }
+  if(optind != argc - 1)
+  {
+    usage(argv[0]);
+    return 1;
+  }
+  max_threads = std::max(1, max_threads);
+
+  // 1, 2, 4, .., all cores
+  vector<int> thread_counts;
+  for(int t=1; t<max_threads; t*=2) thread_counts.push_back(t);
+  thread_counts.push_back(max_threads);
+
+  CameraMetaData *meta;
+  try
+  {
+    meta = new CameraMetaData(cameras);
+  }
+  catch(const std::exception &exc)
+  {
+    fprintf(stderr, "[rawspeed-bench] could not load `%s': %s\n", cameras, exc.what());
+    return 1;
+  }
+
+  vector<string> paths;
+  collect_files(argv[optind], paths);
+  sort(paths.begin(), paths.end());
+  if(paths.empty())
+  {
+    fprintf(stderr, "[rawspeed-bench] no raw files found in `%s'\n", argv[optind]);
+    return 1;
+  }
+
+  vector<bench_file_t> files;
+  for(size_t k=0; k<paths.size(); k++)
+  {
+    bench_file_t file;
+    file.path = paths[k];
+    file.format = get_format(paths[k].c_str());
+    file.megapixels = 0.0;
+
+    char filen[PATH_MAX];
+    snprintf(filen, sizeof(filen), "%s", paths[k].c_str());
+    FileMap *input = NULL;
+    try
+    {
+      FileReader f(filen);
+      input = f.readFile();
+    }
+    catch(const std::exception &exc)
+    {
+      fprintf(stderr, "[rawspeed-bench] could not read `%s': %s\n", filen, exc.what());
+      continue;
+    }
+    file.bytes = input->getSize();
+
+    reset_peak_rss();
+    int failed = 0;
+    for(size_t t=0; t<thread_counts.size() && !failed; t++)
+    {
+      num_threads = thread_counts[t];
+      double best = -1.0;
+      for(int run=0; run<runs; run++)
+      {
+        const double s = decode(input, meta, &file.megapixels);
+        if(s < 0.0)
+        {
+          failed = 1;
+          break;
+        }
+        if(best < 0.0 || s < best) best = s;
+      }
+      file.seconds.push_back(best);
+    }
+    file.peak_rss = get_peak_rss();
+    delete input;
+
+    if(failed)
+    {
+      fprintf(stderr, "[rawspeed-bench] skipping `%s'\n", filen);
+      continue;
+    }
+    fprintf(stdout, "%-60s %7.1f MP %8.1f ms\n", file.path.c_str(), file.megapixels,
+            1e3*file.seconds.back());
+    files.push_back(file);
+  }
+
+  // sum up per format
+  map<string, bench_format_t> formats;
+  for(size_t k=0; k<files.size(); k++)
+  {
+    bench_format_t &f = formats[files[k].format];
+    if(f.seconds.empty()) f.seconds.resize(thread_counts.size(), 0.0);
+    f.files++;
+    f.bytes += files[k].bytes;
+    f.megapixels += files[k].megapixels;
+    f.peak_rss = std::max(f.peak_rss, files[k].peak_rss);
+    for(size_t t=0; t<thread_counts.size(); t++) f.seconds[t] += files[k].seconds[t];
+  }
+
+  map<string, double> baseline;
+  if(baseline_file && read_baseline(baseline_file, baseline))
+    fprintf(stderr, "[rawspeed-bench] could not read baseline `%s'\n", baseline_file);
+
+  FILE *out = NULL;
+  if(output_file && !(out = fopen(output_file, "w")))
+    fprintf(stderr, "[rawspeed-bench] could not write `%s'\n", output_file);
+  if(out) fprintf(out, "# format files MB/s MP/s peak_rss_MB speedup_%dt\n", max_threads);
+
+  fprintf(stdout, "\n%-6s %5s %9s %9s %9s %8s %10s\n", "format", "files", "MB/s", "MP/s", "RSS MB",
+          "speedup", "vs. base");
+  int regressions = 0;
+  for(map<string, bench_format_t>::iterator it = formats.begin(); it != formats.end(); ++it)
+  {
+    const bench_format_t &f = it->second;
+    const double seconds = f.seconds.back();
+    const double mb_s = f.bytes/(1024.0*1024.0)/seconds;
+    const double mp_s = f.megapixels/seconds;
+    const double rss = f.peak_rss/1024.0;
+    const double speedup = f.seconds.front()/seconds;
+    char versus[32] = "";
+    map<string, double>::iterator b = baseline.find(it->first);
+    if(b != baseline.end() && b->second > 0.0)
+    {
+      const double change = 100.0*(mp_s/b->second - 1.0);
+      snprintf(versus, sizeof(versus), "%+6.1f%%%s", change, change < -threshold ? " !" : "");
+      if(change < -threshold) regressions++;
+    }
+    fprintf(stdout, "%-6s %5d %9.1f %9.1f %9.1f %7.2fx %10s\n", it->first.c_str(), f.files, mb_s, mp_s, rss,
+            speedup, versus);
+    if(out) fprintf(out, "%s %d %.3f %.3f %.1f %.3f\n", it->first.c_str(), f.files, mb_s, mp_s, rss, speedup);
+  }
+  if(out) fclose(out);
+
+  if(regressions)
+    fprintf(stdout, "\n%d format(s) got more than %.1f%% slower than the baseline\n", regressions, threshold);
+
+  delete meta;
+  return regressions ? 2 : 0;
+}
+
+// modelines: These editor modelines have been set for all relevant files by tools/update_modelines.sh
+// vim: shiftwidth=2 expandtab tabstop=2 cindent
+// kate: tab-indents: off; indent-width 2; replace-tabs on; indent-mode cstyle; remove-trailing-spaces modified;
@@ -181,7 +181,9 @@ void expose(dt_view_t *self, cairo_t *cri, int32_t width_i, int32_t height_i, in
     dt_view_set_scrollbar(self, zx+.5-boxw*.5, 1.0, boxw, zy+.5-boxh*.5, 1.0, boxh);
   }
 
-  if((dev->image_status == DT_DEV_PIXELPIPE_VALID) && dev->pipe->input_timestamp >= dev->preview_pipe->input_timestamp)
+  if((dev->image_status == DT_DEV_PIXELPIPE_VALID ||
+      (dev->image_status == DT_DEV_PIXELPIPE_RUNNING && dev->image_coarse)) &&
+     dev->pipe->input_timestamp >= dev->preview_pipe->input_timestamp)
   {
     // draw image
     roi_hash_old = roi_hash;
@@ -189,21 +191,25 @@ void expose(dt_view_t *self, cairo_t *cri, int32_t width_i, int32_t height_i, in
     dt_pthread_mutex_lock(mutex);
     wd = dev->pipe->backbuf_width;
     ht = dev->pipe->backbuf_height;
+    // a coarse pass of the progressive mode is blown up to the size of the full one
+    float coarse = dt_dev_get_zoom_scale(dev, zoom, 1.0f, 0) / dev->pipe->backbuf_scale;
+    if(!dev->image_coarse || coarse < 1.001f) coarse = 1.0f;
     stride = cairo_format_stride_for_width (CAIRO_FORMAT_RGB24, wd);
     surface = cairo_image_surface_create_for_data (dev->pipe->backbuf, CAIRO_FORMAT_RGB24, wd, ht, stride);
     cairo_set_source_rgb (cr, .2, .2, .2);
     cairo_paint(cr);
-    cairo_translate(cr, .5f*(width-wd), .5f*(height-ht));
+    cairo_translate(cr, .5f*(width-coarse*wd), .5f*(height-coarse*ht));
     if(closeup)
     {
       cairo_scale(cr, 2.0, 2.0);
-      cairo_translate(cr, -.25f*wd, -.25f*ht);
+      cairo_translate(cr, -.25f*coarse*wd, -.25f*coarse*ht);
     }
+    cairo_scale(cr, coarse, coarse);
     cairo_rectangle(cr, 0, 0, wd, ht);
     cairo_set_source_surface (cr, surface, 0, 0);
-    cairo_pattern_set_filter(cairo_get_source(cr), CAIRO_FILTER_FAST);
+    cairo_pattern_set_filter(cairo_get_source(cr), coarse > 1.0f ? CAIRO_FILTER_GOOD : CAIRO_FILTER_FAST);
     cairo_fill_preserve(cr);
-    cairo_set_line_width(cr, 1.0);
+    cairo_set_line_width(cr, 1.0/coarse);
     cairo_set_source_rgb (cr, .3, .3, .3);
     cairo_stroke(cr);
     cairo_surface_destroy (surface);
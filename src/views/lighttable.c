@@ -1270,6 +1270,8 @@ void expose(dt_view_t *self, cairo_t *cr, int32_t width, int32_t height, int32_t
   }
   else // we do pass on expose to manager or zoomable
   {
+    // the cells are copied from thumbnails prescaled to their size
+    dt_view_image_atlas_begin();
     switch(new_layout)
     {
       case 1: // file manager
@@ -1279,6 +1281,7 @@ void expose(dt_view_t *self, cairo_t *cr, int32_t width, int32_t height, int32_t
         expose_zoomable(self, cr, width, height, pointerx, pointery);
         break;
     }
+    dt_view_image_atlas_end();
   }
   const double end = dt_get_wtime();
   if (darktable.unmuted & DT_DEBUG_PERF)
@@ -1469,7 +1472,10 @@ void leave(dt_view_t *self)
   dt_library_t *lib = (dt_library_t *)self->data;
   lib->button = 0;
   lib->pan = 0;
-  
+
+  // the prescaled thumbnails are only needed in here
+  dt_view_image_atlas_clear();
+
   // exit preview mode if non-sticky
   if(lib->full_preview_id !=-1 && lib->full_preview_sticky==0)
   {
@@ -31,11 +31,34 @@
 #include "gui/draw.h"
 #include "gui/accelerators.h"
 #include <gdk/gdkkeysyms.h>
+#include <math.h>
+#include <stdlib.h>
 
 #include "osm-gps-map.h"
 
 DT_MODULE(1)
 
+// highest zoom level the image clusters are kept for, the map does not go further
+#define DT_MAP_MAX_ZOOM 20
+// thumbnails kept for markers which left the map, for panning back and forth
+#define DT_MAP_THUMB_LRU_SIZE 256
+
+/** a geotagged image, with its position in web mercator projection scaled to [0,1) */
+typedef struct dt_map_point_t
+{
+  int imgid;
+  float latitude, longitude;
+  double x, y;
+} dt_map_point_t;
+
+/** the images in one cell of the clustering grid of a zoom level */
+typedef struct dt_map_cluster_t
+{
+  uint64_t cell;             // row in the upper, column in the lower 32 bits
+  int imgid;                 // image shown for the whole cluster
+  int count;
+  float latitude, longitude; // average position of the images
+} dt_map_cluster_t;
 
 typedef struct dt_map_t
 {
@@ -44,13 +67,24 @@ typedef struct dt_map_t
   OsmGpsMapSource_t map_source;
   OsmGpsMapLayer *osd;
   GSList *images;
+  int images_zoom;
   GdkPixbuf *pin;
   gint selected_image;
   gboolean start_drag;
   struct
   {
-    sqlite3_stmt *main_query;
-  } statements;
+    // all images drawn on the map, read from the database once
+    dt_map_point_t *points;
+    int num_points;
+    // the same, clustered and sorted by cell. built the first time a zoom level is shown
+    dt_map_cluster_t *clusters[DT_MAP_MAX_ZOOM+1];
+    int num_clusters[DT_MAP_MAX_ZOOM+1];
+    gboolean dirty;
+  } index;
+  // imgid -> thumbnail with pin, so panning doesn't decode them again. holds the ones of the
+  // markers on the map, and of the last DT_MAP_THUMB_LRU_SIZE removed ones, oldest first in thumbs_lru
+  GHashTable *thumbs;
+  GQueue *thumbs_lru;
   gboolean drop_filmstrip_activated;
   gboolean filter_images_drawn;
   int max_images_drawn;
@@ -61,10 +95,16 @@ typedef struct dt_map_image_t
   gint imgid;
   OsmGpsMapImage *image;
   gint width, height;
+  // the cluster this marker stands for
+  uint64_t cell;
+  gint count;
+  float latitude, longitude;
 } dt_map_image_t;
 
 static const int thumb_size = 64, thumb_border = 1, pin_size = 13;
 static const uint32_t thumb_frame_color = 0x000000aa;
+// images closer than this many pixels on screen are drawn as one
+static const int cluster_size = 96;
 
 /* proxy function to center map view on location at a zoom level */
 static void _view_map_center_on_location(const dt_view_t *view, gdouble lon, gdouble lat, gdouble zoom);
@@ -100,7 +140,8 @@ static void _set_image_location(dt_view_t *self, int imgid, float longitude, flo
 static void _get_image_location(dt_view_t *self, int imgid, float *longitude, float *latitude);
 
 static gboolean _view_map_prefs_changed(dt_map_t *lib);
-static void _view_map_build_main_query(dt_map_t *lib);
+static void _view_map_build_index(dt_map_t *lib);
+static void _view_map_clear_index(dt_map_t *lib);
 
 const char *name(dt_view_t *self)
 {
@@ -291,9 +332,10 @@ void init(dt_view_t *self)
     g_signal_connect(GTK_WIDGET(lib->map), "drag-failed", G_CALLBACK(_view_map_dnd_failed_callback), self);
   }
 
-  /* build the query string */
-  lib->statements.main_query = NULL;
-  _view_map_build_main_query(lib);
+  /* the image index is read on first use */
+  lib->index.dirty = TRUE;
+  lib->thumbs = g_hash_table_new_full(g_direct_hash, g_direct_equal, NULL, g_object_unref);
+  lib->thumbs_lru = g_queue_new();
 
 #ifdef USE_LUA
   lua_State * L = darktable.lua_state.state;
@@ -324,8 +366,10 @@ void cleanup(dt_view_t *self)
     // FIXME: it would be nice to cleanly destroy the object, but we are doing this inside expose() so removing the widget can cause segfaults.
 //     g_object_unref(G_OBJECT(lib->map));
   }
-  if(lib->statements.main_query)
-    sqlite3_finalize(lib->statements.main_query);
+  _view_map_clear_index(lib);
+  g_hash_table_destroy(lib->thumbs);
+  g_queue_free(lib->thumbs_lru);
+  g_slist_free_full(lib->images, g_free);
   free(self->data);
 }
 
@@ -347,6 +391,183 @@ static gboolean _view_map_redraw(gpointer user_data)
   return FALSE; // remove the function again
 }
 
+static void _view_map_world_pos(double latitude, double longitude, double *x, double *y)
+{
+  // web mercator, as used by the tiles
+  const double s = sin(CLAMP(latitude, -85.0, 85.0)*M_PI/180.0);
+  *x = CLAMP((longitude + 180.0)/360.0, 0.0, 1.0);
+  *y = CLAMP(0.5 - log((1.0 + s)/(1.0 - s))/(4.0*M_PI), 0.0, 1.0);
+}
+
+static int _view_map_cmp_cell(const void *a, const void *b)
+{
+  const dt_map_cluster_t *ca = (const dt_map_cluster_t *)a, *cb = (const dt_map_cluster_t *)b;
+  if(ca->cell != cb->cell) return ca->cell < cb->cell ? -1 : 1;
+  return ca->imgid - cb->imgid;
+}
+
+/* group the images into cells of cluster_size pixels at the given zoom level */
+static const dt_map_cluster_t *_view_map_get_clusters(dt_map_t *lib, int zoom, int *num)
+{
+  if(!lib->index.clusters[zoom] && lib->index.num_points)
+  {
+    const double cells = 256.0*(1 << zoom)/cluster_size;
+    dt_map_cluster_t *c = (dt_map_cluster_t *)malloc(sizeof(dt_map_cluster_t)*lib->index.num_points);
+    if(!c)
+    {
+      *num = 0;
+      return NULL;
+    }
+    for(int k=0; k<lib->index.num_points; k++)
+    {
+      const dt_map_point_t *p = lib->index.points + k;
+      const uint64_t cx = p->x*cells, cy = p->y*cells;
+      c[k] = (dt_map_cluster_t) { (cy << 32) | cx, p->imgid, 1, p->latitude, p->longitude };
+    }
+    qsort(c, lib->index.num_points, sizeof(dt_map_cluster_t), _view_map_cmp_cell);
+    // merge runs of the same cell in place, the first (lowest) image id represents the cluster
+    int n = 0;
+    for(int k=0; k<lib->index.num_points; k++)
+    {
+      if(n && c[n-1].cell == c[k].cell)
+      {
+        dt_map_cluster_t *m = c + n - 1;
+        m->latitude  += (c[k].latitude  - m->latitude)/(m->count + 1);
+        m->longitude += (c[k].longitude - m->longitude)/(m->count + 1);
+        m->count++;
+      }
+      else c[n++] = c[k];
+    }
+    lib->index.clusters[zoom] = (dt_map_cluster_t *)realloc(c, sizeof(dt_map_cluster_t)*n);
+    if(!lib->index.clusters[zoom]) lib->index.clusters[zoom] = c;
+    lib->index.num_clusters[zoom] = n;
+  }
+  *num = lib->index.num_clusters[zoom];
+  return lib->index.clusters[zoom];
+}
+
+/* the marker of this image left the map: keep its thumbnail for a while, drop the oldest ones */
+static void _view_map_release_thumb(dt_map_t *lib, int imgid)
+{
+  if(!g_hash_table_lookup(lib->thumbs, GINT_TO_POINTER(imgid))) return;
+  g_queue_push_tail(lib->thumbs_lru, GINT_TO_POINTER(imgid));
+  while(g_queue_get_length(lib->thumbs_lru) > DT_MAP_THUMB_LRU_SIZE)
+    g_hash_table_remove(lib->thumbs, g_queue_pop_head(lib->thumbs_lru));
+}
+
+/* thumbnail with frame and pin, cached. returns NULL if the mipmap isn't there yet */
+static GdkPixbuf *_view_map_get_thumb(dt_map_t *lib, int imgid, gint *width, gint *height)
+{
+  GdkPixbuf *thumb = (GdkPixbuf *)g_hash_table_lookup(lib->thumbs, GINT_TO_POINTER(imgid));
+  if(thumb)
+  {
+    // in use by a marker again
+    g_queue_remove(lib->thumbs_lru, GINT_TO_POINTER(imgid));
+    *width = gdk_pixbuf_get_width(thumb) - 2*thumb_border;
+    *height = gdk_pixbuf_get_height(thumb) - 2*thumb_border - pin_size;
+    return thumb;
+  }
+
+  dt_mipmap_buffer_t buf;
+  dt_mipmap_size_t mip = dt_mipmap_cache_get_matching_size(darktable.mipmap_cache, thumb_size, thumb_size);
+  dt_mipmap_cache_read_get(darktable.mipmap_cache, &buf, imgid, mip, DT_MIPMAP_BEST_EFFORT);
+  if(buf.buf)
+  {
+    GdkPixbuf *source = NULL;
+    uint8_t *scratchmem = dt_mipmap_cache_alloc_scratchmem(darktable.mipmap_cache);
+    uint8_t *buf_decompressed = dt_mipmap_cache_decompress(&buf, scratchmem);
+
+    // convert image to pixbuf compatible rgb format
+    uint8_t *rgbbuf = (uint8_t*)malloc(buf.width*buf.height*3);
+    if(!rgbbuf) goto get_thumb_failure;
+    for(int i=0; i<buf.height; i++)
+      for(int j=0; j<buf.width; j++)
+        for(int k=0; k<3; k++)
+          rgbbuf[(i*buf.width+j)*3+k] = buf_decompressed[(i*buf.width+j)*4+2-k];
+
+    int w=thumb_size, h=thumb_size;
+    if(buf.width < buf.height) w = (buf.width*thumb_size)/buf.height; // portrait
+    else                       h = (buf.height*thumb_size)/buf.width; // landscape
+
+    // next we get a pixbuf for the image
+    source = gdk_pixbuf_new_from_data(rgbbuf, GDK_COLORSPACE_RGB, FALSE, 8, buf.width, buf.height, buf.width*3, NULL, NULL);
+    if(!source) goto get_thumb_failure;
+
+    // now we want a slightly larger pixbuf that we can put the image on
+    thumb = gdk_pixbuf_new(GDK_COLORSPACE_RGB, TRUE, 8, w+2*thumb_border, h+2*thumb_border+pin_size);
+    if(!thumb) goto get_thumb_failure;
+    gdk_pixbuf_fill(thumb, thumb_frame_color);
+
+    // put the image onto the frame
+    gdk_pixbuf_scale(source, thumb, thumb_border, thumb_border, w, h, thumb_border, thumb_border,
+                     (1.0*w) / buf.width, (1.0*h) / buf.height, GDK_INTERP_HYPER);
+
+    // and finally add the pin
+    gdk_pixbuf_copy_area(lib->pin, 0, 0, w+2*thumb_border, pin_size, thumb, 0, h+2*thumb_border);
+
+    *width = w;
+    *height = h;
+    g_hash_table_insert(lib->thumbs, GINT_TO_POINTER(imgid), thumb);
+
+get_thumb_failure:
+    if(source)
+      g_object_unref(source);
+    free(scratchmem);
+    free(rgbbuf);
+  }
+  dt_mipmap_cache_read_release(darktable.mipmap_cache, &buf);
+  return thumb;
+}
+
+/* a copy of the thumbnail with the number of images in the cluster on it */
+static GdkPixbuf *_view_map_cluster_thumb(GdkPixbuf *thumb, int count)
+{
+  const int w = gdk_pixbuf_get_width(thumb), h = gdk_pixbuf_get_height(thumb);
+  cairo_surface_t *cst = cairo_image_surface_create(CAIRO_FORMAT_ARGB32, w, h);
+  cairo_t *cr = cairo_create(cst);
+  gdk_cairo_set_source_pixbuf(cr, thumb, 0, 0);
+  cairo_paint(cr);
+
+  char text[16];
+  snprintf(text, sizeof(text), "%d", count);
+  cairo_select_font_face(cr, "sans-serif", CAIRO_FONT_SLANT_NORMAL, CAIRO_FONT_WEIGHT_BOLD);
+  cairo_set_font_size(cr, 11);
+  cairo_text_extents_t ext;
+  cairo_text_extents(cr, text, &ext);
+  cairo_rectangle(cr, thumb_border, thumb_border, ext.x_advance + 6, 15);
+  cairo_set_source_rgba(cr, 0.0, 0.0, 0.0, 0.7);
+  cairo_fill(cr);
+  cairo_move_to(cr, thumb_border + 3, thumb_border + 12);
+  cairo_set_source_rgb(cr, 1.0, 1.0, 1.0);
+  cairo_show_text(cr, text);
+  cairo_destroy(cr);
+
+  cairo_surface_flush(cst);
+  uint8_t *data = (uint8_t *)malloc(4*w*h);
+  const int stride = cairo_image_surface_get_stride(cst);
+  for(int j=0; j<h; j++) memcpy(data + 4*w*j, cairo_image_surface_get_data(cst) + stride*j, 4*w);
+  cairo_surface_destroy(cst);
+  dt_draw_cairo_to_gdk_pixbuf(data, w, h);
+  return gdk_pixbuf_new_from_data(data, GDK_COLORSPACE_RGB, TRUE, 8, w, h, w*4, (GdkPixbufDestroyNotify) free, NULL);
+}
+
+static int _view_map_cmp_distance(const void *a, const void *b, void *center)
+{
+  const float *c = (const float *)center;
+  const dt_map_cluster_t *ca = *(const dt_map_cluster_t **)a, *cb = *(const dt_map_cluster_t **)b;
+  const float da = fabsf(ca->latitude - c[0]) + fabsf(ca->longitude - c[1]);
+  const float db = fabsf(cb->latitude - c[0]) + fabsf(cb->longitude - c[1]);
+  return (da > db) - (da < db);
+}
+
+static int _view_map_cmp_latitude(const void *a, const void *b)
+{
+  const dt_map_cluster_t *ca = *(const dt_map_cluster_t **)a, *cb = *(const dt_map_cluster_t **)b;
+  // northern ones first, so the ones further south are drawn on top of them
+  if(ca->latitude != cb->latitude) return ca->latitude < cb->latitude ? 1 : -1;
+  return ca->imgid - cb->imgid;
+}
+
 static void _view_map_changed_callback(OsmGpsMap *map, dt_view_t *self)
 {
   dt_map_t *lib = (dt_map_t *)self->data;
@@ -359,17 +580,6 @@ static void _view_map_changed_callback(OsmGpsMap *map, dt_view_t *self)
   osm_gps_map_point_get_degrees(&bb[0], &bb_0_lat, &bb_0_lon);
   osm_gps_map_point_get_degrees(&bb[1], &bb_1_lat, &bb_1_lon);
 
-  /* make the bounding box a little bigger to the west and south */
-  float lat0 = 0.0, lon0 = 0.0, lat1 = 0.0, lon1 = 0.0;
-  OsmGpsMapPoint *pt0 = osm_gps_map_point_new_degrees(0.0, 0.0), *pt1 = osm_gps_map_point_new_degrees(0.0, 0.0);
-  osm_gps_map_convert_screen_to_geographic(map, 0, 0, pt0);
-  osm_gps_map_convert_screen_to_geographic(map, 1.5*thumb_size, 1.5*thumb_size, pt1);
-  osm_gps_map_point_get_degrees(pt0, &lat0, &lon0);
-  osm_gps_map_point_get_degrees(pt1, &lat1, &lon1);
-  osm_gps_map_point_free(pt0);
-  osm_gps_map_point_free(pt1);
-  double south_border = lat0 - lat1, west_border = lon1 - lon0;
-
   /* get map view state and store  */
   int zoom;
   float center_lat, center_lon;
@@ -377,101 +587,108 @@ static void _view_map_changed_callback(OsmGpsMap *map, dt_view_t *self)
   dt_conf_set_float("plugins/map/longitude", center_lon);
   dt_conf_set_float("plugins/map/latitude", center_lat);
   dt_conf_set_int("plugins/map/zoom", zoom);
-
-  /* check if the prefs have changed and rebuild main_query if needed */
-  if(_view_map_prefs_changed(lib))
-    _view_map_build_main_query(lib);
-
-  /* let's reset and reuse the main_query statement */
-  DT_DEBUG_SQLITE3_CLEAR_BINDINGS(lib->statements.main_query);
-  DT_DEBUG_SQLITE3_RESET(lib->statements.main_query);
-
-  /* bind bounding box coords for the main query */
-  DT_DEBUG_SQLITE3_BIND_DOUBLE(lib->statements.main_query, 1, bb_0_lon - west_border);
-  DT_DEBUG_SQLITE3_BIND_DOUBLE(lib->statements.main_query, 2, bb_1_lon);
-  DT_DEBUG_SQLITE3_BIND_DOUBLE(lib->statements.main_query, 3, bb_0_lat);
-  DT_DEBUG_SQLITE3_BIND_DOUBLE(lib->statements.main_query, 4, bb_1_lat - south_border);
-  DT_DEBUG_SQLITE3_BIND_DOUBLE(lib->statements.main_query, 5, center_lat);
-  DT_DEBUG_SQLITE3_BIND_DOUBLE(lib->statements.main_query, 6, center_lon);
-
-  /* remove the old images */
-  osm_gps_map_image_remove_all(map);
-  if(lib->images)
+  zoom = CLAMP(zoom, 0, DT_MAP_MAX_ZOOM);
+
+  /* check if the prefs have changed and re-read the images if needed */
+  if(_view_map_prefs_changed(lib) || lib->index.dirty)
+    _view_map_build_index(lib);
+
+  /* the cells in view. thumbnails hang to the top right of their position, so also take
+     the ones in the cells just west and south of the view */
+  double x0, y0, x1, y1;
+  _view_map_world_pos(bb_0_lat, bb_0_lon, &x0, &y0);
+  _view_map_world_pos(bb_1_lat, bb_1_lon, &x1, &y1);
+  const double cells = 256.0*(1 << zoom)/cluster_size;
+  const uint64_t cx0 = MAX(0, x0*cells - 1), cx1 = x1*cells;
+  const uint64_t cy0 = y0*cells, cy1 = y1*cells + 1;
+
+  int num_clusters = 0;
+  const dt_map_cluster_t *clusters = _view_map_get_clusters(lib, zoom, &num_clusters);
+  GPtrArray *visible = g_ptr_array_new();
+  for(uint64_t cy=cy0; cy<=cy1 && clusters; cy++)
   {
-    g_slist_free_full(lib->images, g_free);
-    lib->images = NULL;
+    // binary search for the first cell of this row in view
+    const uint64_t first = (cy << 32) | cx0, last = (cy << 32) | cx1;
+    int lo = 0, hi = num_clusters;
+    while(lo < hi)
+    {
+      const int mid = (lo + hi)/2;
+      if(clusters[mid].cell < first) lo = mid + 1;
+      else hi = mid;
+    }
+    for(int k=lo; k<num_clusters && clusters[k].cell <= last; k++)
+      g_ptr_array_add(visible, (gpointer)(clusters + k));
   }
 
-  /* add  all images to the map */
-  gboolean needs_redraw = FALSE;
-  dt_mipmap_size_t mip = dt_mipmap_cache_get_matching_size(darktable.mipmap_cache, thumb_size, thumb_size);
-  while(sqlite3_step(lib->statements.main_query) == SQLITE_ROW)
+  /* keep the ones closest to the center if there are too many */
+  if(visible->len > (guint)lib->max_images_drawn)
   {
-    int imgid = sqlite3_column_int(lib->statements.main_query, 0);
-    dt_mipmap_buffer_t buf;
-    dt_mipmap_cache_read_get(darktable.mipmap_cache, &buf, imgid, mip, DT_MIPMAP_BEST_EFFORT);
+    float center[2] = { center_lat, center_lon };
+    g_qsort_with_data(visible->pdata, visible->len, sizeof(gpointer), _view_map_cmp_distance, center);
+    g_ptr_array_set_size(visible, lib->max_images_drawn);
+  }
+  qsort(visible->pdata, visible->len, sizeof(gpointer), _view_map_cmp_latitude);
 
-    if(buf.buf)
+  /* remove the markers that are gone, the others stay where they are */
+  gboolean *shown = (gboolean *)calloc(visible->len + 1, sizeof(gboolean));
+  GSList *keep = NULL;
+  for(GSList *iter = lib->images; iter; iter = g_slist_next(iter))
+  {
+    dt_map_image_t *entry = (dt_map_image_t *)iter->data;
+    gboolean found = FALSE;
+    for(guint k=0; k<visible->len && lib->images_zoom == zoom && !found; k++)
     {
-      GdkPixbuf *source = NULL, *thumb = NULL;
-      uint8_t *scratchmem = dt_mipmap_cache_alloc_scratchmem(darktable.mipmap_cache);
-      uint8_t *buf_decompressed = dt_mipmap_cache_decompress(&buf, scratchmem);
-
-      // convert image to pixbuf compatible rgb format
-      uint8_t *rgbbuf = (uint8_t*)malloc(buf.width*buf.height*3);
-      if(!rgbbuf) goto map_changed_failure;
-      for(int i=0; i<buf.height; i++)
-        for(int j=0; j<buf.width; j++)
-          for(int k=0; k<3; k++)
-            rgbbuf[(i*buf.width+j)*3+k] = buf_decompressed[(i*buf.width+j)*4+2-k];
-
-      int w=thumb_size, h=thumb_size;
-      if(buf.width < buf.height) w = (buf.width*thumb_size)/buf.height; // portrait
-      else                       h = (buf.height*thumb_size)/buf.width; // landscape
-
-      // next we get a pixbuf for the image
-      source = gdk_pixbuf_new_from_data(rgbbuf, GDK_COLORSPACE_RGB, FALSE, 8, buf.width, buf.height, buf.width*3, NULL, NULL);
-      if(!source) goto map_changed_failure;
-
-      // now we want a slightly larger pixbuf that we can put the image on
-      thumb = gdk_pixbuf_new(GDK_COLORSPACE_RGB, TRUE, 8, w+2*thumb_border, h+2*thumb_border+pin_size);
-      if(!thumb) goto map_changed_failure;
-      gdk_pixbuf_fill(thumb, thumb_frame_color);
-
-      // put the image onto the frame
-      gdk_pixbuf_scale(source, thumb, thumb_border, thumb_border, w, h, thumb_border, thumb_border,
-                       (1.0*w) / buf.width, (1.0*h) / buf.height, GDK_INTERP_HYPER);
-
-      // and finally add the pin
-      gdk_pixbuf_copy_area(lib->pin, 0, 0, w+2*thumb_border, pin_size, thumb, 0, h+2*thumb_border);
-
-      const dt_image_t *cimg = dt_image_cache_read_get(darktable.image_cache, imgid);
-      if(!cimg) goto map_changed_failure;
-      dt_map_image_t *entry = (dt_map_image_t*)malloc(sizeof(dt_map_image_t));
-      if(!entry)
-      {
-        dt_image_cache_read_release(darktable.image_cache, cimg);
-        goto map_changed_failure;
-      }
-      entry->imgid = imgid;
-      entry->image = osm_gps_map_image_add_with_alignment(map, cimg->latitude, cimg->longitude, thumb, 0, 1);
-      entry->width = w;
-      entry->height = h;
-      lib->images = g_slist_prepend(lib->images, entry);
-      dt_image_cache_read_release(darktable.image_cache, cimg);
-
-map_changed_failure:
-      if(source)
-        g_object_unref(source);
-      if(thumb)
-        g_object_unref(thumb);
-      free(scratchmem);
-      free(rgbbuf);
+      const dt_map_cluster_t *c = (const dt_map_cluster_t *)g_ptr_array_index(visible, k);
+      // the position is compared too: a moved image or cluster may well stay in its cell
+      if(!shown[k] && c->cell == entry->cell && c->imgid == entry->imgid && c->count == entry->count &&
+         c->latitude == entry->latitude && c->longitude == entry->longitude)
+        found = shown[k] = TRUE;
     }
+    if(found) keep = g_slist_prepend(keep, entry);
     else
+    {
+      osm_gps_map_image_remove(map, entry->image);
+      _view_map_release_thumb(lib, entry->imgid);
+      g_free(entry);
+    }
+  }
+  g_slist_free(lib->images);
+  lib->images = keep;
+  lib->images_zoom = zoom;
+
+  /* and add the new ones */
+  gboolean needs_redraw = FALSE;
+  for(guint k=0; k<visible->len; k++)
+  {
+    if(shown[k]) continue;
+    const dt_map_cluster_t *c = (const dt_map_cluster_t *)g_ptr_array_index(visible, k);
+    gint w = 0, h = 0;
+    GdkPixbuf *thumb = _view_map_get_thumb(lib, c->imgid, &w, &h);
+    if(!thumb)
+    {
       needs_redraw = TRUE;
-    dt_mipmap_cache_read_release(darktable.mipmap_cache, &buf);
+      continue;
+    }
+    dt_map_image_t *entry = (dt_map_image_t*)g_malloc(sizeof(dt_map_image_t));
+    entry->imgid = c->imgid;
+    entry->cell = c->cell;
+    entry->count = c->count;
+    entry->latitude = c->latitude;
+    entry->longitude = c->longitude;
+    entry->width = w;
+    entry->height = h;
+    if(c->count > 1)
+    {
+      GdkPixbuf *cluster_thumb = _view_map_cluster_thumb(thumb, c->count);
+      entry->image = osm_gps_map_image_add_with_alignment(map, c->latitude, c->longitude, cluster_thumb, 0, 1);
+      g_object_unref(cluster_thumb);
+    }
+    else
+      entry->image = osm_gps_map_image_add_with_alignment(map, c->latitude, c->longitude, thumb, 0, 1);
+    lib->images = g_slist_prepend(lib->images, entry);
   }
+  free(shown);
+  g_ptr_array_free(visible, TRUE);
 
   // not exactly thread safe, but should be good enough for updating the display
   static int timeout_event_source = 0;
@@ -488,7 +705,7 @@ map_changed_failure:
   }
 }
 
-static int _view_map_get_img_at_pos(dt_view_t *self, double x, double y)
+static dt_map_image_t *_view_map_get_entry_at_pos(dt_view_t *self, double x, double y)
 {
   dt_map_t *lib = (dt_map_t*)self->data;
   GSList *iter;
@@ -502,10 +719,10 @@ static int _view_map_get_img_at_pos(dt_view_t *self, double x, double y)
     osm_gps_map_convert_geographic_to_screen(lib->map, pt, &img_x, &img_y);
     img_y -= pin_size;
     if(x >= img_x && x <= img_x + entry->width && y <= img_y && y >= img_y - entry->height)
-      return entry->imgid;
+      return entry;
   }
 
-  return 0;
+  return NULL;
 }
 
 static gboolean _view_map_motion_notify_callback(GtkWidget *w, GdkEventMotion *e, dt_view_t *self)
@@ -520,7 +737,11 @@ static gboolean _view_map_motion_notify_callback(GtkWidget *w, GdkEventMotion *e
       OsmGpsMapImage *image = entry->image;
       if(entry->imgid == lib->selected_image)
       {
+        // forget the marker as well, so it gets added again if the drag fails
         osm_gps_map_image_remove(lib->map, image);
+        _view_map_release_thumb(lib, entry->imgid);
+        lib->images = g_slist_delete_link(lib->images, iter);
+        g_free(entry);
         break;
       }
     }
@@ -586,8 +807,10 @@ static gboolean _view_map_button_press_callback(GtkWidget *w, GdkEventButton *e,
   dt_map_t *lib = (dt_map_t*)self->data;
   if(e->button == 1)
   {
-    // check if the click was on an image or just some random position
-    lib->selected_image = _view_map_get_img_at_pos(self, e->x, e->y);
+    // check if the click was on an image or just some random position. clusters can't be dragged
+    // or opened, double clicking them zooms in like on the map itself
+    const dt_map_image_t *entry = _view_map_get_entry_at_pos(self, e->x, e->y);
+    lib->selected_image = (entry && entry->count == 1) ? entry->imgid : 0;
     if(e->type == GDK_BUTTON_PRESS && lib->selected_image > 0)
     {
       lib->start_drag = TRUE;
@@ -628,6 +851,11 @@ void enter(dt_view_t *self)
   lib->selected_image = 0;
   lib->start_drag = FALSE;
 
+  /* positions and thumbnails may have changed while we were away */
+  lib->index.dirty = TRUE;
+  g_hash_table_remove_all(lib->thumbs);
+  g_queue_clear(lib->thumbs_lru);
+
   /* set the correct map source */
   _view_map_set_map_source_g_object(self, lib->map_source);
 
@@ -798,6 +1026,7 @@ static void _view_map_collection_changed(gpointer instance, gpointer user_data)
 
   if(dt_conf_get_bool("plugins/map/filter_images_drawn"))
   {
+    lib->index.dirty = TRUE;
     /* only redraw when map mode is currently active, otherwise enter() does the magic */
     if(darktable.view_manager->proxy.map.view)
       g_signal_emit_by_name(lib->map, "changed");
@@ -876,6 +1105,9 @@ static void _set_image_location(dt_view_t *self, int imgid, float longitude, flo
   img->latitude = latitude;
   dt_image_cache_write_release(darktable.image_cache, img, DT_IMAGE_CACHE_SAFE);
   dt_image_cache_read_release(darktable.image_cache, cimg);
+
+  dt_map_t *lib = (dt_map_t*)self->data;
+  lib->index.dirty = TRUE;
 }
 
 static void
@@ -989,6 +1221,8 @@ static gboolean _view_map_prefs_changed(dt_map_t *lib)
   gboolean prefs_changed = FALSE;
   int max_images_drawn = dt_conf_get_int("plugins/map/max_images_drawn");
   gboolean filter_images_drawn = dt_conf_get_bool("plugins/map/filter_images_drawn");
+  if(max_images_drawn == 0)
+    max_images_drawn = 100;
 
   if(lib->max_images_drawn!=max_images_drawn)
     prefs_changed=TRUE;
@@ -998,28 +1232,55 @@ static gboolean _view_map_prefs_changed(dt_map_t *lib)
   return prefs_changed;
 }
 
-static void _view_map_build_main_query(dt_map_t *lib)
+static void _view_map_clear_index(dt_map_t *lib)
 {
+  free(lib->index.points);
+  lib->index.points = NULL;
+  lib->index.num_points = 0;
+  for(int k=0; k<=DT_MAP_MAX_ZOOM; k++)
+  {
+    free(lib->index.clusters[k]);
+    lib->index.clusters[k] = NULL;
+    lib->index.num_clusters[k] = 0;
+  }
+}
+
+/* read the positions of all geotagged images once, the clusters per zoom level are made from these on demand */
+static void _view_map_build_index(dt_map_t *lib)
+{
+  sqlite3_stmt *stmt;
   char *geo_query;
 
-  if(lib->statements.main_query)
-    sqlite3_finalize(lib->statements.main_query);
+  _view_map_clear_index(lib);
 
   lib->max_images_drawn = dt_conf_get_int("plugins/map/max_images_drawn");
   if(lib->max_images_drawn == 0)
     lib->max_images_drawn = 100;
   lib->filter_images_drawn = dt_conf_get_bool("plugins/map/filter_images_drawn");
-  geo_query = g_strdup_printf("select * from (select id, latitude from %s where \
-                               longitude >= ?1 and longitude <= ?2 and latitude <= ?3 and latitude >= ?4 \
-                               and longitude not NULL and latitude not NULL order by abs(latitude - ?5), abs(longitude - ?6) \
-                               limit 0, %d) order by (180 - latitude), id",
-                              lib->filter_images_drawn?"images i inner join memory.collected_images c on i.id = c.imgid":"images",
-                              lib->max_images_drawn);
-
-  /* prepare the main query statement */
-  DT_DEBUG_SQLITE3_PREPARE_V2(dt_database_get(darktable.db), geo_query, -1, &lib->statements.main_query, NULL);
+  geo_query = g_strdup_printf("select id, latitude, longitude from %s where longitude not NULL and latitude not NULL",
+                              lib->filter_images_drawn?"images i inner join memory.collected_images c on i.id = c.imgid":"images");
+  DT_DEBUG_SQLITE3_PREPARE_V2(dt_database_get(darktable.db), geo_query, -1, &stmt, NULL);
 
+  int size = 0;
+  while(sqlite3_step(stmt) == SQLITE_ROW)
+  {
+    if(lib->index.num_points == size)
+    {
+      size = MAX(1024, 2*size);
+      dt_map_point_t *points = (dt_map_point_t *)realloc(lib->index.points, sizeof(dt_map_point_t)*size);
+      if(!points) break;
+      lib->index.points = points;
+    }
+    dt_map_point_t *p = lib->index.points + lib->index.num_points++;
+    p->imgid = sqlite3_column_int(stmt, 0);
+    p->latitude = sqlite3_column_double(stmt, 1);
+    p->longitude = sqlite3_column_double(stmt, 2);
+    _view_map_world_pos(p->latitude, p->longitude, &p->x, &p->y);
+  }
+  sqlite3_finalize(stmt);
   g_free(geo_query);
+
+  lib->index.dirty = FALSE;
 }
 
 // modelines: These editor modelines have been set for all relevant files by tools/update_modelines.sh
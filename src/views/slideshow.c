@@ -110,7 +110,13 @@ mime(dt_imageio_module_data_t *data)
 }
 
 static int
-write_image (dt_imageio_module_data_t *datai, const char *filename, const void *in, void *exif, int exif_len, int imgid)
+flags(dt_imageio_module_data_t *data)
+{
+  return 0;
+}
+
+static int
+write_image (dt_imageio_module_data_t *datai, const char *filename, const void *in, void *exif, int exif_len, const char *xmp, int imgid)
 {
   dt_slideshow_format_t *data = (dt_slideshow_format_t *)datai;
   dt_pthread_mutex_lock(&data->d->lock);
@@ -149,7 +155,9 @@ process_next_image(dt_slideshow_t *d)
   buf.mime = mime;
   buf.levels = levels;
   buf.bpp = bpp;
+  buf.flags = flags;
   buf.write_image = write_image;
+  buf.write_image_rows = NULL;
   dat.max_width  = d->width;
   dat.max_height = d->height;
   dat.style[0] = '\0';
@@ -24,6 +24,7 @@
 #include "common/mipmap_cache.h"
 #include "common/debug.h"
 #include "common/history.h"
+#include "common/readahead.h"
 #include "libs/lib.h"
 #include "control/conf.h"
 #include "control/control.h"
@@ -42,6 +43,8 @@
 
 #define DECORATION_SIZE_LIMIT 40
 
+static void _atlas_reset(dt_view_thumb_atlas_t *a);
+
 void dt_view_manager_init(dt_view_manager_t *vm)
 {
   /* prepare statements */
@@ -85,6 +88,8 @@ void dt_view_manager_init(dt_view_manager_t *vm)
 void dt_view_manager_cleanup(dt_view_manager_t *vm)
 {
   for(int k=0; k<vm->num_views; k++) dt_view_unload_module(vm->view + k);
+  _atlas_reset(&vm->thumb_atlas);
+  if(vm->thumb_atlas.index) g_hash_table_destroy(vm->thumb_atlas.index);
 }
 
 const dt_view_t *dt_view_manager_get_current_view(dt_view_manager_t *vm)
@@ -683,6 +688,169 @@ dt_view_star(cairo_t *cr, float x, float y, float r1, float r2)
   cairo_close_path(cr);
 }
 
+// the atlas is at most this wide, in pixels, and has no more slots than this
+#define DT_VIEW_ATLAS_MAX_WIDTH 4096
+#define DT_VIEW_ATLAS_MAX_SLOTS 1024
+
+static void
+_atlas_reset(dt_view_thumb_atlas_t *a)
+{
+  if(a->surface) cairo_surface_destroy(a->surface);
+  a->surface = NULL;
+  free(a->slots);
+  a->slots = NULL;
+  a->num_slots = 0;
+  if(a->index) g_hash_table_remove_all(a->index);
+}
+
+static void
+_atlas_drop(dt_view_thumb_atlas_t *a, const int32_t imgid)
+{
+  const int k = GPOINTER_TO_INT(g_hash_table_lookup(a->index, GINT_TO_POINTER(imgid))) - 1;
+  if(k < 0) return;
+  a->slots[k].imgid = -1;
+  g_hash_table_remove(a->index, GINT_TO_POINTER(imgid));
+}
+
+void dt_view_image_atlas_begin()
+{
+  dt_view_thumb_atlas_t *a = &darktable.view_manager->thumb_atlas;
+  if(!a->index) a->index = g_hash_table_new(NULL, NULL);
+  a->active = 1;
+  a->frame++;
+  // forget the thumbnails that changed since the last frame
+  uint32_t removed[DT_MIPMAP_REMOVED_LOG];
+  const int num = dt_mipmap_cache_get_removed(darktable.mipmap_cache, &a->removed_serial, removed);
+  if(num < 0) _atlas_reset(a);
+  for(int k=0; k<num; k++) _atlas_drop(a, removed[k]);
+}
+
+void dt_view_image_atlas_end()
+{
+  darktable.view_manager->thumb_atlas.active = 0;
+}
+
+void dt_view_image_atlas_clear()
+{
+  _atlas_reset(&darktable.view_manager->thumb_atlas);
+}
+
+// the slot of imgid, if it holds the wanted mip scaled for this cell size.
+static int
+_atlas_lookup(dt_view_thumb_atlas_t *a, const int32_t imgid, const int32_t width, const int32_t height,
+              const dt_mipmap_size_t mip)
+{
+  if(a->cell_width != width || a->cell_height != height) return -1;
+  const int k = GPOINTER_TO_INT(g_hash_table_lookup(a->index, GINT_TO_POINTER(imgid))) - 1;
+  if(k < 0 || a->slots[k].mip != mip) return -1;
+  a->slots[k].used = a->frame;
+  return k;
+}
+
+// a slot for imgid: the one it already has, a free one or the least recently drawn one.
+// if all of them are needed for the current frame the atlas grows.
+static int
+_atlas_alloc(dt_view_thumb_atlas_t *a, const int32_t imgid)
+{
+  const int k = GPOINTER_TO_INT(g_hash_table_lookup(a->index, GINT_TO_POINTER(imgid))) - 1;
+  if(k >= 0) return k;
+
+  int lru = -1;
+  for(int i=0; i<a->num_slots; i++)
+  {
+    if(a->slots[i].imgid == -1)
+    {
+      lru = i;
+      break;
+    }
+    if(lru < 0 || a->slots[i].used < a->slots[lru].used) lru = i;
+  }
+  const int rows = a->num_slots / a->cols;
+  const int max_rows = MIN(DT_VIEW_ATLAS_MAX_SLOTS / a->cols, 32767 / a->slot_height);
+  if((lru < 0 || (a->slots[lru].imgid != -1 && a->slots[lru].used == a->frame)) && rows < max_rows)
+  {
+    const int new_rows = MIN(MAX(1, 2*rows), max_rows);
+    cairo_surface_t *surface = cairo_image_surface_create(CAIRO_FORMAT_RGB24, a->cols*a->slot_width,
+                                                          new_rows*a->slot_height);
+    dt_view_thumb_slot_t *slots = (dt_view_thumb_slot_t *)realloc(a->slots, sizeof(dt_view_thumb_slot_t)*new_rows*a->cols);
+    if(cairo_surface_status(surface) == CAIRO_STATUS_SUCCESS && slots)
+    {
+      if(a->surface)
+      {
+        cairo_t *cr = cairo_create(surface);
+        cairo_set_source_surface(cr, a->surface, 0, 0);
+        cairo_set_operator(cr, CAIRO_OPERATOR_SOURCE);
+        cairo_paint(cr);
+        cairo_destroy(cr);
+        cairo_surface_destroy(a->surface);
+      }
+      a->surface = surface;
+      a->slots = slots;
+      for(int i=a->num_slots; i<new_rows*a->cols; i++)
+      {
+        a->slots[i].imgid = -1;
+        a->slots[i].used = 0;
+      }
+      lru = a->num_slots;
+      a->num_slots = new_rows*a->cols;
+    }
+    else
+    {
+      cairo_surface_destroy(surface);
+      if(slots) a->slots = slots;
+    }
+  }
+  if(lru < 0) return -1;
+
+  if(a->slots[lru].imgid != -1) g_hash_table_remove(a->index, GINT_TO_POINTER(a->slots[lru].imgid));
+  a->slots[lru].imgid = imgid;
+  g_hash_table_insert(a->index, GINT_TO_POINTER(imgid), GINT_TO_POINTER(lru + 1));
+  return lru;
+}
+
+// scales the thumbnail into the slot of imgid, returns the slot or -1.
+static int
+_atlas_store(dt_view_thumb_atlas_t *a, const int32_t imgid, const dt_mipmap_buffer_t *buf, uint8_t *data,
+             const int32_t width, const int32_t height, const float imgwd)
+{
+  if(a->cell_width != width || a->cell_height != height)
+  {
+    // zoom changed
+    _atlas_reset(a);
+    a->cell_width = width;
+    a->cell_height = height;
+    a->slot_width = MAX(1, (int)ceilf(imgwd*width));
+    a->slot_height = MAX(1, (int)ceilf(imgwd*height));
+    a->cols = MAX(1, DT_VIEW_ATLAS_MAX_WIDTH / a->slot_width);
+  }
+  const int k = _atlas_alloc(a, imgid);
+  if(k < 0) return -1;
+
+  dt_view_thumb_slot_t *slot = a->slots + k;
+  const float scale = fminf(width*imgwd/(float)buf->width, height*imgwd/(float)buf->height);
+  slot->mip = buf->size;
+  slot->width = CLAMP((int)(buf->width*scale + 0.5f), 1, a->slot_width);
+  slot->height = CLAMP((int)(buf->height*scale + 0.5f), 1, a->slot_height);
+  slot->used = a->frame;
+
+  const int32_t stride = cairo_format_stride_for_width(CAIRO_FORMAT_RGB24, buf->width);
+  cairo_surface_t *source = cairo_image_surface_create_for_data(data, CAIRO_FORMAT_RGB24, buf->width, buf->height, stride);
+  cairo_t *cr = cairo_create(a->surface);
+  cairo_translate(cr, (k % a->cols)*a->slot_width, (k / a->cols)*a->slot_height);
+  cairo_rectangle(cr, 0, 0, slot->width, slot->height);
+  cairo_scale(cr, slot->width/(double)buf->width, slot->height/(double)buf->height);
+  cairo_set_source_surface(cr, source, 0, 0);
+  cairo_pattern_set_extend(cairo_get_source(cr), CAIRO_EXTEND_PAD);
+  // in skull mode, we want to see big pixels.
+  cairo_pattern_set_filter(cairo_get_source(cr), (buf->width <= 8 && buf->height <= 8) ? CAIRO_FILTER_NEAREST
+                                                                                       : CAIRO_FILTER_GOOD);
+  cairo_set_operator(cr, CAIRO_OPERATOR_SOURCE);
+  cairo_fill(cr);
+  cairo_destroy(cr);
+  cairo_surface_destroy(source);
+  return k;
+}
+
 int32_t
 dt_view_get_image_to_act_on()
 {
@@ -839,35 +1007,74 @@ dt_view_image_expose(
   dt_mipmap_buffer_t buf;
   dt_mipmap_size_t mip = dt_mipmap_cache_get_matching_size(darktable.mipmap_cache,
                                                            imgwd*width, imgwd*height);
-  dt_mipmap_cache_read_get(darktable.mipmap_cache, &buf, imgid, mip, DT_MIPMAP_BEST_EFFORT);
+  // the cells of the lighttable grid come prescaled from the atlas, once it has the wanted size
+  dt_view_thumb_atlas_t *atlas = &darktable.view_manager->thumb_atlas;
+  const int use_atlas = DRAW_THUMB == 1 && atlas->active && zoom != 1 && !full_preview;
+  int slot = use_atlas ? _atlas_lookup(atlas, imgid, width, height, mip) : -1;
+  if(slot >= 0)
+    buf.buf = NULL;
+  else
+    dt_mipmap_cache_read_get(darktable.mipmap_cache, &buf, imgid, mip, DT_MIPMAP_BEST_EFFORT);
 
 #if DRAW_THUMB == 1
   float scale = 1.0;
-  // decompress image, if necessary. if compression is off, scratchmem will be == NULL,
-  // so get the real pointer back:
-  uint8_t *buf_decompressed = dt_mipmap_cache_decompress(&buf, scratchmem);
-
+  // size of the drawn thumbnail before scaling
+  int32_t thumb_wd = 0, thumb_ht = 0;
   cairo_surface_t *surface = NULL;
   if(buf.buf)
   {
-    const int32_t stride = cairo_format_stride_for_width (CAIRO_FORMAT_RGB24, buf.width);
-    surface = cairo_image_surface_create_for_data (buf_decompressed, CAIRO_FORMAT_RGB24, buf.width, buf.height, stride);
-    if(zoom == 1)
+    // decompress image, if necessary. if compression is off, scratchmem will be == NULL,
+    // so get the real pointer back:
+    uint8_t *buf_decompressed = dt_mipmap_cache_decompress(&buf, scratchmem);
+    if(use_atlas) slot = _atlas_store(atlas, imgid, &buf, buf_decompressed, width, height, imgwd);
+    if(slot < 0)
     {
-      scale = fminf(
-                fminf(darktable.thumbnail_width, width) / (float)buf.width,
-                fminf(darktable.thumbnail_height, height) / (float)buf.height
-              );
+      const int32_t stride = cairo_format_stride_for_width (CAIRO_FORMAT_RGB24, buf.width);
+      surface = cairo_image_surface_create_for_data (buf_decompressed, CAIRO_FORMAT_RGB24, buf.width, buf.height, stride);
+      if(zoom == 1)
+      {
+        scale = fminf(
+                  fminf(darktable.thumbnail_width, width) / (float)buf.width,
+                  fminf(darktable.thumbnail_height, height) / (float)buf.height
+                );
+      }
+      else scale = fminf(width*imgwd/(float)buf.width, height*imgwd/(float)buf.height);
+      thumb_wd = buf.width;
+      thumb_ht = buf.height;
     }
-    else scale = fminf(width*imgwd/(float)buf.width, height*imgwd/(float)buf.height);
+  }
+  if(slot >= 0)
+  {
+    thumb_wd = atlas->slots[slot].width;
+    thumb_ht = atlas->slots[slot].height;
   }
 
-  // draw centered and fitted:
   cairo_save(cr);
-  cairo_translate(cr, width/2.0, height/2.0);
-  cairo_scale(cr, scale, scale);
+  if(slot >= 0)
+  {
+    // copy 1:1, starting on a whole device pixel so nothing gets filtered
+    double x = 0.5*(width - thumb_wd), y = 0.5*(height - thumb_ht);
+    cairo_user_to_device(cr, &x, &y);
+    x = round(x);
+    y = round(y);
+    cairo_device_to_user(cr, &x, &y);
+    cairo_translate(cr, x, y);
+    cairo_set_source_surface(cr, atlas->surface, -(slot % atlas->cols)*atlas->slot_width,
+                             -(slot / atlas->cols)*atlas->slot_height);
+    cairo_pattern_set_filter(cairo_get_source(cr), CAIRO_FILTER_NEAREST);
+    cairo_rectangle(cr, 0, 0, thumb_wd, thumb_ht);
+    cairo_fill(cr);
 
-  if(buf.buf)
+    cairo_rectangle(cr, 0, 0, thumb_wd, thumb_ht);
+  }
+  else
+  {
+    // draw centered and fitted:
+    cairo_translate(cr, width/2.0, height/2.0);
+    cairo_scale(cr, scale, scale);
+  }
+
+  if(surface)
   {
     cairo_translate(cr, -0.5*buf.width, -0.5*buf.height);
     cairo_set_source_surface (cr, surface, 0, 0);
@@ -887,7 +1094,7 @@ dt_view_image_expose(
 
   // border around image
   cairo_set_source_rgb(cr, bordercol, bordercol, bordercol);
-  if(buf.buf && (selected || zoom == 1))
+  if(thumb_wd && (selected || zoom == 1))
   {
     const float border = zoom == 1 ? 16/scale : 2/scale;
     cairo_set_line_width(cr, 1./scale);
@@ -901,9 +1108,9 @@ dt_view_image_expose(
       float alpha = 1.0f;
       for(int k=0; k<16; k++)
       {
-        cairo_rectangle(cr, 0, 0, buf.width, buf.height);
+        cairo_rectangle(cr, 0, 0, thumb_wd, thumb_ht);
         cairo_new_sub_path(cr);
-        cairo_rectangle(cr, -k/scale, -k/scale, buf.width+2.*k/scale, buf.height+2.*k/scale);
+        cairo_rectangle(cr, -k/scale, -k/scale, thumb_wd+2.*k/scale, thumb_ht+2.*k/scale);
         cairo_set_source_rgba(cr, 0, 0, 0, alpha);
         alpha *= 0.6f;
         cairo_fill(cr);
@@ -913,13 +1120,13 @@ dt_view_image_expose(
     {
       cairo_set_fill_rule (cr, CAIRO_FILL_RULE_EVEN_ODD);
       cairo_new_sub_path(cr);
-      cairo_rectangle(cr, -border, -border, buf.width+2.*border, buf.height+2.*border);
+      cairo_rectangle(cr, -border, -border, thumb_wd+2.*border, thumb_ht+2.*border);
       cairo_stroke_preserve(cr);
       cairo_set_source_rgb(cr, 1.0-bordercol, 1.0-bordercol, 1.0-bordercol);
       cairo_fill(cr);
     }
   }
-  else if(buf.buf)
+  else if(thumb_wd)
   {
     cairo_set_line_width(cr, 0.5/scale);
     cairo_stroke(cr);
@@ -1388,16 +1595,20 @@ void dt_view_filmstrip_prefetch()
 
   sqlite3_stmt *stmt;
   DT_DEBUG_SQLITE3_PREPARE_V2(dt_database_get(darktable.db), qin, -1, &stmt, NULL);
-  // only get one more image:
+  // the next image is decoded, the files of a few more after it are only read ahead:
   DT_DEBUG_SQLITE3_BIND_INT(stmt, 1, offset+1);
-  DT_DEBUG_SQLITE3_BIND_INT(stmt, 2, offset+2);
+  DT_DEBUG_SQLITE3_BIND_INT(stmt, 2, DT_READAHEAD_MAX+1);
+  int upcoming[DT_READAHEAD_MAX], num_upcoming = 0;
   if(sqlite3_step(stmt) == SQLITE_ROW)
   {
     const uint32_t prefetchid = sqlite3_column_int(stmt, 0);
     // dt_control_log("prefetching image %u", prefetchid);
     dt_mipmap_cache_read_get(darktable.mipmap_cache, NULL, prefetchid, DT_MIPMAP_FULL, DT_MIPMAP_PREFETCH);
+    while(sqlite3_step(stmt) == SQLITE_ROW && num_upcoming < DT_READAHEAD_MAX)
+      upcoming[num_upcoming++] = sqlite3_column_int(stmt, 0);
   }
   sqlite3_finalize(stmt);
+  dt_readahead_images(darktable.readahead, upcoming, num_upcoming);
 }
 
 void dt_view_manager_view_toolbox_add(dt_view_manager_t *vm,GtkWidget *tool)
@@ -21,6 +21,7 @@
 #define DT_VIEW_H
 
 #include "common/image.h"
+#include "common/mipmap_cache.h"
 #ifdef HAVE_MAP
 #include "osm-gps-map-source.h"
 #endif
@@ -128,11 +129,51 @@ dt_view_image_expose(
   int32_t py,
   gboolean full_preview);
 
+/** the cells of the lighttable grid are drawn from thumbnails scaled to the cell size once
+ *  and kept in one surface, so redraws only copy them. call begin and end around the cells
+ *  of one frame, other callers of dt_view_image_expose() scale every time. */
+void dt_view_image_atlas_begin();
+void dt_view_image_atlas_end();
+/** frees the prescaled thumbnails. */
+void dt_view_image_atlas_clear();
+
 /** Set the selection bit to a given value for the specified image */
 void dt_view_set_selection(int imgid, int value);
 /** toggle selection of given image. */
 void dt_view_toggle_selection(int imgid);
 
+/** a prescaled thumbnail in the atlas */
+typedef struct dt_view_thumb_slot_t
+{
+  // -1 if free
+  int32_t imgid;
+  // the mip it was scaled from, the wanted one or a stand-in
+  dt_mipmap_size_t mip;
+  // size of the scaled thumbnail, at the top left of the slot
+  int32_t width, height;
+  // frame it was last drawn in
+  uint32_t used;
+}
+dt_view_thumb_slot_t;
+
+typedef struct dt_view_thumb_atlas_t
+{
+  // set between dt_view_image_atlas_begin() and _end()
+  int active;
+  uint32_t frame;
+  // cell size the slots are made for, all slots are dropped when it changes
+  int32_t cell_width, cell_height;
+  int32_t slot_width, slot_height, cols;
+  int32_t num_slots;
+  cairo_surface_t *surface;
+  dt_view_thumb_slot_t *slots;
+  // imgid -> slot index + 1
+  GHashTable *index;
+  // dt_mipmap_cache_get_removed() state
+  uint32_t removed_serial;
+}
+dt_view_thumb_atlas_t;
+
 #define DT_VIEW_MAX_MODULES 10
 /**
  * holds all relevant data needed to manage the view
@@ -163,6 +204,9 @@ typedef struct dt_view_manager_t
     sqlite3_stmt *get_grouped;
   } statements;
 
+  /* prescaled thumbnails of the lighttable cells */
+  dt_view_thumb_atlas_t thumb_atlas;
+
 
   /*
    * Proxy
@@ -0,0 +1,196 @@
+/*
+    This file is part of darktable,
+    copyright (c) 2015 the darktable project.
+
+    darktable is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    darktable is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with darktable.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+/*
+ * round trip benchmark for the thumbnail codecs: the float block codec in
+ * src/common/image_compression.c and dxt1 through squish, both as the
+ * mipmap cache uses them. reports throughput and psnr of each.
+ *
+ *   compression-bench [input.pfm] [iterations]
+ *
+ * without an input a synthetic 3840x2160 test image is used. the image is
+ * cropped to a multiple of 4 in both directions.
+ */
+
+#include "common/image_compression.h"
+#include "squish/csquish.h"
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+static double
+get_time()
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + 1e-9*ts.tv_nsec;
+}
+
+static float*
+read_pfm(const char *filename, int *wd, int *ht)
+{
+  FILE *f = fopen(filename, "rb");
+  if(!f) return 0;
+  if(fscanf(f, "PF\n%d %d\n%*[^\n]", wd, ht) != 2)
+  {
+    fclose(f);
+    return 0;
+  }
+  fgetc(f); // eat only one newline
+
+  float *p = (float *)malloc(sizeof(float)*3*(*wd)*(*ht));
+  if(fread(p, sizeof(float)*3, (size_t)(*wd)*(*ht), f) != (size_t)(*wd)*(*ht))
+    fprintf(stderr, "[compression-bench] short read on `%s'\n", filename);
+  fclose(f);
+  return p;
+}
+
+// smooth gradients, a few hard edges and some noise, roughly what thumbnails look like.
+static float*
+synthetic_image(const int wd, const int ht)
+{
+  float *p = (float *)malloc(sizeof(float)*3*wd*ht);
+  unsigned int seed = 42;
+  for(int j=0; j<ht; j++) for(int i=0; i<wd; i++)
+  {
+    const float x = i/(float)wd, y = j/(float)ht;
+    const float edge = (((i/97) + (j/61)) & 1) ? 1.0f : 0.35f;
+    for(int c=0; c<3; c++)
+    {
+      seed = seed*1103515245u + 12345u;
+      const float noise = ((seed >> 16) & 0x7fff)/32768.0f - 0.5f;
+      const float v = edge*(0.5f + 0.4f*sinf(6.0f*x + 2.0f*c)*cosf(4.0f*y - c)) + 0.02f*noise;
+      p[3*((size_t)wd*j + i) + c] = fmaxf(v, 1e-4f);
+    }
+  }
+  return p;
+}
+
+static double
+psnr_f(const float *a, const float *b, const size_t n)
+{
+  double err = 0.0;
+  for(size_t k=0; k<n; k++)
+  {
+    const double d = fminf(fmaxf(a[k], 0.0f), 1.0f) - fminf(fmaxf(b[k], 0.0f), 1.0f);
+    err += d*d;
+  }
+  err /= n;
+  return err > 0.0 ? -10.0*log10(err) : INFINITY;
+}
+
+static double
+psnr_8(const uint8_t *a, const uint8_t *b, const size_t num_pixels)
+{
+  double err = 0.0;
+  for(size_t k=0; k<num_pixels; k++) for(int c=0; c<3; c++)
+  {
+    const double d = (a[4*k+c] - (double)b[4*k+c])/255.0;
+    err += d*d;
+  }
+  err /= 3*num_pixels;
+  return err > 0.0 ? -10.0*log10(err) : INFINITY;
+}
+
+static void
+report(const char *name, const int wd, const int ht, const int iterations,
+       const double enc, const double dec, const double psnr)
+{
+  const double mp = wd*(double)ht*1e-6*iterations;
+  fprintf(stdout, "%-22s encode %8.2f MP/s  decode %8.2f MP/s  psnr %6.2f dB\n",
+          name, mp/enc, mp/dec, psnr);
+}
+
+int main(int argc, char *arg[])
+{
+  int wd = 3840, ht = 2160;
+  float *input = 0;
+  if(argc > 1)
+  {
+    input = read_pfm(arg[1], &wd, &ht);
+    if(!input)
+    {
+      fprintf(stderr, "usage: %s [input.pfm] [iterations]\n", arg[0]);
+      exit(1);
+    }
+  }
+  else input = synthetic_image(wd, ht);
+  const int iterations = argc > 2 ? atoi(arg[2]) : 10;
+
+  // crop to full blocks, rows keep their original stride in the input so repack.
+  const int cwd = wd & ~3, cht = ht & ~3;
+  float *in = (float *)malloc(sizeof(float)*3*cwd*cht);
+  for(int j=0; j<cht; j++) memcpy(in + (size_t)3*cwd*j, input + (size_t)3*wd*j, sizeof(float)*3*cwd);
+  free(input);
+  wd = cwd;
+  ht = cht;
+  const size_t num = (size_t)wd*ht;
+  fprintf(stdout, "%dx%d, %d iterations\n", wd, ht, iterations);
+
+  // float block codec, 16 bytes per 4x4 block
+  {
+    uint8_t *blocks = (uint8_t *)malloc(num);
+    float *out = (float *)malloc(sizeof(float)*3*num);
+    double t0 = get_time();
+    for(int k=0; k<iterations; k++) dt_image_compress(in, blocks, wd, ht);
+    const double enc = get_time() - t0;
+    t0 = get_time();
+    for(int k=0; k<iterations; k++) dt_image_uncompress(blocks, out, wd, ht);
+    const double dec = get_time() - t0;
+    report("float block codec", wd, ht, iterations, enc, dec, psnr_f(in, out, 3*num));
+    free(blocks);
+    free(out);
+  }
+
+  // dxt1 on the 8-bit rgba the mipmap cache hands to squish
+  {
+    uint8_t *rgba = (uint8_t *)malloc(4*num);
+    uint8_t *out = (uint8_t *)malloc(4*num);
+    uint8_t *blocks = (uint8_t *)malloc(num/2);
+    for(size_t k=0; k<num; k++)
+    {
+      for(int c=0; c<3; c++) rgba[4*k+c] = (uint8_t)(255.0f*fminf(fmaxf(in[3*k+c], 0.0f), 1.0f) + 0.5f);
+      rgba[4*k+3] = 255;
+    }
+    const int flags[2] = { squish_dxt1 | squish_colour_range_fit, squish_dxt1 };
+    const char *names[2] = { "dxt1 low quality", "dxt1 high quality" };
+    for(int f=0; f<2; f++)
+    {
+      double t0 = get_time();
+      for(int k=0; k<iterations; k++) squish_compress_image(rgba, wd, ht, blocks, flags[f]);
+      const double enc = get_time() - t0;
+      t0 = get_time();
+      for(int k=0; k<iterations; k++) squish_decompress_image(out, wd, ht, blocks, flags[f]);
+      const double dec = get_time() - t0;
+      report(names[f], wd, ht, iterations, enc, dec, psnr_8(rgba, out, num));
+    }
+    free(rgba);
+    free(out);
+    free(blocks);
+  }
+
+  free(in);
+  return 0;
+}
+
+// modelines: These editor modelines have been set for all relevant files by tools/update_modelines.sh
+// vim: shiftwidth=2 expandtab tabstop=2 cindent
+// kate: tab-indents: off; indent-width 2; replace-tabs on; indent-mode cstyle; remove-trailing-spaces modified;